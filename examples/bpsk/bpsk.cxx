@@ -37,8 +37,11 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <pthread.h>
 #include "simpleFE.h"
+#include "sfe_convert.h"
 #include "blkconv.h"
-#include "ringbuf.h"
+#include "partconv.h"
+#include "fftplan.h"
+#include "mirror_ringbuf.h"
 #include "rrc_taps.h"
 
 
@@ -46,21 +49,25 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #define SAMPLES_PER_SYMBOL    (10)
 #define SAMPLE_RATE           (SAMPLES_PER_SYMBOL *  SYMBOL_RATE)
 #define SCALING_FACTOR        (.85f / 1.35f)
+// measured plans of the pulse filter, kept for the next run
+#define FFTW_WISDOM_FILE      "bpsk.wisdom"
 #define RC_TEST
 
 static int exitRequested = 0;
 
-pthread_cond_t buf_cond = PTHREAD_COND_INITIALIZER; 
-pthread_mutex_t buf_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 #if (SAMPLES_PER_SYMBOL == 10)
 static float *rrc_prototype = &RRC_TAPS_111[0];
 static int rrc_filter_len = 111;
-static int blk_conv_fft_size = 2048;
+// the blkconv fft length
+static int pulse_filter_param = 2048;
+typedef blkconv pulse_filter_t;
 #elif (SAMPLES_PER_SYMBOL == 50)
 static float *rrc_prototype = &RRC_TAPS_551[0];
 static int rrc_filter_len = 551;
-static int blk_conv_fft_size = 8192;
+// the partconv block size, 256 samples of latency instead of the 8192
+// point transform blkconv would need
+static int pulse_filter_param = 256;
+typedef partconv pulse_filter_t;
 #endif
 
 static void sigintHandler(int signum)
@@ -75,45 +82,21 @@ static int calc_num_samples(int bytes)
 
 static int convert_samples_to_bytes(void* dst, void* src, int src_len)
 {
-
-    float *in = static_cast<float*>(src);
-    unsigned char *out = static_cast<unsigned char*>(dst);
-    int j = 0;
-    for (int i=0; i<src_len; i+=4){
-        
-        float x0 = in[i];
-        float x1 = in[i+1];
-        float x2 = in[i+2];
-        float x3 = in[i+3];
-
-        unsigned short u0 = ((short)(x0*511) + 512) & 0x3FF;
-        unsigned short u1 = ((short)(x1*511) + 512) & 0x3FF;
-        unsigned short u2 = ((short)(x2*511) + 512) & 0x3FF;
-        unsigned short u3 = ((short)(x3*511) + 512) & 0x3FF;
-        
-        out[j++] = (u0 >>8) | ((u1>>8)<<2) | ((u2>>8)<<4) | ((u3>>8)<<6);
-        out[j++] = u0 & 0xFF;
-        out[j++] = u1 & 0xFF;
-        out[j++] = u2 & 0xFF;
-        out[j++] = u3 & 0xFF;
-    }
-    return j;
+    return sfe_pack_f32(static_cast<unsigned char*>(dst),
+                        static_cast<const float*>(src), src_len);
 }
 
 
 static int tx_callback(unsigned char* buffer, int length, void* userdata)
 {
-    ring_buffer<float> *buf = (ring_buffer<float> *)userdata;
+    mirror_ring_buffer<float> *buf = (mirror_ring_buffer<float> *)userdata;
 
-    pthread_mutex_lock(&buf_mutex);
     if (buf->get_count() < calc_num_samples(length)){
         fprintf(stderr, "U");
     }
     else{
         buf->read(buffer, length, convert_samples_to_bytes, calc_num_samples);
-        pthread_cond_signal(&buf_cond);
     }
-    pthread_mutex_unlock(&buf_mutex);
             
     return exitRequested;
 }
@@ -121,16 +104,16 @@ static int tx_callback(unsigned char* buffer, int length, void* userdata)
 
 void* process(void* data)
 {
-    ring_buffer<float> *buf = (ring_buffer<float> *)data;
-    blkconv pulse_filter(rrc_prototype, rrc_filter_len, blk_conv_fft_size);
+    mirror_ring_buffer<float> *buf = (mirror_ring_buffer<float> *)data;
+    pulse_filter_t pulse_filter(rrc_prototype, rrc_filter_len, pulse_filter_param);
     int blk_size = pulse_filter.get_blksize();
     float *proc_buf = pulse_filter.get_process_buf();
     int n_input = 0, n_phase = 0;
 
     while (!exitRequested)
     {
-        pthread_mutex_lock(&buf_mutex);
-        if (buf->get_space() >= blk_size){
+        // time out now and then to look at exitRequested
+        if (buf->wait_for_space(blk_size, 100)){
             n_input = 0;
             // prepare the input buffer
             if (n_phase > 0)
@@ -163,11 +146,6 @@ void* process(void* data)
             //write to buffer
             buf->write(proc_buf, blk_size);
         }
-        else{
-            
-            pthread_cond_wait(&buf_cond, &buf_mutex);
-        }
-        pthread_mutex_unlock(&buf_mutex);
     }
 
     return NULL;
@@ -177,7 +155,7 @@ int main(int argc, char* argv[])
 {
     sfe* h = sfe_init();
     unsigned sample_rate = SAMPLE_RATE;
-    ring_buffer<float> dev_buf(SAMPLE_RATE);
+    mirror_ring_buffer<float> dev_buf(SAMPLE_RATE);
     pthread_t proc_thread;
     void* ret = NULL;
     
@@ -198,6 +176,8 @@ int main(int argc, char* argv[])
     //setup signal hanlder
     signal(SIGINT, sigintHandler);
 
+    //the pulse filter plans are measured, or read from the wisdom of the last run
+    fft_plan::setup(fft_plan::MEASURE, FFTW_WISDOM_FILE);
 
     //start processing thread
     pthread_create(&proc_thread, NULL, process, &dev_buf);
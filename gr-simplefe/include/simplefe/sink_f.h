@@ -24,6 +24,7 @@
 
 #include <simplefe/api.h>
 #include <gnuradio/sync_block.h>
+#include <string>
 
 namespace gr {
   namespace simplefe {
@@ -32,6 +33,14 @@ namespace gr {
      * \brief <+description of block+>
      * \ingroup simplefe
      *
+     * Bursts are tagged like for the usrp sink: tx_sob starts one at the
+     * tagged item, tx_eob ends it after the tagged item and tx_time 
+     * (tuple of uint64 seconds and double fraction, the host monotonic
+     * clock of the rx_time tags) starts one at that time, which needs a
+     * source running on the same board. Items outside bursts are dropped,
+     * between bursts and on underflow the DAC idles at mid scale. Without
+     * tags the whole stream is one burst.
+     *
      */
     class SIMPLEFE_API sink_f : virtual public gr::sync_block
     {
@@ -45,8 +54,26 @@ namespace gr {
        * constructor is in a private implementation
        * class. simplefe::sink_f::make is the public interface for
        * creating new instances.
+       *
+       * \param sample_rate requested rate, rounded up to a supported one
+       * \param channel 0 for I, 1 for Q
+       * \param serial board to use, empty for the first one found
+       */
+      static sptr make(unsigned sample_rate, int channel,
+                       const std::string &serial = "");
+
+      /*!
+       * \brief Scheduling of the usb event thread of the board, shared 
+       * by all blocks on it, applied right away if streaming, otherwise 
+       * at start.
+       *
+       * \param priority SCHED_FIFO priority (1-99), 0 for normal scheduling
+       * \param cpu_mask cpus the thread may run on, bit n = cpu n, 0 for all
+       * \param lock_memory lock the process memory with mlockall()
+       * \return true if everything was granted
        */
-      static sptr make(unsigned sample_rate, int channel);
+      virtual bool set_realtime(int priority, unsigned long cpu_mask,
+                                bool lock_memory) = 0;
     };
 
   } // namespace simplefe
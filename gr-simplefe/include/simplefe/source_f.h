@@ -24,6 +24,7 @@
 
 #include <simplefe/api.h>
 #include <gnuradio/sync_block.h>
+#include <string>
 
 namespace gr {
   namespace simplefe {
@@ -32,6 +33,12 @@ namespace gr {
      * \brief <+description of block+>
      * \ingroup simplefe
      *
+     * The stream is tagged like the usrp source: rx_time (host monotonic
+     * clock, a tuple of uint64 seconds and double fraction) and rx_rate
+     * on the first item and wherever the stream starts again, there
+     * rx_overflow (#t) marks data dropped by the board or the block and
+     * rx_gap (uint64) the estimated samples of lost usb packets.
+     *
      */
     class SIMPLEFE_API source_f : virtual public gr::sync_block
     {
@@ -45,8 +52,28 @@ namespace gr {
        * constructor is in a private implementation
        * class. simplefe::source_f::make is the public interface for
        * creating new instances.
+       *
+       * \param sample_rate requested rate, rounded up to a supported one
+       * \param channel 0 for I, 1 for Q
+       * \param output_type "f32" (float), "s16" or "s8"
+       * \param serial board to use, empty for the first one found
+       */
+      static sptr make(unsigned sample_rate, int channel,
+                       const std::string &output_type = "f32",
+                       const std::string &serial = "");
+
+      /*!
+       * \brief Scheduling of the usb event thread of the board, shared 
+       * by all blocks on it, applied right away if streaming, otherwise 
+       * at start.
+       *
+       * \param priority SCHED_FIFO priority (1-99), 0 for normal scheduling
+       * \param cpu_mask cpus the thread may run on, bit n = cpu n, 0 for all
+       * \param lock_memory lock the process memory with mlockall()
+       * \return true if everything was granted
        */
-      static sptr make(unsigned sample_rate, int channel);
+      virtual bool set_realtime(int priority, unsigned long cpu_mask,
+                                bool lock_memory) = 0;
     };
 
   } // namespace simplefe
@@ -28,6 +28,9 @@
 
 #include "qa_simplefe.h"
 #include "ringbuf.h"
+#include "spsc_ringbuf.h"
+#include "mirror_ringbuf.h"
+#include "rx_tags.h"
 #include <complex>
 #include "stdio.h"
 
@@ -167,6 +170,298 @@ public:
     
 };
 
+class SpscRingbufTest : public CppUnit::TestFixture
+{
+private:
+    static const int data_size = 16;
+    spsc_ring_buffer< std::complex<float> > *cplx_buf;
+    std::complex<float> wdata[data_size*2];
+    float rdata[data_size*4];
+
+public:
+    void setUp()
+    {
+        // rounded up to 16
+        cplx_buf = new spsc_ring_buffer< std::complex<float> >(data_size-3);
+        for (int i=0; i<data_size*2; i++){
+            wdata[i] = std::complex<float>(i*1.0, i*2.0);
+        }
+    }
+
+    void tearDown()
+    {
+        delete cplx_buf;
+    }
+
+    void testCapacity()
+    {
+        CPPUNIT_ASSERT( cplx_buf->get_capacity() == data_size );
+        CPPUNIT_ASSERT( cplx_buf->get_space() == data_size );
+        CPPUNIT_ASSERT( cplx_buf->get_count() == 0 );
+
+        // all or nothing
+        CPPUNIT_ASSERT( cplx_buf->write(&wdata[0], 12) == 12 );
+        CPPUNIT_ASSERT( cplx_buf->write(&wdata[0], 5) == 0 );
+        CPPUNIT_ASSERT( cplx_buf->get_count() == 12 );
+        CPPUNIT_ASSERT( cplx_buf->wait_for_count(12, 0) );
+        CPPUNIT_ASSERT( !cplx_buf->wait_for_count(13, 10) );
+        CPPUNIT_ASSERT( !cplx_buf->wait_for_space(5, 10) );
+
+        // not enough data, nothing consumed
+        CPPUNIT_ASSERT( cplx_buf->read(&rdata[0], 13*2*sizeof(float),
+                                       RingbufTest::conv, RingbufTest::calc_size) == 0 );
+        CPPUNIT_ASSERT( cplx_buf->get_count() == 12 );
+    }
+
+    void testReadWrite()
+    {
+        //write 12, read 6, write 10 (wraps), read 16
+        cplx_buf->write(&wdata[0], 12);
+        cplx_buf->read(&rdata[0], 6*2*sizeof(float),
+                       RingbufTest::conv, RingbufTest::calc_size);
+        CPPUNIT_ASSERT( cplx_buf->write(&wdata[0], 10) == 10 );
+        CPPUNIT_ASSERT( cplx_buf->read(&rdata[6*2], 16*2*sizeof(float),
+                                       RingbufTest::conv, RingbufTest::calc_size) == 16 );
+
+        for (int i=0; i<(16+6)*2; i+=2){
+            float x = (i%(12*2))/2*1.0;
+            CPPUNIT_ASSERT_DOUBLES_EQUAL( rdata[i], x, 1e-6);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL( rdata[i+1],  x*2.0, 1e-6);
+        }
+        CPPUNIT_ASSERT( cplx_buf->get_count() == 0 );
+    }
+};
+
+class MirrorRingbufTest : public CppUnit::TestFixture
+{
+private:
+    mirror_ring_buffer<float> *buf;
+    float wdata[4096];
+    unsigned char out[5*1024];
+    static int conv_calls;
+
+public:
+    void setUp()
+    {
+        buf = new mirror_ring_buffer<float>(100);
+        for (int i=0; i<4096; i++){
+            wdata[i] = (i%1023 - 511)/511.0f;
+        }
+        conv_calls = 0;
+    }
+
+    void tearDown()
+    {
+        delete buf;
+    }
+
+    // the 4 samples to 5 bytes dac packing, only valid on whole frames
+    static int pack(void* dst, void* src, int src_len)
+    {
+        float *in = (float*)src;
+        unsigned char *o = (unsigned char*)dst;
+        int j = 0;
+
+        conv_calls++;
+        CPPUNIT_ASSERT( src_len % 4 == 0 );
+        for (int i=0; i<src_len; i+=4){
+            unsigned short u[4];
+            for (int k=0; k<4; k++){
+                u[k] = ((short)(in[i+k]*511) + 512) & 0x3FF;
+            }
+            o[j++] = (u[0]>>8) | ((u[1]>>8)<<2) | ((u[2]>>8)<<4) | ((u[3]>>8)<<6);
+            for (int k=0; k<4; k++){
+                o[j++] = u[k] & 0xFF;
+            }
+        }
+        return j;
+    }
+
+    static int calc_len(int bytes)
+    {
+        return bytes/5*4;
+    }
+
+    void testWrapRead()
+    {
+        int cap = buf->get_capacity();
+        unsigned char ref[5*1024];
+
+        if (!buf->is_mirrored()){
+            return;
+        }
+        // page aligned and a power of two
+        CPPUNIT_ASSERT( cap >= 100 && (cap & (cap-1)) == 0 );
+
+        // leave the read index 2 items before the end, a 5 byte frame 
+        // read now straddles the wrap point
+        CPPUNIT_ASSERT( buf->write(&wdata[0], cap-2) == cap-2 );
+        CPPUNIT_ASSERT( buf->read(out, (cap-4)/4*5, pack, calc_len) == cap-4 );
+        CPPUNIT_ASSERT( buf->write(&wdata[0], 100) == 100 );
+        CPPUNIT_ASSERT( buf->read(out, 100/4*5, pack, calc_len) == 100 );
+        CPPUNIT_ASSERT( conv_calls == 2 );
+
+        float expect[100];
+        expect[0] = wdata[cap-4];
+        expect[1] = wdata[cap-3];
+        for (int i=2; i<100; i++){
+            expect[i] = wdata[i-2];
+        }
+        pack(ref, expect, 100);
+        CPPUNIT_ASSERT( memcmp(ref, out, 125) == 0 );
+    }
+
+    void testReserveCommit()
+    {
+        int cap = buf->get_capacity();
+        float *p;
+
+        if (!buf->is_mirrored()){
+            return;
+        }
+        CPPUNIT_ASSERT( buf->write(&wdata[0], cap-3) == cap-3 );
+        CPPUNIT_ASSERT( buf->reserve(4) == NULL );
+        CPPUNIT_ASSERT( buf->peek(cap-3) != NULL );
+        buf->consume(cap-3);
+
+        // fill across the end in place, read it back in one span
+        p = buf->reserve(10);
+        CPPUNIT_ASSERT( p != NULL );
+        memcpy(p, &wdata[200], 10*sizeof(float));
+        CPPUNIT_ASSERT( buf->peek(1) == NULL );
+        buf->commit(10);
+        CPPUNIT_ASSERT( buf->get_count() == 10 );
+
+        p = buf->peek(10);
+        CPPUNIT_ASSERT( p != NULL );
+        CPPUNIT_ASSERT( memcmp(p, &wdata[200], 10*sizeof(float)) == 0 );
+        buf->consume(10);
+        CPPUNIT_ASSERT( buf->get_count() == 0 );
+        CPPUNIT_ASSERT( buf->get_space() == cap );
+    }
+};
+
+int MirrorRingbufTest::conv_calls = 0;
+
+class RxTagTest : public CppUnit::TestFixture
+{
+private:
+    unsigned char data[4][8];
+    sfe_iovec iov[4];
+    unsigned status;
+    sfe_rx_meta meta;
+    sfe_rx_batch batch;
+    std::vector<gr::tag_t> tags;
+
+    static int drop(void* dst, void* src, int src_len)
+    {
+        return src_len;
+    }
+
+    static int same_len(int dst_len)
+    {
+        return dst_len;
+    }
+
+    /* 4 packets of 4 I/Q pairs at 8 kHz, one packet per sample pair lost */
+    void make_batch(unsigned long long sample, unsigned lost_mask)
+    {
+        status = 0xF & ~lost_mask;
+        for (int i=0; i<4; i++){
+            iov[i].base = data[i];
+            iov[i].len = (status & (1u << i)) ? 8 : 0;
+        }
+        memset(&meta, 0, sizeof(meta));
+        meta.sample = sample;
+        meta.rate = 8000;
+        meta.channels = 2;
+        // completes at 10s plus the transfer
+        meta.time_ns = 10000000000ULL + (sample + 16) * 125000;
+        batch.iov = iov;
+        batch.n_iov = 4;
+        batch.status = &status;
+        batch.total_bytes = 0;
+        for (int i=0; i<4; i++){
+            batch.total_bytes += iov[i].len;
+        }
+        batch.meta = &meta;
+    }
+
+    const gr::tag_t *find(const char *key)
+    {
+        for (size_t i=0; i<tags.size(); i++){
+            if (pmt::eqv(tags[i].key, pmt::mp(key))){
+                return &tags[i];
+            }
+        }
+        return NULL;
+    }
+
+public:
+    void setUp()
+    {
+        memset(data, 0, sizeof(data));
+    }
+
+    void tearDown()
+    {
+    }
+
+    void testStartAndGap()
+    {
+        spsc_ring_buffer<unsigned char> ring(1024);
+        gr::simplefe::rx_tagger tagger(2);
+        const gr::tag_t *t;
+
+        make_batch(0, 0);
+        CPPUNIT_ASSERT( tagger.write(ring, &batch) );
+        tagger.get_tags(16, tags);
+        CPPUNIT_ASSERT( tags.size() == 2 );
+        t = find("rx_time");
+        CPPUNIT_ASSERT( t && t->offset == 0 );
+        // completion minus the 16 samples of the transfer
+        CPPUNIT_ASSERT( pmt::to_uint64(pmt::tuple_ref(t->value, 0)) == 10 );
+        CPPUNIT_ASSERT_DOUBLES_EQUAL( pmt::to_double(pmt::tuple_ref(t->value, 1)), 0.0, 1e-9 );
+        t = find("rx_rate");
+        CPPUNIT_ASSERT( t && pmt::to_double(t->value) == 8000 );
+
+        // packet 1 lost, the stream starts again with packet 2 at item 20
+        make_batch(16, 0x2);
+        CPPUNIT_ASSERT( tagger.write(ring, &batch) );
+        tagger.get_tags(20, tags);
+        CPPUNIT_ASSERT( tags.empty() );
+        tagger.get_tags(28, tags);
+        t = find("rx_gap");
+        CPPUNIT_ASSERT( t && t->offset == 20 && pmt::to_uint64(t->value) == 1 );
+        t = find("rx_time");
+        CPPUNIT_ASSERT( t && t->offset == 20 );
+        CPPUNIT_ASSERT( find("rx_rate") == NULL && find("rx_overflow") == NULL );
+    }
+
+    void testOverflow()
+    {
+        spsc_ring_buffer<unsigned char> ring(16);
+        gr::simplefe::rx_tagger tagger(2);
+        const gr::tag_t *t;
+
+        // only two packets fit
+        make_batch(0, 0);
+        CPPUNIT_ASSERT( !tagger.write(ring, &batch) );
+        CPPUNIT_ASSERT( ring.read(NULL, 16, drop, same_len) == 16 );
+        tagger.get_tags(8, tags);
+        CPPUNIT_ASSERT( find("rx_overflow") == NULL );
+
+        make_batch(16, 0);
+        meta.flags = SFE_RX_OVERFLOW;
+        tagger.write(ring, &batch);
+        tagger.get_tags(16, tags);
+        // the full ring and the board overflow are one discontinuity
+        CPPUNIT_ASSERT( tags.size() == 2 );
+        t = find("rx_overflow");
+        CPPUNIT_ASSERT( t && t->offset == 8 && find("rx_time") != NULL );
+    }
+};
+
     
 CppUnit::TestSuite *
 qa_simplefe::suite()
@@ -181,6 +476,24 @@ qa_simplefe::suite()
   s->addTest(new CppUnit::TestCaller<RingbufTest>("testReadWrite2",
                                                    &RingbufTest::testReadWrite2)
              );
+  s->addTest(new CppUnit::TestCaller<SpscRingbufTest>("testSpscCapacity",
+                                                       &SpscRingbufTest::testCapacity)
+             );
+  s->addTest(new CppUnit::TestCaller<SpscRingbufTest>("testSpscReadWrite",
+                                                       &SpscRingbufTest::testReadWrite)
+             );
+  s->addTest(new CppUnit::TestCaller<MirrorRingbufTest>("testMirrorWrapRead",
+                                                         &MirrorRingbufTest::testWrapRead)
+             );
+  s->addTest(new CppUnit::TestCaller<MirrorRingbufTest>("testMirrorReserveCommit",
+                                                         &MirrorRingbufTest::testReserveCommit)
+             );
+  s->addTest(new CppUnit::TestCaller<RxTagTest>("testRxTagStartAndGap",
+                                                 &RxTagTest::testStartAndGap)
+             );
+  s->addTest(new CppUnit::TestCaller<RxTagTest>("testRxTagOverflow",
+                                                 &RxTagTest::testOverflow)
+             );
   
   return s;
 }
@@ -0,0 +1,223 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2019 GPL.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_SFE_RX_TAGS_H
+#define INCLUDED_SFE_RX_TAGS_H
+
+#include <vector>
+#include <string.h>
+#include <pmt/pmt.h>
+#include <gnuradio/tags.h>
+#include "simpleFE.h"
+#include "spsc_ringbuf.h"
+
+namespace gr {
+  namespace simplefe {
+
+      /* turns the rx stream metadata into stream tags. the usb thread
+       * writes a transfer packet by packet through write(), an event is
+       * queued at the byte position where the stream starts again after
+       * the start, a gap or an overflow, work() collects the tags of the
+       * items it hands out. tags follow the usrp source:
+       *
+       *   rx_time      (uint64 seconds, double fraction) of the host
+       *                monotonic clock at the tagged sample
+       *   rx_rate      samples per second, at the start and on changes
+       *   rx_overflow  #t, the ADC FIFO or the ring buffer dropped data
+       *   rx_gap       uint64, estimated samples lost with iso packets
+       */
+      class rx_tagger
+      {
+      public:
+          rx_tagger(unsigned bytes_per_item)
+              : m_events(64), m_bytes_per_item(bytes_per_item),
+                m_pos(0), m_started(false), m_rate(0), m_have_next(false)
+          {
+          }
+
+          /* usb thread, writes one batch into ring and queues its events,
+           * packets that fail keep() are dropped as corrupted. returns
+           * false if the ring had no room for some of it */
+          template <class T>
+          bool write(spsc_ring_buffer<T> &ring, const sfe_rx_batch* batch,
+                     bool (*keep)(unsigned len) = NULL)
+          {
+              const sfe_rx_meta *m = batch->meta;
+              unsigned nch = m->channels ? m->channels : 1;
+              unsigned lost_est = (m->rate + 4000) / 8000;
+              unsigned long long s, s_end;
+              unsigned long long gap = 0;
+              bool overflow = (m->flags & SFE_RX_OVERFLOW) != 0;
+              bool disc = !m_started || overflow;
+              bool full = false;
+
+              /* time_ns is the completion, about the end of the transfer */
+              s_end = m->sample + batch->total_bytes / nch;
+              for (unsigned i=0; i<batch->n_iov; i++){
+                  if (!(batch->status[i >> 5] & (1u << (i & 31)))){
+                      s_end += lost_est;
+                  }
+              }
+
+              s = m->sample;
+              for (unsigned i=0; i<batch->n_iov; i++){
+                  unsigned len = batch->iov[i].len;
+
+                  if (!(batch->status[i >> 5] & (1u << (i & 31)))){
+                      gap += lost_est;
+                      s += lost_est;
+                      disc = true;
+                      continue;
+                  }
+                  if (!len){
+                      continue;
+                  }
+                  if (keep && !keep(len)){
+                      gap += len / nch;
+                      s += len / nch;
+                      disc = true;
+                      continue;
+                  }
+                  if (disc || m->rate != m_rate){
+                      push(m, s, s_end, disc ? overflow : false, gap);
+                      disc = overflow = false;
+                      gap = 0;
+                  }
+                  if (!ring.write((const T*)batch->iov[i].base, len, false)){
+                      /* the next packet that fits starts a new run */
+                      overflow = disc = full = true;
+                  }
+                  else{
+                      m_pos += len;
+                  }
+                  s += len / nch;
+              }
+              return !full;
+          }
+
+          /* work() thread, the tags of the items before item_end */
+          void get_tags(uint64_t item_end, std::vector<gr::tag_t> &tags)
+          {
+              tags.clear();
+              while (next() && m_next.pos / m_bytes_per_item < item_end){
+                  event e = m_next;
+
+                  /* a write that found the ring full queues another event
+                     at the same place, they become one set of tags */
+                  m_have_next = false;
+                  while (next() && m_next.pos == e.pos){
+                      e.gap += m_next.gap;
+                      e.overflow = e.overflow || m_next.overflow;
+                      e.rate = m_next.rate ? m_next.rate : e.rate;
+                      m_have_next = false;
+                  }
+                  add_tags(e, tags);
+              }
+          }
+
+      private:
+          struct event{
+              unsigned long long pos;
+              unsigned long long time_ns;
+              unsigned long long gap;
+              unsigned rate;
+              bool overflow;
+          };
+
+          spsc_ring_buffer<event> m_events;
+          unsigned m_bytes_per_item;
+          /* usb thread */
+          unsigned long long m_pos;
+          bool m_started;
+          unsigned m_rate;
+          /* work() thread */
+          event m_next;
+          bool m_have_next;
+
+          void push(const sfe_rx_meta *m, unsigned long long s,
+                    unsigned long long s_end, bool overflow, unsigned long long gap)
+          {
+              event e;
+
+              e.pos = m_pos;
+              e.time_ns = m->time_ns;
+              if (m->rate){
+                  e.time_ns -= (s_end - s) * 1000000000ULL / m->rate;
+              }
+              e.gap = gap;
+              e.rate = m->rate != m_rate || !m_started ? m->rate : 0;
+              e.overflow = overflow;
+              /* dropped if work() is far behind, the data is too */
+              if (m_events.write(&e, 1)){
+                  m_started = true;
+                  m_rate = m->rate;
+              }
+          }
+
+          static int copy_event(void* dst, void* src, int src_len)
+          {
+              memcpy(dst, src, src_len * sizeof(event));
+              return src_len * sizeof(event);
+          }
+
+          static int one_event(int dst_len)
+          {
+              return 1;
+          }
+
+          bool next()
+          {
+              if (!m_have_next){
+                  m_have_next = m_events.read(&m_next, 1, copy_event, one_event) == 1;
+              }
+              return m_have_next;
+          }
+
+          void add_tags(const event &e, std::vector<gr::tag_t> &tags)
+          {
+              gr::tag_t t;
+
+              t.offset = e.pos / m_bytes_per_item;
+              t.key = pmt::mp("rx_time");
+              t.value = pmt::make_tuple(pmt::from_uint64(e.time_ns / 1000000000ULL),
+                                        pmt::from_double((e.time_ns % 1000000000ULL) * 1e-9));
+              tags.push_back(t);
+              if (e.rate){
+                  t.key = pmt::mp("rx_rate");
+                  t.value = pmt::from_double(e.rate);
+                  tags.push_back(t);
+              }
+              if (e.overflow){
+                  t.key = pmt::mp("rx_overflow");
+                  t.value = pmt::PMT_T;
+                  tags.push_back(t);
+              }
+              if (e.gap){
+                  t.key = pmt::mp("rx_gap");
+                  t.value = pmt::from_uint64(e.gap);
+                  tags.push_back(t);
+              }
+          }
+      };
+
+  } // namespace simplefe
+} // namespace gr
+
+#endif /* INCLUDED_SFE_RX_TAGS_H */
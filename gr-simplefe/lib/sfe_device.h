@@ -22,36 +22,98 @@
 #ifndef INCLUDED_SFE_DEVICE_H
 #define INCLUDED_SFE_DEVICE_H
 
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string.h>
+
 namespace gr {
   namespace simplefe {
 
 
+	  /* one instance per board, keyed by serial number, so sources and 
+	   * sinks given the same serial share the board and its event thread.
+	   * an empty serial stands for the first board found */
 	  class sfe_device 
 	  {
 	  private:
-		  sfe_device()
+		  sfe_device(const std::string &serial)
 		  {
-			  m_sfe = sfe_init();
-			  sfe_reset_board(m_sfe);
+			  sfe_init_options opt;
+
+			  memset(&opt, 0, sizeof(opt));
+			  opt.serial = serial.c_str();
+			  m_sfe = sfe_init_ex(&opt);
+			  if (m_sfe) {
+				  sfe_reset_board(m_sfe);
+			  }
 		  }
 		  ~sfe_device()
 		  {
-			  sfe_close(m_sfe);
+			  if (m_sfe) {
+				  sfe_close(m_sfe);
+			  }
 		  }
 
-		  static sfe_device* m_gb_dev;
+		  static std::map<std::string, sfe_device*> m_devices;
+		  static std::mutex m_devices_lock;
 		  sfe* m_sfe;
 	  public:
-		  static sfe_device* get_device() {
-			  if (!m_gb_dev) {
-				  m_gb_dev = new sfe_device();
+		  static sfe_device* get_device(const std::string &serial = "") {
+			  std::lock_guard<std::mutex> lock(m_devices_lock);
+			  std::string key = serial;
+
+			  if (key.empty()) {
+				  sfe_device_info info;
+				  if (sfe_enumerate(&info, 1) > 0) {
+					  key = info.serial;
+				  }
+			  }
+			  std::map<std::string, sfe_device*>::iterator it = m_devices.find(key);
+			  if (it != m_devices.end()) {
+				  return it->second;
+			  }
+			  sfe_device *d = new sfe_device(key);
+			  if (!d->m_sfe) {
+				  delete d;
+				  return NULL;
 			  }
-			  return m_gb_dev;
+			  m_devices[key] = d;
+			  return d;
 		  }
 
 		  sfe* dev() {
 			  return m_sfe;
 		  }
+
+		  /* shared by all blocks, since they all stream through the one
+		   * usb event thread of the device. priority > 0 asks for
+		   * SCHED_FIFO, cpu_mask 0 leaves the affinity alone */
+		  bool set_realtime(int priority, unsigned long cpu_mask, bool lock_memory)
+		  {
+			  sfe_rt_params p;
+			  sfe_rt_status st;
+			  int ret;
+
+			  p.policy = priority > 0 ? SFE_SCHED_FIFO : SFE_SCHED_OTHER;
+			  p.priority = priority;
+			  p.cpu_mask = cpu_mask;
+			  p.lock_memory = lock_memory ? 1 : 0;
+			  ret = sfe_set_rt_params(m_sfe, &p);
+
+			  if (priority > 0 || cpu_mask || lock_memory) {
+				  sfe_get_rt_status(m_sfe, &st);
+				  std::cerr << "simplefe: realtime " 
+							<< (ret == 0 ? "granted" : "NOT fully granted")
+							<< " (policy " << st.policy 
+							<< ", priority " << st.priority
+							<< ", cpu mask 0x" << std::hex << st.cpu_mask << std::dec
+							<< ", memory " << (st.memory_locked ? "locked" : "unlocked")
+							<< ")" << std::endl;
+			  }
+			  return ret == 0;
+		  }
 	  };
   }
 }
@@ -27,27 +27,31 @@
 #include <gnuradio/io_signature.h>
 #include "sink_c_impl.h"
 #include "simpleFE.h"
+#include "sfe_convert.h"
 #include <stdio.h>
+#include <algorithm>
 
 namespace gr {
     namespace simplefe {
 		
-        sfe_device* sfe_device::m_gb_dev = NULL;
+        std::map<std::string, sfe_device*> sfe_device::m_devices;
+        std::mutex sfe_device::m_devices_lock;
 
         sink_c::sptr
-        sink_c::make(unsigned sample_rate)
+        sink_c::make(unsigned sample_rate, const std::string &serial)
         {
             return gnuradio::get_initial_sptr
-                (new sink_c_impl(sample_rate));
+                (new sink_c_impl(sample_rate, serial));
         }
 
         /*
          * The private constructor
          */
-        sink_c_impl::sink_c_impl(unsigned sample_rate)
+        sink_c_impl::sink_c_impl(unsigned sample_rate, const std::string &serial)
             : gr::sync_block("sink_c",
                              gr::io_signature::make(1, 1, sizeof(std::complex<float>)),
-                             gr::io_signature::make(0, 0, 0))
+                             gr::io_signature::make(0, 0, 0)),
+              m_bursts(m_ringbuf, sink_c_impl::fill_tx_buffer, sink_c_impl::calc_read_len)
         {
             unsigned rates[SIMPLE_FE_NUM_SAMPLE_RATES];
             unsigned r = 0;
@@ -66,10 +70,11 @@ namespace gr {
             }
 			//printf("sample rate: %d\n", r);
         
-            m_sfe = sfe_device::get_device()->dev();
-            if (!m_sfe){
+            m_dev = sfe_device::get_device(serial);
+            if (!m_dev){
                 throw std::runtime_error("Cannot open simpleFE device\n");
             }
+            m_sfe = m_dev->dev();
 
             if (sfe_set_sample_rate(m_sfe, r)){
                 throw std::runtime_error("set sampling rate error, device running ? \n");
@@ -82,31 +87,22 @@ namespace gr {
             /* start tx thread */
 			//std::cout << "start tx" << std::endl;
 			sfe_tx_enable(m_sfe, 1, 1);
-            if (sfe_tx_start(m_sfe, sink_c_impl::tx_callback, this)) {
+            if (sfe_tx_start_burst(m_sfe, sink_c_impl::tx_callback, this) ||
+                !m_bursts.start(m_sfe)) {
                 throw std::runtime_error("start tx failed\n");
             }
         }
       
-        int sink_c_impl::tx_callback(unsigned char* buffer, int length, void* data)
+        int sink_c_impl::tx_callback(unsigned char* buffer, int length, unsigned flags, void* data)
         {
             sink_c_impl *obj = (sink_c_impl*)data;
-            return obj->data_request(buffer, length);
+            return obj->data_request(buffer, length, flags);
         }
 
 
-        int sink_c_impl::data_request(unsigned char* buffer, int length)
+        int sink_c_impl::data_request(unsigned char* buffer, int length, unsigned flags)
         {
-            boost::mutex::scoped_lock lock(m_buf_mutex);
-            if (m_ringbuf.get_count() < calc_read_len(length)) {
-                memset(buffer, 0, length);
-                std::cerr << "U" << std::flush;
-            }
-            else {
-                //copy and convert data
-                m_ringbuf.read(buffer, length, sink_c_impl::fill_tx_buffer, sink_c_impl::calc_read_len);
-                m_buf_cond.notify_one();
-            }
-            return 0;
+            return m_bursts.data_request(buffer, length, flags);
         }
 
         
@@ -118,29 +114,9 @@ namespace gr {
         int sink_c_impl::fill_tx_buffer(void* dst, void* src, int src_len)
         {
             /* dst should have enought memory */
-            /* src_len is a multiple of 2, it represents number of data */          
-            std::complex<float> *in = static_cast<std::complex<float>*>(src);
-            unsigned char *out = static_cast<unsigned char*>(dst);
-            int j = 0;
-            for (int i=0; i<src_len; i+=2){
-              
-                float x0 = in[i].real();
-                float x1 = in[i].imag();
-                float x2 = in[i+1].real();
-                float x3 = in[i+1].imag();
-
-                unsigned short u0 = ((short)(x0*511) + 512) & 0x3FF;
-                unsigned short u1 = ((short)(x1*511) + 512) & 0x3FF;
-                unsigned short u2 = ((short)(x2*511) + 512) & 0x3FF;
-                unsigned short u3 = ((short)(x3*511) + 512) & 0x3FF;
-
-                out[j++] = (u0 >>8) | ((u1>>8)<<2) | ((u2>>8)<<4) | ((u3>>8)<<6);
-                out[j++] = u0 & 0xFF;
-                out[j++] = u1 & 0xFF;
-                out[j++] = u2 & 0xFF;
-                out[j++] = u3 & 0xFF;
-            }
-            return j;
+            /* src_len is a multiple of 2, it represents number of data */
+            return sfe_pack_cf32(static_cast<unsigned char*>(dst),
+                                 static_cast<const float*>(src), src_len);
         }
         void sink_c_impl::reset_simplefe(void)
         {
@@ -154,6 +130,24 @@ namespace gr {
             sfe_stop_tx(m_sfe);
         }
 
+        bool sink_c_impl::start()
+        {
+            m_bursts.clear_abort();
+            return true;
+        }
+
+        /* a work() waiting for the usb thread comes back, its items dropped */
+        bool sink_c_impl::stop()
+        {
+            m_bursts.abort();
+            return true;
+        }
+
+        bool sink_c_impl::set_realtime(int priority, unsigned long cpu_mask, bool lock_memory)
+        {
+            return m_dev->set_realtime(priority, cpu_mask, lock_memory);
+        }
+
         int
         sink_c_impl::work(int noutput_items,
                           gr_vector_const_void_star &input_items,
@@ -161,14 +155,11 @@ namespace gr {
         {
             const std::complex<float> *in = (const std::complex<float> *) input_items[0];
             
-            {
-                boost::mutex::scoped_lock lock(m_buf_mutex );
-                while ( m_ringbuf.get_space() < noutput_items){
-                    //printf("space: %d, %d\n", m_ringbuf.get_space(), m_ringbuf.get_count());
-                    m_buf_cond.wait( lock );
-                }
-                m_ringbuf.write(in, noutput_items);
-            }
+            uint64_t first = nitems_read(0);
+
+            get_tags_in_window(m_tags, 0, 0, noutput_items);
+            std::sort(m_tags.begin(), m_tags.end(), gr::tag_t::offset_compare);
+            m_bursts.write(in, noutput_items, first, m_tags);
             consume_each(noutput_items);
             return 0;
         }
@@ -23,9 +23,8 @@
 
 #include <simplefe/sink_f.h>
 #include "simpleFE.h"
-#include <boost/thread/mutex.hpp>
-#include <boost/thread/condition_variable.hpp>
-#include "ringbuf.h"
+#include "mirror_ringbuf.h"
+#include "tx_bursts.h"
 #include "sfe_device.h"
 
 namespace gr {
@@ -36,17 +35,21 @@ namespace gr {
      private:
       // Nothing to declare in this block.
         sfe* m_sfe;
-        boost::mutex m_buf_mutex;
-        boost::condition_variable m_buf_cond;
-        static int tx_callback(unsigned char* buffer, int length, void* data);
+        sfe_device *m_dev;
+        static int tx_callback(unsigned char* buffer, int length, unsigned flags, void* data);
         static int fill_tx_buffer(void* dst, void* src, int src_len);
           static int calc_read_len(int dst_len);
-        ring_buffer<float> m_ringbuf;
+        mirror_ring_buffer<float> m_ringbuf;
+        tx_burster<float> m_bursts;
+        std::vector<gr::tag_t> m_tags;
 
      public:
-        sink_f_impl(unsigned sample_rate, int channel);
+        sink_f_impl(unsigned sample_rate, int channel, const std::string &serial);
         ~sink_f_impl();
-        int data_request(unsigned char* buffer, int length);
+        bool set_realtime(int priority, unsigned long cpu_mask, bool lock_memory);
+        bool start();
+        bool stop();
+        int data_request(unsigned char* buffer, int length, unsigned flags);
         void reset_simplefe(void);
 
       // Where all the action really happens
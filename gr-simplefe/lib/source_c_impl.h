@@ -23,10 +23,9 @@
 
 #include <simplefe/source_c.h>
 #include "simpleFE.h"
-#include <boost/thread/mutex.hpp>
-#include <boost/thread/condition_variable.hpp>
-#include "ringbuf.h"
+#include "spsc_ringbuf.h"
 #include "sfe_device.h"
+#include "rx_tags.h"
 
 namespace gr {
     namespace simplefe {
@@ -35,18 +34,27 @@ namespace gr {
         {
         private:
             sfe *m_sfe;
-            boost::mutex m_buf_mutex;
-            boost::condition_variable m_buf_cond;
-            static int rx_callback(unsigned char* buffer, int length, void* data);
+            sfe_device *m_dev;
+            static int rx_callback(const sfe_rx_batch* batch, void* data);
             static int calc_src_len(int dst_len);
-            static int fill_rx_buffer(void* dst, void* src, int src_len);
-            ring_buffer<unsigned char> m_ringbuf;
+            static bool even_length(unsigned len);
+            static int fill_rx_fc32(void* dst, void* src, int src_len);
+            static int fill_rx_sc16(void* dst, void* src, int src_len);
+            static int fill_rx_sc8(void* dst, void* src, int src_len);
+            static int output_item_size(const std::string &output_type);
+            int (*m_fill_rx_buffer)(void* dst, void* src, int src_len);
+            spsc_ring_buffer<unsigned char> m_ringbuf;
+            rx_tagger m_tagger;
+            std::vector<gr::tag_t> m_tags;
         
         public:
-            source_c_impl(unsigned sample_rate);
+            source_c_impl(unsigned sample_rate, const std::string &output_type, const std::string &serial);
             ~source_c_impl();
+            bool set_realtime(int priority, unsigned long cpu_mask, bool lock_memory);
+            bool start();
+            bool stop();
         
-            int write_data(unsigned char* buffer, int length);          
+            int write_data(const sfe_rx_batch* batch);          
             // Where all the action really happens
             int work(int noutput_items,
                      gr_vector_const_void_star &input_items,
@@ -24,26 +24,28 @@
 
 #include <gnuradio/io_signature.h>
 #include "source_f_impl.h"
-#include "ringbuf.h"
 #include "simpleFE.h"
+#include "sfe_convert.h"
+#include <algorithm>
 
 namespace gr {
   namespace simplefe {
 
     source_f::sptr
-    source_f::make(unsigned sample_rate, int channel)
+    source_f::make(unsigned sample_rate, int channel, const std::string &output_type, const std::string &serial)
     {
       return gnuradio::get_initial_sptr
-        (new source_f_impl(sample_rate, channel));
+        (new source_f_impl(sample_rate, channel, output_type, serial));
     }
 
     /*
      * The private constructor
      */
-    source_f_impl::source_f_impl(unsigned sample_rate, int channel)
+    source_f_impl::source_f_impl(unsigned sample_rate, int channel, const std::string &output_type, const std::string &serial)
       : gr::sync_block("source_f",
               gr::io_signature::make(0, 0, 0),
-              gr::io_signature::make(1, 1, sizeof(float)))
+              gr::io_signature::make(1, 1, output_item_size(output_type))),
+        m_tagger(calc_src_len(1))
     {
           unsigned rates[SIMPLE_FE_NUM_SAMPLE_RATES];
           unsigned r = 0;
@@ -62,11 +64,22 @@ namespace gr {
           if (r == 0){
               throw std::out_of_range("sample rate is out of range\n");
           }
+
+          if (output_type == "s16"){
+              m_fill_rx_buffer = fill_rx_s16;
+          }
+          else if (output_type == "s8"){
+              m_fill_rx_buffer = fill_rx_s8;
+          }
+          else{
+              m_fill_rx_buffer = fill_rx_f32;
+          }
         
-          m_sfe = sfe_device::get_device()->dev();
-          if (!m_sfe){
+          m_dev = sfe_device::get_device(serial);
+          if (!m_dev){
               throw std::runtime_error("Cannot open simpleFE device\n");
           }
+          m_sfe = m_dev->dev();
 
           if (sfe_set_sample_rate(m_sfe, r)){
               throw std::runtime_error("set sampling rate error, device running ? \n");
@@ -78,29 +91,25 @@ namespace gr {
           /* start rx thread */
 		  //std::cout << "start rx" << std::endl;
           sfe_rx_enable(m_sfe, rx_i, rx_q);
-          if (sfe_rx_start(m_sfe, source_f_impl::rx_callback, this)) {
+          if (sfe_rx_start_batched(m_sfe, source_f_impl::rx_callback, this)) {
               throw std::runtime_error("start rx thread ofailed\n");
           }
     }
       
-      int source_f_impl::rx_callback(unsigned char* buffer, int length, void* data)
+      int source_f_impl::rx_callback(const sfe_rx_batch* batch, void* data)
       {
           source_f_impl *obj = (source_f_impl*)data;
-          return obj->write_data(buffer, length);
+          return obj->write_data(batch);
       }
 
-      int source_f_impl::write_data(unsigned char* buffer, int length)
+      int source_f_impl::write_data(const sfe_rx_batch* batch)
       {
-          if (length > 0){
-              
-              boost::mutex::scoped_lock lock(m_buf_mutex);
-              if (!m_ringbuf.write(buffer, length)){
-                  std::cerr << "O" << std::flush;
-              }
-              else {
-                  m_buf_cond.notify_one();
-              }
-              
+          /* lock free, wake the work thread once for the whole transfer */
+          bool overflow = !m_tagger.write(m_ringbuf, batch);
+          m_ringbuf.notify();
+          
+          if (overflow){
+              std::cerr << "O" << std::flush;
           }
           return 0;
       }
@@ -117,15 +126,51 @@ namespace gr {
           sfe_stop_rx(m_sfe);
       }
 
-      int source_f_impl::fill_rx_buffer(void* dst, void* src, int src_len)
+      bool source_f_impl::start()
+      {
+          m_ringbuf.clear_abort();
+          return true;
+      }
+
+      /* a work() still waiting on the ring comes back with nothing */
+      bool source_f_impl::stop()
+      {
+          m_ringbuf.abort();
+          return true;
+      }
+
+      bool source_f_impl::set_realtime(int priority, unsigned long cpu_mask, bool lock_memory)
+      {
+          return m_dev->set_realtime(priority, cpu_mask, lock_memory);
+      }
+
+      int source_f_impl::output_item_size(const std::string &output_type)
       {
-          float *out = (float*)dst;
-          unsigned char *in = (unsigned char*)src;
-          const float qinv = (1.0f/127.0f);
-          for(int i=0; i<src_len; i++){
-              out[i] = (in[i]-128)*qinv;
+          if (output_type == "f32"){
+              return sizeof(float);
+          }
+          if (output_type == "s16"){
+              return sizeof(short);
           }
-          return src_len*sizeof(float);
+          if (output_type == "s8"){
+              return sizeof(char);
+          }
+          throw std::invalid_argument("output type must be f32, s16 or s8\n");
+      }
+
+      int source_f_impl::fill_rx_f32(void* dst, void* src, int src_len)
+      {
+          return sfe_unpack_f32((float*)dst, (const unsigned char*)src, src_len)*sizeof(float);
+      }
+
+      int source_f_impl::fill_rx_s16(void* dst, void* src, int src_len)
+      {
+          return sfe_unpack_s16((short*)dst, (const unsigned char*)src, src_len)*sizeof(short);
+      }
+
+      int source_f_impl::fill_rx_s8(void* dst, void* src, int src_len)
+      {
+          return sfe_unpack_s8((signed char*)dst, (const unsigned char*)src, src_len);
       }
 
       int
@@ -133,16 +178,20 @@ namespace gr {
                           gr_vector_const_void_star &input_items,
                           gr_vector_void_star &output_items)
       {
-          float *out = (float *) output_items[0];
+          void *out = output_items[0];
 
-          {
-              boost::mutex::scoped_lock lock(m_buf_mutex );
-              while ( m_ringbuf.get_count() < calc_src_len(noutput_items)){
-                  
-                  m_buf_cond.wait( lock );
-              }
-              
-              m_ringbuf.read(out, noutput_items, fill_rx_buffer, calc_src_len);
+          /* the ring never holds more than its capacity, asking for more
+             would wait forever */
+          noutput_items = std::min(noutput_items, m_ringbuf.get_capacity() / calc_src_len(1));
+          if (!m_ringbuf.wait_for_count(calc_src_len(noutput_items)) ||
+              !m_ringbuf.read(out, noutput_items, m_fill_rx_buffer, calc_src_len)){
+              return 0;
+          }
+
+          m_tagger.get_tags(nitems_written(0) + noutput_items, m_tags);
+          for (size_t i=0; i<m_tags.size(); i++){
+              m_tags[i].srcid = alias_pmt();
+              add_item_tag(0, m_tags[i]);
           }
           
           // Tell runtime system how many output items we produced.
@@ -23,10 +23,9 @@
 
 #include <simplefe/source_f.h>
 #include "simpleFE.h"
-#include <boost/thread/mutex.hpp>
-#include <boost/thread/condition_variable.hpp>
-#include "ringbuf.h"
+#include "spsc_ringbuf.h"
 #include "sfe_device.h"
+#include "rx_tags.h"
 
 namespace gr {
     namespace simplefe {
@@ -36,17 +35,25 @@ namespace gr {
         private:
             // Nothing to declare in this block.
             sfe *m_sfe;
-            boost::mutex m_buf_mutex;
-            boost::condition_variable m_buf_cond;
-            static int rx_callback(unsigned char* buffer, int length, void* data);
+            sfe_device *m_dev;
+            static int rx_callback(const sfe_rx_batch* batch, void* data);
             static int calc_src_len(int dst_len);
-            static int fill_rx_buffer(void* dst, void* src, int src_len);
-            ring_buffer<unsigned char> m_ringbuf;
+            static int fill_rx_f32(void* dst, void* src, int src_len);
+            static int fill_rx_s16(void* dst, void* src, int src_len);
+            static int fill_rx_s8(void* dst, void* src, int src_len);
+            static int output_item_size(const std::string &output_type);
+            int (*m_fill_rx_buffer)(void* dst, void* src, int src_len);
+            spsc_ring_buffer<unsigned char> m_ringbuf;
+            rx_tagger m_tagger;
+            std::vector<gr::tag_t> m_tags;
 
         public:
-            source_f_impl(unsigned sample_rate, int channel);
+            source_f_impl(unsigned sample_rate, int channel, const std::string &output_type, const std::string &serial);
             ~source_f_impl();
-            int write_data(unsigned char* buffer, int length);          
+            bool set_realtime(int priority, unsigned long cpu_mask, bool lock_memory);
+            bool start();
+            bool stop();
+            int write_data(const sfe_rx_batch* batch);          
             // Where all the action really happens
             int work(int noutput_items,
                      gr_vector_const_void_star &input_items,
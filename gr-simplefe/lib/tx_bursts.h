@@ -0,0 +1,330 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2019 GPL.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef INCLUDED_SFE_TX_BURSTS_H
+#define INCLUDED_SFE_TX_BURSTS_H
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <atomic>
+#include <iostream>
+#include <pmt/pmt.h>
+#include <gnuradio/tags.h>
+#include "simpleFE.h"
+#include "sfe_convert.h"
+#include "mirror_ringbuf.h"
+
+namespace gr {
+  namespace simplefe {
+
+      /* burst tx for the sinks, tags follow the usrp sink:
+       *
+       *   tx_sob   starts a burst at the tagged item
+       *   tx_eob   ends the burst after the tagged item
+       *   tx_time  (uint64 seconds, double fraction) of the host monotonic
+       *            clock the rx_time tags use, starts a burst there. rx 
+       *            has to run on the board, otherwise it starts at once
+       *
+       * without tags everything is one burst. work() drops the items 
+       * outside bursts, queues an sfe_tx_burst() per burst and an end mark
+       * for the usb thread, which fills the transfers in data_request(). 
+       * the last frame of a burst is padded with zeros, between bursts and
+       * on underflow the DAC idles at mid scale */
+      template <class T>
+      class tx_burster
+      {
+      public:
+          typedef int (*conv_fn)(void* dst, void* src, int src_len);
+          typedef int (*calc_fn)(int dst_len);
+
+          /* conv and calc_len are the ring read() pair of the sink */
+          tx_burster(mirror_ring_buffer<T> &ring, conv_fn conv, calc_fn calc_len)
+              : m_ring(ring), m_conv(conv), m_calc_len(calc_len),
+                m_items_per_frame(calc_len(5)),
+                m_marks(64), m_started(SFE_TX_MAX_BURSTS), m_sfe(NULL), m_aborted(false),
+                m_in_burst(false), m_pos(0), m_read(0), m_have_mark(false)
+          {
+          }
+
+          /* the one burst that is there without tags */
+          bool start(sfe* h)
+          {
+              m_sfe = h;
+              m_in_burst = true;
+              return sfe_tx_burst(h, SFE_TX_NOW) == 0;
+          }
+
+          /* the sink's stop(), a work() waiting on the usb thread returns
+           * and drops what it was given */
+          void abort()
+          {
+              m_aborted = true;
+              m_ring.abort();
+              m_marks.abort();
+              m_started.abort();
+          }
+
+          void clear_abort()
+          {
+              m_ring.clear_abort();
+              m_marks.clear_abort();
+              m_started.clear_abort();
+              m_aborted = false;
+          }
+
+          /* work() thread, writes in[0..n) that lies inside bursts, the 
+           * tags of the items are in tags. returns the items consumed */
+          int write(const T* in, int n, uint64_t first_item,
+                    const std::vector<gr::tag_t> &tags)
+          {
+              int done = 0;
+              size_t t = 0;
+
+              while (done < n){
+                  int end = n;
+
+                  /* up to the next item with tags */
+                  while (t < tags.size() && tags[t].offset < first_item + done){
+                      t++;
+                  }
+                  if (t < tags.size() && tags[t].offset < first_item + n){
+                      end = tags[t].offset - first_item;
+                  }
+                  if (end > done){
+                      write_items(in + done, end - done);
+                      done = end;
+                      continue;
+                  }
+                  done += burst_tags(in + done, first_item + done, tags, t);
+              }
+              return n;
+          }
+
+          /* usb thread, the sfe_tx_burst_callback */
+          int data_request(unsigned char* buffer, int length, unsigned flags)
+          {
+              unsigned items = length / 5 * m_items_per_frame;
+              unsigned count = m_ring.get_count();
+
+              if (flags & SFE_TX_SOB){
+                  /* the library took a burst off its queue, there is room */
+                  char one_more = 1;
+                  m_started.write(&one_more, 1);
+              }
+              if (flags & SFE_TX_LATE){
+                  std::cerr << "L" << std::flush;
+              }
+              if (next_mark() && m_mark - m_read <= items){
+                  /* the end of the burst in this transfer */
+                  unsigned last = m_mark - m_read;
+                  unsigned whole = last - last % m_items_per_frame;
+                  int bytes = 0;
+                  T tail[4];
+
+                  if (count < last){
+                      return underflow(buffer, length);
+                  }
+                  if (whole){
+                      m_ring.read(buffer, whole / m_items_per_frame * 5, m_conv, m_calc_len);
+                      bytes = whole / m_items_per_frame * 5;
+                  }
+                  if (last > whole){
+                      memset(tail, 0, sizeof(tail));
+                      m_ring.read(tail, last - whole, copy_items, same_len);
+                      m_conv(buffer + bytes, tail, m_items_per_frame);
+                      bytes += 5;
+                  }
+                  m_read += last;
+                  m_have_mark = false;
+                  return bytes;
+              }
+              if (count < items){
+                  return underflow(buffer, length);
+              }
+              m_ring.read(buffer, length / 5 * 5, m_conv, m_calc_len);
+              m_read += items;
+              return length;
+          }
+
+      private:
+          mirror_ring_buffer<T> &m_ring;
+          conv_fn m_conv;
+          calc_fn m_calc_len;
+          unsigned m_items_per_frame;
+          /* ring positions after the last item of a burst */
+          spsc_ring_buffer<uint64_t> m_marks;
+          /* one entry per burst the usb thread started */
+          spsc_ring_buffer<char> m_started;
+          sfe* m_sfe;
+          std::atomic<bool> m_aborted;
+          /* work() thread */
+          bool m_in_burst;
+          uint64_t m_pos;
+          /* usb thread */
+          uint64_t m_read;
+          uint64_t m_mark;
+          bool m_have_mark;
+
+          void write_items(const T* in, int n)
+          {
+              if (!m_in_burst){
+                  return;
+              }
+              /* never more than the ring can hold, the usb thread never waits */
+              while (n > 0){
+                  int len = std::min(n, m_ring.get_capacity());
+                  if (!m_ring.wait_for_space(len)){
+                      /* aborted on shutdown */
+                      return;
+                  }
+                  m_ring.write(in, len);
+                  m_pos += len;
+                  in += len;
+                  n -= len;
+              }
+          }
+
+          /* the tags on one item, returns 1 if the item was written */
+          int burst_tags(const T* in, uint64_t item,
+                         const std::vector<gr::tag_t> &tags, size_t t)
+          {
+              bool sob = false, eob = false;
+              unsigned long long start = SFE_TX_NOW;
+
+              for (; t < tags.size() && tags[t].offset == item; t++){
+                  if (pmt::eq(tags[t].key, pmt::mp("tx_sob"))){
+                      sob = true;
+                  }
+                  else if (pmt::eq(tags[t].key, pmt::mp("tx_eob"))){
+                      eob = true;
+                  }
+                  else if (pmt::eq(tags[t].key, pmt::mp("tx_time"))){
+                      sob = true;
+                      start = to_sample(tags[t].value);
+                  }
+              }
+              if (sob){
+                  /* a new burst ends the one before */
+                  end_burst();
+                  queue_burst(start);
+                  m_in_burst = true;
+              }
+              write_items(in, 1);
+              if (eob){
+                  end_burst();
+              }
+              return 1;
+          }
+
+          void end_burst()
+          {
+              if (!m_in_burst){
+                  return;
+              }
+              m_in_burst = false;
+              if (!m_marks.wait_for_space(1)){
+                  /* aborted on shutdown */
+                  return;
+              }
+              m_marks.write(&m_pos, 1);
+          }
+
+          void queue_burst(unsigned long long start)
+          {
+              unsigned long long now;
+              char started[SFE_TX_MAX_BURSTS];
+
+              /* the queue in the library drains one burst at a time */
+              while (sfe_tx_burst(m_sfe, start)){
+                  if (m_aborted){
+                      return;
+                  }
+                  if (start != SFE_TX_NOW && sfe_rx_time_to_sample(m_sfe, 0, &now)){
+                      /* rx went away, as soon as possible then */
+                      start = SFE_TX_NOW;
+                      continue;
+                  }
+                  /* until the usb thread starts a burst, now and then a 
+                     look at rx and at tx still running */
+                  if (m_started.wait_for_count(1, 100)){
+                      m_started.read(started, m_started.get_count(), copy_bytes, same_len);
+                  }
+              }
+          }
+
+          unsigned long long to_sample(const pmt::pmt_t &t)
+          {
+              unsigned long long ns, sample;
+
+              ns = pmt::to_uint64(pmt::tuple_ref(t, 0)) * 1000000000ULL +
+                  (unsigned long long)(pmt::to_double(pmt::tuple_ref(t, 1)) * 1e9 + 0.5);
+              if (sfe_rx_time_to_sample(m_sfe, ns, &sample)){
+                  std::cerr << "tx_time without rx running, sent at once" << std::endl;
+                  return SFE_TX_NOW;
+              }
+              return sample;
+          }
+
+          int underflow(unsigned char* buffer, int length)
+          {
+              sfe_pack_idle(buffer, length);
+              std::cerr << "U" << std::flush;
+              return length;
+          }
+
+          bool next_mark()
+          {
+              if (!m_have_mark){
+                  m_have_mark = m_marks.read(&m_mark, 1, copy_mark, one) == 1;
+              }
+              return m_have_mark;
+          }
+
+          static int copy_items(void* dst, void* src, int src_len)
+          {
+              memcpy(dst, src, src_len * sizeof(T));
+              return src_len * sizeof(T);
+          }
+          static int same_len(int dst_len)
+          {
+              return dst_len;
+          }
+          static int copy_bytes(void* dst, void* src, int src_len)
+          {
+              memcpy(dst, src, src_len);
+              return src_len;
+          }
+          static int copy_mark(void* dst, void* src, int src_len)
+          {
+              memcpy(dst, src, src_len * sizeof(uint64_t));
+              return src_len * sizeof(uint64_t);
+          }
+          static int one(int dst_len)
+          {
+              return 1;
+          }
+      };
+
+  } // namespace simplefe
+} // namespace gr
+
+#endif /* INCLUDED_SFE_TX_BURSTS_H */
@@ -28,6 +28,8 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "blkconv.h"
+#include "fftplan.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -54,24 +56,25 @@ blkconv::blkconv(float *taps, int n_taps, int fft_len)
         m_overlap[i] = 0.0f;
     }
     
-    //fft the taps
+    //the plans are shared, run on this filter's buffer
     in    = (float*)m_data_buf;
     out   = (fftwf_complex*)m_data_buf;
-    m_plan = fftwf_plan_dft_r2c_1d(m_fft_len, in, m_fft_taps, FFTW_ESTIMATE);
+    m_plan     = fft_plan::get(fft_plan::R2C, fft_len);
+    m_inv_plan = fft_plan::get(fft_plan::C2R, fft_len);
+    if (!is_valid()){
+        fprintf(stderr, "blkconv: no %d point fft, the filter puts out 0\n", fft_len);
+        return;
+    }
 
+    //fft the taps
     for (i=0; i<n_taps; i++){
         in[i] = taps[i];
     }
     for (; i<fft_len; i++){
         in[i] = 0.0f;
     }
-    fftwf_execute(m_plan);
-    fftwf_destroy_plan(m_plan);
-
-    //should be inplace 
-    m_plan      = fftwf_plan_dft_r2c_1d(fft_len, in, out, FFTW_ESTIMATE);
-    m_inv_plan = fftwf_plan_dft_c2r_1d(fft_len, out, in, FFTW_ESTIMATE);
-
+    fftwf_execute_dft_r2c(m_plan, in, out);
+    memcpy(m_fft_taps, out, n_ffto*sizeof(fftwf_complex));
 }
 
 void blkconv::process()
@@ -81,12 +84,16 @@ void blkconv::process()
     float *in = (float*)m_data_buf;
     fftwf_complex *out = (fftwf_complex*)m_data_buf;
 
+    if (!is_valid()){
+        memset(in, 0, m_blk_size*sizeof(float));
+        return;
+    }
     //zero padding to fft_len    
     for(i=m_blk_size; i<m_fft_len; i++){
         in[i] = 0.0f;
     }
 
-    fftwf_execute(m_plan);
+    fftwf_execute_dft_r2c(m_plan, in, out);
 
     // multiplication
     for (i=0; i<(m_fft_len/2 + 1); i++)
@@ -100,7 +107,7 @@ void blkconv::process()
         out[i][1] = m_scaling *(re * ci + im * cr);
     }
 
-    fftwf_execute(m_inv_plan);
+    fftwf_execute_dft_c2r(m_inv_plan, out, in);
     //overlap add
     for (i=0; i<m_overlap_size; i++)
     {
@@ -116,7 +123,114 @@ blkconv::~blkconv()
     fftwf_free(m_data_buf);
     fftwf_free(m_fft_taps);
 
-    fftwf_destroy_plan(m_plan);
-    fftwf_destroy_plan(m_inv_plan);
+    fft_plan::release(m_plan);
+    fft_plan::release(m_inv_plan);
+
+}
+
+
+blkconv_c::blkconv_c(float *taps, int n_taps, int fft_len)
+{
+    std::complex<float> *c = new std::complex<float>[n_taps];
+
+    for (int i=0; i<n_taps; i++){
+        c[i] = taps[i];
+    }
+    init(c, n_taps, fft_len);
+    delete[] c;
+}
+
+
+blkconv_c::blkconv_c(std::complex<float> *taps, int n_taps, int fft_len)
+{
+    init(taps, n_taps, fft_len);
+}
+
+
+void blkconv_c::init(const std::complex<float> *taps, int n_taps, int fft_len)
+{
+    int i;
+
+    m_fft_taps = (fftwf_complex*)fftwf_malloc(fft_len*sizeof(fftwf_complex));
+    m_data_buf = (fftwf_complex*)fftwf_malloc(fft_len*sizeof(fftwf_complex));
+
+    m_fft_len = fft_len;
+    m_blk_size = fft_len + 1 - n_taps;
+    m_overlap_size = n_taps - 1;
+
+    m_scaling = 1.0f/m_fft_len;
+
+    m_overlap = (fftwf_complex*)malloc((m_overlap_size + 1) * sizeof(fftwf_complex));
+    for (i=0; i<m_overlap_size; i++){
+        m_overlap[i][0] = m_overlap[i][1] = 0.0f;
+    }
+
+    m_plan     = fft_plan::get(fft_plan::C2C_FORWARD, fft_len);
+    m_inv_plan = fft_plan::get(fft_plan::C2C_BACKWARD, fft_len);
+    if (!is_valid()){
+        fprintf(stderr, "blkconv_c: no %d point fft, the filter puts out 0\n", fft_len);
+        return;
+    }
+
+    //fft the taps, the scaling goes with them
+    for (i=0; i<n_taps; i++){
+        m_data_buf[i][0] = taps[i].real() * m_scaling;
+        m_data_buf[i][1] = taps[i].imag() * m_scaling;
+    }
+    for (; i<fft_len; i++){
+        m_data_buf[i][0] = m_data_buf[i][1] = 0.0f;
+    }
+    fftwf_execute_dft(m_plan, m_data_buf, m_data_buf);
+    memcpy(m_fft_taps, m_data_buf, fft_len*sizeof(fftwf_complex));
+}
+
+
+void blkconv_c::process()
+{
+    int i;
+    fftwf_complex *buf = m_data_buf;
+
+    if (!is_valid()){
+        memset(buf, 0, m_blk_size*sizeof(fftwf_complex));
+        return;
+    }
+    //zero padding to fft_len    
+    for(i=m_blk_size; i<m_fft_len; i++){
+        buf[i][0] = buf[i][1] = 0.0f;
+    }
+
+    fftwf_execute_dft(m_plan, buf, buf);
+
+    // multiplication, the whole spectrum as I/Q is not hermitian
+    for (i=0; i<m_fft_len; i++)
+    {
+        float re = buf[i][0];
+        float im = buf[i][1];
+        float cr = m_fft_taps[i][0];
+        float ci = m_fft_taps[i][1];
+
+        buf[i][0] = re * cr - im * ci;
+        buf[i][1] = re * ci + im * cr;
+    }
+
+    fftwf_execute_dft(m_inv_plan, buf, buf);
+    //overlap add
+    for (i=0; i<m_overlap_size; i++)
+    {
+        buf[i][0]       += m_overlap[i][0];
+        buf[i][1]       += m_overlap[i][1];
+        m_overlap[i][0]  = buf[m_blk_size + i][0];
+        m_overlap[i][1]  = buf[m_blk_size + i][1];
+    }
+}
+
+
+blkconv_c::~blkconv_c()
+{
+    free(m_overlap);
+    fftwf_free(m_data_buf);
+    fftwf_free(m_fft_taps);
 
+    fft_plan::release(m_plan);
+    fft_plan::release(m_inv_plan);
 }
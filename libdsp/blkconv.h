@@ -30,6 +30,7 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef BLK_CONV_H_
 #define BLK_CONV_H_
 
+#include <complex>
 #include <fftw3.h>
 
 class blkconv
@@ -45,6 +46,11 @@ public:
     {
         return (float*)m_data_buf;
     }
+    /* false if fftwf had no plan for the length, process() puts out 0 */
+    bool is_valid()
+    {
+        return m_plan && m_inv_plan;
+    }
     void process();
 private:
 
@@ -62,4 +68,44 @@ private:
 };
 
 
+/* blkconv on interleaved I/Q, one c2c transform a block filters both 
+ * of them. the taps are real, or complex for a filter that is not 
+ * symmetric around DC */
+class blkconv_c
+{
+public: 
+    blkconv_c(float *taps, int n_taps, int fft_len);
+    blkconv_c(std::complex<float> *taps, int n_taps, int fft_len);
+    ~blkconv_c();
+    int get_blksize()
+    {
+        return m_blk_size;
+    }
+    std::complex<float>* get_process_buf()
+    {
+        return (std::complex<float>*)m_data_buf;
+    }
+    /* false if fftwf had no plan for the length, process() puts out 0 */
+    bool is_valid()
+    {
+        return m_plan && m_inv_plan;
+    }
+    void process();
+private:
+    void init(const std::complex<float> *taps, int n_taps, int fft_len);
+
+    fftwf_plan      m_plan;
+    fftwf_plan      m_inv_plan;
+    
+    fftwf_complex  *m_fft_taps;
+    fftwf_complex  *m_data_buf;
+    fftwf_complex  *m_overlap;
+    float           m_scaling;
+    
+    int             m_fft_len;
+    int             m_blk_size;
+    int             m_overlap_size;
+};
+
+
 #endif
@@ -31,111 +31,316 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include "decimate.h"
+#include "dotprod.h"
 #include <math.h>
 #include <assert.h>
 
-decimate::decimate(float *taps, int n_taps, int upsample, int blksize)
-  : m_up_ratio(upsample), m_n_taps(n_taps), m_blksize(blksize)
-  , m_pos(0), m_in(NULL), m_mu(0.0f), m_last_remain(0.0f), m_is_leftover(false)
+/* 15 tap half band, kaiser beta 7, the odd taps right of the centre. 
+ * 2e-4 ripple up to 1/16 of the input rate, 74dB down from 7/16 on */
+#define HB_LEN 15
+static const float hb_taps[4] = {0.297802339f, -0.0569304365f, 0.00939776838f, -0.000269671192f};
+
+/* one half band stage, line has HB_LEN-1 old samples of stride floats 
+ * and room for the block. every other input from odd on makes an output */
+static inline int halfband_run(float *line, int &odd, const float *in, int n_in,
+                               int stride, float *out)
 {
+  int n_out = 0;
 
-  if (m_n_taps%2 == 0){
-    m_n_taps++;
+  memcpy(&line[(HB_LEN-1)*stride], in, sizeof(float)*n_in*stride);
+  for (int i=odd; i<n_in; i+=2){
+    for (int k=0; k<stride; k++){
+      const float *c = &line[(i + HB_LEN/2)*stride + k];
+      out[n_out++] = 0.5f * c[0] +
+        hb_taps[0] * (c[-stride] + c[stride]) + hb_taps[1] * (c[-3*stride] + c[3*stride]) +
+        hb_taps[2] * (c[-5*stride] + c[5*stride]) + hb_taps[3] * (c[-7*stride] + c[7*stride]);
+    }
   }
-  m_taps = new float[m_n_taps];
-  for (int i=0; i<n_taps; i++){
-    m_taps[i] = taps[i];
+  odd = (odd + n_in) & 1;
+  memmove(&line[0], &line[n_in*stride], sizeof(float)*(HB_LEN-1)*stride);
+  return n_out / stride;
+}
+
+
+/* the block goes in twice, nothing already in the ring moves */
+static inline void ring_write(float *ring, int ring_len, int wr, const float *in, int n_in,
+                              int stride)
+{
+  int n0 = ring_len - wr;
+
+  n0 = n0 < n_in ? n0 : n_in;
+  memcpy(&ring[wr*stride], in, sizeof(float)*n0*stride);
+  memcpy(&ring[(wr + ring_len)*stride], in, sizeof(float)*n0*stride);
+  if (n0 < n_in){
+    memcpy(&ring[0], &in[n0*stride], sizeof(float)*(n_in - n0)*stride);
+    memcpy(&ring[ring_len*stride], &in[n0*stride], sizeof(float)*(n_in - n0)*stride);
+  }
+}
+
+
+static bool check_args(int n_in, int blksize, int out_len, float rate, int n_hb)
+{
+  if (rate < 1.0){
+    printf("rate should be larger than 1.0\n");
+    return false;
   }
-  if (n_taps < m_n_taps){
-    m_taps[n_taps] = 0.0f;
+  if (n_in > blksize){
+    printf("number of samples should be less than blksize\n");
+    return false;
   }
+  if (rate < 4.0f * (1 << n_hb) && n_hb > 0){
+    printf("rate should be at least 4 after the half bands\n");
+    return false;
+  }
+  if (out_len < floorf(n_in*1.0f/rate)){
+    printf("output buffer is not large enough");
+    return false;
+  }
+  return true;
+}
+
+
+/* the input and phase of upsampled point pos */
+static inline int split(int pos, int upsample, int *phase)
+{
+  int n = pos >= 0 ? pos / upsample : -((upsample - 1 - pos) / upsample);
 
-  m_len = m_n_taps + m_blksize;
-  m_history = new float[m_len];
-  for (int i=0; i<m_len; i++){
-    m_history[i] = 0.0f;
+  *phase = pos - n * upsample;
+  return n;
+}
+
+
+decimate::decimate(float *taps, int n_taps, int upsample, int blksize, int halfbands)
+  : m_up_ratio(upsample), m_wr(0), m_blksize(blksize), m_t(0.0), m_n_hb(halfbands)
+{
+
+  m_phase_len = (n_taps + m_up_ratio - 1) / m_up_ratio;
+  m_phase_len = (m_phase_len + 3) & ~3;
+  m_taps = dotprod_alloc(m_up_ratio * m_phase_len);
+  for (int j=0; j<m_up_ratio; j++){
+    for (int i=0; i<m_phase_len; i++){
+      int n = i*m_up_ratio + j;
+      m_taps[j*m_phase_len + m_phase_len-1 - i] = n < n_taps ? taps[n] : 0.0f;
+    }
   }
 
+  /* an output can be left over from the previous block */
+  m_hist_len = m_phase_len + 2;
+  m_ring_len = m_hist_len + m_blksize;
+  m_ring = dotprod_alloc(2 * m_ring_len);
+  for (int i=0; i<2*m_ring_len; i++){
+    m_ring[i] = 0.0f;
+  }
+
+  m_hb_line = new float[m_n_hb * (HB_LEN-1 + m_blksize) + 1];
+  m_hb_odd = new int[m_n_hb + 1];
+  m_hb_out = new float[m_blksize/2 + 1];
+  for (int i=0; i<m_n_hb * (HB_LEN-1 + m_blksize); i++){
+    m_hb_line[i] = 0.0f;
+  }
+  for (int i=0; i<m_n_hb; i++){
+    m_hb_odd[i] = 0;
+  }
 }
 
 
 decimate::~decimate()
 {
-  delete[] m_taps;
-  delete[] m_history;
+  dotprod_free(m_taps);
+  dotprod_free(m_ring);
+  delete[] m_hb_line;
+  delete[] m_hb_odd;
+  delete[] m_hb_out;
+}
+
+
+/* one half band stage into m_hb_out */
+int decimate::halfband(int stage, const float *in, int n_in)
+{
+  return halfband_run(&m_hb_line[stage * (HB_LEN-1 + m_blksize)], m_hb_odd[stage],
+                      in, n_in, 1, m_hb_out);
+}
+
+
+void decimate::write_ring(const float *in, int n_in)
+{
+  ring_write(m_ring, m_ring_len, m_wr, in, n_in, 1);
 }
 
 
 int decimate::process(float* in, int n_in, float* out, int out_len, float rate)
 {
-    //fitler for each polyphase and store them;
     int n_out = 0;
-    float t = m_pos + m_mu; //current time
+    int end;
+    double step, first;
 
-    if (rate < 1.0){
-        printf("rate should be larger than 1.0\n");
+    if (!check_args(n_in, m_blksize, out_len, rate, m_n_hb)){
         return 0;
     }
-    if (n_in > m_blksize){
-        printf("number of samples should be less than blksize\n");
-        return 0;
-    }
-	
-    if (out_len < floorf(n_in*1.0f/rate)){
-        printf("output buffer is not large enough");
-        return 0;
-    }            
 
-    memcpy(&m_history[0], &m_history[n_in], sizeof(float)*(m_len - n_in));
-    memcpy(&m_history[m_len - n_in], in, sizeof(float)*n_in);
-    m_in = &m_history[m_len - n_in];
-    
-    //get the output
-    // beacuse rate > 1/upsample, there can only be a sample use the old
-    // remaining
-    if (m_is_leftover){
-      out[n_out++] = m_last_remain * (1.0f-m_mu) + m_mu*get_sample(0, 0);
-      m_is_leftover = false;
-      t += rate * m_up_ratio;
+    for (int s=0; s<m_n_hb; s++){
+        n_in = halfband(s, in, n_in);
+        in = m_hb_out;
     }
-        
-    while(1)
-    {
-        int phase0, phase1, n0, n1, pos1;
-        
-        m_pos = (int)floorf(t);
-        m_mu = t - m_pos;
-        pos1 = m_pos + 1;
+    write_ring(in, n_in);
 
-        phase0 = m_pos % m_up_ratio;
-        phase1 = pos1 % m_up_ratio;
-        n0 = m_pos / m_up_ratio;
-        n1 = pos1 / m_up_ratio;
+    //only the two points around each output are filtered
+    end = n_in * m_up_ratio;
+    step = (double)rate / (1 << m_n_hb) * m_up_ratio;
+    first = (m_phase_len - 1 - m_hist_len) * m_up_ratio + 1;
+    if (m_t < first){
+        /* the output buffer was short, what did not fit is lost */
+        m_t = first;
+    }
+    while (n_out < out_len){
+        int pos = (int)floor(m_t);
+        int n0, n1, phase0, phase1;
+        float mu;
 
-        if (n0 >= n_in || n_out >= out_len){
-            break;
-        }
-        else if (n1 >= n_in){
-            m_is_leftover = true;
-            m_last_remain = get_sample(phase0,n0);
+        if (pos + 1 >= end){
             break;
         }
-        out[n_out++] = get_sample(phase0,n0) * (1.0f-m_mu) + m_mu*get_sample(phase1,n1);
-        t += rate * m_up_ratio;
+        mu = (float)(m_t - pos);
+        n0 = split(pos, m_up_ratio, &phase0);
+        n1 = split(pos + 1, m_up_ratio, &phase1);
+
+        out[n_out++] = get_sample(phase0, n0) * (1.0f-mu) + mu*get_sample(phase1, n1);
+        m_t += step;
     }
 
-    m_pos -= n_in * m_up_ratio;
+    m_t -= end;
+    m_wr = (m_wr + n_in) % m_ring_len;
     return n_out;
 }
         
         
+/* the filter phase at input n of the block, n < 0 is in the history */
 float decimate::get_sample(int phase, int n)
 {
-  float accu = 0.0f;
-  for(int m=phase, j=0; m<m_n_taps; m += m_up_ratio, j++){
-    accu += m_taps[m] * m_in[n - j];
+  int i = (m_wr + n - (m_phase_len - 1)) % m_ring_len;
+
+  if (i < 0){
+    i += m_ring_len;
   }
+  return dotprod(&m_taps[phase * m_phase_len], &m_ring[i], m_phase_len);
+}
 
-  return accu;
+
+decimate_c::decimate_c(float *taps, int n_taps, int upsample, int blksize, int halfbands)
+  : m_up_ratio(upsample), m_wr(0), m_blksize(blksize), m_t(0.0), m_n_hb(halfbands)
+{
+  std::complex<float> *c = new std::complex<float>[n_taps];
+
+  for (int i=0; i<n_taps; i++){
+    c[i] = taps[i];
+  }
+  init(c, n_taps, true);
+  delete[] c;
+}
+
+
+decimate_c::decimate_c(std::complex<float> *taps, int n_taps, int upsample, int blksize, int halfbands)
+  : m_up_ratio(upsample), m_wr(0), m_blksize(blksize), m_t(0.0), m_n_hb(halfbands)
+{
+  init(taps, n_taps, false);
+}
+
+
+void decimate_c::init(const std::complex<float> *taps, int n_taps, bool real)
+{
+  m_phase_len = (n_taps + m_up_ratio - 1) / m_up_ratio;
+  m_phase_len = (m_phase_len + 3) & ~3;
+  dotprod_c_phases(taps, n_taps, real, m_up_ratio, m_phase_len, &m_taps_re, &m_taps_im);
+
+  m_hist_len = m_phase_len + 2;
+  m_ring_len = m_hist_len + m_blksize;
+  m_ring = dotprod_alloc(4 * m_ring_len);
+  for (int i=0; i<4*m_ring_len; i++){
+    m_ring[i] = 0.0f;
+  }
+
+  m_hb_line = new float[2 * m_n_hb * (HB_LEN-1 + m_blksize) + 1];
+  m_hb_odd = new int[m_n_hb + 1];
+  m_hb_out = new float[2 * (m_blksize/2 + 1)];
+  for (int i=0; i<2 * m_n_hb * (HB_LEN-1 + m_blksize); i++){
+    m_hb_line[i] = 0.0f;
+  }
+  for (int i=0; i<m_n_hb; i++){
+    m_hb_odd[i] = 0;
+  }
+}
+
+
+decimate_c::~decimate_c()
+{
+  dotprod_free(m_taps_re);
+  dotprod_free(m_taps_im);
+  dotprod_free(m_ring);
+  delete[] m_hb_line;
+  delete[] m_hb_odd;
+  delete[] m_hb_out;
+}
+
+
+int decimate_c::process(std::complex<float>* in, int n_in, std::complex<float>* out, int out_len, float rate)
+{
+    const float *x = (const float*)in;
+    float *y = (float*)out;
+    int n_out = 0;
+    int end;
+    double step, first;
+
+    if (!check_args(n_in, m_blksize, out_len, rate, m_n_hb)){
+        return 0;
+    }
+
+    for (int s=0; s<m_n_hb; s++){
+        n_in = halfband_run(&m_hb_line[2 * s * (HB_LEN-1 + m_blksize)], m_hb_odd[s],
+                            x, n_in, 2, m_hb_out);
+        x = m_hb_out;
+    }
+    ring_write(m_ring, m_ring_len, m_wr, x, n_in, 2);
+
+    end = n_in * m_up_ratio;
+    step = (double)rate / (1 << m_n_hb) * m_up_ratio;
+    first = (m_phase_len - 1 - m_hist_len) * m_up_ratio + 1;
+    if (m_t < first){
+        m_t = first;
+    }
+    while (n_out < out_len){
+        int pos = (int)floor(m_t);
+        int n0, n1, phase0, phase1;
+        float mu, y0[2], y1[2];
+
+        if (pos + 1 >= end){
+            break;
+        }
+        mu = (float)(m_t - pos);
+        n0 = split(pos, m_up_ratio, &phase0);
+        n1 = split(pos + 1, m_up_ratio, &phase1);
+
+        get_sample(phase0, n0, y0);
+        get_sample(phase1, n1, y1);
+        y[2*n_out] = y0[0] * (1.0f-mu) + mu*y1[0];
+        y[2*n_out+1] = y0[1] * (1.0f-mu) + mu*y1[1];
+        n_out++;
+        m_t += step;
+    }
+
+    m_t -= end;
+    m_wr = (m_wr + n_in) % m_ring_len;
+    return n_out;
+}
+
+
+/* re,im into y */
+void decimate_c::get_sample(int phase, int n, float *y)
+{
+  int i = (m_wr + n - (m_phase_len - 1)) % m_ring_len;
+  int k = phase * m_phase_len;
+
+  if (i < 0){
+    i += m_ring_len;
+  }
+  dotprod_c(&m_taps_re[k], m_taps_im ? &m_taps_im[k] : NULL, &m_ring[2*i], m_phase_len, y);
 }
-        
@@ -30,12 +30,18 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef DECIMATE_H_
 #define DECIMATE_H_
 
+#include <complex>
+
 class decimate
 {
 public:
   /* taps and n_taps defines the interpolation filter
-   * upsample defines the interpolation ratio */
-  decimate(float *taps, int n_taps, int upsample, int blksize);
+   * upsample defines the interpolation ratio 
+   * halfbands decimates by 2 that many times first, the filter is then
+   * for the input rate divided by 2^halfbands. each half band keeps 
+   * 1/16 of its input rate flat and the output needs less than that, 
+   * the rate left after them has to be 4 or more */
+  decimate(float *taps, int n_taps, int upsample, int blksize, int halfbands = 0);
   ~decimate();
 
   /* given a rate of "how many" input samples (step size, like 10.52) to 
@@ -45,22 +51,68 @@ public:
    */
   int process(float* in, int n_in, float *out, int out_len, float rate);
  private:
+  /* phase j reversed at j*m_phase_len, zero padded to a multiple of 4 */
   float          *m_taps;
-  int             m_n_taps;
-  float          *m_history;
+  int             m_phase_len;
   int             m_up_ratio;
-  float          *m_in;
+  /* the delay line as a ring, every sample is at i and i + m_ring_len
+   * so that m_phase_len of them in a row are always contiguous */
+  float          *m_ring;
+  int             m_ring_len;
+  int             m_hist_len;
+  int             m_wr;
 
   int             m_blksize;
-  int             m_len;
-  int             m_pos;
-  float           m_mu;
-  float           m_last_remain;
-  bool            m_is_leftover;
+  /* the next output on the upsampled grid, from the block start */
+  double          m_t;
+
+  /* the half band stages, each HB_LEN-1 old samples then the block */
+  int             m_n_hb;
+  float          *m_hb_line;
+  int            *m_hb_odd;
+  float          *m_hb_out;
 
-  
+  int   halfband(int stage, const float *in, int n_in);
+  void  write_ring(const float *in, int n_in);
   float get_sample(int phase, int n);
 };
 
 
+/* decimate on interleaved I/Q, the half bands and the polyphase stage 
+ * as in decimate. the taps are real, or complex for a filter that is 
+ * not symmetric around DC */
+class decimate_c
+{
+public:
+  decimate_c(float *taps, int n_taps, int upsample, int blksize, int halfbands = 0);
+  decimate_c(std::complex<float> *taps, int n_taps, int upsample, int blksize, int halfbands = 0);
+  ~decimate_c();
+
+  /* as decimate::process, n_in and out_len count complex samples */
+  int process(std::complex<float>* in, int n_in, std::complex<float> *out, int out_len, float rate);
+ private:
+  /* see dotprod_c_phases, m_taps_im is NULL for real taps */
+  float          *m_taps_re;
+  float          *m_taps_im;
+  int             m_phase_len;
+  int             m_up_ratio;
+  /* as in decimate, m_ring_len complex samples twice, re,im interleaved */
+  float          *m_ring;
+  int             m_ring_len;
+  int             m_hist_len;
+  int             m_wr;
+
+  int             m_blksize;
+  double          m_t;
+
+  int             m_n_hb;
+  float          *m_hb_line;
+  int            *m_hb_odd;
+  float          *m_hb_out;
+
+  void init(const std::complex<float> *taps, int n_taps, bool real);
+  void get_sample(int phase, int n, float *y);
+};
+
+
 #endif
@@ -0,0 +1,227 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DOTPROD_H_
+#define DOTPROD_H_
+
+#include <stdlib.h>
+#include <complex>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define DOTPROD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DOTPROD_NEON
+#endif
+
+/* sum of a[i]*b[i], n a multiple of 4, no alignment needed. two 
+ * accumulators keep the adds of one out of the way of the other */
+static inline float dotprod(const float *a, const float *b, int n)
+{
+#if defined(DOTPROD_SSE)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    int i = 0;
+
+    for (; i+8<=n; i+=8){
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+    }
+    if (i < n){
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+#elif defined(DOTPROD_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x2_t s;
+    int i = 0;
+
+    for (; i+8<=n; i+=8){
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a+i), vld1q_f32(b+i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a+i+4), vld1q_f32(b+i+4));
+    }
+    if (i < n){
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a+i), vld1q_f32(b+i));
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    s = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+#else
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+
+    for (int i=0; i<n; i+=4){
+        s0 += a[i] * b[i];
+        s1 += a[i+1] * b[i+1];
+        s2 += a[i+2] * b[i+2];
+        s3 += a[i+3] * b[i+3];
+    }
+    return (s0 + s1) + (s2 + s3);
+#endif
+}
+
+
+/* tap arrays, aligned for the vector loads */
+static inline float* dotprod_alloc(int n)
+{
+    void *p = NULL;
+#ifdef _MSC_VER
+    p = _aligned_malloc(n * sizeof(float), 32);
+#else
+    if (posix_memalign(&p, 32, n * sizeof(float))){
+        p = NULL;
+    }
+#endif
+    return (float*)p;
+}
+
+static inline void dotprod_free(float *p)
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+
+/* sum of taps[i]*x[i] over n complex samples interleaved as re,im into 
+ * y[0], y[1], n a multiple of 4. re and im are the parts of the taps, laid out as for 
+ * dotprod, im is NULL when the taps are real. each tap is widened to 
+ * both lanes of its sample in registers, so real taps are read once for 
+ * I and Q and take the same room as for dotprod */
+static inline void dotprod_c(const float *re, const float *im, const float *x, int n, float *y)
+{
+#if defined(DOTPROD_SSE)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps();
+    __m128 acc3 = _mm_setzero_ps();
+
+    for (int i=0; i<n; i+=4){
+        __m128 t = _mm_loadu_ps(re+i);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_unpacklo_ps(t, t), _mm_loadu_ps(x+2*i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_unpackhi_ps(t, t), _mm_loadu_ps(x+2*i+4)));
+    }
+    if (im){
+        for (int i=0; i<n; i+=4){
+            __m128 t = _mm_loadu_ps(im+i);
+            __m128 d0 = _mm_loadu_ps(x+2*i);
+            __m128 d1 = _mm_loadu_ps(x+2*i+4);
+            d0 = _mm_shuffle_ps(d0, d0, _MM_SHUFFLE(2,3,0,1));
+            d1 = _mm_shuffle_ps(d1, d1, _MM_SHUFFLE(2,3,0,1));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_unpacklo_ps(t, t), d0));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_unpackhi_ps(t, t), d1));
+        }
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc2 = _mm_add_ps(acc2, acc3);
+    acc2 = _mm_add_ps(acc2, _mm_movehl_ps(acc2, acc2));
+    /* im*Q takes away from the real part, im*I adds to the imaginary */
+    y[0] = _mm_cvtss_f32(acc0) - _mm_cvtss_f32(acc2);
+    y[1] = _mm_cvtss_f32(_mm_shuffle_ps(acc0, acc0, 1)) + _mm_cvtss_f32(_mm_shuffle_ps(acc2, acc2, 1));
+#elif defined(DOTPROD_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    float32x2_t s, u;
+
+    for (int i=0; i<n; i+=4){
+        float32x4x2_t t = vzipq_f32(vld1q_f32(re+i), vld1q_f32(re+i));
+        acc0 = vmlaq_f32(acc0, t.val[0], vld1q_f32(x+2*i));
+        acc1 = vmlaq_f32(acc1, t.val[1], vld1q_f32(x+2*i+4));
+    }
+    if (im){
+        for (int i=0; i<n; i+=4){
+            float32x4x2_t t = vzipq_f32(vld1q_f32(im+i), vld1q_f32(im+i));
+            acc2 = vmlaq_f32(acc2, t.val[0], vrev64q_f32(vld1q_f32(x+2*i)));
+            acc3 = vmlaq_f32(acc3, t.val[1], vrev64q_f32(vld1q_f32(x+2*i+4)));
+        }
+    }
+    acc0 = vaddq_f32(acc0, acc1);
+    s = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+    acc2 = vaddq_f32(acc2, acc3);
+    u = vadd_f32(vget_low_f32(acc2), vget_high_f32(acc2));
+    y[0] = vget_lane_f32(s, 0) - vget_lane_f32(u, 0);
+    y[1] = vget_lane_f32(s, 1) + vget_lane_f32(u, 1);
+#else
+    float r0 = 0.0f, i0 = 0.0f, r1 = 0.0f, i1 = 0.0f;
+
+    for (int i=0; i<n; i+=2){
+        r0 += re[i] * x[2*i];
+        i0 += re[i] * x[2*i+1];
+        r1 += re[i+1] * x[2*i+2];
+        i1 += re[i+1] * x[2*i+3];
+    }
+    if (im){
+        for (int i=0; i<n; i+=2){
+            r0 -= im[i] * x[2*i+1];
+            i0 += im[i] * x[2*i];
+            r1 -= im[i+1] * x[2*i+3];
+            i1 += im[i+1] * x[2*i+2];
+        }
+    }
+    y[0] = r0 + r1;
+    y[1] = i0 + i1;
+#endif
+}
+
+
+/* polyphase taps for dotprod_c, phase j of upsample reversed and zero 
+ * padded to phase_len at j*phase_len of re and im. re and im are 
+ * dotprod_alloc'ed here, im is left NULL when real is set */
+static inline void dotprod_c_phases(const std::complex<float> *taps, int n_taps, bool real,
+                                    int upsample, int phase_len, float **re, float **im)
+{
+    *re = dotprod_alloc(upsample * phase_len);
+    *im = real ? NULL : dotprod_alloc(upsample * phase_len);
+    for (int j=0; j<upsample; j++){
+        for (int i=0; i<phase_len; i++){
+            int n = i*upsample + j;
+            int k = j*phase_len + phase_len-1 - i;
+            std::complex<float> t = n < n_taps ? taps[n] : 0.0f;
+
+            (*re)[k] = t.real();
+            if (*im){
+                (*im)[k] = t.imag();
+            }
+        }
+    }
+}
+
+#endif
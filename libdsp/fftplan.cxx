@@ -0,0 +1,226 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "fftplan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+struct plan_entry
+{
+    int         kind;
+    int         n;
+    int         rigor;
+    fftwf_plan  plan;
+    int         refs;
+};
+
+struct plan_state
+{
+    /* fftwf planning is not thread safe, execution is */
+    std::mutex               lock;
+    std::vector<plan_entry>  plans;
+    int                      rigor;
+    unsigned                 flags;
+    char                    *wisdom_file;
+    /* planned with more than ESTIMATE since the wisdom was loaded */
+    bool                     new_wisdom;
+    bool                     at_exit;
+    int                      n_threads;
+    int                      threads_min_len;
+    bool                     threads_ok;
+
+    plan_state()
+        : rigor(fft_plan::ESTIMATE), flags(FFTW_ESTIMATE), wisdom_file(NULL), new_wisdom(false), at_exit(false),
+          n_threads(1), threads_min_len(1 << 15), threads_ok(false)
+    {
+    }
+};
+
+/* made on first use, a filter can be a static of another file */
+static plan_state& state()
+{
+    static plan_state s;
+    return s;
+}
+
+static int export_wisdom(plan_state &s)
+{
+    if (!s.wisdom_file || !s.new_wisdom){
+        return 0;
+    }
+    if (!fftwf_export_wisdom_to_filename(s.wisdom_file)){
+        fprintf(stderr, "can not write fftw wisdom to %s\n", s.wisdom_file);
+        return -1;
+    }
+    s.new_wisdom = false;
+    return 0;
+}
+
+static void save_at_exit()
+{
+    plan_state &s = state();
+    std::lock_guard<std::mutex> g(s.lock);
+
+    export_wisdom(s);
+}
+
+
+int fft_plan::setup(int rigor, const char *wisdom_file, int n_threads, int threads_min_len)
+{
+    static const unsigned flags[] = {FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT};
+    plan_state &s = state();
+    std::lock_guard<std::mutex> g(s.lock);
+    int ret = 0;
+
+    s.rigor = rigor < ESTIMATE ? ESTIMATE : rigor > PATIENT ? PATIENT : rigor;
+    s.flags = flags[s.rigor];
+    s.threads_min_len = threads_min_len;
+    s.n_threads = n_threads > 1 ? n_threads : 1;
+#ifdef LIBDSP_FFTW_THREADS
+    if (s.n_threads > 1 && !s.threads_ok){
+        s.threads_ok = fftwf_init_threads() != 0;
+        if (!s.threads_ok){
+            fprintf(stderr, "fftwf threads did not start, planning single threaded\n");
+        }
+    }
+#else
+    if (s.n_threads > 1){
+        fprintf(stderr, "libdsp is built without fftwf threads\n");
+    }
+#endif
+
+    if (wisdom_file && (!s.wisdom_file || strcmp(wisdom_file, s.wisdom_file))){
+        FILE *fp;
+
+        export_wisdom(s);
+        free(s.wisdom_file);
+        s.wisdom_file = strdup(wisdom_file);
+        /* not there yet is the first run */
+        fp = fopen(wisdom_file, "r");
+        if (fp){
+            fclose(fp);
+            if (!fftwf_import_wisdom_from_filename(wisdom_file)){
+                fprintf(stderr, "fftw wisdom in %s is not readable, planning anew\n", wisdom_file);
+                ret = -1;
+            }
+        }
+        if (!s.at_exit){
+            s.at_exit = atexit(save_at_exit) == 0;
+        }
+    }
+    return ret;
+}
+
+
+fftwf_plan fft_plan::get(int kind, int n)
+{
+    plan_state &s = state();
+    std::lock_guard<std::mutex> g(s.lock);
+    fftwf_complex *buf;
+    plan_entry e;
+
+    for (size_t i=0; i<s.plans.size(); i++){
+        if (s.plans[i].kind == kind && s.plans[i].n == n && s.plans[i].rigor >= s.rigor){
+            s.plans[i].refs++;
+            return s.plans[i].plan;
+        }
+    }
+
+    /* planning past ESTIMATE writes over the buffers */
+    buf = (fftwf_complex*)fftwf_malloc((kind >= C2C_FORWARD ? n : n/2 + 1) * sizeof(fftwf_complex));
+    if (!buf){
+        return NULL;
+    }
+#ifdef LIBDSP_FFTW_THREADS
+    if (s.threads_ok){
+        fftwf_plan_with_nthreads(n >= s.threads_min_len ? s.n_threads : 1);
+    }
+#endif
+    switch (kind){
+    case R2C:
+        e.plan = fftwf_plan_dft_r2c_1d(n, (float*)buf, buf, s.flags);
+        break;
+    case C2R:
+        e.plan = fftwf_plan_dft_c2r_1d(n, buf, (float*)buf, s.flags);
+        break;
+    case C2C_FORWARD:
+    case C2C_BACKWARD:
+        e.plan = fftwf_plan_dft_1d(n, buf, buf, kind == C2C_FORWARD ? FFTW_FORWARD : FFTW_BACKWARD,
+                                   s.flags);
+        break;
+    default:
+        e.plan = NULL;
+        break;
+    }
+    fftwf_free(buf);
+    if (!e.plan){
+        fprintf(stderr, "no fftw plan for %d points\n", n);
+        return NULL;
+    }
+
+    e.kind = kind;
+    e.n = n;
+    e.rigor = s.rigor;
+    e.refs = 1;
+    s.plans.push_back(e);
+    if (s.flags != FFTW_ESTIMATE){
+        s.new_wisdom = true;
+    }
+    return e.plan;
+}
+
+
+void fft_plan::release(fftwf_plan plan)
+{
+    plan_state &s = state();
+    std::lock_guard<std::mutex> g(s.lock);
+
+    for (size_t i=0; i<s.plans.size(); i++){
+        if (s.plans[i].plan == plan){
+            /* the wisdom stays, planning the same again is quick */
+            if (--s.plans[i].refs == 0){
+                fftwf_destroy_plan(plan);
+                s.plans.erase(s.plans.begin() + i);
+            }
+            return;
+        }
+    }
+}
+
+
+int fft_plan::save_wisdom()
+{
+    plan_state &s = state();
+    std::lock_guard<std::mutex> g(s.lock);
+
+    return export_wisdom(s);
+}
@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FFT_PLAN_H_
+#define FFT_PLAN_H_
+
+#include <fftw3.h>
+
+/* the fftwf plans of the process. there is one plan of each kind and 
+ * length, shared by all the filters using it, so it is planned once with
+ * as much rigor as asked for. one planned with less rigor than asked 
+ * for now is not handed out, a new one is planned next to it. plans are
+ * made in place on buffers of their own, the filters run them on theirs 
+ * with fftwf_execute_dft*(), which have to be in place as well and come 
+ * from fftwf_malloc */
+class fft_plan
+{
+public:
+    enum { R2C = 0, C2R = 1, C2C_FORWARD = 2, C2C_BACKWARD = 3 };
+    enum { ESTIMATE = 0, MEASURE = 1, PATIENT = 2 };
+
+    /* rigor is for the plans made from now on. wisdom_file, if not NULL,
+     * is loaded now and saved at exit. transforms of threads_min_len 
+     * points or more use n_threads threads, if libdsp has fftwf threads.
+     * returns 0, -1 if the wisdom file is there but could not be read */
+    static int setup(int rigor, const char *wisdom_file, int n_threads = 1,
+                     int threads_min_len = 1 << 15);
+
+    /* the plan for n points, NULL if fftwf could not make one. each get()
+     * is paired with a release() */
+    static fftwf_plan get(int kind, int n);
+    static void release(fftwf_plan plan);
+
+    /* what was planned with MEASURE or PATIENT to the wisdom file, if
+     * there is one, returns 0 or -1 */
+    static int save_wisdom();
+};
+
+
+#endif
@@ -0,0 +1,269 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MIRROR_RINGBUF_H_
+#define MIRROR_RINGBUF_H_
+
+#include "spsc_ringbuf.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+/* spsc_ring_buffer whose storage is mapped twice back to back, so 
+ * m_buf[i] and m_buf[i + capacity] are the same memory and any span of up
+ * to capacity items starting anywhere in the ring is contiguous.
+ *
+ * read() hands conv one span instead of splitting it at the wrap point, 
+ * which keeps frame based converters such as the 4 samples / 5 bytes DAC
+ * packing aligned. reserve()/commit() and peek()/consume() let the 
+ * producer fill and the consumer drain the ring in place.
+ *
+ * The capacity is rounded up until it covers whole pages. Where the 
+ * double mapping is not available (non Linux, or memfd/mmap failed) it 
+ * falls back to a plain buffer: read()/write() split as before and 
+ * reserve()/peek() fail for spans that cross the end, see is_mirrored().
+ * T must be trivially copyable.
+ */
+template <class T>
+class mirror_ring_buffer : public spsc_ring_buffer<T>
+{
+    typedef spsc_ring_buffer<T> base;
+
+public:
+    mirror_ring_buffer()
+        : m_mirrored(false), m_map_size(0)
+    {
+    }
+
+    mirror_ring_buffer(int capacity)
+        : m_mirrored(false), m_map_size(0)
+    {
+        alloc_buffer(capacity);
+    }
+
+    virtual ~mirror_ring_buffer()
+    {
+        release();
+    }
+
+    /* not thread safe, call before streaming starts */
+    virtual void alloc_buffer(int capacity)
+    {
+        release();
+        if (!map_mirror(capacity)){
+            base::alloc_buffer(capacity);
+        }
+    }
+
+    bool is_mirrored()
+    {
+        return m_mirrored;
+    }
+
+    /* producer side, pointer to len contiguous free items or NULL if 
+       there is not enough room. nothing is visible before commit() */
+    T* reserve(int len)
+    {
+        unsigned wr = this->m_wr.load(std::memory_order_relaxed);
+        unsigned pos = wr & this->m_mask;
+
+        if (len > (int)(this->m_bufsize - (wr - this->m_rd_cache))){
+            this->m_rd_cache = this->m_rd.load(std::memory_order_acquire);
+            if (len > (int)(this->m_bufsize - (wr - this->m_rd_cache))){
+                return NULL;
+            }
+        }
+        if (!m_mirrored && pos + len > this->m_bufsize){
+            return NULL;
+        }
+        return &this->m_buf[pos];
+    }
+
+    /* publish len items filled through reserve() */
+    void commit(int len, bool wake = true)
+    {
+        unsigned wr = this->m_wr.load(std::memory_order_relaxed);
+        this->m_wr.store(wr + len, std::memory_order_release);
+        if (wake){
+            this->notify();
+        }
+    }
+
+    /* consumer side, pointer to len contiguous readable items or NULL if 
+       fewer than len are there. they stay valid until consume() */
+    T* peek(int len)
+    {
+        unsigned rd = this->m_rd.load(std::memory_order_relaxed);
+        unsigned pos = rd & this->m_mask;
+        
+        if (len > (int)(this->m_wr_cache - rd)){
+            this->m_wr_cache = this->m_wr.load(std::memory_order_acquire);
+            if (len > (int)(this->m_wr_cache - rd)){
+                return NULL;
+            }
+        }
+        if (!m_mirrored && pos + len > this->m_bufsize){
+            return NULL;
+        }
+        return &this->m_buf[pos];
+    }
+
+    /* give len items obtained through peek() back to the producer */
+    void consume(int len)
+    {
+        unsigned rd = this->m_rd.load(std::memory_order_relaxed);
+        this->m_rd.store(rd + len, std::memory_order_release);
+        this->notify();
+    }
+
+    int write(const T* data, int len, bool wake = true)
+    {
+        T* p;
+        
+        if (!m_mirrored){
+            return base::write(data, len, wake);
+        }
+        p = reserve(len);
+        if (!p){
+            return 0;
+        }
+        memcpy(p, data, len*sizeof(T));
+        commit(len, wake);
+        return len;
+    }
+
+    /* same contract as spsc_ring_buffer::read, but conv is called once */
+    int read(void* dst, unsigned dst_len,
+             int (*conv)(void* dst, void *src, int src_len),
+             int (*calc_src_len)(int dst_len)
+             )
+    {
+        int src_len;
+        T* p;
+        
+        if (!m_mirrored){
+            return base::read(dst, dst_len, conv, calc_src_len);
+        }
+        if (!conv || !calc_src_len){
+            return 0;
+        }
+        
+        src_len = calc_src_len(dst_len);
+        p = peek(src_len);
+        if (!p){
+            return 0;
+        }
+        conv(dst, p, src_len);
+        consume(src_len);
+        return src_len;
+    }
+
+private:
+    bool    m_mirrored;
+    size_t  m_map_size;
+
+    void release()
+    {
+#ifdef __linux__
+        if (m_mirrored){
+            munmap(this->m_buf, 2*m_map_size);
+            /* keep the base destructor off it */
+            this->m_buf = NULL;
+            m_mirrored = false;
+            m_map_size = 0;
+        }
+#endif
+    }
+
+#ifdef __linux__
+    bool map_mirror(int capacity)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        unsigned n = base::round_capacity(capacity);
+        size_t bytes = n*sizeof(T);
+        char *addr;
+        int fd = -1;
+
+        /* a power of two item count reaches a page multiple eventually */
+        while (bytes % page){
+            n <<= 1;
+            bytes = n*sizeof(T);
+        }
+
+#ifdef SYS_memfd_create
+        fd = syscall(SYS_memfd_create, "spsc_ring", 1 /* MFD_CLOEXEC */);
+#endif
+        if (fd < 0){
+            return false;
+        }
+        if (ftruncate(fd, bytes) != 0){
+            close(fd);
+            return false;
+        }
+
+        /* reserve the address range, then map the file into both halves */
+        addr = (char*)mmap(NULL, 2*bytes, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED){
+            close(fd);
+            return false;
+        }
+        if (mmap(addr, bytes, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(addr + bytes, bytes, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED){
+            munmap(addr, 2*bytes);
+            close(fd);
+            return false;
+        }
+        /* the mappings keep the memory alive */
+        close(fd);
+
+        delete[] this->m_buf;
+        this->m_buf = (T*)addr;
+        this->m_bufsize = n;
+        this->m_mask = n - 1;
+        this->reset();
+        m_map_size = bytes;
+        m_mirrored = true;
+        return true;
+    }
+#else
+    bool map_mirror(int capacity)
+    {
+        return false;
+    }
+#endif
+};
+
+
+#endif
@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "partconv.h"
+#include "fftplan.h"
+#include "dotprod.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* y[k] += x[k]*h[k] over n complex bins interleaved as re,im, n a 
+ * multiple of 4 */
+static inline void cmac(float *y, const float *x, const float *h, int n)
+{
+#if defined(DOTPROD_SSE)
+    const __m128 sign = _mm_set_ps(1.0f, -1.0f, 1.0f, -1.0f);
+
+    for (int i=0; i<2*n; i+=4){
+        __m128 a = _mm_loadu_ps(x+i);
+        __m128 b = _mm_loadu_ps(h+i);
+        __m128 br = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2,2,0,0));
+        __m128 bi = _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(3,3,1,1)), sign);
+        __m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2,3,0,1));
+
+        _mm_storeu_ps(y+i, _mm_add_ps(_mm_loadu_ps(y+i),
+                                      _mm_add_ps(_mm_mul_ps(a, br), _mm_mul_ps(as, bi))));
+    }
+#elif defined(DOTPROD_NEON)
+    for (int i=0; i<2*n; i+=8){
+        float32x4x2_t a = vld2q_f32(x+i);
+        float32x4x2_t b = vld2q_f32(h+i);
+        float32x4x2_t c = vld2q_f32(y+i);
+
+        c.val[0] = vmlaq_f32(c.val[0], a.val[0], b.val[0]);
+        c.val[0] = vmlsq_f32(c.val[0], a.val[1], b.val[1]);
+        c.val[1] = vmlaq_f32(c.val[1], a.val[0], b.val[1]);
+        c.val[1] = vmlaq_f32(c.val[1], a.val[1], b.val[0]);
+        vst2q_f32(y+i, c);
+    }
+#else
+    for (int i=0; i<2*n; i+=2){
+        float re = x[i] * h[i] - x[i+1] * h[i+1];
+        float im = x[i] * h[i+1] + x[i+1] * h[i];
+
+        y[i] += re;
+        y[i+1] += im;
+    }
+#endif
+}
+
+
+partconv::partconv(float *taps, int n_taps, int blksize)
+    : m_head(0), m_blk_size(blksize)
+{
+    int fft_len = 2 * m_blk_size;
+    float *w;
+
+    m_n_part = (n_taps + m_blk_size - 1) / m_blk_size;
+    /* the bins are padded for cmac, the padding stays 0 */
+    m_n_bins = (m_blk_size + 1 + 3) & ~3;
+    /* slots keep the alignment of fftwf_malloc for the shared plans */
+    m_stride = (2 * m_n_bins + 15) & ~15;
+
+    m_fft_taps = (float*)fftwf_malloc(m_n_part * m_stride * sizeof(float));
+    m_fdl = (float*)fftwf_malloc(m_n_part * m_stride * sizeof(float));
+    m_acc = (float*)fftwf_malloc(m_stride * sizeof(float));
+    m_buf = (float*)malloc(m_blk_size * sizeof(float));
+    m_prev = (float*)malloc(m_blk_size * sizeof(float));
+
+    memset(m_fft_taps, 0, m_n_part * m_stride * sizeof(float));
+    memset(m_fdl, 0, m_n_part * m_stride * sizeof(float));
+    memset(m_acc, 0, m_stride * sizeof(float));
+    memset(m_buf, 0, m_blk_size * sizeof(float));
+    memset(m_prev, 0, m_blk_size * sizeof(float));
+
+    m_plan     = fft_plan::get(fft_plan::R2C, fft_len);
+    m_inv_plan = fft_plan::get(fft_plan::C2R, fft_len);
+    if (!is_valid()){
+        fprintf(stderr, "partconv: no %d point fft, the filter puts out 0\n", fft_len);
+        return;
+    }
+
+    //fft each partition zero padded to fft_len, the scaling goes with them
+    for (int p=0; p<m_n_part; p++){
+        w = &m_fft_taps[p * m_stride];
+        for (int i=0; i<m_blk_size && p*m_blk_size + i<n_taps; i++){
+            w[i] = taps[p*m_blk_size + i] / fft_len;
+        }
+        fftwf_execute_dft_r2c(m_plan, w, (fftwf_complex*)w);
+    }
+}
+
+
+partconv::~partconv()
+{
+    fftwf_free(m_fft_taps);
+    fftwf_free(m_fdl);
+    fftwf_free(m_acc);
+    free(m_buf);
+    free(m_prev);
+
+    fft_plan::release(m_plan);
+    fft_plan::release(m_inv_plan);
+}
+
+
+void partconv::process()
+{
+    float *x = &m_fdl[m_head * m_stride];
+
+    if (!is_valid()){
+        memset(m_buf, 0, sizeof(float)*m_blk_size);
+        return;
+    }
+    //the last block and this one, transformed into the newest slot
+    memcpy(x, m_prev, sizeof(float)*m_blk_size);
+    memcpy(&x[m_blk_size], m_buf, sizeof(float)*m_blk_size);
+    memcpy(m_prev, m_buf, sizeof(float)*m_blk_size);
+    fftwf_execute_dft_r2c(m_plan, x, (fftwf_complex*)x);
+    /* the padding bins past blksize+1 stay 0 */
+
+    //partition p against the input p blocks back
+    memset(m_acc, 0, sizeof(float)*2*m_n_bins);
+    for (int p=0; p<m_n_part; p++){
+        int slot = m_head - p < 0 ? m_head - p + m_n_part : m_head - p;
+
+        cmac(m_acc, &m_fdl[slot * m_stride], &m_fft_taps[p * m_stride], m_n_bins);
+    }
+    m_head = m_head + 1 < m_n_part ? m_head + 1 : 0;
+
+    //the first half wrapped around, the second is the output
+    fftwf_execute_dft_c2r(m_inv_plan, (fftwf_complex*)m_acc, m_acc);
+    memcpy(m_buf, &m_acc[m_blk_size], sizeof(float)*m_blk_size);
+}
@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PART_CONV_H_
+#define PART_CONV_H_
+
+#include <fftw3.h>
+
+/* uniformly partitioned overlap-save convolution. the taps are cut in 
+ * partitions of blksize, the spectra of the last inputs are kept in a 
+ * frequency domain delay line and each block is filtered with one pair 
+ * of 2*blksize point transforms against all of them. the latency is 
+ * blksize samples however long the filter is, blksize is even */
+class partconv
+{
+public:
+    partconv(float *taps, int n_taps, int blksize);
+    ~partconv();
+    int get_blksize()
+    {
+        return m_blk_size;
+    }
+    /* blksize samples in, filtered in place by process() */
+    float* get_process_buf()
+    {
+        return m_buf;
+    }
+    /* false if fftwf had no plan for the length, process() puts out 0 */
+    bool is_valid()
+    {
+        return m_plan && m_inv_plan;
+    }
+    void process();
+private:
+    fftwf_plan      m_plan;
+    fftwf_plan      m_inv_plan;
+
+    /* the partitions of the taps and the delay line, m_stride floats 
+     * apart, m_n_bins complex bins each */
+    float          *m_fft_taps;
+    float          *m_fdl;
+    int             m_n_part;
+    int             m_head;
+    int             m_stride;
+    int             m_n_bins;
+
+    float          *m_buf;
+    float          *m_prev;
+    float          *m_acc;
+
+    int             m_blk_size;
+};
+
+
+#endif
@@ -31,62 +31,122 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include "resample.h"
+#include "dotprod.h"
 #include <math.h>
+#include <limits.h>
 #include <assert.h>
 
-resample::resample(float *taps, int n_taps, int upsample, int blksize)
-    : m_n_phase(upsample), m_blksize(blksize)
-    , m_pos(0), m_mu(0.0f), m_last_remain(0.0f), m_is_leftover(false)
+resample::resample(float *taps, int n_taps, int upsample, int blksize, int interp)
+    : m_n_phase(upsample), m_blksize(blksize), m_interp(interp), m_t(0.0)
 {
 
     
     m_phase_len = (n_taps + m_n_phase - 1) / m_n_phase;
-    m_phase_taps = new float*[m_n_phase];
-    m_out = new float*[m_n_phase];
-        
-    for (int i = 0; i<m_n_phase; i++){
-        m_phase_taps[i] = new float[m_phase_len];
-        m_out[i] = new float[m_blksize];
-    }
-    
-    m_history = new float[m_blksize];
+    m_phase_len = (m_phase_len + 3) & ~3;
+    m_taps = new float[m_n_phase * m_phase_len];
+
+    /* the cubic needs the point before the block start, an output can be
+       left over from the previous block with the points it needs */
+    m_hist_len = m_phase_len + 2;
+    m_line = new float[m_hist_len + m_blksize];
 
+    /* no output is closer than 1/upsample of an input apart */
+    m_sched_max = m_blksize * m_n_phase + 2;
+    m_sched_pos = new int[m_sched_max];
+    m_sched_mu = new float[m_sched_max];
 
-    for (int i=0; i<m_phase_len; i++){
-        for (int j=0; j<m_n_phase; j++){
+    for (int j=0; j<m_n_phase; j++){
+        for (int i=0; i<m_phase_len; i++){
             int n = i*m_n_phase + j;
-            if (n < n_taps){
-                m_phase_taps[j][i] = taps[n];
-            }else{
-                m_phase_taps[j][i] = 0.0f;
-            }
+            m_taps[j*m_phase_len + m_phase_len-1 - i] = n < n_taps ? taps[n] : 0.0f;
         }
     }
 
-    for (int i=0; i<m_blksize; i++){
-            m_history[i]= 0.0f;
+    for (int i=0; i<m_hist_len + m_blksize; i++){
+            m_line[i]= 0.0f;
     }
 }
 
 
 resample::~resample()
 {
-    for (int i=0; i<m_n_phase; i++){
-        delete[] m_phase_taps[i];
-        delete[] m_out[i];
+    delete[] m_taps;
+    delete[] m_line;
+    delete[] m_sched_pos;
+    delete[] m_sched_mu;
+}
+
+
+/* the outputs of a block of end upsampled points, up to the last one 
+ * whose points up to ahead after it are all in it. t is the next output 
+ * from the block start, first the oldest point the history still has */
+static int schedule(double &t, double first, int end, int ahead, double step,
+                    int *sched_pos, float *sched_mu, int sched_max, int out_len)
+{
+    int n = 0;
+
+    if (t < first){
+        /* the output buffer was short, what did not fit is lost */
+        t = first;
+    }
+    while (n < out_len && n < sched_max){
+        int pos = (int)floor(t);
+
+        if (pos + ahead >= end){
+            break;
+        }
+        sched_pos[n] = pos;
+        sched_mu[n] = (float)(t - pos);
+        t += step;
+        n++;
     }
-    delete[] m_history;
-    delete[] m_phase_taps;
-    delete[] m_out;
+    t -= end;
+    return n;
+}
+
+
+/* the input and phase of upsampled point pos */
+static inline int split(int pos, int upsample, int *phase)
+{
+    int n = pos >= 0 ? pos / upsample : -((upsample - 1 - pos) / upsample);
+
+    *phase = pos - n * upsample;
+    return n;
+}
+
+
+/* the 4 point lagrange curve through ym1..y2 at mu after y0 */
+static inline float cubic(float ym1, float y0, float y1, float y2, float mu)
+{
+    float c1 = y1 - ym1*(1.0f/3) - y0*0.5f - y2*(1.0f/6);
+    float c2 = (ym1 + y1)*0.5f - y0;
+    float c3 = (y2 - ym1)*(1.0f/6) + (y0 - y1)*0.5f;
+
+    return ((c3*mu + c2)*mu + c1)*mu + y0;
+}
+
+
+/* the upsampled point pos, phase pos % upsample of input pos / upsample */
+float resample::point(int pos)
+{
+    int slot = pos & 3;
+
+    if (m_cache_pos[slot] != pos){
+        int phase;
+        int n = split(pos, m_n_phase, &phase);
 
+        m_cache_pos[slot] = pos;
+        m_cache_val[slot] = dotprod(&m_taps[phase * m_phase_len],
+                                    &m_line[m_hist_len + n - (m_phase_len - 1)],
+                                    m_phase_len);
+    }
+    return m_cache_val[slot];
 }
 
 
 int resample::process(float* in, int n_in, float* out, int out_len, float rate)
 {
-    //fitler for each polyphase and store them;
-    int n_out = 0;
-    float t = m_pos + m_mu; //current time
+    int n_out;
 
     if (n_in > m_blksize || rate < 1.0/m_n_phase){
         printf("input parameter is wrong, rate <= 1/upsample, n_in <= blksize\n");
@@ -97,61 +157,150 @@ int resample::process(float* in, int n_in, float* out, int out_len, float rate)
         return 0;
     }            
 
-    for (int i=0; i<n_in; i++){
+    memcpy(&m_line[m_hist_len], in, sizeof(float)*n_in);
+    for (int i=0; i<4; i++){
+        m_cache_pos[i] = INT_MIN;
+    }
 
-        for(int j=0; j<m_n_phase; j++){
-            float accu = m_phase_taps[j][0] * in[i];
-            for(int n=1; n<m_phase_len; n++){
-                accu += m_phase_taps[j][n] * m_history[n-1];
-            }
-            m_out[j][i] = accu;
-        }
+    //only the phases on the output grid are filtered
+    n_out = schedule(m_t, (m_phase_len - 1 - m_hist_len) * m_n_phase + 1,
+                     n_in * m_n_phase, m_interp == FARROW_CUBIC ? 2 : 1,
+                     (double)rate * m_n_phase, m_sched_pos, m_sched_mu, m_sched_max, out_len);
+    if (m_interp == FARROW_CUBIC){
+        for (int n=0; n<n_out; n++){
+            int pos = m_sched_pos[n];
 
-        for (int n=m_phase_len-2 ; n>0; n--){
-            m_history[n] = m_history[n-1];
+            out[n] = cubic(point(pos-1), point(pos), point(pos+1), point(pos+2), m_sched_mu[n]);
         }
-        m_history[0] = in[i];
-    }
-
-    //get the output
-    // beacuse rate > 1/upsample, there can only be a sample use the old
-    // remaining
-    if (m_is_leftover){
-        out[n_out++] = m_last_remain * (1.0f-m_mu) + m_mu*m_out[0][0];            
-        m_is_leftover = false;
-        t += rate * m_n_phase;
-    }
-        
-    while(1)
-    {
-        int phase0, phase1, n0, n1, pos1;
-        
-        m_pos = (int)floorf(t);
-        m_mu = t - m_pos;
-        pos1 = m_pos + 1;
-
-        phase0 = m_pos % m_n_phase;
-        phase1 = pos1 % m_n_phase;
-        n0 = m_pos / m_n_phase;
-        n1 = pos1 / m_n_phase;
-
-        if (n0 >= n_in || n_out >= out_len){
-            break;
-        }
-        else if (n1 >= n_in){
-            m_is_leftover = true;
-            m_last_remain = m_out[phase0][n0];
-            break;
+    }
+    else{
+        for (int n=0; n<n_out; n++){
+            int pos = m_sched_pos[n];
+            float mu = m_sched_mu[n];
+
+            out[n] = point(pos) * (1.0f-mu) + mu*point(pos+1);
         }
-        out[n_out++] = m_out[phase0][n0] * (1.0f-m_mu) + m_mu*m_out[phase1][n1];
-        t += rate * m_n_phase;
     }
 
-    m_pos -= n_in * m_n_phase;
+    //the newest samples are the history of the next block
+    memmove(&m_line[0], &m_line[n_in], sizeof(float)*m_hist_len);
 
     return n_out;
 }
-        
-        
 
-        
+
+resample_c::resample_c(float *taps, int n_taps, int upsample, int blksize, int interp)
+    : m_n_phase(upsample), m_blksize(blksize), m_interp(interp), m_t(0.0)
+{
+    std::complex<float> *c = new std::complex<float>[n_taps];
+
+    for (int i=0; i<n_taps; i++){
+        c[i] = taps[i];
+    }
+    init(c, n_taps, true);
+    delete[] c;
+}
+
+
+resample_c::resample_c(std::complex<float> *taps, int n_taps, int upsample, int blksize, int interp)
+    : m_n_phase(upsample), m_blksize(blksize), m_interp(interp), m_t(0.0)
+{
+    init(taps, n_taps, false);
+}
+
+
+void resample_c::init(const std::complex<float> *taps, int n_taps, bool real)
+{
+    m_phase_len = (n_taps + m_n_phase - 1) / m_n_phase;
+    m_phase_len = (m_phase_len + 3) & ~3;
+    dotprod_c_phases(taps, n_taps, real, m_n_phase, m_phase_len, &m_taps_re, &m_taps_im);
+
+    m_hist_len = m_phase_len + 2;
+    m_line = new float[2 * (m_hist_len + m_blksize)];
+    for (int i=0; i<2 * (m_hist_len + m_blksize); i++){
+        m_line[i] = 0.0f;
+    }
+
+    m_sched_max = m_blksize * m_n_phase + 2;
+    m_sched_pos = new int[m_sched_max];
+    m_sched_mu = new float[m_sched_max];
+}
+
+
+resample_c::~resample_c()
+{
+    dotprod_free(m_taps_re);
+    dotprod_free(m_taps_im);
+    delete[] m_line;
+    delete[] m_sched_pos;
+    delete[] m_sched_mu;
+}
+
+
+/* re,im of the upsampled point pos, good until point() is called for 
+ * a pos 4 away from it */
+const float* resample_c::point(int pos)
+{
+    int slot = pos & 3;
+
+    if (m_cache_pos[slot] != pos){
+        int phase;
+        int n = split(pos, m_n_phase, &phase);
+        int k = phase * m_phase_len;
+
+        m_cache_pos[slot] = pos;
+        dotprod_c(&m_taps_re[k], m_taps_im ? &m_taps_im[k] : NULL,
+                  &m_line[2 * (m_hist_len + n - (m_phase_len - 1))], m_phase_len,
+                  m_cache_val[slot]);
+    }
+    return m_cache_val[slot];
+}
+
+
+int resample_c::process(std::complex<float>* in, int n_in, std::complex<float>* out, int out_len, float rate)
+{
+    float *y = (float*)out;
+    int n_out;
+
+    if (n_in > m_blksize || rate < 1.0/m_n_phase){
+        printf("input parameter is wrong, rate <= 1/upsample, n_in <= blksize\n");
+        return 0;
+    }
+    if (out_len < floorf(n_in*1.0f/rate)){
+        printf("output buffer is not large enough");
+        return 0;
+    }            
+
+    memcpy(&m_line[2 * m_hist_len], in, sizeof(float)*2*n_in);
+    for (int i=0; i<4; i++){
+        m_cache_pos[i] = INT_MIN;
+    }
+
+    n_out = schedule(m_t, (m_phase_len - 1 - m_hist_len) * m_n_phase + 1,
+                     n_in * m_n_phase, m_interp == resample::FARROW_CUBIC ? 2 : 1,
+                     (double)rate * m_n_phase, m_sched_pos, m_sched_mu, m_sched_max, out_len);
+    if (m_interp == resample::FARROW_CUBIC){
+        for (int n=0; n<n_out; n++){
+            int pos = m_sched_pos[n];
+            float mu = m_sched_mu[n];
+            const float *ym1 = point(pos-1), *y0 = point(pos), *y1 = point(pos+1), *y2 = point(pos+2);
+
+            y[2*n] = cubic(ym1[0], y0[0], y1[0], y2[0], mu);
+            y[2*n+1] = cubic(ym1[1], y0[1], y1[1], y2[1], mu);
+        }
+    }
+    else{
+        for (int n=0; n<n_out; n++){
+            int pos = m_sched_pos[n];
+            float mu = m_sched_mu[n];
+            const float *y0 = point(pos), *y1 = point(pos+1);
+
+            y[2*n] = y0[0] * (1.0f-mu) + mu*y1[0];
+            y[2*n+1] = y0[1] * (1.0f-mu) + mu*y1[1];
+        }
+    }
+
+    memmove(&m_line[0], &m_line[2 * n_in], sizeof(float)*2*m_hist_len);
+
+    return n_out;
+}
\ No newline at end of file
@@ -30,13 +30,20 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef RESAMPLE_H_
 #define RESAMPLE_H_
 
+#include <complex>
+
 class resample
 {
 public:
+    /* how the output is taken between two points of the upsampled grid */
+    enum { LINEAR = 0, FARROW_CUBIC = 1 };
+
     /* taps and n_taps defines the interpolation filter, 
      * upsample defines how much upsampling 
-     * blksize is the number of samples processed on each process call */
-    resample(float *taps, int n_taps, int upsample, int blksize);
+     * blksize is the number of samples processed on each process call 
+     * interp is LINEAR, or FARROW_CUBIC for a 4 point lagrange curve
+     * through the upsampled points, at twice the filter work per output */
+    resample(float *taps, int n_taps, int upsample, int blksize, int interp = LINEAR);
     ~resample();
 
     /* given a rate of "how many" input samples (step size, like 1.52) to 
@@ -46,18 +53,68 @@ public:
      */
     int process(float* in, int n_in, float *out, int out_len, float rate);
 private:
-    float          *m_history;
+    /* phase j reversed at j*m_phase_len, zero padded to a multiple of 4 */
+    float          *m_taps;
     int             m_phase_len;
     int             m_n_phase;
-    float         **m_phase_taps;
-    float         **m_out;
+    /* the delay line, m_hist_len old samples then the block */
+    float          *m_line;
+    int             m_hist_len;
     
     int             m_blksize;
-    int             m_pos;
-    float           m_mu;
-    float           m_last_remain;
-    bool            m_is_leftover;
-    
+    int             m_interp;
+    /* the next output on the upsampled grid, from the block start */
+    double          m_t;
+
+    /* where the outputs of one block fall, found before any filtering */
+    int            *m_sched_pos;
+    float          *m_sched_mu;
+    int             m_sched_max;
+
+    /* upsampled points already filtered in this block, by pos & 3 */
+    int             m_cache_pos[4];
+    float           m_cache_val[4];
+
+    float point(int pos);
+};
+
+
+/* resample on interleaved I/Q, the same grid and interpolation as 
+ * resample. the taps are real, or complex for a filter that is not 
+ * symmetric around DC */
+class resample_c
+{
+public:
+    resample_c(float *taps, int n_taps, int upsample, int blksize, int interp = resample::LINEAR);
+    resample_c(std::complex<float> *taps, int n_taps, int upsample, int blksize, int interp = resample::LINEAR);
+    ~resample_c();
+
+    /* as resample::process, n_in and out_len count complex samples */
+    int process(std::complex<float>* in, int n_in, std::complex<float> *out, int out_len, float rate);
+private:
+    /* see dotprod_c_phases, m_taps_im is NULL for real taps */
+    float          *m_taps_re;
+    float          *m_taps_im;
+    int             m_phase_len;
+    int             m_n_phase;
+    /* m_hist_len old samples then the block, re,im interleaved */
+    float          *m_line;
+    int             m_hist_len;
+
+    int             m_blksize;
+    int             m_interp;
+    double          m_t;
+
+    int            *m_sched_pos;
+    float          *m_sched_mu;
+    int             m_sched_max;
+
+    /* re,im of the points, apart so they come back in registers */
+    int             m_cache_pos[4];
+    float           m_cache_val[4][2];
+
+    void init(const std::complex<float> *taps, int n_taps, bool real);
+    const float* point(int pos);
 };
 
 
@@ -0,0 +1,366 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SPSC_RINGBUF_H_
+#define SPSC_RINGBUF_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <atomic>
+
+#ifdef __linux__
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#endif
+
+#define SPSC_CACHE_LINE   64
+
+/* Wait-free single producer / single consumer ring buffer.
+ *
+ * The producer only ever stores the write index and the consumer only 
+ * ever stores the read index, each index sits on its own cache line. 
+ * Capacity is rounded up to a power of two so wrapping is a mask.
+ *
+ * Neither write() nor read() blocks, they are safe to call from the usb 
+ * event thread. The other side (the gnuradio or processing thread) can 
+ * sleep in wait_for_count()/wait_for_space(), the non-blocking side only 
+ * pays for a futex wake when somebody is actually waiting. 
+ */
+template <class T>
+class spsc_ring_buffer
+{
+public:
+    spsc_ring_buffer()
+        : m_buf(NULL), m_bufsize(0), m_mask(0)
+    {
+        reset();
+    }
+
+    spsc_ring_buffer(int capacity)
+        : m_buf(NULL), m_bufsize(0), m_mask(0)
+    {
+        alloc_buffer(capacity);
+    }
+    
+    virtual ~spsc_ring_buffer()
+    {
+        delete[] m_buf;
+    }
+
+    /* not thread safe, call before streaming starts */
+    virtual void alloc_buffer(int capacity)
+    {
+        delete[] m_buf;
+        m_bufsize = round_capacity(capacity);
+        m_mask = m_bufsize - 1;
+        m_buf = new T[m_bufsize];
+        reset();
+    }
+
+    int get_capacity()
+    {
+        return m_bufsize;
+    }
+    
+    /* producer side */
+    int get_space()
+    {
+        return m_bufsize - (m_wr.load(std::memory_order_relaxed) - m_rd.load(std::memory_order_acquire));
+    }
+
+    /* consumer side */
+    int get_count()
+    {
+        return m_wr.load(std::memory_order_acquire) - m_rd.load(std::memory_order_relaxed);
+    }
+
+    /* all or nothing, returns len or 0 when there is no room. a batch of 
+       writes can pass wake = false and call notify() once at the end */
+    int write(const T* data, int len, bool wake = true)
+    {
+        unsigned wr = m_wr.load(std::memory_order_relaxed);
+        unsigned pos, sz1;
+        
+        if (len > (int)(m_bufsize - (wr - m_rd_cache))){
+            m_rd_cache = m_rd.load(std::memory_order_acquire);
+            if (len > (int)(m_bufsize - (wr - m_rd_cache))){
+                return 0;
+            }
+        }
+
+        pos = wr & m_mask;
+        sz1 = m_bufsize - pos;
+        if (sz1 < (unsigned)len){
+            memcpy(&m_buf[pos], data, sz1*sizeof(T));
+            memcpy(&m_buf[0], &data[sz1], (len-sz1)*sizeof(T));
+        }
+        else{
+            memcpy(&m_buf[pos], data, len*sizeof(T));
+        }
+
+        m_wr.store(wr + len, std::memory_order_release);
+        if (wake){
+            notify();
+        }
+        return len;
+    }
+
+    /* same contract as ring_buffer::read, conv consumes src_len data with 
+       type T and returns number of bytes put into dst */
+    int read(void* dst, unsigned dst_len,
+             int (*conv)(void* dst, void *src, int src_len),
+             int (*calc_src_len)(int dst_len)
+             )
+    {
+        unsigned rd = m_rd.load(std::memory_order_relaxed);
+        unsigned pos, sz1;
+        int src_len;
+        
+        if (!conv || !calc_src_len){
+            return 0;
+        }
+        
+        src_len = calc_src_len(dst_len);
+        if (src_len > (int)(m_wr_cache - rd)){
+            m_wr_cache = m_wr.load(std::memory_order_acquire);
+            if (src_len > (int)(m_wr_cache - rd)){
+                return 0;
+            }
+        }
+
+        pos = rd & m_mask;
+        sz1 = m_bufsize - pos;
+        if (sz1 < (unsigned)src_len){
+            int dst_sz1 = conv(dst, &m_buf[pos], sz1);
+            conv((char*)dst+dst_sz1, &m_buf[0], src_len - sz1);
+        }
+        else{
+            conv(dst, &m_buf[pos], src_len);
+        }
+
+        m_rd.store(rd + src_len, std::memory_order_release);
+        notify();
+        return src_len;
+    }
+
+    /* consumer side, sleep until at least n items are readable,
+       timeout_ms < 0 waits forever. returns true if the data is there,
+       false on timeout or once abort() was called */
+    bool wait_for_count(int n, int timeout_ms = -1)
+    {
+        return wait_until(n, timeout_ms, true);
+    }
+
+    /* producer side, sleep until at least n items can be written */
+    bool wait_for_space(int n, int timeout_ms = -1)
+    {
+        return wait_until(n, timeout_ms, false);
+    }
+
+    /* called by either side after moving its index */
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed)){
+            m_seq.fetch_add(1, std::memory_order_release);
+            wake_all();
+        }
+    }
+
+    /* release any waiter, e.g. on shutdown. waits return false from now
+       on, until clear_abort() or alloc_buffer() */
+    void abort()
+    {
+        m_abort.store(true, std::memory_order_seq_cst);
+        m_seq.fetch_add(1, std::memory_order_seq_cst);
+        wake_all();
+    }
+
+    /* kick any waiter, e.g. on shutdown, the same as abort() */
+    void wakeup()
+    {
+        abort();
+    }
+
+    void clear_abort()
+    {
+        m_abort.store(false, std::memory_order_seq_cst);
+    }
+
+protected:
+    T*          m_buf;
+    unsigned    m_bufsize;
+    unsigned    m_mask;
+
+    static unsigned round_capacity(int capacity)
+    {
+        unsigned n = 1;
+        while (n < (unsigned)capacity){
+            n <<= 1;
+        }
+        return n;
+    }
+
+    void reset()
+    {
+        m_wr.store(0, std::memory_order_relaxed);
+        m_rd.store(0, std::memory_order_relaxed);
+        m_rd_cache = 0;
+        m_wr_cache = 0;
+        m_seq.store(0, std::memory_order_relaxed);
+        m_waiters.store(0, std::memory_order_relaxed);
+        m_abort.store(false, std::memory_order_relaxed);
+    }
+
+    /* producer cache line */
+    alignas(SPSC_CACHE_LINE) std::atomic<unsigned> m_wr;
+    unsigned    m_rd_cache;
+    /* consumer cache line */
+    alignas(SPSC_CACHE_LINE) std::atomic<unsigned> m_rd;
+    unsigned    m_wr_cache;
+
+private:
+    /* waiter bookkeeping, only touched by the notifier if someone sleeps */
+    alignas(SPSC_CACHE_LINE) std::atomic<int> m_seq;
+    std::atomic<int> m_waiters;
+    std::atomic<bool> m_abort;
+#ifndef __linux__
+    std::mutex  m_wait_mutex;
+    std::condition_variable m_wait_cond;
+#endif
+
+    bool ready(int n, bool for_count)
+    {
+        return for_count ? get_count() >= n : get_space() >= n;
+    }
+    
+    /* one deadline for the whole wait, wakeups that find the condition
+       still false sleep only for what is left of it */
+    bool wait_until(int n, int timeout_ms, bool for_count)
+    {
+        long long deadline = timeout_ms >= 0 ? now_ns() + timeout_ms * 1000000LL : 0;
+
+        while (!ready(n, for_count)){
+            int seq = m_seq.load(std::memory_order_acquire);
+            long long left = -1;
+            bool timeout;
+
+            if (m_abort.load(std::memory_order_seq_cst)){
+                return false;
+            }
+            if (timeout_ms >= 0){
+                left = deadline - now_ns();
+                if (left <= 0){
+                    return ready(n, for_count);
+                }
+            }
+            m_waiters.fetch_add(1, std::memory_order_seq_cst);
+            if (ready(n, for_count)){
+                m_waiters.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            if (m_abort.load(std::memory_order_seq_cst)){
+                m_waiters.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            timeout = !sleep_on(seq, left);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (timeout){
+                return ready(n, for_count);
+            }
+        }
+        return true;
+    }
+
+#ifdef __linux__
+    static long long now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    /* returns false on timeout, timeout_ns < 0 sleeps until woken */
+    bool sleep_on(int seq, long long timeout_ns)
+    {
+        struct timespec ts, *pts = NULL;
+        long ret;
+        
+        if (timeout_ns >= 0){
+            ts.tv_sec = timeout_ns / 1000000000LL;
+            ts.tv_nsec = timeout_ns % 1000000000LL;
+            pts = &ts;
+        }
+        ret = syscall(SYS_futex, reinterpret_cast<int*>(&m_seq),
+                      FUTEX_WAIT_PRIVATE, seq, pts, NULL, 0);
+        return !(ret == -1 && errno == ETIMEDOUT);
+    }
+
+    void wake_all()
+    {
+        syscall(SYS_futex, reinterpret_cast<int*>(&m_seq),
+                FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+#else
+    static long long now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool sleep_on(int seq, long long timeout_ns)
+    {
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        if (timeout_ns < 0){
+            m_wait_cond.wait(lock, [&]{ return m_seq.load() != seq; });
+            return true;
+        }
+        return m_wait_cond.wait_for(lock, std::chrono::nanoseconds(timeout_ns),
+                                    [&]{ return m_seq.load() != seq; });
+    }
+
+    void wake_all()
+    {
+        std::lock_guard<std::mutex> lock(m_wait_mutex);
+        m_wait_cond.notify_all();
+    }
+#endif
+};
+
+
+#endif
@@ -0,0 +1,276 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* the I/Q variants against two real instances on de-interleaved copies, 
+ * the way I/Q was filtered before them. with real taps the outputs have 
+ * to match those, with complex taps they have to match the four real 
+ * filters the complex product is made of, or for blkconv the convolution 
+ * done in double. reports complex MSamples/s for both ways */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <complex>
+#include <vector>
+#include "blkconv.h"
+#include "resample.h"
+#include "decimate.h"
+#include "bench_util.h"
+
+typedef std::complex<float> cf;
+
+static const int total_in = 1 << 20;
+static const int blk_len = 4096;
+
+/* the low pass moved up by f of the upsampled rate, only positive 
+ * frequencies get through */
+static std::vector<cf> shifted(const std::vector<float> &h, double f)
+{
+    std::vector<cf> c(h.size());
+
+    for (size_t i=0; i<h.size(); i++){
+        c[i] = h[i] * std::polar(1.0f, (float)(2*M_PI*f*i));
+    }
+    return c;
+}
+
+static std::vector<float> part(const std::vector<cf> &c, bool imag)
+{
+    std::vector<float> p(c.size());
+
+    for (size_t i=0; i<c.size(); i++){
+        p[i] = imag ? c[i].imag() : c[i].real();
+    }
+    return p;
+}
+
+static double max_off(const std::vector<cf> &y, const std::vector<cf> &ref)
+{
+    double err = 0, peak = 0;
+
+    if (y.size() != ref.size()){
+        printf("%d outputs against %d\n", (int)y.size(), (int)ref.size());
+        return 1;
+    }
+    for (size_t i=0; i<y.size(); i++){
+        err = fmax(err, std::abs(y[i] - ref[i]));
+        peak = fmax(peak, std::abs(ref[i]));
+    }
+    return err / peak;
+}
+
+/* the same with one real instance on I and one on Q. y_i and y_q are 
+ * kept apart for building the complex taps reference */
+template <class D>
+static double run_pair(D &di, D &dq, const std::vector<cf> &in, std::vector<cf> &out,
+                       float rate, std::vector<float> *y_i = NULL, std::vector<float> *y_q = NULL)
+{
+    int max_out = (int)(blk_len / rate) + 4;
+    std::vector<float> xi(blk_len), xq(blk_len), oi(max_out), oq(max_out);
+    size_t n = 0;
+    double t0;
+
+    out.resize(0);
+    out.resize((size_t)(total_in / rate) + 2*max_out);
+    t0 = now_sec();
+    for (int b=0; b+blk_len<=total_in; b+=blk_len){
+        int m;
+
+        for (int i=0; i<blk_len; i++){
+            xi[i] = in[b + i].real();
+            xq[i] = in[b + i].imag();
+        }
+        m = di.process(&xi[0], blk_len, &oi[0], max_out, rate);
+        dq.process(&xq[0], blk_len, &oq[0], max_out, rate);
+        for (int i=0; i<m; i++){
+            out[n + i] = cf(oi[i], oq[i]);
+        }
+        if (y_i){
+            y_i->insert(y_i->end(), oi.begin(), oi.begin() + m);
+            y_q->insert(y_q->end(), oq.begin(), oq.begin() + m);
+        }
+        n += m;
+    }
+    t0 = now_sec() - t0;
+    out.resize(n);
+    return total_in / t0 * 1e-6;
+}
+
+/* (hr + j hi) * (I + j Q) from hr and hi each run on I and Q */
+template <class D>
+static void complex_ref(D &ri, D &rq, D &ii, D &iq, const std::vector<cf> &in,
+                        std::vector<cf> &ref, float rate)
+{
+    std::vector<float> hr_i, hr_q, hi_i, hi_q;
+    std::vector<cf> dummy;
+
+    hr_i.reserve(total_in);
+    run_pair(ri, rq, in, dummy, rate, &hr_i, &hr_q);
+    run_pair(ii, iq, in, dummy, rate, &hi_i, &hi_q);
+    ref.resize(hr_i.size());
+    for (size_t i=0; i<ref.size(); i++){
+        ref[i] = cf(hr_i[i] - hi_q[i], hr_q[i] + hi_i[i]);
+    }
+}
+
+static double blk_run_pair(blkconv &ci, blkconv &cq, const std::vector<cf> &in, std::vector<cf> &out)
+{
+    int blk = ci.get_blksize();
+    float *bi = ci.get_process_buf(), *bq = cq.get_process_buf();
+    double t0;
+
+    out.resize(0);
+    out.resize(total_in);
+    t0 = now_sec();
+    for (int b=0; b+blk<=total_in; b+=blk){
+        for (int i=0; i<blk; i++){
+            bi[i] = in[b + i].real();
+            bq[i] = in[b + i].imag();
+        }
+        ci.process();
+        cq.process();
+        for (int i=0; i<blk; i++){
+            out[b + i] = cf(bi[i], bq[i]);
+        }
+    }
+    t0 = now_sec() - t0;
+    out.resize(total_in / blk * blk);
+    return out.size() / t0 * 1e-6;
+}
+
+/* the first n outputs of the convolution, in double */
+static std::vector<cf> blk_ref(const std::vector<cf> &h, const std::vector<cf> &in, size_t n)
+{
+    std::vector<cf> y(n);
+
+    for (size_t i=0; i<n; i++){
+        std::complex<double> s = 0;
+        for (size_t k=0; k<h.size() && k<=i; k++){
+            s += std::complex<double>(h[k]) * std::complex<double>(in[i - k]);
+        }
+        y[i] = cf(s);
+    }
+    return y;
+}
+
+static int report(const char *name, double r_c, double r_pair, double off)
+{
+    if (r_pair > 0){
+        printf("%-34s %10.2f %10.2f %7.1fx %10.2e\n", name, r_c, r_pair, r_c / r_pair, off);
+    }
+    else{
+        printf("%-34s %10.2f %10s %8s %10.2e\n", name, r_c, "", "", off);
+    }
+    if (off > 1e-4){
+        printf("%s is %g off\n", name, off);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<cf> in(total_in), y, ref;
+    int failed = 0;
+
+    srand(1);
+    for (int i=0; i<total_in; i++){
+        in[i] = cf(rand() * 2.0f / RAND_MAX - 1, rand() * 2.0f / RAND_MAX - 1);
+    }
+
+    printf("%-34s %10s %10s %8s %10s\n", "", "I/Q MS/s", "2x MS/s", "speedup", "off");
+    {
+        const int n_taps = 129, fft_len = 1024;
+        std::vector<float> h = lowpass(n_taps, 0.45 / 4.0, 1);
+        std::vector<cf> hc = shifted(h, 0.125);
+        blkconv_c conv(&h[0], n_taps, fft_len);
+        blkconv ci(&h[0], n_taps, fft_len), cq(&h[0], n_taps, fft_len);
+        blkconv_c conv_c(&hc[0], n_taps, fft_len);
+        double r_c, r_pair;
+
+        r_c = run_blocks(conv, in, y);
+        r_pair = blk_run_pair(ci, cq, in, ref);
+        failed |= report("blkconv 129 taps", r_c, r_pair, max_off(y, ref));
+
+        r_c = run_blocks(conv_c, in, y);
+        y.resize(4 * fft_len);
+        failed |= report("blkconv 129 complex taps", r_c, 0, max_off(y, blk_ref(hc, in, y.size())));
+    }
+    {
+        const int n_taps = 256, up = 32;
+        const float rate = 1.37f;
+        std::vector<float> h = lowpass(n_taps, 0.45 / (up * rate), up);
+        std::vector<cf> hc = shifted(h, 0.125 / (up * rate));
+        std::vector<float> hr = part(hc, false), hi = part(hc, true);
+
+        for (int interp=resample::LINEAR; interp<=resample::FARROW_CUBIC; interp++){
+            resample_c rc(&h[0], n_taps, up, blk_len, interp);
+            resample ri(&h[0], n_taps, up, blk_len, interp), rq(&h[0], n_taps, up, blk_len, interp);
+            resample_c rcc(&hc[0], n_taps, up, blk_len, interp);
+            resample rr_i(&hr[0], n_taps, up, blk_len, interp), rr_q(&hr[0], n_taps, up, blk_len, interp);
+            resample ri_i(&hi[0], n_taps, up, blk_len, interp), ri_q(&hi[0], n_taps, up, blk_len, interp);
+            double r_c, r_pair;
+            bool cubic = interp == resample::FARROW_CUBIC;
+
+            r_c = run_rate(rc, in, y, rate, blk_len);
+            r_pair = run_pair(ri, rq, in, ref, rate);
+            failed |= report(cubic ? "resample cubic" : "resample linear", r_c, r_pair, max_off(y, ref));
+
+            r_c = run_rate(rcc, in, y, rate, blk_len);
+            complex_ref(rr_i, rr_q, ri_i, ri_q, in, ref, rate);
+            failed |= report(cubic ? "resample cubic complex taps" : "resample linear complex taps",
+                             r_c, 0, max_off(y, ref));
+        }
+    }
+    {
+        const int n_taps = 1024, up = 8, hb = 2;
+        const float rate = 21.3f;
+        std::vector<float> h = lowpass(n_taps, 0.45 / (up * rate / (1 << hb)), up);
+        std::vector<cf> hc = shifted(h, 0.125 / (up * rate / (1 << hb)));
+        std::vector<float> hr = part(hc, false), hi = part(hc, true);
+        decimate_c dc(&h[0], n_taps, up, blk_len, hb);
+        decimate di(&h[0], n_taps, up, blk_len, hb), dq(&h[0], n_taps, up, blk_len, hb);
+        decimate_c dcc(&hc[0], n_taps, up, blk_len, hb);
+        decimate dr_i(&hr[0], n_taps, up, blk_len, hb), dr_q(&hr[0], n_taps, up, blk_len, hb);
+        decimate di_i(&hi[0], n_taps, up, blk_len, hb), di_q(&hi[0], n_taps, up, blk_len, hb);
+        double r_c, r_pair;
+
+        r_c = run_rate(dc, in, y, rate, blk_len);
+        r_pair = run_pair(di, dq, in, ref, rate);
+        failed |= report("decimate 2 half bands", r_c, r_pair, max_off(y, ref));
+
+        r_c = run_rate(dcc, in, y, rate, blk_len);
+        complex_ref(dr_i, dr_q, di_i, di_q, in, ref, rate);
+        failed |= report("decimate 2 half bands complex taps", r_c, 0, max_off(y, ref));
+    }
+    return failed;
+}
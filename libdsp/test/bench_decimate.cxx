@@ -0,0 +1,235 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* the decimator against the one it replaced, which moved its whole 
+ * history down on every call and filtered with a strided loop. reports 
+ * input MSamples/s, against the 7.5MS/s of the ADC, and how far the 
+ * outputs are off the same interpolation done in double. the half band
+ * cascade takes the ADC rate to 48kHz, a tone in the band has to come 
+ * through and one just out of it must not */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include "decimate.h"
+#include "bench_util.h"
+
+static const int total_in = 1 << 22;
+static const int blk_len = 4096;
+static const double adc_rate = 7.5e6;
+
+/* decimate as it was, memmove for its overlapping memcpy */
+class decimate_ref
+{
+public:
+    decimate_ref(float *taps, int n_taps, int upsample, int blksize)
+        : m_n_taps(n_taps), m_up_ratio(upsample), m_in(NULL), m_blksize(blksize)
+        , m_pos(0), m_mu(0.0f), m_last_remain(0.0f), m_is_leftover(false)
+    {
+        if (m_n_taps%2 == 0){
+            m_n_taps++;
+        }
+        m_taps = new float[m_n_taps];
+        for (int i=0; i<n_taps; i++){
+            m_taps[i] = taps[i];
+        }
+        if (n_taps < m_n_taps){
+            m_taps[n_taps] = 0.0f;
+        }
+        m_len = m_n_taps + m_blksize;
+        m_history = new float[m_len];
+        memset(m_history, 0, sizeof(float)*m_len);
+    }
+
+    ~decimate_ref()
+    {
+        delete[] m_taps;
+        delete[] m_history;
+    }
+
+    int process(float* in, int n_in, float* out, int out_len, float rate)
+    {
+        int n_out = 0;
+        float t = m_pos + m_mu;
+
+        memmove(&m_history[0], &m_history[n_in], sizeof(float)*(m_len - n_in));
+        memcpy(&m_history[m_len - n_in], in, sizeof(float)*n_in);
+        m_in = &m_history[m_len - n_in];
+        if (m_is_leftover){
+            out[n_out++] = m_last_remain * (1.0f-m_mu) + m_mu*get_sample(0, 0);
+            m_is_leftover = false;
+            t += rate * m_up_ratio;
+        }
+        while(1){
+            int phase0, phase1, n0, n1, pos1;
+            m_pos = (int)floorf(t);
+            m_mu = t - m_pos;
+            pos1 = m_pos + 1;
+            phase0 = m_pos % m_up_ratio;
+            phase1 = pos1 % m_up_ratio;
+            n0 = m_pos / m_up_ratio;
+            n1 = pos1 / m_up_ratio;
+            if (n0 >= n_in || n_out >= out_len){
+                break;
+            }
+            else if (n1 >= n_in){
+                m_is_leftover = true;
+                m_last_remain = get_sample(phase0,n0);
+                break;
+            }
+            out[n_out++] = get_sample(phase0,n0) * (1.0f-m_mu) + m_mu*get_sample(phase1,n1);
+            t += rate * m_up_ratio;
+        }
+        m_pos -= n_in * m_up_ratio;
+        return n_out;
+    }
+
+private:
+    float          *m_taps;
+    int             m_n_taps;
+    float          *m_history;
+    int             m_up_ratio;
+    float          *m_in;
+    int             m_blksize;
+    int             m_len;
+    int             m_pos;
+    float           m_mu;
+    float           m_last_remain;
+    bool            m_is_leftover;
+
+    float get_sample(int phase, int n)
+    {
+        float accu = 0.0f;
+        for(int m=phase, j=0; m<m_n_taps; m += m_up_ratio, j++){
+            accu += m_taps[m] * m_in[n - j];
+        }
+        return accu;
+    }
+};
+
+/* the largest error of the first n outputs */
+static double linear_error(const std::vector<float> &out, const std::vector<float> &in,
+                           const std::vector<float> &h, int upsample, float rate, size_t n)
+{
+    double err = 0;
+
+    for (size_t i=0; i<n && i<out.size(); i++){
+        double t = i * (double)rate * upsample;
+        long k = (long)floor(t);
+        double mu = t - k, y[2];
+
+        for (int p=0; p<2; p++){
+            y[p] = 0;
+            for (long m=(k+p) % upsample; m<(long)h.size() && m<=k+p; m+=upsample){
+                y[p] += h[m] * (double)in[(k+p-m) / upsample];
+            }
+        }
+        err = fmax(err, fabs(out[i] - (y[0]*(1-mu) + y[1]*mu)));
+    }
+    return err;
+}
+
+static std::vector<float> tone(double f)
+{
+    std::vector<float> x(total_in);
+
+    for (int i=0; i<total_in; i++){
+        x[i] = (float)sin(2*M_PI*f/adc_rate*i);
+    }
+    return x;
+}
+
+/* past the filters starting up */
+static double rms(const std::vector<float> &y)
+{
+    double s = 0;
+    size_t first = y.size() / 4;
+
+    for (size_t i=first; i<y.size(); i++){
+        s += y[i]*y[i];
+    }
+    return sqrt(s / (y.size() - first));
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct { int n_taps; int upsample; float rate; } cfg[] = {
+        {512, 8, 10.52f}, {2048, 8, 40.3f}, {8192, 8, 156.25f},
+    };
+    std::vector<float> in = tone(12345.0), y_ref, y_new;
+    int failed = 0;
+
+    printf("%6s %4s %8s %10s %10s %8s %10s %10s\n", "taps", "up", "rate", "old MS/s",
+           "new MS/s", "speedup", "old off", "new off");
+    for (unsigned c=0; c<sizeof(cfg)/sizeof(cfg[0]); c++){
+        std::vector<float> h = lowpass(cfg[c].n_taps, 0.45 / (cfg[c].upsample * cfg[c].rate), cfg[c].upsample);
+        decimate_ref ref(&h[0], cfg[c].n_taps, cfg[c].upsample, blk_len);
+        decimate dec(&h[0], cfg[c].n_taps, cfg[c].upsample, blk_len);
+        double r_ref = run_rate(ref, in, y_ref, cfg[c].rate, blk_len);
+        double r_new = run_rate(dec, in, y_new, cfg[c].rate, blk_len);
+        size_t n = (size_t)(4 * blk_len / cfg[c].rate);
+        double off_ref = linear_error(y_ref, in, h, cfg[c].upsample, cfg[c].rate, n);
+        double off_new = linear_error(y_new, in, h, cfg[c].upsample, cfg[c].rate, n);
+
+        if (off_new > 1e-4){
+            printf("output is %g off\n", off_new);
+            failed = 1;
+        }
+        printf("%6d %4d %8.2f %10.2f %10.2f %7.1fx %10.2e %10.2e\n", cfg[c].n_taps,
+               cfg[c].upsample, cfg[c].rate, r_ref, r_new, r_new / r_ref, off_ref, off_new);
+    }
+
+    /* 7.5MS/s to 48kHz, five half bands and 4.88 left */
+    {
+        const float rate = (float)(adc_rate / 48000);
+        const int hb = 5, up = 8, n_taps = 1024;
+        std::vector<float> h = lowpass(n_taps, 0.45 / (up * rate / (1 << hb)), up);
+        decimate dec(&h[0], n_taps, up, blk_len, hb);
+        std::vector<float> far = tone(60000.0);
+        double speed, pass, stop;
+
+        speed = run_rate(dec, in, y_new, rate, blk_len);
+        pass = rms(y_new) * sqrt(2.0);
+        decimate dec_far(&h[0], n_taps, up, blk_len, hb);
+        run_rate(dec_far, far, y_new, rate, blk_len);
+        stop = rms(y_new) * sqrt(2.0);
+        printf("7.5MS/s to 48kHz over %d half bands: %.2f MS/s, %.1fx real time, "
+               "12.3kHz at %.3f, 60kHz at %.1f dB\n", hb, speed, speed * 1e6 / adc_rate,
+               pass, 20*log10(stop));
+        if (fabs(pass - 1) > 0.01 || stop > 1e-3){
+            printf("the cascade does not filter as it should\n");
+            failed = 1;
+        }
+    }
+    return failed;
+}
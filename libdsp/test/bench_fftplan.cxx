@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* blkconv at the fft sizes of the bpsk example, with plans from 
+ * ESTIMATE and from MEASURE, and how long planning takes from nothing 
+ * and from the wisdom the first run saved. filters of one length have 
+ * to share their plans and the measured ones have to filter the same.
+ *
+ *   bench_fftplan [wisdom file] [threads] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include "blkconv.h"
+#include "fftplan.h"
+#include "bench_util.h"
+
+static const int total_in = 1 << 22;
+
+int main(int argc, char* argv[])
+{
+    static const struct { int n_taps; int sps; int fft_len; } cfg[] = {
+        {111, 10, 2048}, {551, 50, 8192},
+    };
+    const char *wisdom = argc > 1 ? argv[1] : "bench_fftplan.wisdom";
+    int n_threads = argc > 2 ? atoi(argv[2]) : 1;
+    std::vector<float> in(total_in), y_est, y_meas;
+    int failed = 0;
+
+    srand(1);
+    for (int i=0; i<total_in; i++){
+        in[i] = rand() * 2.0f / RAND_MAX - 1;
+    }
+
+    printf("%6s %6s %12s %12s %8s %12s %12s %10s\n", "taps", "fft", "est MS/s", "meas MS/s",
+           "speedup", "plan ms", "wisdom ms", "off");
+    for (unsigned c=0; c<sizeof(cfg)/sizeof(cfg[0]); c++){
+        std::vector<float> h = lowpass(cfg[c].n_taps, 0.5 / cfg[c].sps, 1);
+        double r_est, r_meas, t_plan, t_wisdom, off = 0;
+
+        fft_plan::setup(fft_plan::ESTIMATE, NULL);
+        {
+            blkconv conv(&h[0], cfg[c].n_taps, cfg[c].fft_len);
+            r_est = run_blocks(conv, in, y_est);
+        }
+
+        fft_plan::setup(fft_plan::MEASURE, wisdom, n_threads, cfg[c].fft_len);
+        t_plan = now_sec();
+        {
+            blkconv conv(&h[0], cfg[c].n_taps, cfg[c].fft_len);
+            t_plan = now_sec() - t_plan;
+            {
+                /* a second filter of the length plans nothing */
+                blkconv other(&h[0], cfg[c].n_taps, cfg[c].fft_len);
+                fftwf_plan p = fft_plan::get(fft_plan::R2C, cfg[c].fft_len);
+                fftwf_plan q = fft_plan::get(fft_plan::R2C, cfg[c].fft_len);
+
+                if (!p || p != q){
+                    printf("%d point filters do not share their plans\n", cfg[c].fft_len);
+                    failed = 1;
+                }
+                fft_plan::release(p);
+                fft_plan::release(q);
+            }
+            r_meas = run_blocks(conv, in, y_meas);
+        }
+        if (fft_plan::save_wisdom()){
+            failed = 1;
+        }
+
+        /* the plans are gone with the filters, the wisdom is not */
+        t_wisdom = now_sec();
+        {
+            blkconv conv(&h[0], cfg[c].n_taps, cfg[c].fft_len);
+            t_wisdom = now_sec() - t_wisdom;
+        }
+
+        for (size_t i=0; i<y_est.size(); i++){
+            off = fmax(off, fabs(y_est[i] - y_meas[i]));
+        }
+        if (off > 1e-5){
+            printf("measured plans are %g off\n", off);
+            failed = 1;
+        }
+        printf("%6d %6d %12.2f %12.2f %7.2fx %12.3f %12.3f %10.2e\n", cfg[c].n_taps,
+               cfg[c].fft_len, r_est, r_meas, r_meas / r_est, t_plan * 1e3, t_wisdom * 1e3, off);
+    }
+
+    /* a plan from ESTIMATE is not good enough once MEASURE is asked for */
+    {
+        fftwf_plan est, meas;
+
+        fft_plan::setup(fft_plan::ESTIMATE, NULL);
+        est = fft_plan::get(fft_plan::R2C, 1024);
+        fft_plan::setup(fft_plan::MEASURE, NULL);
+        meas = fft_plan::get(fft_plan::R2C, 1024);
+        if (!est || !meas || est == meas){
+            printf("the estimated plan is handed out for a measured one\n");
+            failed = 1;
+        }
+        fft_plan::release(est);
+        fft_plan::release(meas);
+    }
+    return failed;
+}
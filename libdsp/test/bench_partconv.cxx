@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* the partitioned convolver against blkconv with the transform it 
+ * needs for the same taps, latency being the samples a block holds back. 
+ * both have to be the convolution done in double */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include "blkconv.h"
+#include "partconv.h"
+#include "bench_util.h"
+
+static const int total_in = 1 << 21;
+static const int n_check = 1 << 14;
+
+/* the largest error of the first n_check outputs */
+static double conv_error(const std::vector<float> &y, const std::vector<float> &in,
+                         const std::vector<float> &h)
+{
+    double err = 0;
+
+    for (int i=0; i<n_check && i<(int)y.size(); i++){
+        double s = 0;
+        for (int k=0; k<(int)h.size() && k<=i; k++){
+            s += h[k] * (double)in[i - k];
+        }
+        err = fmax(err, fabs(y[i] - s));
+    }
+    return err;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct { int n_taps; int sps; int blksize; } cfg[] = {
+        {551, 50, 64}, {551, 50, 256}, {2048, 50, 128}, {8192, 200, 256},
+    };
+    std::vector<float> in(total_in), y_blk, y_part;
+    int failed = 0;
+
+    srand(1);
+    for (int i=0; i<total_in; i++){
+        in[i] = rand() * 2.0f / RAND_MAX - 1;
+    }
+
+    printf("%6s %6s %10s %10s %10s %10s %10s %10s\n", "taps", "fft", "blk MS/s", "latency",
+           "part MS/s", "latency", "blk off", "part off");
+    for (unsigned c=0; c<sizeof(cfg)/sizeof(cfg[0]); c++){
+        std::vector<float> h = lowpass(cfg[c].n_taps, 0.5 / cfg[c].sps, 1);
+        int fft_len = 1;
+        double r_blk, r_part, off_blk, off_part;
+
+        /* what blkconv takes to hold back no more than 3/4 of a transform */
+        while (fft_len < 4 * cfg[c].n_taps){
+            fft_len *= 2;
+        }
+        blkconv conv(&h[0], cfg[c].n_taps, fft_len);
+        partconv part(&h[0], cfg[c].n_taps, cfg[c].blksize);
+
+        r_blk = run_blocks(conv, in, y_blk);
+        r_part = run_blocks(part, in, y_part);
+        off_blk = conv_error(y_blk, in, h);
+        off_part = conv_error(y_part, in, h);
+        if (off_part > 1e-4){
+            printf("partitioned output is %g off\n", off_part);
+            failed = 1;
+        }
+        printf("%6d %6d %10.2f %10d %10.2f %10d %10.2e %10.2e\n", cfg[c].n_taps, fft_len,
+               r_blk, conv.get_blksize(), r_part, part.get_blksize(), off_blk, off_part);
+    }
+    return failed;
+}
@@ -0,0 +1,222 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* the polyphase resampler against the one it replaced, which filtered 
+ * every phase of every input and kept the ones the output grid needed.
+ * reports input MSamples/s of both and of the farrow cubic mode, how 
+ * far the linear outputs of either are off the same interpolation done in
+ * double at the exact output times, and how far a sine is off the ideal
+ * one with either mode. the old one adds up the output time in float 
+ * within a block and drifts off the grid towards the block end */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include "resample.h"
+#include "bench_util.h"
+
+static const int total_in = 1 << 20;
+static const int blk_len = 1024;
+
+/* resample as it was */
+class resample_ref
+{
+public:
+    resample_ref(float *taps, int n_taps, int upsample, int blksize)
+        : m_n_phase(upsample), m_blksize(blksize)
+        , m_pos(0), m_mu(0.0f), m_last_remain(0.0f), m_is_leftover(false)
+    {
+        m_phase_len = (n_taps + m_n_phase - 1) / m_n_phase;
+        m_phase_taps = new float*[m_n_phase];
+        m_out = new float*[m_n_phase];
+        for (int i = 0; i<m_n_phase; i++){
+            m_phase_taps[i] = new float[m_phase_len];
+            m_out[i] = new float[m_blksize];
+        }
+        m_history = new float[m_blksize];
+        for (int i=0; i<m_phase_len; i++){
+            for (int j=0; j<m_n_phase; j++){
+                int n = i*m_n_phase + j;
+                m_phase_taps[j][i] = n < n_taps ? taps[n] : 0.0f;
+            }
+        }
+        memset(m_history, 0, sizeof(float)*m_blksize);
+    }
+
+    ~resample_ref()
+    {
+        for (int i=0; i<m_n_phase; i++){
+            delete[] m_phase_taps[i];
+            delete[] m_out[i];
+        }
+        delete[] m_history;
+        delete[] m_phase_taps;
+        delete[] m_out;
+    }
+
+    int process(float* in, int n_in, float* out, int out_len, float rate)
+    {
+        int n_out = 0;
+        float t = m_pos + m_mu;
+
+        for (int i=0; i<n_in; i++){
+            for(int j=0; j<m_n_phase; j++){
+                float accu = m_phase_taps[j][0] * in[i];
+                for(int n=1; n<m_phase_len; n++){
+                    accu += m_phase_taps[j][n] * m_history[n-1];
+                }
+                m_out[j][i] = accu;
+            }
+            for (int n=m_phase_len-2 ; n>0; n--){
+                m_history[n] = m_history[n-1];
+            }
+            m_history[0] = in[i];
+        }
+        if (m_is_leftover){
+            out[n_out++] = m_last_remain * (1.0f-m_mu) + m_mu*m_out[0][0];            
+            m_is_leftover = false;
+            t += rate * m_n_phase;
+        }
+        while(1){
+            int phase0, phase1, n0, n1, pos1;
+            m_pos = (int)floorf(t);
+            m_mu = t - m_pos;
+            pos1 = m_pos + 1;
+            phase0 = m_pos % m_n_phase;
+            phase1 = pos1 % m_n_phase;
+            n0 = m_pos / m_n_phase;
+            n1 = pos1 / m_n_phase;
+            if (n0 >= n_in || n_out >= out_len){
+                break;
+            }
+            else if (n1 >= n_in){
+                m_is_leftover = true;
+                m_last_remain = m_out[phase0][n0];
+                break;
+            }
+            out[n_out++] = m_out[phase0][n0] * (1.0f-m_mu) + m_mu*m_out[phase1][n1];
+            t += rate * m_n_phase;
+        }
+        m_pos -= n_in * m_n_phase;
+        return n_out;
+    }
+
+private:
+    float          *m_history;
+    int             m_phase_len;
+    int             m_n_phase;
+    float         **m_phase_taps;
+    float         **m_out;
+    int             m_blksize;
+    int             m_pos;
+    float           m_mu;
+    float           m_last_remain;
+    bool            m_is_leftover;
+};
+
+/* the largest error of the first n linear outputs */
+static double linear_error(const std::vector<float> &out, const std::vector<float> &in,
+                           const std::vector<float> &h, int upsample, float rate, size_t n)
+{
+    double err = 0;
+
+    for (size_t i=0; i<n && i<out.size(); i++){
+        double t = i * (double)rate * upsample;
+        long k = (long)floor(t);
+        double mu = t - k, y[2];
+
+        for (int p=0; p<2; p++){
+            /* the zero stuffed input through the filter */
+            y[p] = 0;
+            for (long m=(k+p) % upsample; m<(long)h.size() && m<=k+p; m+=upsample){
+                y[p] += h[m] * (double)in[(k+p-m) / upsample];
+            }
+        }
+        err = fmax(err, fabs(out[i] - (y[0]*(1-mu) + y[1]*mu)));
+    }
+    return err;
+}
+
+/* rms error against the ideal sine, past the filter start */
+static double sine_error(const std::vector<float> &out, double f, float rate, int n_taps, int upsample)
+{
+    double delay = (n_taps - 1) / 2.0 / upsample;
+    double err = 0;
+    size_t n, first = (size_t)(4*n_taps / rate);
+
+    for (n=first; n<out.size(); n++){
+        double e = out[n] - sin(2*M_PI*f*(n*(double)rate - delay));
+        err += e*e;
+    }
+    return sqrt(err / (out.size() - first));
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct { int n_taps; int upsample; float rate; } cfg[] = {
+        {31, 4, 0.77f}, {128, 4, 0.77f}, {256, 8, 1.9f}, {512, 32, 0.5f}, {1024, 64, 1.01f},
+    };
+    std::vector<float> in(total_in), y_ref, y_lin, y_cub;
+    const double f = 0.1234;
+    int failed = 0;
+
+    for (int i=0; i<total_in; i++){
+        in[i] = (float)sin(2*M_PI*f*i);
+    }
+    printf("%6s %4s %6s %10s %10s %10s %8s %10s %10s %10s %10s\n", "taps", "up", "rate", "old MS/s",
+           "lin MS/s", "cubic MS/s", "speedup", "old off", "lin off", "lin err", "cubic err");
+    for (unsigned c=0; c<sizeof(cfg)/sizeof(cfg[0]); c++){
+        std::vector<float> h = lowpass(cfg[c].n_taps, 0.45 / cfg[c].upsample, cfg[c].upsample);
+        resample_ref ref(&h[0], cfg[c].n_taps, cfg[c].upsample, blk_len);
+        resample lin(&h[0], cfg[c].n_taps, cfg[c].upsample, blk_len);
+        resample cub(&h[0], cfg[c].n_taps, cfg[c].upsample, blk_len, resample::FARROW_CUBIC);
+        double r_ref = run_rate(ref, in, y_ref, cfg[c].rate, blk_len);
+        double r_lin = run_rate(lin, in, y_lin, cfg[c].rate, blk_len);
+        double r_cub = run_rate(cub, in, y_cub, cfg[c].rate, blk_len);
+        /* a few blocks */
+        size_t n = (size_t)(4 * blk_len / cfg[c].rate);
+        double off_ref = linear_error(y_ref, in, h, cfg[c].upsample, cfg[c].rate, n);
+        double off_lin = linear_error(y_lin, in, h, cfg[c].upsample, cfg[c].rate, n);
+
+        if (off_lin > 1e-4){
+            printf("linear output is %g off\n", off_lin);
+            failed = 1;
+        }
+        printf("%6d %4d %6.2f %10.2f %10.2f %10.2f %7.1fx %10.2e %10.2e %10.2e %10.2e\n",
+               cfg[c].n_taps, cfg[c].upsample, cfg[c].rate, r_ref, r_lin, r_cub, r_lin / r_ref,
+               off_ref, off_lin,
+               sine_error(y_lin, f, cfg[c].rate, cfg[c].n_taps, cfg[c].upsample),
+               sine_error(y_cub, f, cfg[c].rate, cfg[c].n_taps, cfg[c].upsample));
+    }
+    return failed;
+}
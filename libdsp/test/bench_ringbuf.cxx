@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* compare the mutex + condition variable ring_buffer used by the sinks
+ * against spsc_ring_buffer, one producer and one consumer thread moving
+ * float blocks through each. reports throughput and how long the consumer
+ * (the usb thread in real life) spends inside a single read */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "ringbuf.h"
+#include "spsc_ringbuf.h"
+#include "bench_util.h"
+
+static const int total_items = 1 << 26;
+static const int blk_len = 1000;
+static const int capacity = 16384;
+
+static int copy_conv(void* dst, void* src, int src_len)
+{
+    memcpy(dst, src, src_len*sizeof(float));
+    return src_len*sizeof(float);
+}
+
+static int calc_len(int dst_len)
+{
+    return dst_len;
+}
+
+struct read_stats
+{
+    double max_read;
+    double sum_read;
+    long   n_read;
+
+    void add(double t)
+    {
+        sum_read += t;
+        n_read++;
+        if (t > max_read){
+            max_read = t;
+        }
+    }
+};
+
+/* ---- locked version, as in sink_f_impl / bpsk ---- */
+static ring_buffer<float> locked_buf(capacity);
+static pthread_mutex_t locked_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  locked_cond = PTHREAD_COND_INITIALIZER;
+
+static void* locked_producer(void*)
+{
+    float blk[blk_len];
+    for (int i=0; i<blk_len; i++){
+        blk[i] = i;
+    }
+    for (int n=0; n<total_items; n+=blk_len){
+        pthread_mutex_lock(&locked_mutex);
+        while (locked_buf.get_space() < blk_len){
+            pthread_cond_wait(&locked_cond, &locked_mutex);
+        }
+        locked_buf.write(blk, blk_len);
+        pthread_cond_signal(&locked_cond);
+        pthread_mutex_unlock(&locked_mutex);
+    }
+    return NULL;
+}
+
+static void* locked_consumer(void* arg)
+{
+    read_stats *st = (read_stats*)arg;
+    float blk[blk_len];
+    for (int n=0; n<total_items; n+=blk_len){
+        double t0 = now_sec();
+        pthread_mutex_lock(&locked_mutex);
+        while (locked_buf.get_count() < blk_len){
+            pthread_cond_wait(&locked_cond, &locked_mutex);
+            t0 = now_sec();
+        }
+        locked_buf.read(blk, blk_len, copy_conv, calc_len);
+        pthread_cond_signal(&locked_cond);
+        pthread_mutex_unlock(&locked_mutex);
+        st->add(now_sec() - t0);
+    }
+    return NULL;
+}
+
+/* ---- lock free version ---- */
+static spsc_ring_buffer<float> spsc_buf(capacity);
+
+static void* spsc_producer(void*)
+{
+    float blk[blk_len];
+    for (int i=0; i<blk_len; i++){
+        blk[i] = i;
+    }
+    for (int n=0; n<total_items; n+=blk_len){
+        spsc_buf.wait_for_space(blk_len);
+        spsc_buf.write(blk, blk_len);
+    }
+    return NULL;
+}
+
+static void* spsc_consumer(void* arg)
+{
+    read_stats *st = (read_stats*)arg;
+    float blk[blk_len];
+    for (int n=0; n<total_items; n+=blk_len){
+        double t0;
+        spsc_buf.wait_for_count(blk_len);
+        t0 = now_sec();
+        spsc_buf.read(blk, blk_len, copy_conv, calc_len);
+        st->add(now_sec() - t0);
+    }
+    return NULL;
+}
+
+static void run(const char* name, void* (*prod)(void*), void* (*cons)(void*))
+{
+    pthread_t tp, tc;
+    read_stats st = {0.0, 0.0, 0};
+    double t0 = now_sec(), dt;
+    
+    pthread_create(&tp, NULL, prod, NULL);
+    pthread_create(&tc, NULL, cons, &st);
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+    dt = now_sec() - t0;
+
+    printf("%-8s %8.1f Mitems/s   read avg %6.2f us  max %8.2f us\n",
+           name, total_items / dt * 1e-6,
+           st.sum_read / st.n_read * 1e6, st.max_read * 1e6);
+}
+
+/* a wait that can never be met has to come back on wakeup() */
+static spsc_ring_buffer<float> stop_buf(16);
+
+static void* forever_waiter(void* arg)
+{
+    *(bool*)arg = stop_buf.wait_for_count(32);
+    return NULL;
+}
+
+/* notifies that do not meet the condition, the waiter keeps its deadline */
+static void* noisy_producer(void* arg)
+{
+    float x = 0;
+    double t_end = now_sec() + 1.0;
+
+    while (now_sec() < t_end){
+        stop_buf.write(&x, 1);
+        stop_buf.read(&x, 1, copy_conv, calc_len);
+        usleep(1000);
+    }
+    return NULL;
+}
+
+static int check_waits()
+{
+    pthread_t t;
+    bool got = true;
+    double t0, dt;
+    int failed = 0;
+
+    pthread_create(&t, NULL, forever_waiter, &got);
+    usleep(50000);
+    stop_buf.wakeup();
+    pthread_join(t, NULL);
+    if (got){
+        printf("wait_for_count() past the capacity returned true\n");
+        failed = 1;
+    }
+
+    stop_buf.clear_abort();
+    pthread_create(&t, NULL, noisy_producer, NULL);
+    t0 = now_sec();
+    got = stop_buf.wait_for_count(32, 100);
+    dt = now_sec() - t0;
+    pthread_join(t, NULL);
+    if (got || dt > 0.3){
+        printf("a 100ms wait woken every ms took %.0f ms\n", dt * 1e3);
+        failed = 1;
+    }
+    printf("wakeup releases an endless wait, a 100ms wait woken every ms took %.0f ms\n",
+           dt * 1e3);
+    return failed;
+}
+
+int main()
+{
+    run("locked", locked_producer, locked_consumer);
+    run("spsc", spsc_producer, spsc_consumer);
+    return check_waits();
+}
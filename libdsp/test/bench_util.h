@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+/* what the benches share: the clock, the test filters and the timing 
+ * loops over a whole input */
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+static inline double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* hamming windowed sinc cut at fc of the filter rate */
+static inline std::vector<float> lowpass(int n_taps, double fc, double gain)
+{
+    std::vector<float> h(n_taps);
+
+    for (int i=0; i<n_taps; i++){
+        double x = i - (n_taps - 1) / 2.0;
+        double s = x == 0 ? 2*fc : sin(2*M_PI*fc*x) / (M_PI*x);
+        h[i] = (float)(gain * s * (0.54 - 0.46*cos(2*M_PI*i/(n_taps - 1))));
+    }
+    return h;
+}
+
+/* a resampler or decimator fed blk_len at a time, input MSamples/s */
+template <class D, class T>
+static double run_rate(D &d, const std::vector<T> &in, std::vector<T> &out, float rate, int blk_len)
+{
+    int max_out = (int)(blk_len / rate) + 4;
+    size_t n = 0;
+    double t0;
+
+    out.resize(0);
+    out.resize((size_t)(in.size() / rate) + 2*max_out);
+    t0 = now_sec();
+    for (size_t b=0; b+blk_len<=in.size(); b+=blk_len){
+        n += d.process((T*)&in[b], blk_len, &out[n], max_out, rate);
+    }
+    t0 = now_sec() - t0;
+    out.resize(n);
+    return in.size() / t0 * 1e-6;
+}
+
+/* a block convolver through its process buffer, MSamples/s */
+template <class C, class T>
+static double run_blocks(C &c, const std::vector<T> &in, std::vector<T> &out)
+{
+    int blk = c.get_blksize();
+    T *buf = c.get_process_buf();
+    double t0;
+
+    out.resize(in.size() / blk * blk);
+    t0 = now_sec();
+    for (size_t b=0; b<out.size(); b+=blk){
+        memcpy(buf, &in[b], sizeof(T)*blk);
+        c.process();
+        memcpy(&out[b], buf, sizeof(T)*blk);
+    }
+    t0 = now_sec() - t0;
+    return out.size() / t0 * 1e-6;
+}
+
+#endif
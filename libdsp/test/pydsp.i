@@ -1,6 +1,7 @@
 %module pydsp
 %{
 #define SWIG_FILE_WITH_INIT
+#include <complex>
 #include "resample.h"
 #include "decimate.h"
 %}
@@ -17,6 +18,14 @@ import_array();
 %apply (float *IN_ARRAY1, int DIM1) {(float *in, int n_in)};
 %apply (float *ARGOUT_ARRAY1, int DIM1) {(float *out, int out_len)};
 
+/* I/Q as numpy complex64, the complex taps constructors are left out as 
+ * the typechecks can not tell them from the real ones */
+%numpy_typemaps(std::complex<float>, NPY_CFLOAT, int)
+%apply (std::complex<float> *IN_ARRAY1, int DIM1) {(std::complex<float> *in, int n_in)};
+%apply (std::complex<float> *ARGOUT_ARRAY1, int DIM1) {(std::complex<float> *out, int out_len)};
+%ignore resample_c::resample_c(std::complex<float> *, int, int, int, int);
+%ignore decimate_c::decimate_c(std::complex<float> *, int, int, int, int);
+
 
 %include "resample.h"
 %include "decimate.h"
@@ -35,6 +35,8 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MAX5863_CS  (0)
 #define AUXDAC_CS   (1)
 #define FPGA_CS     (3)
+/* the configuration flash, only while the FPGA is held in reset */
+#define FLASH_CS    (4)
 
 
 #endif
@@ -0,0 +1,1084 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* 
+ * streaming tests against the emulated board, no hardware needed.
+ * exits non zero if a check fails. "emutest bench" runs the streams
+ * unthrottled and prints the host side throughput instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <dirent.h>
+#include "simpleFE.h"
+#include "usb_access.h"
+#include "ezusb.h"
+#include "sfe_flash.h"
+#include "sfe_emu.h"
+
+#define RATE        7500000
+#define CHECK(c, ...) do{ if (!(c)){ fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failures++; } }while(0)
+
+static int failures = 0;
+
+/* rx side, every byte is one more than the one before */
+typedef struct{
+    unsigned long long bytes;
+    unsigned long long gaps;
+    unsigned long long lost_packets;
+    int have_last;
+    unsigned char last;
+    unsigned max_len;
+    /* the stream metadata */
+    unsigned long long blocks;
+    unsigned long long meta_errors;
+    unsigned long long meta_lost;
+    unsigned long long gap_blocks;
+    unsigned long long overflow_blocks;
+    unsigned long long overflow_samples;
+    sfe_rx_meta prev;
+    unsigned long long next_sample;
+    /* the callback sleeps once, like a stalled application */
+    unsigned long long stall_at;
+    unsigned stall_ms;
+}rx_check;
+
+/* tx side, a 10 bit ramp goes out and is checked at the DAC */
+typedef struct{
+    unsigned next;
+    unsigned long long sent;
+    unsigned long long seen;
+    unsigned long long errors;
+    int synced;
+    unsigned expect;
+}tx_check;
+
+static rx_check rxc;
+static tx_check txc;
+static unsigned char loop_last;
+static unsigned long long loop_bad, loop_bytes;
+
+static void wait_uframes(int board, unsigned long long n)
+{
+    sfe_emu_stats st;
+    unsigned long long end;
+
+    sfe_emu_get_stats(board, &st);
+    end = st.uframes + n;
+    while (st.uframes < end){
+        usleep(1000);
+        sfe_emu_get_stats(board, &st);
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check_meta(rx_check *c, const sfe_rx_meta *m, unsigned n_iov, unsigned bytes)
+{
+    if (c->blocks){
+        /* lost samples are counted in, overflow ones before the block */
+        if (m->flags & SFE_RX_OVERFLOW){
+            c->meta_errors += m->sample < c->next_sample;
+        }else{
+            c->meta_errors += m->sample != c->next_sample;
+        }
+        c->meta_errors += m->frame < c->prev.frame + n_iov || m->time_ns < c->prev.time_ns;
+    }
+    c->meta_errors += m->rate != RATE || m->channels == 0;
+    c->next_sample = m->sample + bytes / m->channels;
+    if (m->flags & SFE_RX_OVERFLOW){
+        c->overflow_blocks++;
+        c->overflow_samples += m->lost_samples;
+    }else{
+        c->next_sample += m->lost_samples;
+    }
+    c->gap_blocks += (m->flags & SFE_RX_GAP) != 0;
+    c->meta_lost += m->lost_packets;
+    c->prev = *m;
+    c->blocks++;
+}
+
+static int rx_batch_cb(const sfe_rx_batch* batch, void* userdata)
+{
+    rx_check *c = userdata;
+    unsigned i, j;
+
+    check_meta(c, batch->meta, batch->n_iov, batch->total_bytes);
+    if (c->stall_ms && c->blocks == c->stall_at){
+        usleep(c->stall_ms * 1000);
+    }
+
+    for (i=0; i<batch->n_iov; i++){
+        if (!(batch->status[i >> 5] & (1u << (i & 31)))){
+            c->lost_packets++;
+        }
+        for (j=0; j<batch->iov[i].len; j++){
+            unsigned char v = batch->iov[i].base[j];
+            if (c->have_last && v != (unsigned char)(c->last + 1)){
+                c->gaps++;
+            }
+            c->last = v;
+            c->have_last = 1;
+        }
+        c->bytes += batch->iov[i].len;
+        c->max_len = batch->iov[i].len > c->max_len ? batch->iov[i].len : c->max_len;
+    }
+    return 0;
+}
+
+static int loop_rx_cb(const sfe_rx_batch* batch, void* userdata)
+{
+    unsigned i, j;
+
+    /* after the start the DAC ramp comes back as ramp >> 2 */
+    for (i=0; i<batch->n_iov; i++){
+        for (j=0; j<batch->iov[i].len; j++){
+            unsigned char v = batch->iov[i].base[j];
+            if (v != 0x80 && loop_bytes && v != loop_last && v != (unsigned char)(loop_last + 1)){
+                loop_bad++;
+            }
+            loop_last = v;
+            loop_bytes++;
+        }
+    }
+    return 0;
+}
+
+/* packs the ramp, 4 samples in 5 bytes */
+static int tx_cb(unsigned char* buffer, int length, void* userdata)
+{
+    tx_check *c = userdata;
+    int i;
+
+    for (i=0; i+5<=length; i+=5){
+        unsigned u0 = c->next++ & 0x3FF;
+        unsigned u1 = c->next++ & 0x3FF;
+        unsigned u2 = c->next++ & 0x3FF;
+        unsigned u3 = c->next++ & 0x3FF;
+
+        buffer[i] = (u0>>8) | ((u1>>8)<<2) | ((u2>>8)<<4) | ((u3>>8)<<6);
+        buffer[i+1] = u0 & 0xFF;
+        buffer[i+2] = u1 & 0xFF;
+        buffer[i+3] = u2 & 0xFF;
+        buffer[i+4] = u3 & 0xFF;
+        c->sent += 4;
+    }
+    return 0;
+}
+
+static void dac_cb(int board, const unsigned short *samples, unsigned n, void *userdata)
+{
+    tx_check *c = userdata;
+    unsigned i;
+
+    for (i=0; i<n; i++){
+        if (c->synced && samples[i] != c->expect){
+            c->errors++;
+        }
+        c->expect = (samples[i] + 1) & 0x3FF;
+        c->synced = 1;
+    }
+    c->seen += n;
+}
+
+static void set_config(int boards, double measure_ppm, double loss, double speed, int source)
+{
+    sfe_emu_config cfg;
+
+    sfe_emu_get_config(&cfg);
+    cfg.num_boards = boards;
+    cfg.measure_ppm = measure_ppm;
+    cfg.packet_loss = loss;
+    cfg.speed = speed;
+    cfg.adc_source = source;
+    sfe_emu_set_config(&cfg);
+}
+
+static sfe* open_board(const char *serial)
+{
+    sfe_init_options opt;
+    sfe *h;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.serial = serial;
+    h = sfe_init_ex(&opt);
+    if (h && sfe_set_sample_rate(h, RATE)){
+        sfe_close(h);
+        return NULL;
+    }
+    return h;
+}
+
+static void test_enumerate(void)
+{
+    sfe_device_info info[4];
+    int n = sfe_enumerate(info, 4);
+
+    CHECK(n == 2, "%d boards enumerated", n);
+    if (n == 2){
+        CHECK(!strcmp(info[0].serial, "EMU0000") && !strcmp(info[1].serial, "EMU0001"),
+              "serials %s %s", info[0].serial, info[1].serial);
+    }
+}
+
+struct cmd_order{
+    int next;
+    int bad;
+};
+
+/* command i writes i to auxdac channel i%4, done runs in order and only
+ * after the write has reached the board */
+static void cmd_done(int status, void *userdata)
+{
+    struct cmd_order *o = userdata;
+    sfe_emu_regs r;
+
+    sfe_emu_get_regs(0, &r);
+    o->bad += status != 0 || r.auxdac[o->next & 3] != (o->next & 0xFF);
+    o->next++;
+}
+
+static void test_cmd(void)
+{
+    sfe_emu_regs r0, r;
+    struct cmd_order order = {0, 0};
+    unsigned char wr[2] = {0x01, 0x5a}, rd[2] = {0, 0}, big[9];
+    sfe *h = open_board("EMU0000");
+    sfe_cmd *c;
+    int i, ret;
+
+    CHECK(h != NULL, "cannot open EMU0000");
+    if (!h){
+        return;
+    }
+
+    /* the enables work from the shadow of the FPGA registers */
+    sfe_emu_get_regs(0, &r0);
+    sfe_rx_enable(h, 1, 1);
+    sfe_tx_enable(h, 1, 0);
+    sfe_stop_tx(h);
+    sfe_stop_rx(h);
+    sfe_emu_get_regs(0, &r);
+    CHECK(r.status_reads == r0.status_reads, "%llu status reads",
+          r.status_reads - r0.status_reads);
+    CHECK(r.ctrl == 0, "ctrl 0x%02x after stopping", r.ctrl);
+
+    /* a sweep queued as it is built and waited for once */
+    for (i=0; i<256; i++){
+        c = sfe_cmd_new(h);
+        sfe_cmd_auxdac(c, i & 3, i);
+        sfe_cmd_external_gpio(c, i & 15, i & 1);
+        sfe_cmd_submit(c, cmd_done, &order);
+    }
+    ret = sfe_cmd_wait(h);
+    sfe_emu_get_regs(0, &r);
+    CHECK(ret == 0 && order.next == 256 && order.bad == 0, "wait %d, %d done, %d failed",
+          ret, order.next, order.bad);
+    CHECK(r.auxdac[0] == 252 && r.auxdac[1] == 253 && r.auxdac[2] == 254 && r.auxdac[3] == 255,
+          "auxdac %u %u %u %u", r.auxdac[0], r.auxdac[1], r.auxdac[2], r.auxdac[3]);
+
+    /* steps of one command see each other */
+    c = sfe_cmd_new(h);
+    sfe_cmd_i2c_write(c, 0x30, wr, 2);
+    sfe_cmd_i2c_read(c, 0x30, rd, 2);
+    ret = sfe_cmd_run(c);
+    CHECK(ret == 0 && rd[0] == 0x01 && rd[1] == 0x5a, "i2c read back %d: %02x %02x",
+          ret, rd[0], rd[1]);
+
+    /* a command that cannot be built is refused as a whole */
+    memset(big, 0, sizeof(big));
+    c = sfe_cmd_new(h);
+    sfe_cmd_auxdac(c, 0, 1);
+    sfe_cmd_i2c_write(c, 0x30, big, sizeof(big));
+    ret = sfe_cmd_submit(c, cmd_done, &order);
+    CHECK(ret == -1 && sfe_cmd_wait(h) == 0 && order.next == 256, "oversized i2c write %d", ret);
+    sfe_emu_get_regs(0, &r);
+    CHECK(r.auxdac[0] == 252, "refused command ran, auxdac %u", r.auxdac[0]);
+
+    printf("register queue: %d commands, %llu status reads\n", order.next,
+           r.status_reads - r0.status_reads);
+    sfe_close(h);
+}
+
+/* 3000 bytes at 0x100 in 16 byte records */
+static void write_hex(const char *path, unsigned seed)
+{
+    FILE *f = fopen(path, "w");
+    unsigned addr, i;
+
+    for (addr = 0x100; addr < 0x100 + 3000; addr += 16){
+        unsigned sum = 16 + (addr >> 8) + (addr & 0xFF);
+        
+        fprintf(f, ":10%04X00", addr);
+        for (i=0; i<16; i++){
+            unsigned b = (addr * 7 + i * 13 + seed) & 0xFF;
+            fprintf(f, "%02X", b);
+            sum += b;
+        }
+        fprintf(f, "%02X\n", (0x100 - (sum & 0xFF)) & 0xFF);
+    }
+    fprintf(f, ":00000001FF\n");
+    fclose(f);
+}
+
+static int count_files(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int n = 0;
+
+    while (d && (e = readdir(d)) != NULL){
+        n += e->d_name[0] != '.';
+    }
+    if (d){
+        closedir(d);
+    }
+    return n;
+}
+
+static void remove_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char path[256];
+
+    while (d && (e = readdir(d)) != NULL){
+        /* a name that does not fit is not one the test made */
+        if (e->d_name[0] != '.' &&
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) < (int)sizeof(path)){
+            remove(path);
+        }
+    }
+    if (d){
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/* the hex file is parsed once into merged writes and cached, the probe
+ * recognizes what is in RAM */
+static void test_firmware(void)
+{
+    char dir[] = "/tmp/emutest_fwXXXXXX", hex[64], other[64];
+    struct ezusb_image *img, *img2;
+    sfe_usb *usb = usb_open(0, NULL);
+    sfe_emu_regs r0, r;
+    int ret;
+
+    CHECK(usb != NULL && mkdtemp(dir) != NULL, "cannot open board 0");
+    if (!usb){
+        return;
+    }
+    verbose = 0;
+    setenv("SFE_FW_CACHE", dir, 1);
+    snprintf(hex, sizeof(hex), "%s.hex", dir);
+    snprintf(other, sizeof(other), "%s.2.hex", dir);
+    write_hex(hex, 0);
+    write_hex(other, 1);
+
+    /* stop, 3000 bytes in one write, run */
+    sfe_emu_get_regs(0, &r0);
+    ret = ezusb_load_ram(usb->dev, hex, FX_TYPE_FX2LP, IMG_TYPE_HEX, 0);
+    sfe_emu_get_regs(0, &r);
+    CHECK(ret == 0 && r.fw_writes - r0.fw_writes == 3, "load %d, %llu writes",
+          ret, r.fw_writes - r0.fw_writes);
+    CHECK(count_files(dir) == 1, "%d files in the cache", count_files(dir));
+
+    /* from the cache this time */
+    img = ezusb_image_open(hex, FX_TYPE_FX2LP);
+    img2 = ezusb_image_open(other, FX_TYPE_FX2LP);
+    CHECK(img && img2 && count_files(dir) == 2, "images %p %p, %d files in the cache",
+          (void*)img, (void*)img2, count_files(dir));
+    if (img && img2){
+        CHECK(ezusb_image_probe(usb->dev, img) == 1, "loaded firmware not recognized");
+        CHECK(ezusb_image_probe(usb->dev, img2) == 0, "other firmware recognized");
+        CHECK(ezusb_image_hash(img) != ezusb_image_hash(img2), "same hash");
+    }
+    ezusb_image_close(img);
+    ezusb_image_close(img2);
+
+    unsetenv("SFE_FW_CACHE");
+    remove(hex);
+    remove(other);
+    remove_dir(dir);
+    usb_close(usb);
+}
+
+/* the flash tools on board 1, an image at an unaligned offset so the 
+ * first and last sector are shared with what lies around it */
+static void test_flash(void)
+{
+    const unsigned addr = 0x10000 + 100, len = 100000;
+    const unsigned first = addr & ~(SFE_FLASH_SECTOR - 1);
+    const unsigned nsect = (addr + len - first + SFE_FLASH_SECTOR - 1) / SFE_FLASH_SECTOR;
+    unsigned char *img = malloc(len), *back = malloc(len), mark[100], tmp[100];
+    sfe_usb *usb = usb_open(1, NULL);
+    sfe_flash_stats st0, st;
+    sfe_emu_regs r0, r;
+    sfe_flash *f;
+    unsigned i;
+    int ret;
+
+    CHECK(usb != NULL && img && back, "cannot open board 1");
+    if (!usb || !img || !back){
+        free(img);
+        free(back);
+        return;
+    }
+    srand(7);
+    for (i=0; i<len; i++){
+        img[i] = rand() & 0xFF;
+    }
+    /* the FPGA held in reset, which leaves the spi pins to the flash */
+    set_cs_creset(usb, 1, 0);
+    f = sfe_flash_open(usb);
+
+    sfe_emu_get_regs(1, &r0);
+    ret = sfe_flash_erase(f, addr, len, SFE_FLASH_SECTOR);
+    ret = ret ? ret : sfe_flash_program(f, addr, img, len);
+    ret = ret ? ret : sfe_flash_verify(f, addr, img, len);
+    sfe_emu_flash_access(1, addr, back, len, 0);
+    sfe_flash_get_stats(f, &st0);
+    sfe_emu_get_regs(1, &r);
+    CHECK(ret == 0 && !memcmp(back, img, len), "program and verify %d", ret);
+    /* a page sent again may have made it the first time as well */
+    CHECK(r.flash_programs - r0.flash_programs >= (len + 100 + 255) / 256
+          && r.flash_programs - r0.flash_programs <= st0.pages,
+          "%llu pages programmed", r.flash_programs - r0.flash_programs);
+    CHECK(st0.resent < st0.pages / 8, "%u of %u pages sent again", st0.resent, st0.pages);
+    printf("flash: %u page programs, %u sent again, %llu commands ignored while busy\n",
+           st0.pages, st0.resent, r.flash_rejected - r0.flash_rejected);
+
+    /* something outside the image in its first sector */
+    memset(mark, 0x5a, sizeof(mark));
+    sfe_emu_flash_access(1, first, mark, sizeof(mark), 1);
+    /* sectors 0 and 3 need an erase, 10 only has bits to clear */
+    for (i=0; i<16; i++){
+        img[i] ^= 0xFF;
+        img[3*SFE_FLASH_SECTOR + i] ^= 0xFF;
+        img[10*SFE_FLASH_SECTOR + i] &= 0x0F;
+        img[10*SFE_FLASH_SECTOR + 1000 + i] &= 0xF0;
+    }
+    ret = sfe_flash_update(f, addr, img, len);
+    ret = ret ? ret : sfe_flash_verify(f, addr, img, len);
+    sfe_emu_flash_access(1, first, tmp, sizeof(tmp), 0);
+    sfe_flash_get_stats(f, &st);
+    CHECK(ret == 0 && !memcmp(tmp, mark, sizeof(mark)), "update %d", ret);
+    CHECK(st.sectors_skipped - st0.sectors_skipped == nsect - 3 
+          && st.sectors_erased - st0.sectors_erased == 2 
+          && st.sectors_patched - st0.sectors_patched == 1,
+          "%u sectors: %u skipped, %u erased, %u patched", nsect,
+          st.sectors_skipped - st0.sectors_skipped, st.sectors_erased - st0.sectors_erased,
+          st.sectors_patched - st0.sectors_patched);
+
+    /* nothing left to do */
+    sfe_emu_get_regs(1, &r0);
+    ret = sfe_flash_update(f, addr, img, len);
+    sfe_emu_get_regs(1, &r);
+    CHECK(ret == 0 && r.flash_programs == r0.flash_programs && r.flash_erases == r0.flash_erases,
+          "update of an equal image %d: %llu programs, %llu erases", ret,
+          r.flash_programs - r0.flash_programs, r.flash_erases - r0.flash_erases);
+
+    sfe_flash_close(f);
+    set_cs_creset(usb, 1, 1);
+    usb_close(usb);
+    free(img);
+    free(back);
+}
+
+static void test_rx(double loss)
+{
+    sfe_device_info di;
+    sfe_emu_stats st0, st;
+    sfe_stats ss;
+    sfe *h = open_board("EMU0001");
+
+    CHECK(h != NULL, "cannot open EMU0001");
+    if (!h){
+        return;
+    }
+    sfe_get_device_info(h, &di);
+    CHECK(!strcmp(di.serial, "EMU0001"), "opened %s", di.serial);
+    
+    set_config(2, 0, loss, 1.0, SFE_EMU_ADC_RAMP);
+    memset(&rxc, 0, sizeof(rxc));
+    sfe_rx_enable(h, 1, 1);
+    sfe_rx_start_batched(h, rx_batch_cb, &rxc);
+    /* the FIFO overflows until the first transfers are queued */
+    wait_uframes(1, 800);
+    sfe_emu_get_stats(1, &st0);
+    wait_uframes(1, 4000);
+    sfe_emu_get_stats(1, &st);
+    sfe_stop_rx(h);
+    sfe_get_stats(h, &ss);
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+    
+    printf("rx loss %.3f: %llu bytes, %llu gaps, %llu packets lost (%llu by the board), adc overflow %llu\n",
+           loss, rxc.bytes, rxc.gaps, rxc.lost_packets, st.lost_packets,
+           st.adc_overflow - st0.adc_overflow);
+    /* 0.5s of two channels */
+    CHECK(rxc.bytes > RATE/2, "only %llu bytes received", rxc.bytes);
+    CHECK(st.adc_overflow == st0.adc_overflow, "adc overflow %llu", st.adc_overflow - st0.adc_overflow);
+    if (loss == 0){
+        CHECK(rxc.gaps == 0, "%llu gaps in the ramp", rxc.gaps);
+    }else{
+        CHECK(rxc.lost_packets > 0 && rxc.gaps > 0 && rxc.gaps <= rxc.lost_packets,
+              "%llu lost packets, %llu gaps", rxc.lost_packets, rxc.gaps);
+    }
+    CHECK(rxc.meta_errors == 0, "%llu blocks out of place", rxc.meta_errors);
+    CHECK(rxc.meta_lost == rxc.lost_packets, "metadata lost %llu packets, %llu missing",
+          rxc.meta_lost, rxc.lost_packets);
+    CHECK((loss > 0) == (rxc.gap_blocks > 0), "%llu blocks with gaps", rxc.gap_blocks);
+    CHECK(rxc.overflow_blocks == 0, "%llu blocks overflowed", rxc.overflow_blocks);
+    /* the first transfers are not delivered */
+    CHECK(ss.rx_bytes >= rxc.bytes, "stats %llu bytes, %llu received", ss.rx_bytes, rxc.bytes);
+    CHECK(ss.rx_failed_packets >= rxc.lost_packets && (loss > 0) == (ss.rx_failed_packets > 0),
+          "stats %llu failed packets, %llu lost", ss.rx_failed_packets, rxc.lost_packets);
+    sfe_close(h);
+}
+
+/* the application holds the event thread for longer than the transfers
+ * in flight last, the samples dropped by the ADC FIFO are reported */
+static void test_rx_stall(void)
+{
+    sfe_init_options opt;
+    sfe_emu_stats st0, st;
+    double dropped;
+    sfe *h;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.serial = "EMU0001";
+    opt.packets_per_xfer = 8;
+    opt.num_xfers = 8;
+    h = sfe_init_ex(&opt);
+    CHECK(h != NULL, "cannot open EMU0001");
+    if (!h){
+        return;
+    }
+    sfe_set_sample_rate(h, RATE);
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+    memset(&rxc, 0, sizeof(rxc));
+    rxc.stall_at = 400;
+    rxc.stall_ms = 100;
+    sfe_rx_enable(h, 1, 1);
+    sfe_rx_start_batched(h, rx_batch_cb, &rxc);
+    wait_uframes(1, 800);
+    sfe_emu_get_stats(1, &st0);
+    wait_uframes(1, 8000);
+    sfe_emu_get_stats(1, &st);
+    sfe_stop_rx(h);
+
+    dropped = (st.adc_overflow - st0.adc_overflow) / 2.0;
+    printf("rx stall: %llu blocks, %llu overflowed, %llu samples reported lost, %.0f dropped\n",
+           rxc.blocks, rxc.overflow_blocks, rxc.overflow_samples, dropped);
+    CHECK(rxc.meta_errors == 0, "%llu blocks out of place", rxc.meta_errors);
+    CHECK(rxc.overflow_blocks > 0 && dropped > 0, "stall not seen, %.0f samples dropped", dropped);
+    /* an estimate from the host clock, the emulator runs a bit behind it */
+    CHECK(rxc.overflow_samples > 0.5 * dropped && rxc.overflow_samples < 1.5 * dropped,
+          "%llu samples reported lost, %.0f dropped", rxc.overflow_samples, dropped);
+    sfe_close(h);
+}
+
+/* one channel at the top rate fits one iso transaction per microframe,
+ * two need two */
+static void test_iso_sizing(void)
+{
+    sfe_emu_regs r;
+    int nch;
+    sfe *h = open_board("EMU0001");
+
+    CHECK(h != NULL, "cannot open EMU0001");
+    if (!h){
+        return;
+    }
+    CHECK(sfe_get_max_sample_rate(h, 2, 0) == RATE && sfe_get_max_sample_rate(h, 2, 2) == RATE,
+          "max rate %u rx, %u full duplex", sfe_get_max_sample_rate(h, 2, 0),
+          sfe_get_max_sample_rate(h, 2, 2));
+    for (nch=1; nch<=2; nch++){
+        memset(&rxc, 0, sizeof(rxc));
+        sfe_rx_enable(h, 1, nch == 2);
+        sfe_rx_start_batched(h, rx_batch_cb, &rxc);
+        wait_uframes(1, 4000);
+        sfe_stop_rx(h);
+        sfe_emu_get_regs(1, &r);
+        printf("iso sizing: %d channels, %u transactions, packets up to %u bytes\n",
+               nch, r.isopkts, rxc.max_len);
+        CHECK(r.isopkts == (unsigned)nch, "%u transactions per microframe", r.isopkts);
+        CHECK(rxc.max_len <= 1024u * nch, "%u bytes in a packet", rxc.max_len);
+        CHECK(rxc.gaps == 0, "%llu gaps", rxc.gaps);
+        CHECK(rxc.bytes > (unsigned long long)RATE * nch / 4, "only %llu bytes", rxc.bytes);
+    }
+    sfe_close(h);
+}
+
+static void set_clock(double clock_ppm)
+{
+    sfe_emu_config cfg;
+
+    sfe_emu_get_config(&cfg);
+    cfg.clock_ppm = clock_ppm;
+    sfe_emu_set_config(&cfg);
+}
+
+static void test_tx(double clock_ppm, double measure_ppm, unsigned long long uframes, double speed)
+{
+    sfe_emu_stats st0, st;
+    sfe_tx_rate_state rs;
+    sfe *h = open_board("EMU0000");
+    unsigned long long underflow;
+
+    CHECK(h != NULL, "cannot open EMU0000");
+    if (!h){
+        return;
+    }
+    set_config(2, measure_ppm, 0, speed, SFE_EMU_ADC_RAMP);
+    set_clock(clock_ppm);
+    memset(&txc, 0, sizeof(txc));
+    sfe_emu_set_dac_callback(dac_cb, &txc);
+    sfe_tx_enable(h, 1, 0);
+    sfe_tx_start(h, tx_cb, &txc);
+    /* the first second fills the FIFO */
+    wait_uframes(0, 8000);
+    sfe_emu_get_stats(0, &st0);
+    wait_uframes(0, uframes);
+    sfe_emu_get_stats(0, &st);
+    sfe_get_tx_rate_state(h, &rs);
+    sfe_stop_tx(h);
+    sfe_emu_set_dac_callback(NULL, NULL);
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+    set_clock(0);
+
+    underflow = st.dac_underflow - st0.dac_underflow;
+    printf("tx clock %+.0fppm read %+.0fppm: %llu samples sent, %llu converted, %llu errors, "
+           "dac level %u, underflow %llu, overflow %llu, estimated %+.1fppm\n",
+           clock_ppm, clock_ppm + measure_ppm, txc.sent, txc.seen, txc.errors, 
+           st.dac_level, underflow, st.dac_overflow, rs.est_ppm);
+    CHECK(txc.seen > RATE/2, "only %llu samples converted", txc.seen);
+    CHECK(txc.errors == 0, "%llu samples out of sequence", txc.errors);
+    CHECK(underflow == 0, "dac underflow %llu", underflow);
+    CHECK(st.dac_overflow == 0, "dac overflow %llu", st.dac_overflow);
+    if (uframes >= 20*8000){
+        /* the estimate settles in a few of its 10s time constants */
+        CHECK(fabs(rs.est_ppm - clock_ppm) < 5, "estimated %.1fppm, the DAC runs at %+.0fppm",
+              rs.est_ppm, clock_ppm);
+    }
+    sfe_close(h);
+}
+
+static void test_loopback(void)
+{
+    sfe *h = open_board("EMU0000");
+
+    CHECK(h != NULL, "cannot open EMU0000");
+    if (!h){
+        return;
+    }
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_LOOPBACK);
+    memset(&txc, 0, sizeof(txc));
+    loop_bytes = loop_bad = 0;
+    sfe_tx_enable(h, 1, 0);
+    sfe_rx_enable(h, 1, 0);
+    sfe_tx_start(h, tx_cb, &txc);
+    sfe_rx_start_batched(h, loop_rx_cb, NULL);
+    wait_uframes(0, 4000);
+    sfe_stop_rx(h);
+    sfe_stop_tx(h);
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+
+    printf("loopback: %llu bytes, %llu out of sequence\n", loop_bytes, loop_bad);
+    CHECK(loop_bytes > RATE/4, "only %llu bytes looped back", loop_bytes);
+    CHECK(loop_bad == 0, "%llu samples out of sequence", loop_bad);
+    sfe_close(h);
+}
+
+static unsigned long long hist_sum(const unsigned long long *hist, unsigned n)
+{
+    unsigned long long sum = 0;
+    unsigned i;
+
+    for (i=0; i<n; i++){
+        sum += hist[i];
+    }
+    return sum;
+}
+
+/* the counters of sfe_get_stats against what the callbacks saw */
+static void test_stats(void)
+{
+    sfe_stats ss;
+    sfe *h = open_board("EMU0000");
+
+    CHECK(h != NULL, "cannot open EMU0000");
+    if (!h){
+        return;
+    }
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+    memset(&rxc, 0, sizeof(rxc));
+    memset(&txc, 0, sizeof(txc));
+    sfe_tx_enable(h, 1, 0);
+    sfe_rx_enable(h, 1, 1);
+    sfe_tx_start(h, tx_cb, &txc);
+    sfe_rx_start_batched(h, rx_batch_cb, &rxc);
+    wait_uframes(0, 4000);
+    sfe_stop_rx(h);
+    sfe_stop_tx(h);
+    sfe_get_stats(h, &ss);
+
+    printf("stats: rx %llu transfers %llu bytes, tx %llu transfers %llu bytes, "
+           "%llu level readings, clock %llu Hz\n", ss.rx_transfers, ss.rx_bytes,
+           ss.tx_transfers, ss.tx_bytes, ss.rc_updates, ss.clock_hz);
+    CHECK(ss.rx_bytes >= rxc.bytes && rxc.bytes > RATE/4, "stats %llu bytes, %llu received",
+          ss.rx_bytes, rxc.bytes);
+    /* 4 samples in 5 bytes, the priming transfers are not completed ones */
+    CHECK(ss.tx_bytes <= txc.sent * 5 / 4 && ss.tx_bytes > RATE/4 * 5 / 4,
+          "stats %llu bytes, %llu samples sent", ss.tx_bytes, txc.sent);
+    CHECK(ss.rx_failed_packets == 0 && ss.tx_failed_packets == 0 && ss.tx_short_packets == 0 &&
+          ss.rx_resubmit_errors == 0 && ss.tx_resubmit_errors == 0 && ss.ctrl_errors == 0,
+          "errors without loss: rx %llu tx %llu short %llu resubmit %llu %llu control %llu",
+          ss.rx_failed_packets, ss.tx_failed_packets, ss.tx_short_packets,
+          ss.rx_resubmit_errors, ss.tx_resubmit_errors, ss.ctrl_errors);
+    CHECK(hist_sum(ss.tx_callback_time, SFE_STATS_TIME_BINS) == ss.tx_transfers,
+          "%llu tx callbacks timed, %llu transfers",
+          hist_sum(ss.tx_callback_time, SFE_STATS_TIME_BINS), ss.tx_transfers);
+    CHECK(hist_sum(ss.rx_callback_time, SFE_STATS_TIME_BINS) > 0 &&
+          hist_sum(ss.rx_callback_time, SFE_STATS_TIME_BINS) <= ss.rx_transfers,
+          "%llu rx callbacks timed, %llu transfers",
+          hist_sum(ss.rx_callback_time, SFE_STATS_TIME_BINS), ss.rx_transfers);
+    CHECK(ss.rc_updates > 0 && hist_sum(ss.dac_level, SFE_STATS_LEVEL_BINS) == ss.rc_updates,
+          "%llu dac levels, %llu rate control updates",
+          hist_sum(ss.dac_level, SFE_STATS_LEVEL_BINS), ss.rc_updates);
+    CHECK(ss.clock_hz > 29000000 && ss.clock_hz < 31000000, "clock %llu Hz", ss.clock_hz);
+    CHECK(ss.log_dropped == 0 && ss.last_error == 0, "%llu messages dropped, last error %d",
+          ss.log_dropped, ss.last_error);
+    sfe_close(h);
+}
+
+/* bursts of full scale on an idle DAC, the rx sample they loop back at */
+#define BURST_RUNS 8
+
+typedef struct{
+    unsigned left;
+    unsigned len;
+    unsigned late;
+    unsigned long long run_start[BURST_RUNS];
+    unsigned long long run_len[BURST_RUNS];
+    unsigned runs;
+    int in_run;
+    /* bursts the callback queues on its own, delta apart */
+    sfe *h;
+    unsigned chain;
+    unsigned delta;
+    unsigned chained;
+    unsigned chain_fail;
+}burst_check;
+
+static burst_check bc;
+
+static int burst_cb(unsigned char* buffer, int length, unsigned flags, void* userdata)
+{
+    burst_check *c = userdata;
+    unsigned n;
+
+    if (flags & SFE_TX_SOB){
+        c->left = c->len;
+        if (c->chained < c->chain){
+            sfe_tx_rate_state rs;
+            unsigned long long t;
+
+            /* none of these may take a lock the caller holds */
+            sfe_get_tx_rate_state(c->h, &rs);
+            if (sfe_tx_get_time(c->h, &t) || sfe_tx_burst(c->h, t + c->delta)){
+                c->chain_fail++;
+            }
+            c->chained++;
+        }
+    }
+    c->late += (flags & SFE_TX_LATE) != 0;
+    /* code 1023 packs to all ones */
+    n = c->left * 5 / 4;
+    n = n < (unsigned)length ? n : (unsigned)length;
+    memset(buffer, 0xFF, n);
+    c->left -= n * 4 / 5;
+    return n;
+}
+
+static int burst_rx_cb(const sfe_rx_batch* batch, void* userdata)
+{
+    burst_check *c = userdata;
+    unsigned long long s = batch->meta->sample;
+    unsigned i, j;
+
+    for (i=0; i<batch->n_iov; i++){
+        for (j=0; j<batch->iov[i].len; j++, s++){
+            int high = batch->iov[i].base[j] == 0xFF;
+            
+            if (high && !c->in_run){
+                c->in_run = c->runs < BURST_RUNS;
+                if (c->in_run){
+                    c->run_start[c->runs++] = s;
+                }
+            }
+            else if (!high){
+                c->in_run = 0;
+            }
+            if (c->in_run){
+                c->run_len[c->runs-1]++;
+            }
+        }
+    }
+    return 0;
+}
+
+static void test_tx_burst(void)
+{
+    sfe_emu_stats st0, st;
+    unsigned long long t, first = 0;
+    const unsigned n = 1000, delta = 75000;
+    unsigned i;
+    int ret = -1;
+    sfe *h = open_board("EMU0000");
+
+    CHECK(h != NULL, "cannot open EMU0000");
+    if (!h){
+        return;
+    }
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_LOOPBACK);
+    memset(&bc, 0, sizeof(bc));
+    bc.len = n;
+    sfe_tx_enable(h, 1, 0);
+    sfe_rx_enable(h, 1, 0);
+    sfe_rx_start_batched(h, burst_rx_cb, &bc);
+    sfe_tx_start_burst(h, burst_cb, &bc);
+    for (i=0; i<2000 && ret; i++){
+        usleep(1000);
+        ret = sfe_tx_get_time(h, &t);
+    }
+    CHECK(ret == 0, "tx never lined up with rx");
+    if (!ret){
+        first = t + RATE / 20;
+        for (i=0; i<3; i++){
+            CHECK(sfe_tx_burst(h, first + i * delta) == 0, "cannot queue burst %u", i);
+        }
+        sfe_emu_get_stats(0, &st0);
+        wait_uframes(0, (RATE / 20 + 3 * delta) / (RATE / 8000) + 800);
+        sfe_emu_get_stats(0, &st);
+    }
+    sfe_stop_tx(h);
+    sfe_stop_rx(h);
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+
+    printf("tx burst: %u runs", bc.runs);
+    for (i=0; i<bc.runs; i++){
+        printf(" %lld+%llu", (long long)(bc.run_start[i] - first), bc.run_len[i]);
+    }
+    printf("\n");
+    if (!ret){
+        CHECK(bc.runs == 3, "%u bursts came back", bc.runs);
+        CHECK(bc.late == 0, "%u bursts late", bc.late);
+        CHECK(st.dac_underflow == st0.dac_underflow, "dac underflow between bursts");
+        for (i=0; i<bc.runs && i<3; i++){
+            CHECK(bc.run_len[i] == n, "burst %u is %llu samples", i, bc.run_len[i]);
+            CHECK(bc.run_start[i] - bc.run_start[0] == i * delta, "burst %u at %llu", 
+                  i, bc.run_start[i] - bc.run_start[0]);
+        }
+        /* the line up is measured on the host */
+        CHECK(bc.runs && llabs((long long)(bc.run_start[0] - first)) < RATE / 100,
+              "first burst %lld samples off", (long long)(bc.run_start[0] - first));
+    }
+    sfe_close(h);
+}
+
+/* every burst queues the next one from inside the callback */
+static void test_tx_burst_chain(void)
+{
+    unsigned long long t;
+    const unsigned n = 1000, delta = 150000, chain = 3;
+    unsigned i, pkts, xfers;
+    int ret = -1;
+    sfe *h = open_board("EMU0000");
+
+    CHECK(h != NULL, "cannot open EMU0000");
+    if (!h){
+        return;
+    }
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_LOOPBACK);
+    memset(&bc, 0, sizeof(bc));
+    bc.len = n;
+    bc.h = h;
+    bc.chain = chain;
+    bc.delta = delta;
+    sfe_get_transfer_geometry(h, &pkts, &xfers);
+    sfe_tx_enable(h, 1, 0);
+    sfe_rx_enable(h, 1, 0);
+    sfe_rx_start_batched(h, burst_rx_cb, &bc);
+    sfe_tx_start_burst(h, burst_cb, &bc);
+    for (i=0; i<2000 && ret; i++){
+        usleep(1000);
+        ret = sfe_tx_get_time(h, &t);
+    }
+    CHECK(ret == 0, "tx never lined up with rx");
+    if (!ret){
+        CHECK(sfe_tx_burst(h, t + RATE / 20) == 0, "cannot queue the first burst");
+        wait_uframes(0, (RATE / 20 + (chain + 1) * delta) / (RATE / 8000) + 800);
+    }
+    sfe_stop_tx(h);
+    sfe_stop_rx(h);
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+
+    printf("tx burst chain: %u runs", bc.runs);
+    for (i=1; i<bc.runs; i++){
+        printf(" +%llu", bc.run_start[i] - bc.run_start[i-1]);
+    }
+    printf("\n");
+    if (!ret){
+        CHECK(bc.chained == chain && bc.chain_fail == 0, "%u of %u bursts queued from the callback",
+              bc.chained - bc.chain_fail, chain);
+        CHECK(bc.runs == chain + 1, "%u bursts came back", bc.runs);
+        CHECK(bc.late == 0, "%u bursts late", bc.late);
+        for (i=1; i<bc.runs; i++){
+            long long d = bc.run_start[i] - bc.run_start[i-1];
+
+            CHECK(bc.run_len[i] == n, "burst %u is %llu samples", i, bc.run_len[i]);
+            /* queued from where the transfer starts, not the burst */
+            CHECK(d > (long long)delta - pkts * (RATE / 8000) && d <= delta + 4,
+                  "burst %u %lld after the last", i, d);
+        }
+    }
+    sfe_close(h);
+}
+
+/* both boards at once, each on its own event thread */
+static void test_two_boards(void)
+{
+    rx_check c0, c1;
+    sfe *h0 = open_board("EMU0000");
+    sfe *h1 = open_board("EMU0001");
+
+    CHECK(h0 && h1, "cannot open both boards");
+    if (h0 && h1){
+        memset(&c0, 0, sizeof(c0));
+        memset(&c1, 0, sizeof(c1));
+        sfe_rx_enable(h0, 1, 0);
+        sfe_rx_enable(h1, 1, 1);
+        sfe_rx_start_batched(h0, rx_batch_cb, &c0);
+        sfe_rx_start_batched(h1, rx_batch_cb, &c1);
+        wait_uframes(1, 4000);
+        sfe_stop_rx(h0);
+        sfe_stop_rx(h1);
+        printf("two boards: %llu and %llu bytes\n", c0.bytes, c1.bytes);
+        CHECK(c0.gaps == 0 && c1.gaps == 0, "gaps %llu %llu", c0.gaps, c1.gaps);
+        CHECK(c1.bytes > c0.bytes * 3 / 2, "2 channels %llu vs 1 channel %llu", c1.bytes, c0.bytes);
+    }
+    if (h0){
+        sfe_close(h0);
+    }
+    if (h1){
+        sfe_close(h1);
+    }
+}
+
+static void bench(void)
+{
+    sfe_emu_stats st0, st;
+    double t0, t1;
+    sfe *h;
+
+    set_config(2, 0, 0, 0, SFE_EMU_ADC_RAMP);
+    h = open_board("EMU0000");
+    if (!h){
+        failures++;
+        return;
+    }
+    memset(&rxc, 0, sizeof(rxc));
+    memset(&txc, 0, sizeof(txc));
+    sfe_rx_enable(h, 1, 1);
+    sfe_tx_enable(h, 1, 1);
+    sfe_emu_get_stats(0, &st0);
+    t0 = now();
+    sfe_rx_start_batched(h, rx_batch_cb, &rxc);
+    sfe_tx_start(h, tx_cb, &txc);
+    sleep(3);
+    sfe_stop_tx(h);
+    sfe_stop_rx(h);
+    t1 = now();
+    sfe_emu_get_stats(0, &st);
+    
+    printf("unthrottled full duplex: %.1fx real time, rx %.1f MB/s, tx %.1f MB/s, adc overflow %llu, dac underflow %llu\n",
+           (st.uframes - st0.uframes) / 8000.0 / (t1 - t0),
+           rxc.bytes / (t1 - t0) / 1e6, txc.sent * 10 / 8 / (t1 - t0) / 1e6,
+           st.adc_overflow - st0.adc_overflow, st.dac_underflow - st0.dac_underflow);
+    sfe_close(h);
+}
+
+int main(int argc, char* argv[])
+{
+    set_config(2, 0, 0, 1.0, SFE_EMU_ADC_RAMP);
+
+    if (argc > 1 && !strcmp(argv[1], "bench")){
+        bench();
+        return failures ? 1 : 0;
+    }
+    
+    test_enumerate();
+    test_cmd();
+    test_firmware();
+    test_flash();
+    test_rx(0);
+    test_rx(0.01);
+    test_rx_stall();
+    test_iso_sizing();
+    test_tx(0, 0, 4000, 1.0);
+    /* the board clock is off and read right, and the reading is off, 
+     * where the FIFO level loop has to find the rate on its own. half a
+     * minute each at 8x real time. unthrottled, a host thread that loses
+     * the cpu for a while lets the bus run ahead of the level readings */
+    test_tx(100, 0, 30*8000, 8);
+    test_tx(0, 150, 30*8000, 8);
+    test_loopback();
+    test_stats();
+    test_tx_burst();
+    test_tx_burst_chain();
+    test_two_boards();
+
+    printf(failures ? "%d checks FAILED\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,353 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* 
+ * the subset of the libusb-1.0 api used by libsimpleFE, implemented by
+ * sfe_emu.c on top of an emulated board instead of a usb stack. building
+ * the library against this header instead of the real one gives the
+ * simpleFE_emu library, see sfe_emu.h for the knobs of the emulation.
+ */
+
+#ifndef SFE_EMU_LIBUSB_H_
+#define SFE_EMU_LIBUSB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/time.h>
+#endif
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define LIBUSB_API_VERSION          0x01000106
+#define LIBUSB_CALL
+#define LIBUSB_CONTROL_SETUP_SIZE   8
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)
+#define LIBUSB_ZERO_SIZED_ARRAY
+#else
+#define LIBUSB_ZERO_SIZED_ARRAY     0
+#endif
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+enum libusb_error{
+    LIBUSB_SUCCESS = 0,
+    LIBUSB_ERROR_IO = -1,
+    LIBUSB_ERROR_INVALID_PARAM = -2,
+    LIBUSB_ERROR_ACCESS = -3,
+    LIBUSB_ERROR_NO_DEVICE = -4,
+    LIBUSB_ERROR_NOT_FOUND = -5,
+    LIBUSB_ERROR_BUSY = -6,
+    LIBUSB_ERROR_TIMEOUT = -7,
+    LIBUSB_ERROR_OVERFLOW = -8,
+    LIBUSB_ERROR_PIPE = -9,
+    LIBUSB_ERROR_INTERRUPTED = -10,
+    LIBUSB_ERROR_NO_MEM = -11,
+    LIBUSB_ERROR_NOT_SUPPORTED = -12,
+    LIBUSB_ERROR_OTHER = -99
+};
+
+enum libusb_transfer_status{
+    LIBUSB_TRANSFER_COMPLETED,
+    LIBUSB_TRANSFER_ERROR,
+    LIBUSB_TRANSFER_TIMED_OUT,
+    LIBUSB_TRANSFER_CANCELLED,
+    LIBUSB_TRANSFER_STALL,
+    LIBUSB_TRANSFER_NO_DEVICE,
+    LIBUSB_TRANSFER_OVERFLOW
+};
+
+enum libusb_endpoint_direction{
+    LIBUSB_ENDPOINT_OUT = 0x00,
+    LIBUSB_ENDPOINT_IN = 0x80
+};
+
+enum libusb_request_type{
+    LIBUSB_REQUEST_TYPE_STANDARD = 0x00 << 5,
+    LIBUSB_REQUEST_TYPE_CLASS = 0x01 << 5,
+    LIBUSB_REQUEST_TYPE_VENDOR = 0x02 << 5,
+    LIBUSB_REQUEST_TYPE_RESERVED = 0x03 << 5
+};
+
+enum libusb_request_recipient{
+    LIBUSB_RECIPIENT_DEVICE = 0x00,
+    LIBUSB_RECIPIENT_INTERFACE = 0x01,
+    LIBUSB_RECIPIENT_ENDPOINT = 0x02,
+    LIBUSB_RECIPIENT_OTHER = 0x03
+};
+
+enum libusb_transfer_type{
+    LIBUSB_TRANSFER_TYPE_CONTROL = 0,
+    LIBUSB_TRANSFER_TYPE_ISOCHRONOUS = 1,
+    LIBUSB_TRANSFER_TYPE_BULK = 2,
+    LIBUSB_TRANSFER_TYPE_INTERRUPT = 3
+};
+
+enum libusb_transfer_flags{
+    LIBUSB_TRANSFER_SHORT_NOT_OK = 1 << 0,
+    LIBUSB_TRANSFER_FREE_BUFFER = 1 << 1,
+    LIBUSB_TRANSFER_FREE_TRANSFER = 1 << 2
+};
+
+enum libusb_log_level{
+    LIBUSB_LOG_LEVEL_NONE = 0,
+    LIBUSB_LOG_LEVEL_ERROR,
+    LIBUSB_LOG_LEVEL_WARNING,
+    LIBUSB_LOG_LEVEL_INFO,
+    LIBUSB_LOG_LEVEL_DEBUG
+};
+
+struct libusb_device_descriptor{
+    uint8_t  bLength;
+    uint8_t  bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t  bDeviceClass;
+    uint8_t  bDeviceSubClass;
+    uint8_t  bDeviceProtocol;
+    uint8_t  bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t  iManufacturer;
+    uint8_t  iProduct;
+    uint8_t  iSerialNumber;
+    uint8_t  bNumConfigurations;
+};
+
+struct libusb_control_setup{
+    uint8_t  bmRequestType;
+    uint8_t  bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+};
+
+struct libusb_iso_packet_descriptor{
+    unsigned int length;
+    unsigned int actual_length;
+    enum libusb_transfer_status status;
+};
+
+struct libusb_transfer;
+typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer{
+    libusb_device_handle *dev_handle;
+    uint8_t flags;
+    unsigned char endpoint;
+    unsigned char type;
+    unsigned int timeout;
+    enum libusb_transfer_status status;
+    int length;
+    int actual_length;
+    libusb_transfer_cb_fn callback;
+    void *user_data;
+    unsigned char *buffer;
+    int num_iso_packets;
+    struct libusb_iso_packet_descriptor iso_packet_desc[LIBUSB_ZERO_SIZED_ARRAY];
+};
+
+int libusb_init(libusb_context **ctx);
+void libusb_exit(libusb_context *ctx);
+void libusb_set_debug(libusb_context *ctx, int level);
+const char* libusb_error_name(int errcode);
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list);
+void libusb_free_device_list(libusb_device **list, int unref_devices);
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc);
+uint8_t libusb_get_bus_number(libusb_device *dev);
+uint8_t libusb_get_device_address(libusb_device *dev);
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers, int port_numbers_len);
+int libusb_get_max_iso_packet_size(libusb_device *dev, unsigned char endpoint);
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle);
+void libusb_close(libusb_device_handle *dev_handle);
+libusb_device* libusb_get_device(libusb_device_handle *dev_handle);
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle, uint8_t desc_index,
+                                       unsigned char *data, int length);
+int libusb_set_auto_detach_kernel_driver(libusb_device_handle *dev_handle, int enable);
+int libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number);
+int libusb_release_interface(libusb_device_handle *dev_handle, int interface_number);
+
+int libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type,
+                            uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                            unsigned char *data, uint16_t wLength, unsigned int timeout);
+int libusb_bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint,
+                         unsigned char *data, int length, int *actual_length,
+                         unsigned int timeout);
+
+struct libusb_transfer* libusb_alloc_transfer(int iso_packets);
+void libusb_free_transfer(struct libusb_transfer *transfer);
+int libusb_submit_transfer(struct libusb_transfer *transfer);
+int libusb_cancel_transfer(struct libusb_transfer *transfer);
+
+unsigned char* libusb_dev_mem_alloc(libusb_device_handle *dev_handle, size_t length);
+int libusb_dev_mem_free(libusb_device_handle *dev_handle, unsigned char *buffer, size_t length);
+
+int libusb_handle_events(libusb_context *ctx);
+int libusb_handle_events_completed(libusb_context *ctx, int *completed);
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv);
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed);
+void libusb_interrupt_event_handler(libusb_context *ctx);
+
+static inline uint16_t libusb_cpu_to_le16(const uint16_t x)
+{
+    union{
+        uint8_t  b8[2];
+        uint16_t b16;
+    }_tmp;
+    _tmp.b8[1] = (uint8_t)(x >> 8);
+    _tmp.b8[0] = (uint8_t)(x & 0xff);
+    return _tmp.b16;
+}
+#define libusb_le16_to_cpu libusb_cpu_to_le16
+
+static inline unsigned char* libusb_control_transfer_get_data(struct libusb_transfer *transfer)
+{
+    return transfer->buffer + LIBUSB_CONTROL_SETUP_SIZE;
+}
+
+static inline struct libusb_control_setup* libusb_control_transfer_get_setup(struct libusb_transfer *transfer)
+{
+    return (struct libusb_control_setup*)(void*)transfer->buffer;
+}
+
+static inline void libusb_fill_control_setup(unsigned char *buffer, uint8_t bmRequestType,
+                                             uint8_t bRequest, uint16_t wValue,
+                                             uint16_t wIndex, uint16_t wLength)
+{
+    struct libusb_control_setup *setup = (struct libusb_control_setup*)(void*)buffer;
+    setup->bmRequestType = bmRequestType;
+    setup->bRequest = bRequest;
+    setup->wValue = libusb_cpu_to_le16(wValue);
+    setup->wIndex = libusb_cpu_to_le16(wIndex);
+    setup->wLength = libusb_cpu_to_le16(wLength);
+}
+
+static inline void libusb_fill_control_transfer(struct libusb_transfer *transfer,
+                                                libusb_device_handle *dev_handle,
+                                                unsigned char *buffer,
+                                                libusb_transfer_cb_fn callback,
+                                                void *user_data, unsigned int timeout)
+{
+    struct libusb_control_setup *setup = (struct libusb_control_setup*)(void*)buffer;
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint = 0;
+    transfer->type = LIBUSB_TRANSFER_TYPE_CONTROL;
+    transfer->timeout = timeout;
+    transfer->buffer = buffer;
+    if (setup){
+        transfer->length = (int)(LIBUSB_CONTROL_SETUP_SIZE + libusb_le16_to_cpu(setup->wLength));
+    }
+    transfer->user_data = user_data;
+    transfer->callback = callback;
+}
+
+static inline void libusb_fill_bulk_transfer(struct libusb_transfer *transfer,
+                                             libusb_device_handle *dev_handle,
+                                             unsigned char endpoint, unsigned char *buffer,
+                                             int length, libusb_transfer_cb_fn callback,
+                                             void *user_data, unsigned int timeout)
+{
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint = endpoint;
+    transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+    transfer->timeout = timeout;
+    transfer->buffer = buffer;
+    transfer->length = length;
+    transfer->user_data = user_data;
+    transfer->callback = callback;
+}
+
+static inline void libusb_fill_iso_transfer(struct libusb_transfer *transfer,
+                                            libusb_device_handle *dev_handle,
+                                            unsigned char endpoint, unsigned char *buffer,
+                                            int length, int num_iso_packets,
+                                            libusb_transfer_cb_fn callback,
+                                            void *user_data, unsigned int timeout)
+{
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint = endpoint;
+    transfer->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+    transfer->timeout = timeout;
+    transfer->buffer = buffer;
+    transfer->length = length;
+    transfer->num_iso_packets = num_iso_packets;
+    transfer->user_data = user_data;
+    transfer->callback = callback;
+}
+
+static inline void libusb_set_iso_packet_lengths(struct libusb_transfer *transfer,
+                                                 unsigned int length)
+{
+    int i;
+    for (i = 0; i < transfer->num_iso_packets; i++){
+        transfer->iso_packet_desc[i].length = length;
+    }
+}
+
+static inline unsigned char* libusb_get_iso_packet_buffer(struct libusb_transfer *transfer,
+                                                          unsigned int packet)
+{
+    size_t offset = 0;
+    unsigned int i;
+
+    if (packet >= (unsigned int)transfer->num_iso_packets){
+        return NULL;
+    }
+    for (i = 0; i < packet; i++){
+        offset += transfer->iso_packet_desc[i].length;
+    }
+    return transfer->buffer + offset;
+}
+
+static inline unsigned char* libusb_get_iso_packet_buffer_simple(struct libusb_transfer *transfer,
+                                                                 unsigned int packet)
+{
+    if (packet >= (unsigned int)transfer->num_iso_packets){
+        return NULL;
+    }
+    return transfer->buffer + (size_t)transfer->iso_packet_desc[0].length * packet;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
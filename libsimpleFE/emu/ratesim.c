@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* the tx rate control against a model of the bus and the DAC FIFO, hours
+ * of streaming in a few seconds and no board needed.
+ *
+ * the host sends one packet per microframe of its own clock from a queue
+ * of transfers, refilled as they complete. the DAC drains the FIFO at the
+ * board clock, in whole 5 byte frames. the level is read as every
+ * transfer completes and the board clock every 80000 packets, like 
+ * simpleFE.c does. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sfe_ratectl.h"
+
+#define CHECK(c, ...) do{ if (!(c)){ fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failures++; } }while(0)
+
+#define NOMINAL         9375000.0   /* 7.5MS/s, one channel */
+#define FIFO_BYTES      4096
+#define PKTS_PER_XFER   120
+#define LEVEL_PKTS      PKTS_PER_XFER
+#define CLOCK_PKTS      80000
+#define UFRAMES_PER_SEC 8000
+/* the FIFO starts empty, the prime needs a few frames to get there */
+#define SETTLE_UFRAMES  (UFRAMES_PER_SEC / 10)
+
+static int failures = 0;
+
+typedef struct{
+    const char *name;
+    double board_ppm;      /* DAC clock against nominal */
+    double read_ppm;       /* error of the board clock reading */
+    double wander_ppm;     /* peak of a slow sine on top of board_ppm */
+    double wander_sec;
+    double step_ppm;       /* jump of board_ppm half way through */
+    unsigned depth;        /* transfers in flight */
+    double seconds;
+    double max_est_err;    /* ppm, over the last quarter */
+}scenario;
+
+typedef struct{
+    unsigned lengths[PKTS_PER_XFER];
+}xfer;
+
+typedef struct{
+    unsigned long long underflow;
+    unsigned long long overflow;
+    unsigned min_fill, max_fill;
+    double max_est_err;
+    double est_ppm;
+    double true_ppm;
+}result;
+
+static double board_ppm(const scenario *sc, double t)
+{
+    double ppm = sc->board_ppm;
+    
+    if (sc->wander_ppm != 0){
+        ppm += sc->wander_ppm * sin(2 * M_PI * t / sc->wander_sec);
+    }
+    if (t >= sc->seconds / 2){
+        ppm += sc->step_ppm;
+    }
+    return ppm;
+}
+
+/* what set_tx_packet_info() does */
+static void fill_xfer(sfe_ratectl *rc, xfer *x)
+{
+    unsigned total = sfe_rc_next(rc, PKTS_PER_XFER);
+    unsigned len0 = total / PKTS_PER_XFER;
+    unsigned i;
+
+    for (i=1; i<PKTS_PER_XFER; i++){
+        x->lengths[i] = len0;
+    }
+    x->lengths[0] = total - len0 * (PKTS_PER_XFER - 1);
+}
+
+static void run(const scenario *sc, result *r)
+{
+    static xfer queue[SFE_RC_MAX_DEPTH];
+    sfe_ratectl rc;
+    sfe_tx_rate_state st;
+    unsigned long long uf, n_uframes = (unsigned long long)(sc->seconds * UFRAMES_PER_SEC);
+    unsigned head = 0, pkt = 0, level_pkts = 0, clock_pkts = 0, i;
+    double fill = 0, drain = 0;
+    double t, ppm;
+
+    memset(r, 0, sizeof(*r));
+    r->min_fill = FIFO_BYTES;
+    
+    ppm = board_ppm(sc, 0);
+    sfe_rc_init(&rc, NOMINAL, NOMINAL * (1 + (ppm + sc->read_ppm) * 1e-6),
+                sc->depth, FIFO_BYTES, (double)LEVEL_PKTS / UFRAMES_PER_SEC);
+    for (i=0; i<sc->depth; i++){
+        fill_xfer(&rc, &queue[i]);
+    }
+
+    for (uf=0; uf<n_uframes; uf++){
+        t = (double)uf / UFRAMES_PER_SEC;
+        ppm = board_ppm(sc, t);
+
+        /* the DAC takes whole frames */
+        drain += NOMINAL * (1 + ppm * 1e-6) / UFRAMES_PER_SEC;
+        while (drain >= SFE_RC_FRAME_BYTES){
+            drain -= SFE_RC_FRAME_BYTES;
+            if (fill < SFE_RC_FRAME_BYTES){
+                if (uf > SETTLE_UFRAMES){
+                    r->underflow += SFE_RC_FRAME_BYTES;
+                }
+            }else{
+                fill -= SFE_RC_FRAME_BYTES;
+            }
+        }
+        if (uf > SETTLE_UFRAMES && fill < r->min_fill){
+            r->min_fill = (unsigned)fill;
+        }
+
+        /* one packet from the head of the queue */
+        fill += queue[head].lengths[pkt];
+        if (fill > FIFO_BYTES){
+            if (uf > SETTLE_UFRAMES){
+                r->overflow += (unsigned long long)(fill - FIFO_BYTES);
+            }
+            fill = FIFO_BYTES;
+        }
+        if (uf > SETTLE_UFRAMES && fill > r->max_fill){
+            r->max_fill = (unsigned)fill;
+        }
+
+        if (++pkt == PKTS_PER_XFER){
+            /* the completion, level and clock readings go out with it. 
+               they come after the packet of the microframe */
+            level_pkts += PKTS_PER_XFER;
+            clock_pkts += PKTS_PER_XFER;
+            if (level_pkts >= LEVEL_PKTS){
+                level_pkts = 0;
+                sfe_rc_level(&rc, fill >= FIFO_BYTES ? 0x3F : (unsigned)fill * 64 / FIFO_BYTES);
+            }
+            if (clock_pkts >= CLOCK_PKTS){
+                clock_pkts = 0;
+                sfe_rc_clock(&rc, NOMINAL * (1 + (ppm + sc->read_ppm) * 1e-6));
+            }
+            fill_xfer(&rc, &queue[head]);
+            head = (head + 1) % sc->depth;
+            pkt = 0;
+        }
+
+        if (uf >= n_uframes * 3 / 4 && uf % UFRAMES_PER_SEC == 0){
+            sfe_rc_get_state(&rc, &st);
+            if (fabs(st.est_ppm - ppm) > r->max_est_err){
+                r->max_est_err = fabs(st.est_ppm - ppm);
+            }
+        }
+    }
+    sfe_rc_get_state(&rc, &st);
+    r->est_ppm = st.est_ppm;
+    r->true_ppm = ppm;
+}
+
+/* the readings can be a few 100 ppm off, the host usb clock alone may be
+ * 500 ppm off. nothing sent can reach the FIFO before the transfers 
+ * already queued, a shorter queue copes with more at the start */
+static const scenario scenarios[] = {
+    /* name                   board  read  wander  period step depth secs  est */
+    {"nominal",                   0,    0,     0,     0,    0,  32,  120,  3},
+    {"board +100ppm",           100,    0,     0,     0,    0,  32,  120,  3},
+    {"board -250ppm",          -250,    0,     0,     0,    0,  32,  120,  3},
+    {"reading +200ppm",           0,  200,     0,     0,    0,  32,  120,  3},
+    {"reading -200ppm",          50, -200,     0,     0,    0,  32,  120,  3},
+    {"reading +500ppm",           0,  500,     0,     0,    0,   8,  120,  3},
+    {"reading -500ppm",           0, -500,     0,     0,    0,   8,  120,  3},
+    {"wander 20ppm/600s",         0,    0,    20,   600,    0,  32, 1200,  5},
+    {"step +40ppm",              20,    0,     0,     0,   40,  32,  120,  3},
+};
+
+int main(int argc, char **argv)
+{
+    unsigned i;
+    result r;
+
+    printf("%-20s %10s %10s %10s %10s %10s %10s %10s\n", "", "true ppm", "est ppm", 
+           "max err", "min fill", "max fill", "underflow", "overflow");
+    for (i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); i++){
+        const scenario *sc = &scenarios[i];
+        
+        run(sc, &r);
+        printf("%-20s %+10.1f %+10.1f %10.2f %10u %10u %10llu %10llu\n", sc->name, r.true_ppm, 
+               r.est_ppm, r.max_est_err, r.min_fill, r.max_fill, r.underflow, r.overflow);
+        CHECK(r.underflow == 0 && r.overflow == 0, "%s: FIFO under/overflow", sc->name);
+        CHECK(r.max_est_err <= sc->max_est_err, "%s: estimate off by %.2fppm", sc->name, r.max_est_err);
+    }
+    
+    printf(failures ? "%d checks FAILED\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,1547 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "libusb.h"
+#include "sfe_emu.h"
+#include "usb_access.h"
+#include "chip_select.h"
+
+#define EMU_VID             0x1209
+#define EMU_PID             0xA119
+#define EMU_FPGA_CLK        30000000
+#define EMU_SERIAL_INDEX    3
+#define EMU_EP_SPI_OUT      0x01
+#define EMU_EP_SPI_IN       0x81
+#define EMU_EP_DATA_OUT     0x02
+#define EMU_EP_DATA_IN      0x86
+#define EMU_GPIO_CDONE      6
+#define EMU_GPIO_FLASH_CS   4
+#define EMU_GPIO_CRESET     7
+#define EMU_UFRAMES_PER_SEC 8000
+#define EMU_UFRAMES_PER_MS  8
+#define EMU_MAX_SPI         64
+#define EMU_FX_RAM          65536      /* what the 0xA0 loader request reaches */
+#define EMU_VR_LOAD         0xA0
+/* a W25Q16 behind the FPGA, timed on a clock that also counts the usb
+ * requests, so polling it takes time even when nothing streams */
+#define EMU_FLASH_BYTES     (2*1024*1024)
+#define EMU_FLASH_PAGE      256
+#define EMU_REQUEST_NS      125000LL
+#define EMU_SPI_BYTE_NS     1333LL
+#define EMU_ISO_TRANSACTION 1024
+#define EMU_PP_NS           700000LL
+#define EMU_SE_NS           45000000LL
+#define EMU_BE_NS           150000000LL
+#define EMU_CE_NS           2000000000LL
+
+/* the emulator's own bookkeeping sits in front of every transfer */
+struct emu_xfer{
+    struct emu_xfer *next;
+    libusb_device_handle *handle;
+    int num_iso;
+    int pkt;            /* next iso packet served */
+    size_t offset;      /* of that packet in the buffer */
+};
+#define XFER_OF(e)  ((struct libusb_transfer*)(void*)((char*)(e) + sizeof(struct emu_xfer)))
+#define EMU_OF(t)   ((struct emu_xfer*)(void*)((char*)(t) - sizeof(struct emu_xfer)))
+
+struct byte_fifo{
+    unsigned char *buf;
+    unsigned size;
+    unsigned rd;
+    unsigned fill;
+};
+
+struct emu_board;
+
+struct emu_flash{
+    unsigned char *mem;
+    unsigned char cmd;
+    unsigned addr;
+    int ignored;                /* busy when selected, only RSR1 works */
+    int wel;
+    long long busy_until;
+    unsigned char page[EMU_FLASH_PAGE];
+    unsigned char page_mask[EMU_FLASH_PAGE];
+    unsigned long long programs;
+    unsigned long long erases;
+    unsigned long long rejected;
+};
+
+/* a board as seen through one context */
+struct libusb_device{
+    struct emu_board *board;
+    libusb_context *ctx;
+};
+
+struct libusb_context{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct emu_xfer *done_head;
+    struct emu_xfer *done_tail;
+    int interrupted;
+    struct libusb_device devs[SFE_EMU_MAX_BOARDS];
+};
+
+struct emu_board{
+    int index;
+    char serial[16];
+    
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int thread_running;
+    int thread_exit;
+    int open_count;
+    libusb_device_handle *owner;   /* claimed interface 0 */
+
+    /* FX2 side */
+    unsigned char gpio[8];
+    unsigned char i2c[128][8];
+    unsigned char spi_miso[EMU_MAX_SPI];
+    int spi_len;
+    int spi_pos;
+    int spi_cs;          /* gpio of the selected spi slave, -1 none */
+    unsigned isopkts;    /* IN transactions per microframe, 0 all of them */
+    unsigned max_packet;
+    unsigned char fx_ram[EMU_FX_RAM];
+    unsigned long long fw_writes;
+
+    /* FPGA registers */
+    unsigned char ctrl;  /* tx_q tx_i rx_q rx_i sys_en */
+    unsigned char cdiv;
+    unsigned short ext_gpio;
+    unsigned char pll_a, pll_n;
+    unsigned char spi_cmd;
+    unsigned char max5863;
+    unsigned char auxdac[2];
+    unsigned char auxdac_val[4];
+    unsigned long long status_reads;
+    struct emu_flash flash;
+    long long xfer_ns;          /* time spent in spi and vendor requests */
+
+    /* data path */
+    struct emu_xfer *in_head, *in_tail;
+    struct emu_xfer *out_head, *out_tail;
+    struct byte_fifo adc;
+    struct byte_fifo dac;
+    struct byte_fifo loop;
+    double adc_acc;
+    double dac_acc;
+    unsigned char ramp;
+    unsigned rng;
+    sfe_emu_stats stats;
+};
+
+struct libusb_device_handle{
+    libusb_device *dev;
+    struct emu_board *board;
+    libusb_context *ctx;
+};
+
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+static int emu_ready = 0;
+static sfe_emu_config emu_cfg;
+static struct emu_board *emu_boards[SFE_EMU_MAX_BOARDS];
+static int emu_num_boards = 0;
+static sfe_emu_dac_callback *emu_dac_cb = NULL;
+static void *emu_dac_ctx = NULL;
+
+
+static double env_double(const char *name, double def)
+{
+    const char *v = getenv(name);
+    return v && *v ? atof(v) : def;
+}
+
+/* emu_lock held */
+static void load_config(void)
+{
+    const char *adc;
+    
+    if (emu_ready){
+        return;
+    }
+    memset(&emu_cfg, 0, sizeof(emu_cfg));
+    emu_cfg.num_boards = (int)env_double("SFE_EMU_BOARDS", 1);
+    emu_cfg.clock_ppm = env_double("SFE_EMU_CLOCK_PPM", 0);
+    emu_cfg.measure_ppm = env_double("SFE_EMU_MEASURE_PPM", 0);
+    emu_cfg.packet_loss = env_double("SFE_EMU_LOSS", 0);
+    emu_cfg.speed = env_double("SFE_EMU_SPEED", 1.0);
+    adc = getenv("SFE_EMU_ADC");
+    emu_cfg.adc_source = adc && !strcmp(adc, "loopback") ? SFE_EMU_ADC_LOOPBACK : SFE_EMU_ADC_RAMP;
+    /* FIFO_AW 12 in hardware/HDL/top.v */
+    emu_cfg.fifo_bytes = 4096;
+    emu_cfg.max_packet_size = 3072;
+    emu_cfg.seed = 1;
+    emu_ready = 1;
+}
+
+void sfe_emu_get_config(sfe_emu_config *cfg)
+{
+    pthread_mutex_lock(&emu_lock);
+    load_config();
+    *cfg = emu_cfg;
+    pthread_mutex_unlock(&emu_lock);
+}
+
+int sfe_emu_set_config(const sfe_emu_config *cfg)
+{
+    if (cfg->num_boards < 0 || cfg->num_boards > SFE_EMU_MAX_BOARDS ||
+        cfg->packet_loss < 0 || cfg->packet_loss > 1 || cfg->speed < 0 ||
+        cfg->fifo_bytes < 64 || cfg->max_packet_size < 5){
+        fprintf(stderr, "sfe_emu: invalid configuration\n");
+        return -1;
+    }
+    pthread_mutex_lock(&emu_lock);
+    load_config();
+    emu_cfg = *cfg;
+    pthread_mutex_unlock(&emu_lock);
+    return 0;
+}
+
+void sfe_emu_set_dac_callback(sfe_emu_dac_callback *cb, void *userdata)
+{
+    pthread_mutex_lock(&emu_lock);
+    emu_dac_cb = cb;
+    emu_dac_ctx = userdata;
+    pthread_mutex_unlock(&emu_lock);
+}
+
+int sfe_emu_get_stats(int board, sfe_emu_stats *st)
+{
+    struct emu_board *dev;
+    
+    pthread_mutex_lock(&emu_lock);
+    dev = board >= 0 && board < emu_num_boards ? emu_boards[board] : NULL;
+    pthread_mutex_unlock(&emu_lock);
+    if (!dev){
+        return -1;
+    }
+    pthread_mutex_lock(&dev->lock);
+    *st = dev->stats;
+    st->adc_level = dev->adc.fill;
+    st->dac_level = dev->dac.fill;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+int sfe_emu_get_regs(int board, sfe_emu_regs *r)
+{
+    struct emu_board *dev;
+    
+    pthread_mutex_lock(&emu_lock);
+    dev = board >= 0 && board < emu_num_boards ? emu_boards[board] : NULL;
+    pthread_mutex_unlock(&emu_lock);
+    if (!dev){
+        return -1;
+    }
+    pthread_mutex_lock(&dev->lock);
+    r->ctrl = dev->ctrl;
+    r->cdiv = dev->cdiv;
+    r->ext_gpio = dev->ext_gpio;
+    r->max5863 = dev->max5863;
+    memcpy(r->auxdac, dev->auxdac_val, sizeof(r->auxdac));
+    r->status_reads = dev->status_reads;
+    r->flash_programs = dev->flash.programs;
+    r->flash_erases = dev->flash.erases;
+    r->flash_rejected = dev->flash.rejected;
+    r->fw_writes = dev->fw_writes;
+    r->isopkts = dev->isopkts;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+int sfe_emu_flash_access(int board, unsigned addr, unsigned char *data, unsigned len, int write)
+{
+    struct emu_board *dev;
+    
+    pthread_mutex_lock(&emu_lock);
+    dev = board >= 0 && board < emu_num_boards ? emu_boards[board] : NULL;
+    pthread_mutex_unlock(&emu_lock);
+    if (!dev || addr > EMU_FLASH_BYTES || len > EMU_FLASH_BYTES - addr){
+        return -1;
+    }
+    pthread_mutex_lock(&dev->lock);
+    if (write){
+        memcpy(dev->flash.mem + addr, data, len);
+    }else{
+        memcpy(data, dev->flash.mem + addr, len);
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* FIFOs */
+
+static int fifo_alloc(struct byte_fifo *f, unsigned size)
+{
+    f->buf = malloc(size);
+    f->size = size;
+    f->rd = 0;
+    f->fill = 0;
+    return f->buf ? 0 : -1;
+}
+
+static void fifo_reset(struct byte_fifo *f)
+{
+    f->rd = 0;
+    f->fill = 0;
+}
+
+/* returns the number of bytes that did not fit */
+static unsigned fifo_put(struct byte_fifo *f, const unsigned char *src, unsigned len)
+{
+    unsigned n = f->size - f->fill;
+    unsigned wr, i;
+    
+    n = len < n ? len : n;
+    wr = (f->rd + f->fill) % f->size;
+    for (i=0; i<n; i++){
+        f->buf[wr] = src[i];
+        wr = wr + 1 == f->size ? 0 : wr + 1;
+    }
+    f->fill += n;
+    return len - n;
+}
+
+static unsigned fifo_get(struct byte_fifo *f, unsigned char *dst, unsigned len)
+{
+    unsigned n = len < f->fill ? len : f->fill;
+    unsigned i;
+    
+    for (i=0; i<n; i++){
+        if (dst){
+            dst[i] = f->buf[f->rd];
+        }
+        f->rd = f->rd + 1 == f->size ? 0 : f->rd + 1;
+    }
+    f->fill -= n;
+    return n;
+}
+
+static unsigned char fifo_level(const struct byte_fifo *f)
+{
+    if (f->fill >= f->size){
+        return 0x3F;
+    }
+    return (unsigned long long)f->fill * 64 / f->size;
+}
+
+static unsigned next_rand(struct emu_board *dev)
+{
+    /* xorshift32 */
+    unsigned x = dev->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    dev->rng = x;
+    return x;
+}
+
+static int packet_lost(struct emu_board *dev, double loss)
+{
+    return loss > 0 && (next_rand(dev) / 4294967296.0) < loss;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* FPGA and spi slaves */
+
+static int count_bits(unsigned v)
+{
+    int n = 0;
+    for (; v; v >>= 1){
+        n += v & 1;
+    }
+    return n;
+}
+
+static void fpga_write_ctrl(struct emu_board *dev, unsigned char v)
+{
+    if (!(v & 0x01) || !(v & 0x06)){
+        fifo_reset(&dev->adc);
+        dev->adc_acc = 0;
+    }
+    if (!(v & 0x01) || !(v & 0x18)){
+        fifo_reset(&dev->dac);
+        fifo_reset(&dev->loop);
+        dev->dac_acc = 0;
+    }
+    dev->ctrl = v & 0x1F;
+}
+
+/* one byte clocked through the FPGA spi port */
+static unsigned char fpga_spi(struct emu_board *dev, int pos, unsigned char mosi)
+{
+    int wr, reg;
+    
+    if (pos == 0){
+        dev->spi_cmd = mosi;
+        if (!(mosi >> 7)){
+            dev->status_reads++;
+        }
+        return 0;
+    }
+    wr = dev->spi_cmd >> 7;
+    reg = (dev->spi_cmd >> 5) & 0x03;
+    if (!wr){
+        /* every read returns the status word */
+        return pos == 1 ? dev->cdiv & 0x7F : pos == 2 ? dev->ctrl : 0;
+    }
+    switch (reg){
+    case 0:
+        if (pos == 1){
+            fpga_write_ctrl(dev, mosi);
+        }
+        break;
+    case 1:
+        if (pos == 1){
+            dev->cdiv = mosi & 0x7F;
+        }
+        break;
+    case 2:
+        if (pos == 1){
+            dev->ext_gpio = (dev->ext_gpio & 0x00FF) | (mosi << 8);
+        }else if (pos == 2){
+            dev->ext_gpio = (dev->ext_gpio & 0xFF00) | mosi;
+        }
+        break;
+    case 3:
+        if (pos == 1){
+            dev->pll_a = mosi;
+        }else if (pos == 2){
+            dev->pll_n = mosi;
+        }
+        break;
+    }
+    return 0;
+}
+
+static long long flash_now(struct emu_board *dev)
+{
+    return (long long)dev->stats.uframes * 125000 + dev->xfer_ns;
+}
+
+/* one byte clocked through the flash, commands that change the array 
+ * take effect when the chip select rises */
+static unsigned char flash_spi(struct emu_board *dev, int pos, unsigned char mosi)
+{
+    struct emu_flash *f = &dev->flash;
+    int busy = flash_now(dev) < f->busy_until;
+    
+    if (pos == 0){
+        f->cmd = mosi;
+        f->addr = 0;
+        f->ignored = busy && mosi != 0x05;
+        f->rejected += f->ignored;
+        memset(f->page_mask, 0, sizeof(f->page_mask));
+        return 0xFF;
+    }
+    if (f->ignored){
+        return 0xFF;
+    }
+    switch (f->cmd){
+    case 0x05:  /* status 1, repeated while selected */
+        return (busy ? 0x01 : 0x00) | (f->wel ? 0x02 : 0x00);
+    case 0x9F:  /* JEDEC id */
+        return pos == 1 ? 0xEF : pos == 2 ? 0x40 : pos == 3 ? 0x15 : 0xFF;
+    case 0x03:  /* read */
+    case 0x02:  /* page program */
+    case 0x20:  /* 4k sector erase */
+    case 0x52:  /* 32k block erase */
+    case 0xD8:  /* 64k block erase */
+        if (pos <= 3){
+            f->addr = ((f->addr << 8) | mosi) & (EMU_FLASH_BYTES - 1);
+            return 0xFF;
+        }
+        if (f->cmd == 0x03){
+            return f->mem[(f->addr + pos - 4) & (EMU_FLASH_BYTES - 1)];
+        }
+        if (f->cmd == 0x02){
+            /* wraps within the page */
+            unsigned i = (f->addr + pos - 4) & (EMU_FLASH_PAGE - 1);
+            f->page[i] = mosi;
+            f->page_mask[i] = 1;
+        }
+        return 0xFF;
+    default:
+        return 0xFF;
+    }
+}
+
+static void flash_deselect(struct emu_board *dev, int pos)
+{
+    struct emu_flash *f = &dev->flash;
+    long long now = flash_now(dev);
+    unsigned base, size = 0, i;
+    long long t = 0;
+
+    if (f->ignored || pos == 0){
+        return;
+    }
+    switch (f->cmd){
+    case 0x06:
+        f->wel = 1;
+        return;
+    case 0x04:
+        f->wel = 0;
+        return;
+    case 0x02:
+        if (!f->wel || pos < 5){
+            return;
+        }
+        base = f->addr & ~(EMU_FLASH_PAGE - 1);
+        for (i=0; i<EMU_FLASH_PAGE; i++){
+            if (f->page_mask[i]){
+                f->mem[base + i] &= f->page[i];
+            }
+        }
+        f->programs++;
+        f->wel = 0;
+        f->busy_until = now + EMU_PP_NS;
+        return;
+    case 0x20: size = 4096;   t = EMU_SE_NS; break;
+    case 0x52: size = 32768;  t = EMU_BE_NS; break;
+    case 0xD8: size = 65536;  t = EMU_BE_NS; break;
+    case 0xC7: size = EMU_FLASH_BYTES; t = EMU_CE_NS; break;
+    default:
+        return;
+    }
+    if (!f->wel || (f->cmd != 0xC7 && pos < 4)){
+        return;
+    }
+    base = f->cmd == 0xC7 ? 0 : f->addr & ~(size - 1);
+    memset(f->mem + base, 0xFF, size);
+    f->erases++;
+    f->wel = 0;
+    f->busy_until = now + t;
+}
+
+static unsigned char spi_byte(struct emu_board *dev, unsigned char mosi)
+{
+    int pos = dev->spi_pos++;
+    
+    switch (dev->spi_cs){
+    case FPGA_CS:
+        return fpga_spi(dev, pos, mosi);
+    case MAX5863_CS:
+        dev->max5863 = mosi;
+        return 0;
+    case EMU_GPIO_FLASH_CS:
+        return flash_spi(dev, pos, mosi);
+    case AUXDAC_CS:
+        if (pos < 2){
+            dev->auxdac[pos] = mosi;
+        }
+        if (pos == 1){
+            dev->auxdac_val[dev->auxdac[0] >> 6] = ((dev->auxdac[0] & 0x0F) << 4) | (mosi >> 4);
+        }
+        return 0;
+    default:
+        /* flash or nothing selected, the bus floats high */
+        return 0xFF;
+    }
+}
+
+static void set_board_gpio(struct emu_board *dev, int gpio, int val)
+{
+    static const int cs_lines[] = {FPGA_CS, MAX5863_CS, AUXDAC_CS, EMU_GPIO_FLASH_CS};
+    unsigned i;
+    
+    if (gpio < 0 || gpio >= 8){
+        return;
+    }
+    if (dev->spi_cs == EMU_GPIO_FLASH_CS && gpio == EMU_GPIO_FLASH_CS && val){
+        flash_deselect(dev, dev->spi_pos);
+    }
+    dev->gpio[gpio] = !!val;
+    if (gpio == EMU_GPIO_CRESET){
+        /* held in reset the FPGA forgets its configuration */
+        dev->gpio[EMU_GPIO_CDONE] = !!val;
+    }
+    
+    /* a falling chip select starts a new spi transaction */
+    dev->spi_cs = -1;
+    for (i=0; i<sizeof(cs_lines)/sizeof(cs_lines[0]); i++){
+        if (!dev->gpio[cs_lines[i]]){
+            if (cs_lines[i] == gpio){
+                dev->spi_pos = 0;
+            }
+            dev->spi_cs = cs_lines[i];
+            break;
+        }
+    }
+}
+
+
+/* ------------------------------------------------------------------ */
+/* vendor requests, dev->lock held, returns bytes or a libusb error */
+
+static int do_control(struct emu_board *dev, uint8_t type, uint8_t req,
+                      uint16_t wValue, uint16_t wIndex,
+                      unsigned char *data, uint16_t wLength)
+{
+    int in = type & LIBUSB_ENDPOINT_IN;
+    
+    dev->xfer_ns += EMU_REQUEST_NS;
+    if ((type & 0x60) != LIBUSB_REQUEST_TYPE_VENDOR){
+        return LIBUSB_ERROR_PIPE;
+    }
+
+    switch (req){
+    case VR_GPIO:
+        if (in){
+            if (wLength < 1){
+                return LIBUSB_ERROR_OVERFLOW;
+            }
+            data[0] = (wValue >> 8) < 8 ? dev->gpio[wValue >> 8] : 0;
+            return 1;
+        }
+        set_board_gpio(dev, wValue >> 8, wValue & 0xFF);
+        return 0;
+        
+    case VR_RATE:
+        if (!in){
+            if ((wValue & 0xFF) == 0x02){
+                dev->isopkts = wValue >> 8;
+            }
+            return 0;
+        }
+        if ((wValue & 0xFF) == 0x01){
+            /* FPGA clock as measured on the board */
+            double clk;
+            unsigned v;
+            
+            pthread_mutex_lock(&emu_lock);
+            clk = EMU_FPGA_CLK * (1 + emu_cfg.clock_ppm * 1e-6) * (1 + emu_cfg.measure_ppm * 1e-6);
+            pthread_mutex_unlock(&emu_lock);
+            v = (unsigned)(clk + 0.5);
+            if (wLength < VR_RATE_CLOCK_BYTES){
+                return LIBUSB_ERROR_OVERFLOW;
+            }
+            data[0] = v >> 24;
+            data[1] = v >> 16;
+            data[2] = v >> 8;
+            data[3] = v;
+            return VR_RATE_CLOCK_BYTES;
+        }
+        if (wLength < VR_RATE_STATUS_BYTES){
+            return LIBUSB_ERROR_OVERFLOW;
+        }
+        /* the top 6 bits of the fill, all ones when full, like fifo.v */
+        data[0] = fifo_level(&dev->adc);
+        data[1] = fifo_level(&dev->dac);
+        return VR_RATE_STATUS_BYTES;
+        
+    case EMU_VR_LOAD:
+        /* the hardware loader, on-chip RAM and CPUCS */
+        if (wValue + wLength > EMU_FX_RAM){
+            return LIBUSB_ERROR_PIPE;
+        }
+        if (in){
+            memcpy(data, dev->fx_ram + wValue, wLength);
+        }else{
+            memcpy(dev->fx_ram + wValue, data, wLength);
+            dev->fw_writes++;
+        }
+        return wLength;
+        
+    case VR_I2C:
+        if (wLength > 8){
+            return LIBUSB_ERROR_INVALID_PARAM;
+        }
+        if (in){
+            memcpy(data, dev->i2c[(wValue >> 8) & 0x7F], wLength);
+        }else{
+            memcpy(dev->i2c[(wValue >> 8) & 0x7F], data, wLength);
+        }
+        return wLength;
+        
+    default:
+        /* firmware download and the like, accepted and ignored */
+        if (in){
+            memset(data, 0, wLength);
+        }
+        return wLength;
+    }
+}
+
+/* spi over the bulk pipe, the reply to an OUT is read back on the IN */
+static int do_bulk(struct emu_board *dev, unsigned char ep, unsigned char *data, int length)
+{
+    int i;
+    
+    if (ep == EMU_EP_SPI_OUT){
+        length = length > EMU_MAX_SPI ? EMU_MAX_SPI : length;
+        dev->xfer_ns += EMU_REQUEST_NS + EMU_SPI_BYTE_NS * length;
+        for (i=0; i<length; i++){
+            dev->spi_miso[i] = spi_byte(dev, data[i]);
+        }
+        dev->spi_len = length;
+        return length;
+    }
+    if (ep == EMU_EP_SPI_IN){
+        length = length > dev->spi_len ? dev->spi_len : length;
+        memcpy(data, dev->spi_miso, length);
+        dev->spi_len = 0;
+        return length;
+    }
+    return LIBUSB_ERROR_PIPE;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* completions */
+
+static void complete_xfer(struct emu_xfer *e, enum libusb_transfer_status status)
+{
+    libusb_context *ctx = e->handle->ctx;
+    
+    XFER_OF(e)->status = status;
+    e->next = NULL;
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->done_tail){
+        ctx->done_tail->next = e;
+    }else{
+        ctx->done_head = e;
+    }
+    ctx->done_tail = e;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static void queue_push(struct emu_xfer **head, struct emu_xfer **tail, struct emu_xfer *e)
+{
+    e->next = NULL;
+    if (*tail){
+        (*tail)->next = e;
+    }else{
+        *head = e;
+    }
+    *tail = e;
+}
+
+static struct emu_xfer* queue_pop(struct emu_xfer **head, struct emu_xfer **tail)
+{
+    struct emu_xfer *e = *head;
+    if (e){
+        *head = e->next;
+        if (!*head){
+            *tail = NULL;
+        }
+    }
+    return e;
+}
+
+static int queue_remove(struct emu_xfer **head, struct emu_xfer **tail, struct emu_xfer *e)
+{
+    struct emu_xfer **pp, *prev = NULL;
+    
+    for (pp = head; *pp; prev = *pp, pp = &(*pp)->next){
+        if (*pp == e){
+            *pp = e->next;
+            if (*tail == e){
+                *tail = prev;
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* the data path, one microframe at a time, dev->lock held */
+
+static unsigned sample_rate(struct emu_board *dev, const sfe_emu_config *cfg)
+{
+    double clk = EMU_FPGA_CLK * (1 + cfg->clock_ppm * 1e-6);
+    return (unsigned)(clk / (dev->cdiv * 2 + 4));
+}
+
+static void run_adc(struct emu_board *dev, unsigned rate, int source)
+{
+    unsigned char buf[4096];
+    int nch = count_bits(dev->ctrl & 0x06);
+    unsigned n, i, lost;
+
+    if (!(dev->ctrl & 0x01) || !nch){
+        return;
+    }
+    dev->adc_acc += (double)rate * nch / EMU_UFRAMES_PER_SEC;
+    n = (unsigned)dev->adc_acc;
+    /* whole samples of every channel */
+    n -= n % nch;
+    dev->adc_acc -= n;
+    while (n){
+        unsigned len = n < sizeof(buf) ? n : sizeof(buf);
+        if (source == SFE_EMU_ADC_LOOPBACK){
+            unsigned got = fifo_get(&dev->loop, buf, len);
+            memset(buf + got, 0x80, len - got);
+        }else{
+            for (i=0; i<len; i++){
+                buf[i] = dev->ramp++;
+            }
+        }
+        lost = fifo_put(&dev->adc, buf, len);
+        dev->stats.adc_bytes += len;
+        dev->stats.adc_overflow += lost;
+        n -= len;
+    }
+}
+
+static void run_dac(struct emu_board *dev, unsigned rate, int source,
+                    sfe_emu_dac_callback *cb, void *cb_ctx)
+{
+    unsigned char frame[5];
+    unsigned short samples[4*256];
+    unsigned char loop[4];
+    int nch = count_bits(dev->ctrl & 0x18);
+    unsigned frames, ns = 0, i;
+
+    if (!(dev->ctrl & 0x01) || !nch){
+        return;
+    }
+    /* 4 samples in 5 bytes, the DAC only takes whole frames */
+    dev->dac_acc += (double)rate * nch / EMU_UFRAMES_PER_SEC;
+    frames = (unsigned)(dev->dac_acc / 4);
+    dev->dac_acc -= frames * 4.0;
+    
+    for (i=0; i<frames; i++){
+        if (dev->dac.fill < 5){
+            dev->stats.dac_underflow += 5 * (frames - i);
+            break;
+        }
+        fifo_get(&dev->dac, frame, 5);
+        dev->stats.dac_bytes += 5;
+        samples[ns+0] = ((frame[0] & 0x03) << 8) | frame[1];
+        samples[ns+1] = ((frame[0] & 0x0C) << 6) | frame[2];
+        samples[ns+2] = ((frame[0] & 0x30) << 4) | frame[3];
+        samples[ns+3] = ((frame[0] & 0xC0) << 2) | frame[4];
+        if (source == SFE_EMU_ADC_LOOPBACK){
+            loop[0] = samples[ns+0] >> 2;
+            loop[1] = samples[ns+1] >> 2;
+            loop[2] = samples[ns+2] >> 2;
+            loop[3] = samples[ns+3] >> 2;
+            fifo_put(&dev->loop, loop, 4);
+        }
+        ns += 4;
+        if (ns == sizeof(samples)/sizeof(samples[0])){
+            if (cb){
+                cb(dev->index, samples, ns, cb_ctx);
+            }
+            ns = 0;
+        }
+    }
+    if (ns && cb){
+        cb(dev->index, samples, ns, cb_ctx);
+    }
+}
+
+static void serve_in(struct emu_board *dev, double loss)
+{
+    struct emu_xfer *e = dev->in_head;
+    struct libusb_transfer *t;
+    struct libusb_iso_packet_descriptor *d;
+    int nch = count_bits(dev->ctrl & 0x06);
+    unsigned len;
+
+    if (!e){
+        return;
+    }
+    t = XFER_OF(e);
+    d = &t->iso_packet_desc[e->pkt];
+    len = d->length < dev->max_packet ? d->length : dev->max_packet;
+    if (dev->isopkts && len > dev->isopkts * EMU_ISO_TRANSACTION){
+        len = dev->isopkts * EMU_ISO_TRANSACTION;
+    }
+    len = len < dev->adc.fill ? len : dev->adc.fill;
+    if (nch){
+        len -= len % nch;
+    }
+
+    dev->stats.in_packets++;
+    if (packet_lost(dev, loss)){
+        /* sent by the device and lost on the wire */
+        fifo_get(&dev->adc, NULL, len);
+        d->actual_length = 0;
+        d->status = LIBUSB_TRANSFER_ERROR;
+        dev->stats.lost_packets++;
+    }else{
+        d->actual_length = fifo_get(&dev->adc, t->buffer + e->offset, len);
+        d->status = LIBUSB_TRANSFER_COMPLETED;
+        t->actual_length += d->actual_length;
+    }
+    e->offset += d->length;
+    if (++e->pkt == e->num_iso){
+        queue_pop(&dev->in_head, &dev->in_tail);
+        complete_xfer(e, LIBUSB_TRANSFER_COMPLETED);
+    }
+}
+
+static void serve_out(struct emu_board *dev, double loss)
+{
+    struct emu_xfer *e = dev->out_head;
+    struct libusb_transfer *t;
+    struct libusb_iso_packet_descriptor *d;
+    unsigned len;
+
+    if (!e){
+        return;
+    }
+    t = XFER_OF(e);
+    d = &t->iso_packet_desc[e->pkt];
+    len = d->length < dev->max_packet ? d->length : dev->max_packet;
+
+    dev->stats.out_packets++;
+    if (packet_lost(dev, loss)){
+        d->actual_length = 0;
+        d->status = LIBUSB_TRANSFER_ERROR;
+        dev->stats.lost_packets++;
+    }else{
+        if (dev->ctrl & 0x18){
+            dev->stats.dac_overflow += fifo_put(&dev->dac, t->buffer + e->offset, len);
+        }
+        d->actual_length = len;
+        d->status = LIBUSB_TRANSFER_COMPLETED;
+        t->actual_length += len;
+    }
+    e->offset += d->length;
+    if (++e->pkt == e->num_iso){
+        queue_pop(&dev->out_head, &dev->out_tail);
+        complete_xfer(e, LIBUSB_TRANSFER_COMPLETED);
+    }
+}
+
+static void run_uframe(struct emu_board *dev, const sfe_emu_config *cfg,
+                       sfe_emu_dac_callback *cb, void *cb_ctx)
+{
+    unsigned rate = sample_rate(dev, cfg);
+    
+    run_adc(dev, rate, cfg->adc_source);
+    serve_in(dev, cfg->packet_loss);
+    /* the control requests come in after the periodic packets of a 
+       microframe, they see the packet that has just come in */
+    run_dac(dev, rate, cfg->adc_source, cb, cb_ctx);
+    serve_out(dev, cfg->packet_loss);
+    dev->stats.uframes++;
+    dev->stats.sample_rate = rate;
+}
+
+static void add_ns(struct timespec *ts, long long ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+/* one thread per open board plays the usb host controller, a 1ms frame 
+ * of 8 microframes per iteration */
+static void* bus_thread_func(void *arg)
+{
+    struct emu_board *dev = arg;
+    struct timespec deadline;
+    
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    pthread_mutex_lock(&dev->lock);
+    while (!dev->thread_exit){
+        sfe_emu_config cfg;
+        sfe_emu_dac_callback *cb;
+        void *cb_ctx;
+        int i;
+
+        pthread_mutex_lock(&emu_lock);
+        cfg = emu_cfg;
+        cb = emu_dac_cb;
+        cb_ctx = emu_dac_ctx;
+        pthread_mutex_unlock(&emu_lock);
+        
+        if (cfg.speed > 0){
+            add_ns(&deadline, (long long)(1000000 / cfg.speed));
+            while (!dev->thread_exit &&
+                   pthread_cond_timedwait(&dev->cond, &dev->lock, &deadline) != ETIMEDOUT){
+            }
+        }
+        else{
+            /* unthrottled, time only moves while the host keeps transfers queued */
+            while (!dev->thread_exit && !dev->in_head && !dev->out_head){
+                pthread_cond_wait(&dev->cond, &dev->lock);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+        }
+        if (dev->thread_exit){
+            break;
+        }
+        for (i=0; i<EMU_UFRAMES_PER_MS; i++){
+            run_uframe(dev, &cfg, cb, cb_ctx);
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return NULL;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* the bus */
+
+static struct emu_board* new_board(int index)
+{
+    struct emu_board *dev = calloc(1, sizeof(struct emu_board));
+    pthread_condattr_t attr;
+    int i;
+    
+    if (!dev){
+        return NULL;
+    }
+    dev->flash.mem = malloc(EMU_FLASH_BYTES);
+    if (!dev->flash.mem ||
+        fifo_alloc(&dev->adc, emu_cfg.fifo_bytes) ||
+        fifo_alloc(&dev->dac, emu_cfg.fifo_bytes) ||
+        fifo_alloc(&dev->loop, emu_cfg.fifo_bytes)){
+        free(dev->flash.mem);
+        free(dev->adc.buf);
+        free(dev->dac.buf);
+        free(dev->loop.buf);
+        free(dev);
+        return NULL;
+    }
+    memset(dev->flash.mem, 0xFF, EMU_FLASH_BYTES);
+    dev->index = index;
+    dev->max_packet = emu_cfg.max_packet_size;
+    snprintf(dev->serial, sizeof(dev->serial), "EMU%04d", index);
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dev->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    for (i=0; i<8; i++){
+        dev->gpio[i] = 1;
+    }
+    dev->spi_cs = -1;
+    dev->rng = emu_cfg.seed * 2654435761u + index + 1;
+    if (!dev->rng){
+        dev->rng = 1;
+    }
+    return dev;
+}
+
+int libusb_init(libusb_context **pctx)
+{
+    libusb_context *ctx = calloc(1, sizeof(libusb_context));
+    int i;
+    
+    if (!ctx){
+        return LIBUSB_ERROR_NO_MEM;
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+    
+    pthread_mutex_lock(&emu_lock);
+    load_config();
+    for (i=emu_num_boards; i<emu_cfg.num_boards; i++){
+        emu_boards[i] = new_board(i);
+        if (!emu_boards[i]){
+            break;
+        }
+        emu_num_boards++;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    
+    if (pctx){
+        *pctx = ctx;
+    }
+    return LIBUSB_SUCCESS;
+}
+
+void libusb_exit(libusb_context *ctx)
+{
+    if (!ctx){
+        return;
+    }
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->cond);
+    free(ctx);
+}
+
+void libusb_set_debug(libusb_context *ctx, int level)
+{
+}
+
+const char* libusb_error_name(int errcode)
+{
+    switch (errcode){
+    case LIBUSB_SUCCESS: return "LIBUSB_SUCCESS";
+    case LIBUSB_ERROR_IO: return "LIBUSB_ERROR_IO";
+    case LIBUSB_ERROR_INVALID_PARAM: return "LIBUSB_ERROR_INVALID_PARAM";
+    case LIBUSB_ERROR_ACCESS: return "LIBUSB_ERROR_ACCESS";
+    case LIBUSB_ERROR_NO_DEVICE: return "LIBUSB_ERROR_NO_DEVICE";
+    case LIBUSB_ERROR_NOT_FOUND: return "LIBUSB_ERROR_NOT_FOUND";
+    case LIBUSB_ERROR_BUSY: return "LIBUSB_ERROR_BUSY";
+    case LIBUSB_ERROR_TIMEOUT: return "LIBUSB_ERROR_TIMEOUT";
+    case LIBUSB_ERROR_OVERFLOW: return "LIBUSB_ERROR_OVERFLOW";
+    case LIBUSB_ERROR_PIPE: return "LIBUSB_ERROR_PIPE";
+    case LIBUSB_ERROR_INTERRUPTED: return "LIBUSB_ERROR_INTERRUPTED";
+    case LIBUSB_ERROR_NO_MEM: return "LIBUSB_ERROR_NO_MEM";
+    case LIBUSB_ERROR_NOT_SUPPORTED: return "LIBUSB_ERROR_NOT_SUPPORTED";
+    case LIBUSB_TRANSFER_ERROR: return "LIBUSB_TRANSFER_ERROR";
+    case LIBUSB_TRANSFER_TIMED_OUT: return "LIBUSB_TRANSFER_TIMED_OUT";
+    case LIBUSB_TRANSFER_CANCELLED: return "LIBUSB_TRANSFER_CANCELLED";
+    case LIBUSB_TRANSFER_STALL: return "LIBUSB_TRANSFER_STALL";
+    case LIBUSB_TRANSFER_NO_DEVICE: return "LIBUSB_TRANSFER_NO_DEVICE";
+    case LIBUSB_TRANSFER_OVERFLOW: return "LIBUSB_TRANSFER_OVERFLOW";
+    default: return "**UNKNOWN**";
+    }
+}
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+    libusb_device **l;
+    int i, n;
+    
+    pthread_mutex_lock(&emu_lock);
+    n = emu_num_boards;
+    l = calloc(n + 1, sizeof(libusb_device*));
+    if (l){
+        for (i=0; i<n; i++){
+            ctx->devs[i].board = emu_boards[i];
+            ctx->devs[i].ctx = ctx;
+            l[i] = &ctx->devs[i];
+        }
+    }
+    pthread_mutex_unlock(&emu_lock);
+    if (!l){
+        return LIBUSB_ERROR_NO_MEM;
+    }
+    *list = l;
+    return n;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+    /* the devices live as long as their context */
+    free(list);
+}
+
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+    memset(desc, 0, sizeof(*desc));
+    desc->bLength = 18;
+    desc->bDescriptorType = 1;
+    desc->bcdUSB = 0x0200;
+    desc->bMaxPacketSize0 = 64;
+    desc->idVendor = EMU_VID;
+    desc->idProduct = EMU_PID;
+    desc->iManufacturer = 1;
+    desc->iProduct = 2;
+    desc->iSerialNumber = EMU_SERIAL_INDEX;
+    desc->bNumConfigurations = 1;
+    return LIBUSB_SUCCESS;
+}
+
+uint8_t libusb_get_bus_number(libusb_device *dev)
+{
+    return 1;
+}
+
+uint8_t libusb_get_device_address(libusb_device *dev)
+{
+    return dev->board->index + 2;
+}
+
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers, int port_numbers_len)
+{
+    if (port_numbers_len < 1){
+        return LIBUSB_ERROR_OVERFLOW;
+    }
+    port_numbers[0] = dev->board->index + 1;
+    return 1;
+}
+
+int libusb_get_max_iso_packet_size(libusb_device *dev, unsigned char endpoint)
+{
+    if (endpoint != EMU_EP_DATA_OUT && endpoint != EMU_EP_DATA_IN){
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    return dev->board->max_packet;
+}
+
+int libusb_open(libusb_device *d, libusb_device_handle **pdh)
+{
+    libusb_device_handle *dh = calloc(1, sizeof(libusb_device_handle));
+    struct emu_board *dev = d->board;
+    
+    if (!dh){
+        return LIBUSB_ERROR_NO_MEM;
+    }
+    dh->dev = d;
+    dh->board = dev;
+    dh->ctx = d->ctx;
+    
+    pthread_mutex_lock(&dev->lock);
+    if (dev->open_count++ == 0){
+        dev->thread_exit = 0;
+        if (pthread_create(&dev->thread, NULL, bus_thread_func, dev)){
+            dev->open_count--;
+            pthread_mutex_unlock(&dev->lock);
+            free(dh);
+            return LIBUSB_ERROR_NO_MEM;
+        }
+        dev->thread_running = 1;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    *pdh = dh;
+    return LIBUSB_SUCCESS;
+}
+
+/* transfers of a handle that is going away are cancelled, dev->lock held */
+static void cancel_handle_xfers(struct emu_xfer **head, struct emu_xfer **tail,
+                                libusb_device_handle *dh)
+{
+    struct emu_xfer *keep_head = NULL, *keep_tail = NULL, *e;
+    
+    while ((e = queue_pop(head, tail))){
+        if (e->handle == dh){
+            complete_xfer(e, LIBUSB_TRANSFER_CANCELLED);
+        }else{
+            queue_push(&keep_head, &keep_tail, e);
+        }
+    }
+    *head = keep_head;
+    *tail = keep_tail;
+}
+
+void libusb_close(libusb_device_handle *dh)
+{
+    struct emu_board *dev;
+    int stop = 0;
+    
+    if (!dh){
+        return;
+    }
+    dev = dh->board;
+    pthread_mutex_lock(&dev->lock);
+    cancel_handle_xfers(&dev->in_head, &dev->in_tail, dh);
+    cancel_handle_xfers(&dev->out_head, &dev->out_tail, dh);
+    if (dev->owner == dh){
+        dev->owner = NULL;
+    }
+    if (--dev->open_count == 0 && dev->thread_running){
+        dev->thread_exit = 1;
+        dev->thread_running = 0;
+        pthread_cond_broadcast(&dev->cond);
+        stop = 1;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    if (stop){
+        pthread_join(dev->thread, NULL);
+    }
+    free(dh);
+}
+
+libusb_device* libusb_get_device(libusb_device_handle *dh)
+{
+    return dh->dev;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dh, uint8_t desc_index,
+                                       unsigned char *data, int length)
+{
+    const char *s;
+    int n;
+
+    switch (desc_index){
+    case 1: s = "simpleFE"; break;
+    case 2: s = "simpleFE emulator"; break;
+    case EMU_SERIAL_INDEX: s = dh->board->serial; break;
+    default: return LIBUSB_ERROR_INVALID_PARAM;
+    }
+    if (length <= 0){
+        return LIBUSB_ERROR_INVALID_PARAM;
+    }
+    n = (int)strlen(s);
+    n = n < length - 1 ? n : length - 1;
+    memcpy(data, s, n);
+    data[n] = 0;
+    return n;
+}
+
+int libusb_set_auto_detach_kernel_driver(libusb_device_handle *dh, int enable)
+{
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_claim_interface(libusb_device_handle *dh, int interface_number)
+{
+    struct emu_board *dev = dh->board;
+    int ret = LIBUSB_SUCCESS;
+    
+    if (interface_number != 0){
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+    pthread_mutex_lock(&dev->lock);
+    if (dev->owner && dev->owner != dh){
+        ret = LIBUSB_ERROR_BUSY;
+    }else{
+        dev->owner = dh;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return ret;
+}
+
+int libusb_release_interface(libusb_device_handle *dh, int interface_number)
+{
+    struct emu_board *dev = dh->board;
+    
+    pthread_mutex_lock(&dev->lock);
+    if (dev->owner == dh){
+        dev->owner = NULL;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_control_transfer(libusb_device_handle *dh, uint8_t request_type,
+                            uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+                            unsigned char *data, uint16_t wLength, unsigned int timeout)
+{
+    struct emu_board *dev = dh->board;
+    int ret;
+    
+    pthread_mutex_lock(&dev->lock);
+    ret = do_control(dev, request_type, bRequest, wValue, wIndex, data, wLength);
+    pthread_mutex_unlock(&dev->lock);
+    return ret;
+}
+
+int libusb_bulk_transfer(libusb_device_handle *dh, unsigned char endpoint,
+                         unsigned char *data, int length, int *actual_length,
+                         unsigned int timeout)
+{
+    struct emu_board *dev = dh->board;
+    int ret;
+    
+    pthread_mutex_lock(&dev->lock);
+    ret = do_bulk(dev, endpoint, data, length);
+    pthread_mutex_unlock(&dev->lock);
+    if (ret < 0){
+        return ret;
+    }
+    if (actual_length){
+        *actual_length = ret;
+    }
+    return LIBUSB_SUCCESS;
+}
+
+struct libusb_transfer* libusb_alloc_transfer(int iso_packets)
+{
+    size_t size = sizeof(struct emu_xfer) + sizeof(struct libusb_transfer) +
+        sizeof(struct libusb_iso_packet_descriptor) * (iso_packets > 0 ? iso_packets : 0);
+    struct emu_xfer *e = calloc(1, size);
+    
+    if (!e){
+        return NULL;
+    }
+    e->num_iso = iso_packets;
+    XFER_OF(e)->num_iso_packets = iso_packets;
+    return XFER_OF(e);
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+    if (!transfer){
+        return;
+    }
+    if ((transfer->flags & LIBUSB_TRANSFER_FREE_BUFFER) && transfer->buffer){
+        free(transfer->buffer);
+    }
+    free(EMU_OF(transfer));
+}
+
+int libusb_submit_transfer(struct libusb_transfer *t)
+{
+    struct emu_xfer *e = EMU_OF(t);
+    libusb_device_handle *dh = t->dev_handle;
+    struct emu_board *dev = dh->board;
+    int ret = LIBUSB_SUCCESS;
+    
+    e->handle = dh;
+    e->pkt = 0;
+    e->offset = 0;
+    t->actual_length = 0;
+    
+    pthread_mutex_lock(&dev->lock);
+    switch (t->type){
+    case LIBUSB_TRANSFER_TYPE_CONTROL:{
+        struct libusb_control_setup *setup = libusb_control_transfer_get_setup(t);
+        int n = do_control(dev, setup->bmRequestType, setup->bRequest,
+                           libusb_le16_to_cpu(setup->wValue), libusb_le16_to_cpu(setup->wIndex),
+                           libusb_control_transfer_get_data(t), libusb_le16_to_cpu(setup->wLength));
+        t->actual_length = n < 0 ? 0 : n;
+        complete_xfer(e, n < 0 ? LIBUSB_TRANSFER_STALL : LIBUSB_TRANSFER_COMPLETED);
+        break;
+    }
+    case LIBUSB_TRANSFER_TYPE_BULK:{
+        int n = do_bulk(dev, t->endpoint, t->buffer, t->length);
+        t->actual_length = n < 0 ? 0 : n;
+        complete_xfer(e, n < 0 ? LIBUSB_TRANSFER_STALL : LIBUSB_TRANSFER_COMPLETED);
+        break;
+    }
+    case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
+        if (e->num_iso < t->num_iso_packets || t->num_iso_packets <= 0){
+            ret = LIBUSB_ERROR_INVALID_PARAM;
+        }else if (t->endpoint == EMU_EP_DATA_IN){
+            e->num_iso = t->num_iso_packets;
+            queue_push(&dev->in_head, &dev->in_tail, e);
+            pthread_cond_broadcast(&dev->cond);
+        }else if (t->endpoint == EMU_EP_DATA_OUT){
+            e->num_iso = t->num_iso_packets;
+            queue_push(&dev->out_head, &dev->out_tail, e);
+            pthread_cond_broadcast(&dev->cond);
+        }else{
+            ret = LIBUSB_ERROR_NOT_FOUND;
+        }
+        break;
+    default:
+        ret = LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return ret;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *t)
+{
+    struct emu_xfer *e = EMU_OF(t);
+    struct emu_board *dev = t->dev_handle->board;
+    int ret = LIBUSB_ERROR_NOT_FOUND;
+    
+    pthread_mutex_lock(&dev->lock);
+    if (!queue_remove(&dev->in_head, &dev->in_tail, e) ||
+        !queue_remove(&dev->out_head, &dev->out_tail, e)){
+        complete_xfer(e, LIBUSB_TRANSFER_CANCELLED);
+        ret = LIBUSB_SUCCESS;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return ret;
+}
+
+/* there is no usbfs memory to map, callers fall back to the heap */
+unsigned char* libusb_dev_mem_alloc(libusb_device_handle *dh, size_t length)
+{
+    return NULL;
+}
+
+int libusb_dev_mem_free(libusb_device_handle *dh, unsigned char *buffer, size_t length)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+/* runs the callbacks of everything completed so far, waits up to 
+ * deadline (forever if NULL) for the first completion */
+static int handle_events(libusb_context *ctx, const struct timespec *deadline, int *completed)
+{
+    struct emu_xfer *e, *next;
+    int ret = 0;
+    
+    pthread_mutex_lock(&ctx->lock);
+    while (!ctx->done_head && !ctx->interrupted && !(completed && *completed)){
+        if (deadline){
+            if (pthread_cond_timedwait(&ctx->cond, &ctx->lock, deadline) == ETIMEDOUT){
+                break;
+            }
+        }else{
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+    }
+    if (ctx->interrupted && !ctx->done_head){
+        ret = LIBUSB_ERROR_INTERRUPTED;
+    }
+    ctx->interrupted = 0;
+    e = ctx->done_head;
+    ctx->done_head = ctx->done_tail = NULL;
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (; e; e = next){
+        struct libusb_transfer *t = XFER_OF(e);
+        /* the callback may free or resubmit the transfer */
+        int free_xfer = t->flags & LIBUSB_TRANSFER_FREE_TRANSFER;
+        next = e->next;
+        if (t->callback){
+            t->callback(t);
+        }
+        if (free_xfer){
+            libusb_free_transfer(t);
+        }
+    }
+    return ret == LIBUSB_ERROR_INTERRUPTED ? 0 : ret;
+}
+
+int libusb_handle_events(libusb_context *ctx)
+{
+    struct timeval tv = {60, 0};
+    return libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+}
+
+int libusb_handle_events_completed(libusb_context *ctx, int *completed)
+{
+    return handle_events(ctx, NULL, completed);
+}
+
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv)
+{
+    return libusb_handle_events_timeout_completed(ctx, tv, NULL);
+}
+
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+    struct timespec deadline;
+    
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    add_ns(&deadline, (long long)tv->tv_sec * 1000000000 + (long long)tv->tv_usec * 1000);
+    return handle_events(ctx, &deadline, completed);
+}
+
+void libusb_interrupt_event_handler(libusb_context *ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    ctx->interrupted = 1;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
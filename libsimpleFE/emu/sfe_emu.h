@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SFE_EMU_H_
+#define SFE_EMU_H_
+
+/* 
+ * in-process emulation of simpleFE boards for testing without hardware.
+ * 
+ * a board models the FX2 endpoints (spi bulk pipe, iso data in/out), the
+ * vendor requests VR_GPIO, VR_RATE, VR_I2C and the 0xA0 firmware load,
+ * the FPGA spi register file, the ADC/DAC FIFOs behind the iso endpoints 
+ * and the configuration flash.
+ * the sample clock runs on a virtual 125us microframe clock which normally
+ * follows wall time.
+ * 
+ * applications link simpleFE_emu instead of simpleFE and use the normal
+ * sfe_ api, the defaults can be changed with sfe_emu_set_config() or from 
+ * the environment:
+ *    SFE_EMU_BOARDS        number of boards on the bus
+ *    SFE_EMU_CLOCK_PPM     FPGA clock error
+ *    SFE_EMU_MEASURE_PPM   error of the on-board clock measurement
+ *    SFE_EMU_LOSS          iso packet loss probability
+ *    SFE_EMU_SPEED         1 for real time, 0 to run as fast as the host
+ *    SFE_EMU_ADC           "ramp" or "loopback"
+ */
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define SFE_EMU_MAX_BOARDS      16
+
+/* every ADC byte is the previous one plus one, gaps show lost data */
+#define SFE_EMU_ADC_RAMP        0
+/* the DAC samples come back on the ADC, 10 bit truncated to 8 */
+#define SFE_EMU_ADC_LOOPBACK    1
+
+typedef struct sfe_emu_config_s{
+    int num_boards;
+    /* the FPGA clock is off by this much, the host learns about it only
+     * through the VR_RATE clock reading */
+    double clock_ppm;
+    /* the clock reading is off by this much, so the host sends the DAC
+     * data at a slightly wrong rate and the DAC FIFO level drifts, this 
+     * is what the FIFO level based rate control has to correct */
+    double measure_ppm;
+    double packet_loss;       /* per iso packet, in and out */
+    double speed;             /* virtual time / wall time, 0 = unthrottled */
+    int adc_source;           /* SFE_EMU_ADC_xxx */
+    unsigned fifo_bytes;      /* ADC and DAC FIFO size */
+    unsigned max_packet_size; /* iso bytes per microframe */
+    unsigned seed;
+}sfe_emu_config;
+
+typedef struct sfe_emu_stats_s{
+    unsigned long long uframes;        /* virtual time in 125us */
+    unsigned long long adc_bytes;      /* produced by the ADC */
+    unsigned long long adc_overflow;   /* bytes dropped, FIFO full */
+    unsigned long long dac_bytes;      /* consumed by the DAC */
+    unsigned long long dac_underflow;  /* bytes the DAC missed */
+    unsigned long long dac_overflow;   /* bytes dropped, FIFO full */
+    unsigned long long in_packets;
+    unsigned long long out_packets;
+    unsigned long long lost_packets;
+    unsigned adc_level;                /* FIFO fill in bytes */
+    unsigned dac_level;
+    unsigned sample_rate;              /* true rate, including clock_ppm */
+}sfe_emu_stats;
+
+/* what the host has written to the board */
+typedef struct sfe_emu_regs_s{
+    unsigned char ctrl;                /* FPGA reg 0 */
+    unsigned char cdiv;                /* FPGA reg 1 */
+    unsigned short ext_gpio;           /* FPGA reg 2 */
+    unsigned char max5863;
+    unsigned char auxdac[4];           /* last value per channel */
+    unsigned long long status_reads;   /* FPGA status register reads */
+    unsigned long long flash_programs; /* page programs */
+    unsigned long long flash_erases;
+    unsigned long long flash_rejected; /* commands sent while busy */
+    unsigned long long fw_writes;      /* 0xA0 loader writes */
+    unsigned isopkts;                  /* rx iso transactions per microframe */
+}sfe_emu_regs;
+
+/* 10 bit DAC samples in the order they are converted */
+typedef void (sfe_emu_dac_callback)(int board, const unsigned short *samples,
+                                    unsigned n, void *userdata);
+
+void sfe_emu_get_config(sfe_emu_config *cfg);
+/* clock, loss and speed settings apply immediately, the number of boards 
+ * and the FIFO and packet sizes when the bus is first enumerated */
+int sfe_emu_set_config(const sfe_emu_config *cfg);
+int sfe_emu_get_stats(int board, sfe_emu_stats *st);
+int sfe_emu_get_regs(int board, sfe_emu_regs *r);
+/* the configuration flash behind the FPGA, 2MB, read or written directly */
+int sfe_emu_flash_access(int board, unsigned addr, unsigned char *data, unsigned len, int write);
+/* called on the bus thread of the board, keep it short */
+void sfe_emu_set_dac_callback(sfe_emu_dac_callback *cb, void *userdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* checks every sample conversion kernel the cpu supports against the 
+ * scalar reference and measures its throughput, no hardware needed */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sfe_convert.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define NUM_SAMPLES    (1 << 20)
+#define BENCH_SECONDS  0.5
+
+static double now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / f.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static float fsamples[NUM_SAMPLES];
+static short ssamples[NUM_SAMPLES];
+static unsigned char out[NUM_SAMPLES/4*5 + 16];
+static unsigned char ref[NUM_SAMPLES/4*5 + 16];
+static unsigned char adc[NUM_SAMPLES];
+static float fout[NUM_SAMPLES + 16];
+static float fref[NUM_SAMPLES + 16];
+
+/* every length and misalignment up to a few vector widths, plus the big
+ * buffer, bytes past the end must stay untouched */
+static int verify(sfe_simd k)
+{
+    unsigned n, off, len;
+    
+    for (off=0; off<4; off++){
+        for (n=0; n<=96; n++){
+            memset(out, 0xA5, n/4*5 + 16);
+            memset(ref, 0xA5, n/4*5 + 16);
+            len = sfe_pack_f32(out, fsamples + off, n);
+            sfe_pack_f32_ref(ref, fsamples + off, n);
+            if (len != n/4*5 || memcmp(out, ref, len + 16)){
+                fprintf(stderr, "%s: pack_f32 mismatch n=%u off=%u\n", sfe_simd_name(k), n, off);
+                return -1;
+            }
+            len = sfe_pack_s16(out, ssamples + off, n);
+            sfe_pack_s16_ref(ref, ssamples + off, n);
+            if (len != n/4*5 || memcmp(out, ref, len + 16)){
+                fprintf(stderr, "%s: pack_s16 mismatch n=%u off=%u\n", sfe_simd_name(k), n, off);
+                return -1;
+            }
+        }
+    }
+
+    for (off=0; off<4; off++){
+        for (n=0; n<=96; n++){
+            memset(fout, 0xA5, (n+16)*sizeof(float));
+            memset(fref, 0xA5, (n+16)*sizeof(float));
+            len = sfe_unpack_f32(fout, adc + off, n);
+            sfe_unpack_f32_ref(fref, adc + off, n);
+            if (len != n || memcmp(fout, fref, (n+16)*sizeof(float))){
+                fprintf(stderr, "%s: unpack_f32 mismatch n=%u off=%u\n", sfe_simd_name(k), n, off);
+                return -1;
+            }
+            memset(fout, 0xA5, (n+16)*sizeof(short));
+            memset(fref, 0xA5, (n+16)*sizeof(short));
+            len = sfe_unpack_s16((short*)fout, adc + off, n);
+            sfe_unpack_s16_ref((short*)fref, adc + off, n);
+            if (len != n || memcmp(fout, fref, (n+16)*sizeof(short))){
+                fprintf(stderr, "%s: unpack_s16 mismatch n=%u off=%u\n", sfe_simd_name(k), n, off);
+                return -1;
+            }
+            memset(fout, 0xA5, n+16);
+            memset(fref, 0xA5, n+16);
+            len = sfe_unpack_s8((signed char*)fout, adc + off, n);
+            sfe_unpack_s8_ref((signed char*)fref, adc + off, n);
+            if (len != n || memcmp(fout, fref, n+16)){
+                fprintf(stderr, "%s: unpack_s8 mismatch n=%u off=%u\n", sfe_simd_name(k), n, off);
+                return -1;
+            }
+        }
+    }
+
+    len = sfe_pack_cf32(out, fsamples, NUM_SAMPLES/2);
+    sfe_pack_f32_ref(ref, fsamples, NUM_SAMPLES);
+    if (len != NUM_SAMPLES/4*5 || memcmp(out, ref, len)){
+        fprintf(stderr, "%s: pack_cf32 mismatch\n", sfe_simd_name(k));
+        return -1;
+    }
+    return 0;
+}
+
+enum {PACK_F32, PACK_S16, UNPACK_F32, UNPACK_S8, UNPACK_S16};
+static const char *bench_names[] = {
+    "pack f32", "pack s16", "unpack f32", "unpack s8", "unpack s16"
+};
+
+/* MB/s counts the wire bytes, packed for the dac and raw for the adc */
+static void bench(sfe_simd k, int what)
+{
+    double t0 = now(), t;
+    unsigned long long bytes = 0;
+    unsigned rounds = 0;
+
+    do{
+        switch (what){
+        case PACK_F32:
+            bytes += sfe_pack_f32(out, fsamples, NUM_SAMPLES);
+            break;
+        case PACK_S16:
+            bytes += sfe_pack_s16(out, ssamples, NUM_SAMPLES);
+            break;
+        case UNPACK_F32:
+            bytes += sfe_unpack_f32(fout, adc, NUM_SAMPLES);
+            break;
+        case UNPACK_S8:
+            bytes += sfe_unpack_s8((signed char*)fout, adc, NUM_SAMPLES);
+            break;
+        default:
+            bytes += sfe_unpack_s16((short*)fout, adc, NUM_SAMPLES);
+            break;
+        }
+        rounds++;
+        t = now() - t0;
+    }while (t < BENCH_SECONDS);
+
+    printf("%-8s %-12s %10.1f MB/s %10.1f MS/s\n", sfe_simd_name(k), bench_names[what],
+           bytes / t * 1e-6, (double)rounds * NUM_SAMPLES / t * 1e-6);
+}
+
+int main(int argc, char* argv[])
+{
+    int k, ret = 0;
+
+    srand(1);
+    for (int i=0; i<NUM_SAMPLES; i++){
+        fsamples[i] = (rand() / (float)RAND_MAX - 0.5f) * 2.6f;
+        ssamples[i] = (short)(rand() & 0xFFFF);
+        adc[i] = (unsigned char)i;
+    }
+    /* the edges, out of range values and NaN */
+    fsamples[1] = 1.0f;
+    fsamples[2] = -1.0f;
+    fsamples[5] = -0.0f;
+    fsamples[6] = NAN;
+    fsamples[9] = INFINITY;
+    fsamples[10] = -INFINITY;
+    fsamples[13] = 1.0f - 1e-7f;
+    ssamples[1] = 32767;
+    ssamples[2] = -32768;
+    
+    printf("default kernel: %s\n", sfe_simd_name(sfe_convert_get_kernel()));
+    for (k=SFE_SIMD_SCALAR; k<SFE_SIMD_NUM; k++){
+        if (!sfe_simd_supported((sfe_simd)k)){
+            continue;
+        }
+        sfe_convert_set_kernel((sfe_simd)k);
+        if (verify((sfe_simd)k)){
+            ret = 1;
+            continue;
+        }
+        for (int b=PACK_F32; b<=UNPACK_S16; b++){
+            bench((sfe_simd)k, b);
+        }
+    }
+    sfe_convert_set_kernel(SFE_SIMD_AUTO);
+    
+    return ret;
+}
@@ -57,23 +57,69 @@ void usleep(DWORD waitTime) {
 #endif
 
 
-int main(int argc, char* argv[])
+/* bus:address as udev passes it, NULL for the first board */
+static sfe_usb* open_board(const char *where)
 {
-    sfe_usb *h = usb_init();
-    int i;
-    unsigned status;
+    sfe_usb_info list[16];
+    unsigned bus, address;
+    int n, i;
 
-    if (get_cdone(h) != -1){
-        fprintf(stderr, "firmware already loaded\n");
-        return 1;
+    if (!where){
+        return usb_init();
+    }
+    if (sscanf(where, "%u:%u", &bus, &address) != 2){
+        fprintf(stderr, "`%s' is not bus:address\n", where);
+        return NULL;
+    }
+    n = usb_enumerate(list, 16);
+    for (i=0; i<n; i++){
+        if (list[i].bus == bus && list[i].address == address){
+            sfe_usb *h = usb_open(i, NULL);
+
+            /* other boards may come and go in between */
+            if (h && (h->info.bus != bus || h->info.address != address)){
+                usb_close(h);
+                break;
+            }
+            return h;
+        }
     }
+    fprintf(stderr, "no board at %s\n", where);
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    struct ezusb_image *img;
+    sfe_usb *h;
+    int ret;
 
     if (argc < 2){
-        fprintf(stderr, "usage: fw_load `path to simplefe.hex'\n");
+        fprintf(stderr, "usage: fw_load `path to simplefe.hex' [bus:address]\n");
         return 2;
     }
 
-    return ezusb_load_ram(h->dev, argv[1], FX_TYPE_FX2LP, IMG_TYPE_HEX, 0);
+    /* parsed, or mapped from the cache, before the board is touched */
+    img = ezusb_image_open(argv[1], FX_TYPE_FX2LP);
+    if (!img){
+        return 2;
+    }
+    h = open_board(argc > 2 ? argv[2] : NULL);
+    if (!h){
+        ezusb_image_close(img);
+        return 2;
+    }
+
+    /* the firmware answers VR_GPIO, reload it only if it is another one */
+    if (get_cdone(h) != -1 && ezusb_image_probe(h->dev, img) == 1){
+        fprintf(stderr, "firmware already loaded\n");
+        ret = 1;
+    }
+    else {
+        ret = ezusb_load_image(h->dev, img);
+    }
     
+    ezusb_image_close(img);
     usb_close(h);
+    return ret;
 }
@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "usb_access.h"
+#include "sfe_flash.h"
 
 
 #ifdef _MSC_VER
@@ -55,6 +56,7 @@ void usleep(DWORD waitTime) {
 
 static bool verbose = false;
 static sfe_usb *bb = NULL;
+static sfe_flash *fl = NULL;
 // ---------------------------------------------------------
 // FLASH definitions
 // ---------------------------------------------------------
@@ -271,63 +273,6 @@ static void flash_write_enable()
     }
 }
 
-static void flash_bulk_erase()
-{
-    fprintf(stderr, "bulk erase..\n");
-
-    uint8_t data[1] = { FC_CE };
-    flash_chip_select();
-    usb_xfer_spi(bb,data, 1);
-    flash_chip_deselect();
-}
-
-static void flash_64kB_sector_erase(int addr)
-{
-    fprintf(stderr, "erase 64kB sector at 0x%06X..\n", addr);
-
-    uint8_t command[4] = { FC_BE64, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
-
-    flash_chip_select();
-    usb_xfer_spi(bb, command, 4);
-    flash_chip_deselect();
-}
-
-static void flash_prog(int addr, uint8_t *data, int n)
-{
-    if (verbose)
-        fprintf(stderr, "prog 0x%06X +0x%03X..\n", addr, n);
-
-    uint8_t command[4] = { FC_PP, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
-
-    if (verbose)
-        for (int i = 0; i < n; i++)
-            fprintf(stderr, "%02x%c", data[i], i == n - 1 || i % 32 == 31 ? '\n' : ' ');
-    
-    flash_chip_select();
-    usb_xfer_spi(bb, command, 4);
-    usb_xfer_spi(bb, data, n);
-    flash_chip_deselect();
-
-}
-
-static void flash_read(int addr, uint8_t *data, int n)
-{
-    if (verbose)
-        fprintf(stderr, "read 0x%06X +0x%03X..\n", addr, n);
-
-    uint8_t command[4] = { FC_RD, (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr };
-
-    flash_chip_select();
-    usb_xfer_spi(bb, command, 4);
-    memset(data, 0, n);
-    usb_xfer_spi(bb, data, n);
-    flash_chip_deselect();
-
-    if (verbose)
-        for (int i = 0; i < n; i++)
-            fprintf(stderr, "%02x%c", data[i], i == n - 1 || i % 32 == 31 ? '\n' : ' ');
-}
-
 static void flash_wait()
 {
     if (verbose)
@@ -403,17 +348,15 @@ static void flash_disable_protection()
 static void help(const char *progname)
 {
     fprintf(stderr, "Simple programming tool for FX2LP Lattice iCE programmers.\n");
-    fprintf(stderr, "Usage: %s [-b|-n|-c] <input file>\n", progname);
+    fprintf(stderr, "Usage: %s [-b|-n|-c|-D] <input file>\n", progname);
     fprintf(stderr, "       %s -r|-R<bytes> <output file>\n", progname);
     fprintf(stderr, "       %s -S <input file>\n", progname);
     fprintf(stderr, "       %s -t\n", progname);
     fprintf(stderr, "\n");
     fprintf(stderr, "General options:\n");
-    fprintf(stderr, "  -d <device string>    use the specified USB device [default: i:0x0403:0x6010 or i:0x0403:0x6014]\n");
-    fprintf(stderr, "                          d:<devicenode>               (e.g. d:002/005)\n");
-    fprintf(stderr, "                          i:<vendor>:<product>         (e.g. i:0x0403:0x6010)\n");
-    fprintf(stderr, "                          i:<vendor>:<product>:<index> (e.g. i:0x0403:0x6010:0)\n");
-    fprintf(stderr, "                          s:<vendor>:<product>:<serial-string>\n");
+    fprintf(stderr, "  -d <device string>    use the specified simpleFE board [default: the first one]\n");
+    fprintf(stderr, "                          i:<index>                    (e.g. i:1)\n");
+    fprintf(stderr, "                          s:<serial-string>\n");
     fprintf(stderr, "  -I [ABCD]             connect to the specified interface on the FTDI chip\n");
     fprintf(stderr, "                          [default: A]\n");
     fprintf(stderr, "  -o <offset in bytes>  start address for read/write [default: 0]\n");
@@ -430,6 +373,8 @@ static void help(const char *progname)
     fprintf(stderr, "                          (append 'k' to the argument for size in kilobytes,\n");
     fprintf(stderr, "                          or 'M' for size in megabytes)\n");
     fprintf(stderr, "  -c                    do not write flash, only verify (`check')\n");
+    fprintf(stderr, "  -D                    write only the 4kB sectors that differ from the file,\n");
+    fprintf(stderr, "                          then verify. The rest of the flash is kept.\n");
     fprintf(stderr, "  -S                    perform SRAM programming\n");
     fprintf(stderr, "  -t                    just read the flash ID sequence\n");
     fprintf(stderr, "\n");
@@ -494,6 +439,7 @@ int main(int argc, char **argv)
     bool slow_clock = false;
     bool disable_protect = false;
     bool disable_verify = false;
+    bool diff_mode = false;
     const char *filename = NULL;
     const char *devstr = NULL;
     int ifnum = 0;
@@ -506,7 +452,7 @@ int main(int argc, char **argv)
     /* Decode command line parameters */
     int opt;
     char *endptr;
-    while ((opt = getopt_long(argc, argv, "d:I:rR:e:o:cbnStvspX", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:I:rR:e:o:cbnStvspXD", long_options, NULL)) != -1) {
         switch (opt) {
         case 'd': /* device string */
             devstr = optarg;
@@ -596,6 +542,9 @@ int main(int argc, char **argv)
         case 'X': /* disable verification */
             disable_verify = true;
             break;
+        case 'D': /* only rewrite what differs */
+            diff_mode = true;
+            break;
         case -2:
             help(argv[0]);
             return EXIT_SUCCESS;
@@ -618,6 +567,11 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    if (diff_mode && (bulk_erase || dont_erase || erase_mode || read_mode || check_mode || prog_sram || test_mode)) {
+        fprintf(stderr, "%s: option `-D' only valid in programming mode, without `-b', `-n' and `-e'\n", my_name);
+        return EXIT_FAILURE;
+    }
+
     if (disable_protect && (read_mode || check_mode || prog_sram || test_mode)) {
         fprintf(stderr, "%s: option `-p' only valid in programming mode\n", my_name);
         return EXIT_FAILURE;
@@ -743,7 +697,16 @@ int main(int argc, char **argv)
 
     fprintf(stderr, "init..\n");
     
-    bb = usb_init();
+    if (devstr && !strncmp(devstr, "i:", 2))
+        bb = usb_open(atoi(devstr + 2), NULL);
+    else if (devstr && !strncmp(devstr, "s:", 2))
+        bb = usb_open(0, devstr + 2);
+    else
+        bb = usb_init();
+    if (!bb) {
+        fprintf(stderr, "%s: cannot open the simpleFE board\n", my_name);
+        return EXIT_FAILURE;
+    }
     fprintf(stderr, "cdone: %s\n", get_cdone(bb) ? "high" : "low");
 
     flash_release_reset();
@@ -826,6 +789,12 @@ int main(int argc, char **argv)
 
         flash_read_id();
 
+        fl = sfe_flash_open(bb);
+        if (!fl) {
+            fprintf(stderr, "%s: out of memory\n", my_name);
+            goto err;
+        }
+
 
         // ---------------------------------------------------------
         // Program
@@ -839,13 +808,17 @@ int main(int argc, char **argv)
                 flash_disable_protection();
             }
 			
-            if (!dont_erase)
+            if (diff_mode)
+            {
+                /* the erase is up to sfe_flash_update() */
+            }
+            else if (!dont_erase)
             {
                 if (bulk_erase)
                 {
-                    flash_write_enable();
-                    flash_bulk_erase();
-                    flash_wait();
+                    fprintf(stderr, "bulk erase..\n");
+                    if (sfe_flash_erase_chip(fl))
+                        goto err;
                 }
                 else
                 {
@@ -855,31 +828,45 @@ int main(int argc, char **argv)
                     int end_addr = (rw_offset + file_size + 0xffff) & ~0xffff;
 
                     for (int addr = begin_addr; addr < end_addr; addr += 0x10000) {
-                        flash_write_enable();
-                        flash_64kB_sector_erase(addr);
+                        fprintf(stderr, "erase 64kB sector at 0x%06X..\n", addr);
+                        if (sfe_flash_erase(fl, addr, 1, SFE_FLASH_BLOCK))
+                            goto err;
                         if (verbose) {
                             fprintf(stderr, "Status after block erase:\n");
                             flash_read_status();
                         }
-                        flash_wait();
                     }
                 }
             }
 
             if (!erase_mode)
             {
-                fprintf(stderr, "programming..\n");
+                uint8_t *image = (uint8_t*)malloc(file_size > 0 ? file_size : 1);
+                sfe_flash_stats st;
+                int ret;
 
-                for (int rc, addr = 0; true; addr += rc) {
-                    uint8_t buffer[256];
-                    int page_size = 256 - (rw_offset + addr) % 256;
-                    rc = fread(buffer, 1, page_size, f);
-                    if (rc <= 0)
-                        break;
-                    flash_write_enable();
-                    flash_prog(rw_offset + addr, buffer, rc);
-                    flash_wait();
+                if (!image || fread(image, 1, file_size, f) != (size_t)file_size) {
+                    fprintf(stderr, "%s: %s: can't read the file\n", my_name, filename);
+                    free(image);
+                    goto err;
                 }
+                
+                fprintf(stderr, "programming..\n");
+                if (diff_mode)
+                    ret = sfe_flash_update(fl, rw_offset, image, file_size);
+                else
+                    ret = sfe_flash_program(fl, rw_offset, image, file_size);
+                free(image);
+                if (ret)
+                    goto err;
+
+                sfe_flash_get_stats(fl, &st);
+                if (diff_mode)
+                    fprintf(stderr, "sectors: %u unchanged, %u erased, %u patched\n",
+                            st.sectors_skipped, st.sectors_erased, st.sectors_patched);
+                if (verbose)
+                    fprintf(stderr, "%u page programs, %u sent again after a busy status\n",
+                            st.pages, st.resent);
 
                 /* seek to the beginning for second pass */
                 fseek(f, 0, SEEK_SET);
@@ -890,21 +877,27 @@ int main(int argc, char **argv)
         // ---------------------------------------------------------
 
         if (read_mode) {
+            uint8_t *buffer = (uint8_t*)malloc(read_size > 0 ? read_size : 1);
+            
             fprintf(stderr, "reading..\n");
-            for (int addr = 0; addr < read_size; addr += 256) {
-                uint8_t buffer[256];
-                flash_read(rw_offset + addr, buffer, 256);
-                fwrite(buffer, read_size - addr > 256 ? 256 : read_size - addr, 1, f);
+            if (!buffer || sfe_flash_read(fl, rw_offset, buffer, read_size)) {
+                free(buffer);
+                goto err;
             }
+            fwrite(buffer, read_size, 1, f);
+            free(buffer);
         } else if (!erase_mode && !disable_verify) {
+            static uint8_t buffer_file[SFE_FLASH_BLOCK];
+            
             fprintf(stderr, "reading..\n");
-            for (int addr = 0; true; addr += 256) {
-                uint8_t buffer_flash[256], buffer_file[256];
-                int rc = fread(buffer_file, 1, 256, f);
+            for (int addr = 0; true; addr += SFE_FLASH_BLOCK) {
+                int rc = fread(buffer_file, 1, SFE_FLASH_BLOCK, f);
                 if (rc <= 0)
                     break;
-                flash_read(rw_offset + addr, buffer_flash, rc);
-                if (memcmp(buffer_file, buffer_flash, rc)) {
+                int ret = sfe_flash_verify(fl, rw_offset + addr, buffer_file, rc);
+                if (ret < 0)
+                    goto err;
+                if (ret) {
                     fprintf(stderr, "Found difference between flash and file!\n");
                     goto err;
                 }
@@ -913,6 +906,9 @@ int main(int argc, char **argv)
             fprintf(stderr, "VERIFY OK\n");
         }
 
+        sfe_flash_close(fl);
+        fl = NULL;
+
 
         // ---------------------------------------------------------
         // Reset
@@ -935,6 +931,7 @@ int main(int argc, char **argv)
 
     fprintf(stderr, "Bye.\n");
  err:    
+    sfe_flash_close(fl);
     usb_close(bb);
     return 0;
 }
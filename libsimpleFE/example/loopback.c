@@ -74,42 +74,65 @@ static int tx_callback(unsigned char* buffer, int length, void* userdata)
     return exitRequested;
 }
 
-static int rx_callback(unsigned char* buffer, int length, void* userdata)
+static int rx_callback(sfe_rx_block* blk, void* userdata)
 {
     static unsigned rx_cnt = 0;
-    rx_bytes += length;
-    rx_pkts ++ ;
+    sfe *h = (sfe*)userdata;
+    unsigned i;
+
+    /* the packets are read in place, no copy unless recording */
+    for (i=0; i<blk->num_packets; i++){
+        unsigned length = blk->lengths[i];
+        unsigned char *buffer = blk->data + i*blk->stride;
+
+        if (!length){
+            continue;
+        }
+        rx_bytes += length;
+        rx_pkts ++ ;
         
-    if(rx_pkts <= 80 ){
-        memcpy(recwav + recpos, buffer, length);
-        recpos += length;
-    }
-	else {
-		recpos = 0;
-	}
+        if(rx_pkts <= 80 ){
+            memcpy(recwav + recpos, buffer, length);
+            recpos += length;
+        }
+        else {
+            recpos = 0;
+        }
     
-    if (rx_pkts % 8000 == 0){
-        rx_cnt++;
-        printf("adc throughput: %lld\n", rx_bytes*8000/rx_pkts);
-        if (rx_cnt == 5){
-            rx_bytes = 0;
-            rx_pkts = 0;
-            rx_cnt = 0;
+        if (rx_pkts % 8000 == 0){
+            rx_cnt++;
+            printf("adc throughput: %lld\n", rx_bytes*8000/rx_pkts);
+            if (rx_cnt == 5){
+                rx_bytes = 0;
+                rx_pkts = 0;
+                rx_cnt = 0;
+            }
         }
     }
+    sfe_rx_release(h, blk);
     return exitRequested;
 }
 
 
 int main(int argc, char* argv[])
 {
-    sfe *h_tx = sfe_init();
+    sfe_init_options opt;
+    unsigned pkts, xfers;
+    
+    /* optional in-flight latency target in microseconds */
+    memset(&opt, 0, sizeof(opt));
+    if (argc > 1){
+        opt.latency_us = atoi(argv[1]);
+    }
+    sfe *h_tx = sfe_init_ex(&opt);
     
     unsigned sample_rate =7500000;
     if(!h_tx){
         fprintf(stderr, "Cannot open tx simpleFE device\n");
         return 1;
     }
+    sfe_get_transfer_geometry(h_tx, &pkts, &xfers);
+    printf("%u transfers of %u packets in flight\n", xfers, pkts);
 
     //fill waveform buffer
     for(int i=0, j=0; i<1280; i+=5){
@@ -139,7 +162,7 @@ int main(int argc, char* argv[])
     fp = fopen("rec.dat", "wb");
     signal(SIGINT, sigintHandler);
 
-    if (sfe_rx_start(h_tx, rx_callback, NULL)){        
+    if (sfe_rx_start_zerocopy(h_tx, rx_callback, h_tx)){        
         printf("rx start failed\n");
         exit(1);
     }
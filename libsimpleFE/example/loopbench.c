@@ -0,0 +1,673 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* 
+ * full duplex loopback benchmark, the DAC outputs cabled to the ADC 
+ * inputs. every supported sample rate and every rx/tx channel pairing is
+ * streamed for a while, each point reports
+ *
+ *   sustained rx and tx throughput against what the rate asks for
+ *   histograms of how far the rx and tx callback intervals are off the
+ *   transfer period
+ *   the round trip from the tx callback that starts a 31 chip m-sequence
+ *   to the rx callback it comes back in, found by correlation on the 
+ *   first rx channel. this is mostly the transfers queued on both sides,
+ *   -l sets the budget as sfe_init_options.latency_us does
+ *   rx overflows and lost samples, empty DAC FIFO readings
+ *
+ * results go to stdout and optionally to JSON and CSV files. the _emu 
+ * build runs on the emulated board with the ADC looped back and adds the
+ * FIFO counters of the emulator. the emulator loops the DAC bytes back 
+ * in channel order, the round trip is only found when rx and tx use the 
+ * same number of channels.
+ *
+ *    loopbench -t 2 -j bench.json -o bench.csv
+ *    loopbench_emu -e 16 -t 0.5 -c I:I,IQ:IQ
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <time.h>
+#include "simpleFE.h"
+#ifdef SFE_EMU
+#include "sfe_emu.h"
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+static void msleep(unsigned ms) { Sleep(ms); }
+static unsigned long long now_ns(void)
+{
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (unsigned long long)(cnt.QuadPart / freq.QuadPart) * 1000000000ULL +
+        (unsigned long long)(cnt.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+}
+#else
+#include <unistd.h>
+static void msleep(unsigned ms) { usleep(ms * 1000); }
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define JIT_BINS        8
+#define PN_LEN          31
+#define PN_CHIP         8
+#define PN_SAMPLES      (PN_LEN * PN_CHIP)
+/* between two sequences, and how long one may take to come back */
+#define PN_PERIOD_MS    50
+#define PN_TIMEOUT_MS   1000
+#define WARMUP_MS       100
+
+/* upper edges of the jitter bins in us, the last one is open */
+static const unsigned jit_edges_us[JIT_BINS-1] = {50, 100, 200, 500, 1000, 2000, 5000};
+
+typedef struct{
+    double nominal_us;
+    unsigned long long last_ns;
+    unsigned long long hist[JIT_BINS];
+    double max_us;
+}jitter;
+
+/* callbacks counted after the warm up */
+typedef struct{
+    unsigned long long first_ns;
+    unsigned long long last_ns;
+    unsigned long long bytes;
+    jitter jit;
+}stream;
+
+typedef struct{
+    /* the point */
+    unsigned rate;
+    int rx_i, rx_q, tx_i, tx_q;
+    unsigned long long start_ns;
+
+    stream rx, tx;
+    unsigned long long rx_overflow_blocks;
+    unsigned long long rx_lost_samples;
+    unsigned long long rx_gap_blocks;
+    unsigned long long tx_empty_readings;
+    long long emu_adc_overflow;
+    long long emu_dac_underflow;
+
+    /* the m-sequence, tx side */
+    unsigned long long tx_samples;   /* DAC samples, all channels */
+    unsigned long long pn_start;     /* sample period the sequence starts at */
+    unsigned long long pn_sent_ns;
+    unsigned long long pn_next_ns;
+    int pn_armed;
+    /* rx side */
+    unsigned long long rx_bytes_all;
+    unsigned char cap[PN_SAMPLES];
+    unsigned cap_n;
+    unsigned long long cap_ns;
+    /* round trips */
+    unsigned lat_n;
+    unsigned lat_missed;
+    double lat_min_us, lat_max_us, lat_sum_us;
+}point;
+
+static int pn[PN_LEN];
+
+/* x^5 + x^3 + 1 */
+static void make_pn(void)
+{
+    unsigned reg = 0x1F, i;
+
+    for (i=0; i<PN_LEN; i++){
+        unsigned bit = ((reg >> 4) ^ (reg >> 2)) & 1;
+        pn[i] = (reg & 1) ? 1 : -1;
+        reg = ((reg << 1) | bit) & 0x1F;
+    }
+}
+
+static void jitter_add(jitter *j, unsigned long long t)
+{
+    if (j->last_ns){
+        double d = fabs((t - j->last_ns) / 1000.0 - j->nominal_us);
+        unsigned b = 0;
+
+        while (b < JIT_BINS-1 && d >= jit_edges_us[b]){
+            b++;
+        }
+        j->hist[b]++;
+        j->max_us = d > j->max_us ? d : j->max_us;
+    }
+    j->last_ns = t;
+}
+
+static void stream_add(point *p, stream *s, unsigned long long t, unsigned bytes)
+{
+    if (t - p->start_ns < WARMUP_MS * 1000000ULL){
+        return;
+    }
+    if (!s->first_ns){
+        /* what came with the first callback was there before it */
+        s->first_ns = t;
+    }
+    else{
+        s->bytes += bytes;
+    }
+    s->last_ns = t;
+    jitter_add(&s->jit, t);
+}
+
+static double stream_rate(const stream *s)
+{
+    return s->last_ns > s->first_ns ? s->bytes * 1e9 / (s->last_ns - s->first_ns) : 0;
+}
+
+/* the DAC code of a sample period, the sequence at full scale on every
+ * channel, mid scale otherwise */
+static unsigned tx_code(point *p, unsigned long long period)
+{
+    if (p->pn_armed && period >= p->pn_start && period < p->pn_start + PN_SAMPLES){
+        return pn[(period - p->pn_start) / PN_CHIP] > 0 ? 1023 : 0;
+    }
+    return 512;
+}
+
+static int tx_callback(unsigned char* buffer, int length, void* userdata)
+{
+    point *p = userdata;
+    unsigned ntx = p->tx_i + p->tx_q;
+    unsigned long long t = now_ns();
+    int i, k;
+
+    stream_add(p, &p->tx, t, length);
+    if (!p->pn_armed && t >= p->pn_next_ns){
+        /* on the next whole sample period of this transfer */
+        p->pn_start = (p->tx_samples + ntx - 1) / ntx;
+        p->pn_sent_ns = t;
+        p->pn_armed = 1;
+        p->cap_n = 0;
+    }
+    for (i=0; i+5<=length; i+=5){
+        unsigned u[4];
+
+        for (k=0; k<4; k++){
+            u[k] = tx_code(p, p->tx_samples++ / ntx);
+        }
+        buffer[i] = (u[0]>>8) | ((u[1]>>8)<<2) | ((u[2]>>8)<<4) | ((u[3]>>8)<<6);
+        buffer[i+1] = u[0] & 0xFF;
+        buffer[i+2] = u[1] & 0xFF;
+        buffer[i+3] = u[2] & 0xFF;
+        buffer[i+4] = u[3] & 0xFF;
+    }
+    return 0;
+}
+
+/* the chips at their centres against the sequence */
+static void pn_check(point *p)
+{
+    int corr = 0, k;
+    double us;
+
+    for (k=0; k<PN_LEN; k++){
+        corr += (p->cap[k*PN_CHIP + PN_CHIP/2] > 0x80 ? 1 : -1) * pn[k];
+    }
+    p->pn_armed = 0;
+    p->pn_next_ns = p->cap_ns + PN_PERIOD_MS * 1000000ULL;
+    if (corr < PN_LEN - 2){
+        p->lat_missed++;
+        return;
+    }
+    us = (p->cap_ns - p->pn_sent_ns) / 1000.0;
+    if (!p->lat_n || us < p->lat_min_us){
+        p->lat_min_us = us;
+    }
+    if (!p->lat_n || us > p->lat_max_us){
+        p->lat_max_us = us;
+    }
+    p->lat_sum_us += us;
+    p->lat_n++;
+}
+
+static int rx_callback(const sfe_rx_batch* batch, void* userdata)
+{
+    point *p = userdata;
+    const sfe_rx_meta *m = batch->meta;
+    unsigned nrx = p->rx_i + p->rx_q;
+    unsigned long long t = now_ns();
+    unsigned i, j;
+
+    stream_add(p, &p->rx, t, batch->total_bytes);
+    if (m->flags & SFE_RX_OVERFLOW){
+        p->rx_overflow_blocks++;
+    }
+    if (m->flags & SFE_RX_GAP){
+        p->rx_gap_blocks++;
+    }
+    p->rx_lost_samples += m->lost_samples;
+
+    for (i=0; i<batch->n_iov; i++){
+        const unsigned char *d = batch->iov[i].base;
+
+        for (j=0; j<batch->iov[i].len; j++, p->rx_bytes_all++){
+            /* the first channel only */
+            if (p->rx_bytes_all % nrx || !p->pn_armed){
+                continue;
+            }
+            if (!p->cap_n && abs((int)d[j] - 0x80) < 0x40){
+                continue;
+            }
+            if (!p->cap_n){
+                p->cap_ns = t;
+            }
+            p->cap[p->cap_n++] = d[j];
+            if (p->cap_n == PN_SAMPLES){
+                pn_check(p);
+            }
+        }
+    }
+    if (p->pn_armed && t - p->pn_sent_ns > PN_TIMEOUT_MS * 1000000ULL){
+        p->pn_armed = 0;
+        p->pn_next_ns = t;
+        p->lat_missed++;
+    }
+    return 0;
+}
+
+/* counts the empty DAC FIFO readings since the last call */
+static void poll_tx_level(sfe *h, point *p, unsigned *last_updates)
+{
+    sfe_tx_rate_state st;
+    unsigned n, i;
+
+    sfe_get_tx_rate_state(h, &st);
+    n = st.num_updates - *last_updates;
+    n = n < st.history_len ? n : st.history_len;
+    for (i=st.history_len - n; i<st.history_len; i++){
+        p->tx_empty_readings += st.level_history[i] == 0;
+    }
+    *last_updates = st.num_updates;
+}
+
+static const char* ch_name(int i, int q)
+{
+    return i && q ? "IQ" : (i ? "I" : "Q");
+}
+
+static int run_point(sfe *h, point *p, double seconds, unsigned pkts)
+{
+    unsigned last_updates = 0;
+    unsigned long long end;
+#ifdef SFE_EMU
+    sfe_emu_stats st0, st;
+#endif
+
+    p->rx.jit.nominal_us = p->tx.jit.nominal_us = pkts * 125.0;
+    p->emu_adc_overflow = p->emu_dac_underflow = -1;
+    if (sfe_set_sample_rate(h, p->rate)){
+        return -1;
+    }
+    sfe_rx_enable(h, p->rx_i, p->rx_q);
+    sfe_tx_enable(h, p->tx_i, p->tx_q);
+#ifdef SFE_EMU
+    sfe_emu_get_stats(0, &st0);
+#endif
+    p->start_ns = now_ns();
+    p->pn_next_ns = p->start_ns + WARMUP_MS * 1000000ULL;
+    if (sfe_rx_start_batched(h, rx_callback, p)){
+        return -1;
+    }
+    if (sfe_tx_start(h, tx_callback, p)){
+        sfe_stop_rx(h);
+        return -1;
+    }
+    end = p->start_ns + (unsigned long long)(seconds * 1e9);
+    while (now_ns() < end){
+        msleep(20);
+        poll_tx_level(h, p, &last_updates);
+    }
+    sfe_stop_tx(h);
+    sfe_stop_rx(h);
+#ifdef SFE_EMU
+    sfe_emu_get_stats(0, &st);
+    p->emu_adc_overflow = st.adc_overflow - st0.adc_overflow;
+    p->emu_dac_underflow = st.dac_underflow - st0.dac_underflow;
+#endif
+    return 0;
+}
+
+static void write_csv_header(FILE *fp)
+{
+    int b;
+    
+    fprintf(fp, "rate,rx,tx,rx_Bps,rx_expected_Bps,tx_Bps,tx_expected_Bps");
+    for (b=0; b<JIT_BINS; b++){
+        fprintf(fp, ",rx_jit%d", b);
+    }
+    fprintf(fp, ",rx_jit_max_us");
+    for (b=0; b<JIT_BINS; b++){
+        fprintf(fp, ",tx_jit%d", b);
+    }
+    fprintf(fp, ",tx_jit_max_us,lat_n,lat_missed,lat_min_us,lat_mean_us,lat_max_us"
+            ",rx_overflow_blocks,rx_lost_samples,rx_gap_blocks,tx_empty_readings"
+            ",emu_adc_overflow,emu_dac_underflow\n");
+}
+
+static void write_csv(FILE *fp, const point *p)
+{
+    int b;
+
+    fprintf(fp, "%u,%s,%s,%.0f,%u,%.0f,%u", p->rate, ch_name(p->rx_i, p->rx_q),
+            ch_name(p->tx_i, p->tx_q), stream_rate(&p->rx), p->rate * (p->rx_i + p->rx_q),
+            stream_rate(&p->tx), p->rate * (p->tx_i + p->tx_q) * 5 / 4);
+    for (b=0; b<JIT_BINS; b++){
+        fprintf(fp, ",%llu", p->rx.jit.hist[b]);
+    }
+    fprintf(fp, ",%.1f", p->rx.jit.max_us);
+    for (b=0; b<JIT_BINS; b++){
+        fprintf(fp, ",%llu", p->tx.jit.hist[b]);
+    }
+    fprintf(fp, ",%.1f,%u,%u,%.1f,%.1f,%.1f,%llu,%llu,%llu,%llu,%lld,%lld\n",
+            p->tx.jit.max_us, p->lat_n, p->lat_missed, p->lat_min_us,
+            p->lat_n ? p->lat_sum_us / p->lat_n : 0, p->lat_max_us,
+            p->rx_overflow_blocks, p->rx_lost_samples, p->rx_gap_blocks,
+            p->tx_empty_readings, p->emu_adc_overflow, p->emu_dac_underflow);
+}
+
+static void write_json_hist(FILE *fp, const char *name, const jitter *j)
+{
+    int b;
+
+    fprintf(fp, "\"%s\": {\"max_us\": %.1f, \"counts\": [", name, j->max_us);
+    for (b=0; b<JIT_BINS; b++){
+        fprintf(fp, "%s%llu", b ? ", " : "", j->hist[b]);
+    }
+    fprintf(fp, "]}");
+}
+
+static void write_json(FILE *fp, const point *p, int first)
+{
+    fprintf(fp, "%s    {\"rate\": %u, \"rx\": \"%s\", \"tx\": \"%s\",\n", first ? "" : ",\n",
+            p->rate, ch_name(p->rx_i, p->rx_q), ch_name(p->tx_i, p->tx_q));
+    fprintf(fp, "     \"rx_Bps\": %.0f, \"rx_expected_Bps\": %u, \"tx_Bps\": %.0f, \"tx_expected_Bps\": %u,\n",
+            stream_rate(&p->rx), p->rate * (p->rx_i + p->rx_q),
+            stream_rate(&p->tx), p->rate * (p->tx_i + p->tx_q) * 5 / 4);
+    fprintf(fp, "     ");
+    write_json_hist(fp, "rx_jitter", &p->rx.jit);
+    fprintf(fp, ", ");
+    write_json_hist(fp, "tx_jitter", &p->tx.jit);
+    fprintf(fp, ",\n     \"latency\": {\"n\": %u, \"missed\": %u", p->lat_n, p->lat_missed);
+    if (p->lat_n){
+        fprintf(fp, ", \"min_us\": %.1f, \"mean_us\": %.1f, \"max_us\": %.1f",
+                p->lat_min_us, p->lat_sum_us / p->lat_n, p->lat_max_us);
+    }
+    fprintf(fp, "},\n     \"rx_overflow_blocks\": %llu, \"rx_lost_samples\": %llu, "
+            "\"rx_gap_blocks\": %llu, \"tx_empty_readings\": %llu",
+            p->rx_overflow_blocks, p->rx_lost_samples, p->rx_gap_blocks, p->tx_empty_readings);
+    if (p->emu_adc_overflow >= 0){
+        fprintf(fp, ", \"emu_adc_overflow\": %lld, \"emu_dac_underflow\": %lld",
+                p->emu_adc_overflow, p->emu_dac_underflow);
+    }
+    fprintf(fp, "}");
+}
+
+/* "I:IQ,IQ:IQ" into rx/tx channel masks, bit 0 I and bit 1 Q */
+static int parse_combos(const char *s, int *rx, int *tx, int max)
+{
+    int n = 0;
+
+    while (*s && n < max){
+        char r[4], t[4];
+        int len = 0;
+
+        if (sscanf(s, "%3[IQ]:%3[IQ]%n", r, t, &len) != 2 || !len){
+            return -1;
+        }
+        rx[n] = (strchr(r, 'I') ? 1 : 0) | (strchr(r, 'Q') ? 2 : 0);
+        tx[n] = (strchr(t, 'I') ? 1 : 0) | (strchr(t, 'Q') ? 2 : 0);
+        n++;
+        s += len;
+        if (*s == ','){
+            s++;
+        }
+    }
+    return n;
+}
+
+static void help(const char *my_name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", my_name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -t <seconds>     per point, default 1\n");
+    fprintf(stderr, "  -r <rate>        only this sample rate (rounded up to a supported one)\n");
+    fprintf(stderr, "  -e <n>           every n-th supported rate, default 1\n");
+    fprintf(stderr, "  -c <rx:tx,...>   channel pairings, e.g. I:I,IQ:IQ, default all 9\n");
+    fprintf(stderr, "  -l <us>          usb latency budget, default the library default\n");
+    fprintf(stderr, "  -s <serial>      board to use\n");
+    fprintf(stderr, "  -j <file>        JSON results\n");
+    fprintf(stderr, "  -o <file>        CSV results\n");
+#ifdef SFE_EMU
+    fprintf(stderr, "  -x <speed>       emulated time / wall time, default 1\n");
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned rates[SIMPLE_FE_NUM_SAMPLE_RATES];
+    int rx_set[9], tx_set[9];
+    int num_combos = 0;
+    double seconds = 1.0;
+    unsigned only_rate = 0, every = 1, pkts, xfers;
+    const char *json_path = NULL, *csv_path = NULL;
+    FILE *json = NULL, *csv = NULL;
+    sfe_init_options init;
+    int opt, r, c, first = 1, failed = 0;
+    sfe *h;
+#ifdef SFE_EMU
+    sfe_emu_config cfg;
+    double speed = 1.0;
+#endif
+
+    memset(&init, 0, sizeof(init));
+    while ((opt = getopt(argc, argv, "t:r:e:c:l:s:j:o:x:h")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'r':
+            only_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            every = strtoul(optarg, NULL, 0);
+            every = every ? every : 1;
+            break;
+        case 'c':
+            num_combos = parse_combos(optarg, rx_set, tx_set, 9);
+            if (num_combos <= 0){
+                help(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            init.latency_us = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            init.serial = optarg;
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        case 'o':
+            csv_path = optarg;
+            break;
+#ifdef SFE_EMU
+        case 'x':
+            speed = atof(optarg);
+            break;
+#endif
+        default:
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!num_combos){
+        for (r=1; r<=3; r++){
+            for (c=1; c<=3; c++){
+                rx_set[num_combos] = r;
+                tx_set[num_combos++] = c;
+            }
+        }
+    }
+    if (seconds * 1000 < 2 * WARMUP_MS){
+        seconds = 2 * WARMUP_MS / 1000.0;
+    }
+    make_pn();
+
+#ifdef SFE_EMU
+    sfe_emu_get_config(&cfg);
+    cfg.adc_source = SFE_EMU_ADC_LOOPBACK;
+    cfg.speed = speed;
+    sfe_emu_set_config(&cfg);
+#endif
+    h = sfe_init_ex(&init);
+    if (!h){
+        fprintf(stderr, "Cannot open simpleFE device\n");
+        return EXIT_FAILURE;
+    }
+    sfe_reset_board(h);
+    sfe_get_transfer_geometry(h, &pkts, &xfers);
+
+    if (json_path && !(json = fopen(json_path, "w"))){
+        fprintf(stderr, "cannot open %s\n", json_path);
+        sfe_close(h);
+        return EXIT_FAILURE;
+    }
+    if (csv_path && !(csv = fopen(csv_path, "w"))){
+        fprintf(stderr, "cannot open %s\n", csv_path);
+        if (json){
+            fclose(json);
+        }
+        sfe_close(h);
+        return EXIT_FAILURE;
+    }
+    if (json){
+        sfe_device_info info;
+
+        sfe_get_device_info(h, &info);
+        fprintf(json, "{\"serial\": \"%s\", \"emulated\": %s, \"seconds\": %.3f,\n",
+                info.serial,
+#ifdef SFE_EMU
+                "true",
+#else
+                "false",
+#endif
+                seconds);
+        fprintf(json, " \"packets_per_xfer\": %u, \"num_xfers\": %u, \"jitter_edges_us\": [", pkts, xfers);
+        for (r=0; r<JIT_BINS-1; r++){
+            fprintf(json, "%s%u", r ? ", " : "", jit_edges_us[r]);
+        }
+        fprintf(json, "],\n \"points\": [\n");
+    }
+    if (csv){
+        write_csv_header(csv);
+    }
+
+    printf("%9s %3s %3s %10s %10s %8s %8s %6s %9s %6s %6s\n", "rate", "rx", "tx", 
+           "rx MB/s", "tx MB/s", "rx jit", "tx jit", "rt n", "rt us", "ovf", "empty");
+    sfe_query_sample_rates(rates);
+    for (r=0; r<SIMPLE_FE_NUM_SAMPLE_RATES; r++){
+        if (only_rate){
+            /* the lowest one at or above it, the rates go down */
+            if (rates[r] < only_rate || (r+1 < SIMPLE_FE_NUM_SAMPLE_RATES && rates[r+1] >= only_rate)){
+                continue;
+            }
+        }
+        else if (r % every){
+            continue;
+        }
+        for (c=0; c<num_combos; c++){
+            point *p = calloc(1, sizeof(point));
+            int nrx = (rx_set[c] & 1) + (rx_set[c] >> 1);
+            int ntx = (tx_set[c] & 1) + (tx_set[c] >> 1);
+
+            if (!p){
+                fprintf(stderr, "out of memory\n");
+                failed = 1;
+                break;
+            }
+            p->rate = rates[r];
+            p->rx_i = rx_set[c] & 1;
+            p->rx_q = rx_set[c] >> 1;
+            p->tx_i = tx_set[c] & 1;
+            p->tx_q = tx_set[c] >> 1;
+            if (sfe_get_max_sample_rate(h, nrx, ntx) < p->rate){
+                printf("%9u %3s %3s   above the usb limit, skipped\n", p->rate,
+                       ch_name(p->rx_i, p->rx_q), ch_name(p->tx_i, p->tx_q));
+                free(p);
+                continue;
+            }
+            if (run_point(h, p, seconds, pkts)){
+                fprintf(stderr, "%u %s:%s did not stream\n", p->rate,
+                        ch_name(p->rx_i, p->rx_q), ch_name(p->tx_i, p->tx_q));
+                failed = 1;
+                free(p);
+                continue;
+            }
+            printf("%9u %3s %3s %10.3f %10.3f %8.1f %8.1f %6u %9.1f %6llu %6llu\n",
+                   p->rate, ch_name(p->rx_i, p->rx_q), ch_name(p->tx_i, p->tx_q),
+                   stream_rate(&p->rx) / 1e6, stream_rate(&p->tx) / 1e6,
+                   p->rx.jit.max_us, p->tx.jit.max_us, p->lat_n,
+                   p->lat_n ? p->lat_sum_us / p->lat_n : 0,
+                   p->rx_overflow_blocks, p->tx_empty_readings);
+            fflush(stdout);
+            if (json){
+                write_json(json, p, first);
+            }
+            if (csv){
+                write_csv(csv, p);
+            }
+            first = 0;
+            free(p);
+        }
+    }
+
+    if (json){
+        fprintf(json, "\n ]\n}\n");
+        fclose(json);
+    }
+    if (csv){
+        fclose(csv);
+    }
+    sfe_close(h);
+    return failed ? EXIT_FAILURE : 0;
+}
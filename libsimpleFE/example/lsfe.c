@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* lists the simpleFE boards attached to this host, the index and serial
+ * are what sfe_init_options.device_index / .serial select */
+
+#include <stdio.h>
+#include "simpleFE.h"
+
+#define MAX_BOARDS    16
+
+int main(int argc, char* argv[])
+{
+    sfe_device_info info[MAX_BOARDS];
+    int i, n;
+
+    n = sfe_enumerate(info, MAX_BOARDS);
+    if (n < 0){
+        fprintf(stderr, "enumeration failed\n");
+        return 1;
+    }
+    if (n == 0){
+        printf("no simpleFE board found\n");
+        return 0;
+    }
+
+    printf("index  bus  addr  port        serial\n");
+    for (i=0; i<n && i<MAX_BOARDS; i++){
+        printf("%5d  %3u  %4u  %-10s  %s\n", i, info[i].bus, info[i].address,
+               info[i].port_path, info[i].serial[0] ? info[i].serial : "(unreadable)");
+    }
+    return 0;
+}
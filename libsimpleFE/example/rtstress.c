@@ -0,0 +1,351 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* 
+ * overflow / underflow rate of a full duplex stream under synthetic cpu 
+ * load, with and without the realtime settings of sfe_set_rt_params().
+ *
+ * the usb callbacks only move data between the device and two rings, a 
+ * worker drains the rx ring and a producer fills the tx ring, like a real
+ * application would. an rx packet that does not fit is an overflow, a tx
+ * packet that cannot be filled is an underflow. the load threads spin at
+ * normal priority on every cpu to compete with all of them.
+ *
+ *    rtstress -l 8 -p 50 -c 0x2 -m      
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include "simpleFE.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+static void msleep(unsigned ms) { Sleep(ms); }
+#else
+#include <unistd.h>
+static void msleep(unsigned ms) { usleep(ms * 1000); }
+#endif
+
+#define RING_SIZE     (1 << 20)
+
+typedef struct ring_s{
+    unsigned char buf[RING_SIZE];
+    unsigned head;
+    unsigned tail;
+    pthread_mutex_t lock;
+}ring;
+
+static ring rx_ring;
+static ring tx_ring;
+
+static volatile int exitRequested = 0;
+static volatile unsigned long overflows = 0;
+static volatile unsigned long underflows = 0;
+static volatile unsigned long rx_bytes = 0;
+static volatile unsigned long tx_bytes = 0;
+static volatile double sink = 0;
+
+static unsigned ring_count(ring *r)
+{
+    return r->head - r->tail;
+}
+
+/* all or nothing, so a short ring shows up as one overflow */
+static int ring_put(ring *r, const unsigned char *src, unsigned len)
+{
+    unsigned pos, n;
+
+    pthread_mutex_lock(&r->lock);
+    if (RING_SIZE - ring_count(r) < len){
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+    pos = r->head & (RING_SIZE - 1);
+    n = len < RING_SIZE - pos ? len : RING_SIZE - pos;
+    memcpy(r->buf + pos, src, n);
+    memcpy(r->buf, src + n, len - n);
+    r->head += len;
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+static int ring_get(ring *r, unsigned char *dst, unsigned len)
+{
+    unsigned pos, n;
+
+    pthread_mutex_lock(&r->lock);
+    if (ring_count(r) < len){
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+    pos = r->tail & (RING_SIZE - 1);
+    n = len < RING_SIZE - pos ? len : RING_SIZE - pos;
+    memcpy(dst, r->buf + pos, n);
+    memcpy(dst + n, r->buf, len - n);
+    r->tail += len;
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+static void
+sigintHandler(int signum)
+{
+    exitRequested = 1;
+}
+
+static int rx_callback(unsigned char* buffer, int length, void* userdata)
+{
+    if (length > 0){
+        if (ring_put(&rx_ring, buffer, length)){
+            overflows++;
+        }
+        else{
+            rx_bytes += length;
+        }
+    }
+    return exitRequested;
+}
+
+static int tx_callback(unsigned char* buffer, int length, void* userdata)
+{
+    if (ring_get(&tx_ring, buffer, length)){
+        /* midscale, 0x200 for every sample */
+        memset(buffer, 0, length);
+        for (int i=0; i+5<=length; i+=5){
+            buffer[i] = 0xAA;
+        }
+        underflows++;
+    }
+    else{
+        tx_bytes += length;
+    }
+    return exitRequested;
+}
+
+/* consumes the rx samples */
+static void* rx_worker(void *arg)
+{
+    unsigned char blk[4096];
+    unsigned acc = 0;
+
+    while (!exitRequested){
+        if (ring_get(&rx_ring, blk, sizeof(blk))){
+            msleep(1);
+            continue;
+        }
+        for (unsigned i=0; i<sizeof(blk); i++){
+            acc += blk[i];
+        }
+    }
+    sink += acc;
+    return NULL;
+}
+
+/* keeps the tx ring topped up with a slow ramp */
+static void* tx_producer(void *arg)
+{
+    unsigned char blk[4000];
+    unsigned j = 0;
+
+    while (!exitRequested){
+        for (unsigned i=0; i<sizeof(blk); i+=5){
+            unsigned d0 = j++ & 0x3FF;
+            unsigned d1 = j++ & 0x3FF;
+            unsigned d2 = j++ & 0x3FF;
+            unsigned d3 = j++ & 0x3FF;
+
+            blk[i] = (d0>>8) | ((d1>>8)<<2) | ((d2>>8)<<4) | ((d3>>8)<<6);
+            blk[i+1] = d0 & 0xFF;
+            blk[i+2] = d1 & 0xFF;
+            blk[i+3] = d2 & 0xFF;
+            blk[i+4] = d3 & 0xFF;
+        }
+        while (!exitRequested && ring_put(&tx_ring, blk, sizeof(blk))){
+            msleep(1);
+        }
+    }
+    return NULL;
+}
+
+static void* load_thread(void *arg)
+{
+    double x = 1.0;
+
+    while (!exitRequested){
+        for (int i=0; i<100000; i++){
+            x = x * 1.0000001 + 1e-9;
+        }
+    }
+    sink += x;
+    return NULL;
+}
+
+static const char* policy_name(int policy)
+{
+    switch (policy){
+    case SFE_SCHED_FIFO:
+        return "FIFO";
+    case SFE_SCHED_RR:
+        return "RR";
+    default:
+        return "OTHER";
+    }
+}
+
+static void help(const char *my_name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", my_name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -r <rate>        sample rate, default 7500000\n");
+    fprintf(stderr, "  -t <seconds>     run time, default 10\n");
+    fprintf(stderr, "  -l <threads>     cpu load threads, default 4\n");
+    fprintf(stderr, "  -p <priority>    SCHED_FIFO priority of the usb thread, 0 = normal\n");
+    fprintf(stderr, "  -c <mask>        cpus the usb thread may run on, e.g. 0x2\n");
+    fprintf(stderr, "  -m               lock memory\n");
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned sample_rate = 7500000;
+    unsigned seconds = 10;
+    unsigned num_load = 4;
+    sfe_rt_params rt;
+    sfe_rt_status st;
+    pthread_t rx_tid, tx_tid;
+    pthread_t *load_tid;
+    unsigned long last_o = 0, last_u = 0;
+    int opt;
+    sfe *h;
+
+    memset(&rt, 0, sizeof(rt));
+    while ((opt = getopt(argc, argv, "r:t:l:p:c:mh")) != -1) {
+        switch (opt) {
+        case 'r':
+            sample_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            num_load = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            rt.priority = strtol(optarg, NULL, 0);
+            break;
+        case 'c':
+            rt.cpu_mask = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            rt.lock_memory = 1;
+            break;
+        default:
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    rt.policy = rt.priority > 0 ? SFE_SCHED_FIFO : SFE_SCHED_OTHER;
+
+    h = sfe_init();
+    if (!h){
+        fprintf(stderr, "Cannot open simpleFE device\n");
+        return EXIT_FAILURE;
+    }
+
+    sfe_reset_board(h);
+    if (sfe_set_sample_rate(h, sample_rate)){
+        fprintf(stderr, "set sample rate\n");
+        sfe_close(h);
+        return EXIT_FAILURE;
+    }
+    if (sfe_set_rt_params(h, &rt)){
+        fprintf(stderr, "realtime settings not fully granted, running anyway\n");
+    }
+    sfe_tx_enable(h, 1, 1);
+    sfe_rx_enable(h, 1, 1);
+
+    pthread_mutex_init(&rx_ring.lock, NULL);
+    pthread_mutex_init(&tx_ring.lock, NULL);
+    signal(SIGINT, sigintHandler);
+
+    load_tid = calloc(num_load ? num_load : 1, sizeof(pthread_t));
+    for (unsigned i=0; i<num_load; i++){
+        pthread_create(&load_tid[i], NULL, load_thread, NULL);
+    }
+    pthread_create(&rx_tid, NULL, rx_worker, NULL);
+    pthread_create(&tx_tid, NULL, tx_producer, NULL);
+
+    /* let the producer get ahead before the stream starts */
+    msleep(100);
+    if (sfe_rx_start(h, rx_callback, NULL) || sfe_tx_start(h, tx_callback, NULL)){
+        fprintf(stderr, "stream start failed\n");
+        exitRequested = 1;
+    }
+    else if (sfe_get_rt_status(h, &st) == 0){
+        printf("usb thread: %s prio %d cpus 0x%lx memory %s, %s\n",
+               policy_name(st.policy), st.priority, st.cpu_mask,
+               st.memory_locked ? "locked" : "unlocked",
+               st.granted ? "granted" : "NOT granted");
+    }
+
+    for (unsigned s=0; s<seconds && !exitRequested; s++){
+        unsigned long o, u;
+        
+        msleep(1000);
+        o = overflows;
+        u = underflows;
+        printf("%3u s: rx %lu B  tx %lu B  O %lu/s  U %lu/s\n",
+               s + 1, rx_bytes, tx_bytes, o - last_o, u - last_u);
+        last_o = o;
+        last_u = u;
+    }
+    exitRequested = 1;
+
+    sfe_stop_tx(h);
+    sfe_stop_rx(h);
+
+    pthread_join(rx_tid, NULL);
+    pthread_join(tx_tid, NULL);
+    for (unsigned i=0; i<num_load; i++){
+        pthread_join(load_tid[i], NULL);
+    }
+    free(load_tid);
+
+    printf("total: %lu overflows, %lu underflows in %u s with %u load threads\n",
+           overflows, underflows, seconds, num_load);
+
+    signal(SIGINT, SIG_DFL);
+    sfe_close(h);
+    return 0;
+}
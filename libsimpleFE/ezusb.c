@@ -25,6 +25,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
 #include "libusb.h"
 #include "ezusb.h"
@@ -105,6 +116,29 @@ static bool fx2lp_is_external(uint32_t addr, size_t len)
 }
 
 
+/*
+ * CPUCS address and memory layout of a part
+ */
+static void fx_params(int fx_type, uint32_t *cpucs_addr,
+	bool (**is_external)(uint32_t addr, size_t len))
+{
+	/* EZ-USB original/FX and FX2 devices differ, apart from the 8051 core */
+	switch(fx_type) {
+	case FX_TYPE_FX2LP:
+		*cpucs_addr = 0xe600;
+		*is_external = fx2lp_is_external;
+		break;
+	case FX_TYPE_FX2:
+		*cpucs_addr = 0xe600;
+		*is_external = fx2_is_external;
+		break;
+	default:
+		*cpucs_addr = 0x7f92;
+		*is_external = fx_is_external;
+		break;
+	}
+}
+
 /*****************************************************************************/
 
 /*
@@ -726,6 +760,17 @@ int ezusb_load_ram(libusb_device_handle *device, const char *path, int fx_type,
 	if (fx_type == FX_TYPE_FX3)
 		return fx3_load_ram(device, path);
 
+	/* the common case goes through the image cache */
+	if (img_type == IMG_TYPE_HEX && stage == 0) {
+		struct ezusb_image *img = ezusb_image_open(path, fx_type);
+
+		if (img == NULL)
+			return -1;
+		ret = ezusb_load_image(device, img);
+		ezusb_image_close(img);
+		return ret;
+	}
+
 	image = fopen(path, "rb");
 	if (image == NULL) {
 		logerror("%s: unable to open for input.\n", path);
@@ -744,21 +789,7 @@ int ezusb_load_ram(libusb_device_handle *device, const char *path, int fx_type,
 		}
 	}
 
-	/* EZ-USB original/FX and FX2 devices differ, apart from the 8051 core */
-	switch(fx_type) {
-	case FX_TYPE_FX2LP:
-		cpucs_addr = 0xe600;
-		is_external = fx2lp_is_external;
-		break;
-	case FX_TYPE_FX2:
-		cpucs_addr = 0xe600;
-		is_external = fx2_is_external;
-		break;
-	default:
-		cpucs_addr = 0x7f92;
-		is_external = fx_is_external;
-		break;
-	}
+	fx_params(fx_type, &cpucs_addr, &is_external);
 
 	/* use only first stage loader? */
 	if (stage == 0) {
@@ -827,3 +858,408 @@ exit:
 	fclose(image);
 	return ret;
 }
+
+/*****************************************************************************/
+
+/*
+ * Pre-parsed RAM images.  Parsing a hex file takes a strtoul per byte, and
+ * a udev rule loading a rack of boards does that once per board.  A hex file
+ * is parsed once into segments merged up to EZUSB_MAX_WRITE bytes, which is
+ * kept in a cache directory under the hash of the hex file and mapped from
+ * there the next time.  The cache file is written under a temporary name
+ * and renamed, so loaders running at the same time never see half of it.
+ *
+ * Cache file layout, little endian:
+ *   "EZIMAGE1", u64 hash of the hex file and fx_type, u64 hash of the
+ *   segments, u32 number of segments, u32 fx_type, then per segment
+ *   u32 address, u16 length, u8 external, u8 0 and the data.
+ */
+
+#define EZUSB_MAX_WRITE		4096	/* what usbfs takes in one control transfer */
+#define IMAGE_MAGIC		"EZIMAGE1"
+#define IMAGE_HEADER		32
+#define SEGMENT_HEADER		8
+#define FNV_OFFSET		0xcbf29ce484222325ULL
+#define FNV_PRIME		0x100000001b3ULL
+
+struct ezusb_image {
+	unsigned char *data;	/* in the cache file layout */
+	size_t size;
+	size_t alloc;
+	size_t last;		/* header of the last segment while parsing */
+	bool mapped;
+	unsigned num_segments;
+	int fx_type;
+	uint64_t source_hash;
+	uint64_t hash;
+};
+
+static uint64_t fnv1a(uint64_t h, const unsigned char *p, size_t len)
+{
+	while (len--) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static uint32_t get_le(const unsigned char *p, int n)
+{
+	uint32_t v = 0;
+
+	while (n--)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int n)
+{
+	while (n--) {
+		*p++ = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+	return ((uint64_t)get_le(p + 4, 4) << 32) | get_le(p, 4);
+}
+
+static int make_dir(const char *path)
+{
+#if defined(_WIN32)
+	return _mkdir(path);
+#else
+	return mkdir(path, 0755);
+#endif
+}
+
+/*
+ * $SFE_FW_CACHE, an empty one turns the cache off, otherwise simplefe
+ * under $XDG_CACHE_HOME or $HOME/.cache (%LOCALAPPDATA% on windows)
+ */
+static int cache_dir(char *buf, size_t n)
+{
+	const char *env = getenv("SFE_FW_CACHE");
+
+	if (env != NULL) {
+		if (!env[0])
+			return -1;
+		snprintf(buf, n, "%s", env);
+	} else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0]) {
+		snprintf(buf, n, "%s/simplefe", env);
+	} else if ((env = getenv("HOME")) != NULL && env[0]) {
+		snprintf(buf, n, "%s/.cache", env);
+		make_dir(buf);
+		snprintf(buf, n, "%s/.cache/simplefe", env);
+#if defined(_WIN32)
+	} else if ((env = getenv("LOCALAPPDATA")) != NULL && env[0]) {
+		snprintf(buf, n, "%s\\simplefe", env);
+#endif
+	} else {
+		return -1;
+	}
+	make_dir(buf);
+	return 0;
+}
+
+static int image_grow(struct ezusb_image *img, size_t n)
+{
+	if (img->size + n > img->alloc) {
+		size_t alloc = img->alloc ? img->alloc * 2 : 16384;
+		unsigned char *p;
+
+		while (alloc < img->size + n)
+			alloc *= 2;
+		p = (unsigned char*)realloc(img->data, alloc);
+		if (p == NULL)
+			return -ENOMEM;
+		img->data = p;
+		img->alloc = alloc;
+	}
+	return 0;
+}
+
+/*
+ * parse_xxx() callback, appends to the last segment when it continues it
+ */
+static int image_poke(void *context, uint32_t addr, bool external,
+	const unsigned char *data, size_t len)
+{
+	struct ezusb_image *img = (struct ezusb_image*)context;
+
+	while (len > 0) {
+		unsigned char *seg = img->num_segments ? img->data + img->last : NULL;
+		size_t seg_len = seg ? get_le(seg + 4, 2) : 0;
+		size_t n;
+
+		if (seg && get_le(seg, 4) + seg_len == addr && seg[6] == external
+			&& seg_len < EZUSB_MAX_WRITE) {
+			n = len < EZUSB_MAX_WRITE - seg_len ? len : EZUSB_MAX_WRITE - seg_len;
+			if (image_grow(img, n) < 0)
+				return -ENOMEM;
+			put_le(img->data + img->last + 4, seg_len + n, 2);
+		} else {
+			n = len < EZUSB_MAX_WRITE ? len : EZUSB_MAX_WRITE;
+			if (image_grow(img, SEGMENT_HEADER + n) < 0)
+				return -ENOMEM;
+			img->last = img->size;
+			seg = img->data + img->last;
+			put_le(seg, addr, 4);
+			put_le(seg + 4, n, 2);
+			seg[6] = external;
+			seg[7] = 0;
+			img->size += SEGMENT_HEADER;
+			img->num_segments++;
+		}
+		memcpy(img->data + img->size, data, n);
+		img->size += n;
+		addr += (uint32_t)n;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Checks a cache file and the segments in it, returns the number of
+ * segments or -1
+ */
+static int image_check(const unsigned char *data, size_t size, uint64_t source_hash)
+{
+	size_t off = IMAGE_HEADER;
+	unsigned i, n;
+
+	if (size < IMAGE_HEADER || memcmp(data, IMAGE_MAGIC, 8)
+		|| get_le64(data + 8) != source_hash)
+		return -1;
+	n = get_le(data + 24, 4);
+	for (i = 0; i < n; i++) {
+		if (size - off < SEGMENT_HEADER
+			|| size - off - SEGMENT_HEADER < get_le(data + off + 4, 2))
+			return -1;
+		off += SEGMENT_HEADER + get_le(data + off + 4, 2);
+	}
+	if (off != size || fnv1a(FNV_OFFSET, data + IMAGE_HEADER, size - IMAGE_HEADER) != get_le64(data + 16))
+		return -1;
+	return (int)n;
+}
+
+static struct ezusb_image *image_map(const char *file, uint64_t source_hash)
+{
+	struct ezusb_image *img;
+	unsigned char *data;
+	size_t size;
+	int n;
+#if defined(_WIN32)
+	FILE *f = fopen(file, "rb");
+	long len;
+
+	if (f == NULL)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) < 0
+		|| (data = (unsigned char*)malloc(len ? len : 1)) == NULL) {
+		fclose(f);
+		return NULL;
+	}
+	size = len;
+	if (fread(data, 1, size, f) != size) {
+		fclose(f);
+		free(data);
+		return NULL;
+	}
+	fclose(f);
+#else
+	struct stat st;
+	int fd = open(file, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	size = st.st_size;
+	data = (unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+#endif
+	n = image_check(data, size, source_hash);
+	img = n < 0 ? NULL : (struct ezusb_image*)calloc(1, sizeof(*img));
+	if (img == NULL) {
+		if (n < 0)
+			logerror("%s: stale or broken, parsing again\n", file);
+#if defined(_WIN32)
+		free(data);
+#else
+		munmap(data, size);
+#endif
+		return NULL;
+	}
+	img->data = data;
+	img->size = size;
+#if !defined(_WIN32)
+	img->mapped = true;
+#endif
+	img->num_segments = n;
+	img->fx_type = (int)get_le(data + 28, 4);
+	img->source_hash = source_hash;
+	img->hash = get_le64(data + 16);
+	return img;
+}
+
+static void image_save(const struct ezusb_image *img, const char *file)
+{
+	char tmp[600];
+	FILE *f;
+	bool ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.%ld", file, (long)getpid());
+	f = fopen(tmp, "wb");
+	if (f == NULL)
+		return;
+	ok = fwrite(img->data, 1, img->size, f) == img->size;
+	ok = (fclose(f) == 0) && ok;
+	if (!ok || rename(tmp, file) != 0) {
+		if (verbose > 1)
+			logerror("%s: cannot write the image cache\n", file);
+		remove(tmp);
+	}
+}
+
+struct ezusb_image *ezusb_image_open(const char *path, int fx_type)
+{
+	struct ezusb_image *img;
+	uint32_t cpucs_addr;
+	bool (*is_external)(uint32_t off, size_t len);
+	unsigned char buf[4096], type = (unsigned char)fx_type;
+	uint64_t source_hash = FNV_OFFSET;
+	char dir[512], file[600];
+	bool cached;
+	size_t n;
+	FILE *image;
+
+	image = fopen(path, "rb");
+	if (image == NULL) {
+		logerror("%s: unable to open for input.\n", path);
+		return NULL;
+	}
+	while ((n = fread(buf, 1, sizeof(buf), image)) > 0)
+		source_hash = fnv1a(source_hash, buf, n);
+	source_hash = fnv1a(source_hash, &type, 1);
+
+	cached = cache_dir(dir, sizeof(dir)) == 0;
+	if (cached) {
+		snprintf(file, sizeof(file), "%s/%016llx.img", dir, (unsigned long long)source_hash);
+		img = image_map(file, source_hash);
+		if (img != NULL) {
+			if (verbose > 1)
+				logerror("firmware image %s from %s\n", path, file);
+			fclose(image);
+			return img;
+		}
+	}
+
+	img = (struct ezusb_image*)calloc(1, sizeof(*img));
+	if (img == NULL || image_grow(img, IMAGE_HEADER) < 0) {
+		free(img);
+		fclose(image);
+		return NULL;
+	}
+	img->size = IMAGE_HEADER;
+	fx_params(fx_type, &cpucs_addr, &is_external);
+	rewind(image);
+	if (parse_ihex(image, img, is_external, image_poke) < 0) {
+		logerror("unable to parse %s\n", path);
+		fclose(image);
+		ezusb_image_close(img);
+		return NULL;
+	}
+	fclose(image);
+
+	img->fx_type = fx_type;
+	img->source_hash = source_hash;
+	img->hash = fnv1a(FNV_OFFSET, img->data + IMAGE_HEADER, img->size - IMAGE_HEADER);
+	memcpy(img->data, IMAGE_MAGIC, 8);
+	put_le(img->data + 8, source_hash, 8);
+	put_le(img->data + 16, img->hash, 8);
+	put_le(img->data + 24, img->num_segments, 4);
+	put_le(img->data + 28, (uint32_t)fx_type, 4);
+	if (cached)
+		image_save(img, file);
+	return img;
+}
+
+void ezusb_image_close(struct ezusb_image *img)
+{
+	if (img == NULL)
+		return;
+#if !defined(_WIN32)
+	if (img->mapped)
+		munmap(img->data, img->size);
+	else
+#endif
+		free(img->data);
+	free(img);
+}
+
+uint64_t ezusb_image_hash(const struct ezusb_image *img)
+{
+	return img->hash;
+}
+
+int ezusb_load_image(libusb_device_handle *device, const struct ezusb_image *img)
+{
+	struct ram_poke_context ctx;
+	uint32_t cpucs_addr;
+	bool (*is_external)(uint32_t off, size_t len);
+	const unsigned char *seg = img->data + IMAGE_HEADER;
+	unsigned i;
+
+	fx_params(img->fx_type, &cpucs_addr, &is_external);
+	ctx.device = device;
+	ctx.mode = internal_only;
+	ctx.total = ctx.count = 0;
+
+	if (!ezusb_cpucs(device, cpucs_addr, false))
+		return -1;
+	for (i = 0; i < img->num_segments; i++) {
+		size_t len = get_le(seg + 4, 2);
+
+		if (ram_poke(&ctx, get_le(seg, 4), seg[6] != 0, seg + SEGMENT_HEADER, len) < 0) {
+			logerror("unable to upload the firmware image\n");
+			return -1;
+		}
+		seg += SEGMENT_HEADER + len;
+	}
+	if (verbose && (ctx.count != 0)) {
+		logerror("... WROTE: %d bytes, %d segments, avg %d\n",
+			(int)ctx.total, (int)ctx.count, (int)(ctx.total/ctx.count));
+	}
+	if (!ezusb_cpucs(device, cpucs_addr, true))
+		return -1;
+	return 0;
+}
+
+int ezusb_image_probe(libusb_device_handle *device, const struct ezusb_image *img)
+{
+	const unsigned char *seg = img->data + IMAGE_HEADER;
+	unsigned char buf[EZUSB_MAX_WRITE];
+	uint64_t hash = FNV_OFFSET;
+	unsigned i;
+
+	/* the segments as they are now, hashed like the image */
+	for (i = 0; i < img->num_segments; i++) {
+		size_t len = get_le(seg + 4, 2);
+
+		if (seg[6])
+			return 0;
+		if (ezusb_read(device, "read on-chip", RW_INTERNAL, get_le(seg, 4), buf, len) < 0)
+			return -1;
+		hash = fnv1a(hash, seg, SEGMENT_HEADER);
+		hash = fnv1a(hash, buf, len);
+		seg += SEGMENT_HEADER + len;
+	}
+	return hash == img->hash;
+}
@@ -110,6 +110,28 @@ extern int ezusb_load_ram(libusb_device_handle *device,
 extern int ezusb_load_eeprom(libusb_device_handle *device,
 	const char *path, int fx_type, int img_type, int config);
 
+/*
+ * A hex file parsed into maximal RAM writes.  ezusb_image_open() keeps
+ * it in a cache directory ($SFE_FW_CACHE, or simplefe in the user cache
+ * directory) under the hash of the hex file and maps it from there next
+ * time, ezusb_load_ram() uses this for single stage hex loads.
+ */
+struct ezusb_image;
+extern struct ezusb_image *ezusb_image_open(const char *path, int fx_type);
+extern void ezusb_image_close(struct ezusb_image *img);
+/* hash of the RAM contents the image writes */
+extern uint64_t ezusb_image_hash(const struct ezusb_image *img);
+/* stops the CPU, writes the image and restarts it */
+extern int ezusb_load_image(libusb_device_handle *device,
+	const struct ezusb_image *img);
+/*
+ * Reads the image's RAM ranges back through the hardware loader, which
+ * also answers while firmware runs.  Returns 1 if their hash matches the
+ * image, so the running firmware is this one, 0 if not and <0 on errors.
+ */
+extern int ezusb_image_probe(libusb_device_handle *device,
+	const struct ezusb_image *img);
+
 /* Verbosity level (default 1). Can be increased or decreased with options v/q  */
 extern int verbose;
 
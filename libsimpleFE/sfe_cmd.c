@@ -0,0 +1,531 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sfe_cmd.h"
+#include "libusb.h"
+
+#define CMD_TIMEOUT_MS   1000
+#define CMD_PUMP_US      100000
+
+struct cmd_op{
+    sfe_cmd *cmd;
+    int spi;                         /* bulk pipe, otherwise ep0 */
+    int always;                      /* still runs after an error */
+    struct libusb_transfer *xfer;    /* the vendor request or the spi OUT */
+    struct libusb_transfer *xfer_in; /* the spi IN */
+    unsigned char *result;           /* where the bytes read go, or NULL */
+    unsigned len;
+};
+
+struct sfe_cmd_s{
+    sfe_cmdq *q;
+    struct cmd_op *ops;
+    unsigned num_ops;
+    unsigned max_ops;
+    unsigned next;            /* next op to submit */
+    int status;
+    int broken;               /* a step could not be added */
+    int waited;               /* its status goes to sfe_cmd_run(), not the queue */
+    sfe_cmd_callback *done;
+    void *userdata;
+    sfe_cmd *next_cmd;
+};
+
+struct cmd_list{
+    sfe_cmd *head;
+    sfe_cmd *tail;
+};
+
+
+static void free_cmd(sfe_cmd *c)
+{
+    unsigned i;
+    
+    /* the buffers go with LIBUSB_TRANSFER_FREE_BUFFER */
+    for (i=0; i<c->num_ops; i++){
+        libusb_free_transfer(c->ops[i].xfer);
+        libusb_free_transfer(c->ops[i].xfer_in);
+    }
+    free(c->ops);
+    free(c);
+}
+
+static struct cmd_op* add_op(sfe_cmd *c)
+{
+    struct cmd_op *op;
+    
+    if (c->broken){
+        return NULL;
+    }
+    if (c->num_ops == c->max_ops){
+        unsigned n = c->max_ops ? c->max_ops * 2 : 8;
+        struct cmd_op *ops = realloc(c->ops, n * sizeof(struct cmd_op));
+        if (!ops){
+            c->broken = 1;
+            return NULL;
+        }
+        c->ops = ops;
+        c->max_ops = n;
+    }
+    op = &c->ops[c->num_ops++];
+    memset(op, 0, sizeof(*op));
+    op->cmd = c;
+    return op;
+}
+
+/* a vendor request, data is sent for OUT, result receives IN */
+static int add_ep0(sfe_cmd *c, uint8_t type, uint8_t req, uint16_t value,
+                   const unsigned char *data, unsigned char *result, unsigned len)
+{
+    struct cmd_op *op = add_op(c);
+    unsigned char *buf;
+    
+    if (!op){
+        return -1;
+    }
+    buf = malloc(LIBUSB_CONTROL_SETUP_SIZE + len);
+    op->xfer = libusb_alloc_transfer(0);
+    if (!buf || !op->xfer){
+        fprintf(stderr, "cannot allocate transfer structure\n");
+        free(buf);
+        c->broken = 1;
+        return -1;
+    }
+    libusb_fill_control_setup(buf, LIBUSB_RECIPIENT_DEVICE | LIBUSB_REQUEST_TYPE_VENDOR | type,
+                              req, value, 0, len);
+    if (data && len){
+        memcpy(buf + LIBUSB_CONTROL_SETUP_SIZE, data, len);
+    }
+    libusb_fill_control_transfer(op->xfer, c->q->usb->dev, buf, NULL, NULL, CMD_TIMEOUT_MS);
+    op->xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    op->result = result;
+    op->len = len;
+    return 0;
+}
+
+static int add_spi_chunk(sfe_cmd *c, const unsigned char *mosi, unsigned char *miso, unsigned len)
+{
+    sfe_usb *usb = c->q->usb;
+    struct cmd_op *op = add_op(c);
+    unsigned char *out, *in;
+    
+    if (!op){
+        return -1;
+    }
+    out = malloc(len);
+    in = malloc(len);
+    op->xfer = libusb_alloc_transfer(0);
+    op->xfer_in = libusb_alloc_transfer(0);
+    if (!out || !in || !op->xfer || !op->xfer_in){
+        fprintf(stderr, "cannot allocate transfer structure\n");
+        free(out);
+        free(in);
+        c->broken = 1;
+        return -1;
+    }
+    memcpy(out, mosi, len);
+    libusb_fill_bulk_transfer(op->xfer, usb->dev, usb->ep_spi_out, out, len, NULL, NULL, CMD_TIMEOUT_MS);
+    libusb_fill_bulk_transfer(op->xfer_in, usb->dev, usb->ep_spi_in, in, len, NULL, NULL, CMD_TIMEOUT_MS);
+    op->xfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    op->xfer_in->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    op->spi = 1;
+    op->result = miso;
+    op->len = len;
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* the engine, q->lock held unless noted */
+
+static int transfer_error(enum libusb_transfer_status status)
+{
+    switch (status){
+    case LIBUSB_TRANSFER_COMPLETED: return 0;
+    case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:  return LIBUSB_ERROR_OVERFLOW;
+    case LIBUSB_TRANSFER_CANCELLED: return LIBUSB_ERROR_INTERRUPTED;
+    default:                        return LIBUSB_ERROR_IO;
+    }
+}
+
+static void fail(sfe_cmd *c, int err)
+{
+    if (!c->status){
+        c->status = err;
+    }
+}
+
+static void LIBUSB_CALL op_callback(struct libusb_transfer *transfer);
+
+static void submit_op(sfe_cmdq *q, struct cmd_op *op)
+{
+    int err;
+    
+    op->xfer->callback = op_callback;
+    op->xfer->user_data = op;
+    err = libusb_submit_transfer(op->xfer);
+    if (err){
+        fail(op->cmd, err);
+        return;
+    }
+    q->pending++;
+    
+    /* the IN waits on the pipe until the OUT has been clocked through */
+    if (op->xfer_in){
+        op->xfer_in->callback = op_callback;
+        op->xfer_in->user_data = op;
+        err = libusb_submit_transfer(op->xfer_in);
+        if (err){
+            fail(op->cmd, err);
+        }else{
+            q->pending++;
+        }
+    }
+}
+
+/* nothing in flight, moves finished commands to done and starts the next
+ * phase. after an error the rest of a command is skipped, except for 
+ * the steps that raise a line, so chip selects are not left asserted */
+static void run_queue(sfe_cmdq *q, struct cmd_list *done)
+{
+    while (!q->pending && q->head){
+        sfe_cmd *c = q->head;
+        struct cmd_op *op;
+        unsigned n = 0;
+        
+        if (c->next == c->num_ops){
+            q->head = c->next_cmd;
+            if (!q->head){
+                q->tail = NULL;
+            }
+            c->next_cmd = NULL;
+            if (done->tail){
+                done->tail->next_cmd = c;
+            }else{
+                done->head = c;
+            }
+            done->tail = c;
+            continue;
+        }
+
+        op = &c->ops[c->next];
+        if (op->spi){
+            c->next++;
+            if (!c->status){
+                submit_op(q, op);
+            }
+            continue;
+        }
+
+        /* a run of vendor requests, possibly into the following commands */
+        while (c && n < SFE_CMD_MAX_PHASE){
+            if (c->next == c->num_ops){
+                c = c->next_cmd;
+                continue;
+            }
+            op = &c->ops[c->next];
+            if (op->spi){
+                break;
+            }
+            c->next++;
+            if (!c->status || op->always){
+                submit_op(q, op);
+                n++;
+            }
+        }
+    }
+}
+
+/* without q->lock, runs the done callbacks in submission order */
+static void retire(sfe_cmdq *q, struct cmd_list *done)
+{
+    sfe_cmd *c, *next;
+    unsigned n = 0;
+    int status = 0;
+    
+    for (c = done->head; c; c = next){
+        next = c->next_cmd;
+        if (c->status){
+            fprintf(stderr, "register access failed: %s\n", libusb_error_name(c->status));
+            if (!c->waited && !status){
+                status = c->status;
+            }
+        }
+        if (c->done){
+            c->done(c->status, c->userdata);
+        }
+        free_cmd(c);
+        n++;
+    }
+    if (n){
+        pthread_mutex_lock(&q->lock);
+        if (status && !q->status){
+            q->status = status;
+        }
+        q->queued -= n;
+        pthread_cond_broadcast(&q->retired);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+static void LIBUSB_CALL
+op_callback(struct libusb_transfer *transfer)
+{
+    struct cmd_op *op = transfer->user_data;
+    sfe_cmd *c = op->cmd;
+    sfe_cmdq *q = c->q;
+    struct cmd_list done = {NULL, NULL};
+    int err = transfer_error(transfer->status);
+
+    pthread_mutex_lock(&q->lock);
+    if (!err && op->spi && transfer == op->xfer_in){
+        /* like usb_xfer_spi, an empty reply is not an error */
+        if (transfer->actual_length && transfer->actual_length != (int)op->len){
+            err = LIBUSB_ERROR_IO;
+        }
+        else if (op->result){
+            memcpy(op->result, transfer->buffer, transfer->actual_length);
+        }
+    }
+    else if (!err && !op->spi && op->result){
+        if (transfer->actual_length != (int)op->len){
+            err = LIBUSB_ERROR_IO;
+        }else{
+            memcpy(op->result, libusb_control_transfer_get_data(transfer), op->len);
+        }
+    }
+    if (err){
+        fail(c, err);
+    }
+    if (--q->pending == 0){
+        run_queue(q, &done);
+    }
+    pthread_mutex_unlock(&q->lock);
+    retire(q, &done);
+}
+
+
+/* ------------------------------------------------------------------ */
+
+/* q->lock held, returns after something was retired or may have been. 
+ * without an event thread the waiter handles the events itself */
+static void wait_retired(sfe_cmdq *q)
+{
+    if (q->owner){
+        pthread_cond_wait(&q->retired, &q->lock);
+    }else{
+        struct timeval tv = {0, CMD_PUMP_US};
+        
+        pthread_mutex_unlock(&q->lock);
+        libusb_handle_events_timeout_completed(q->usb->ctx, &tv, NULL);
+        pthread_mutex_lock(&q->lock);
+    }
+}
+
+void sfe_cmdq_init(sfe_cmdq *q, sfe *owner, sfe_usb *usb)
+{
+    memset(q, 0, sizeof(*q));
+    q->owner = owner;
+    q->usb = usb;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->retired, NULL);
+}
+
+void sfe_cmdq_destroy(sfe_cmdq *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->queued){
+        wait_retired(q);
+    }
+    pthread_mutex_unlock(&q->lock);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->retired);
+}
+
+sfe_cmd* sfe_cmdq_new_cmd(sfe_cmdq *q)
+{
+    sfe_cmd *c = calloc(1, sizeof(sfe_cmd));
+    if (c){
+        c->q = q;
+    }
+    return c;
+}
+
+int sfe_cmdq_wait(sfe_cmdq *q)
+{
+    int ret;
+    
+    pthread_mutex_lock(&q->lock);
+    while (q->queued){
+        wait_retired(q);
+    }
+    ret = q->status;
+    q->status = 0;
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+void sfe_cmdq_wait_flag(sfe_cmdq *q, const int *flag)
+{
+    pthread_mutex_lock(&q->lock);
+    while (!*flag){
+        wait_retired(q);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+sfe* sfe_cmd_owner(const sfe_cmd *c)
+{
+    return c->q->owner;
+}
+
+int sfe_cmd_gpio(sfe_cmd *c, int gpio, int val)
+{
+    int ret = add_ep0(c, LIBUSB_ENDPOINT_OUT, VR_GPIO, (gpio << 8) | !!val, NULL, NULL, 0);
+    if (!ret){
+        c->ops[c->num_ops-1].always = !!val;
+    }
+    return ret;
+}
+
+int sfe_cmd_spi(sfe_cmd *c, int cs, const unsigned char *mosi, unsigned char *miso, unsigned len)
+{
+    unsigned s;
+    
+    if (!len){
+        return c->broken ? -1 : 0;
+    }
+    if (cs >= 0){
+        sfe_cmd_gpio(c, cs, 0);
+    }
+    for (s = 0; s < len; s += SFE_CMD_SPI_CHUNK){
+        unsigned n = len - s > SFE_CMD_SPI_CHUNK ? SFE_CMD_SPI_CHUNK : len - s;
+        add_spi_chunk(c, &mosi[s], miso ? &miso[s] : NULL, n);
+    }
+    if (cs >= 0){
+        sfe_cmd_gpio(c, cs, 1);
+    }
+    return c->broken ? -1 : 0;
+}
+
+int sfe_cmd_i2c_write(sfe_cmd *c, unsigned char addr, const unsigned char *data, unsigned len)
+{
+    if (len > 8){
+        fprintf(stderr, "i2c transfers are at most 8 bytes\n");
+        c->broken = 1;
+        return -1;
+    }
+    return add_ep0(c, LIBUSB_ENDPOINT_OUT, VR_I2C, addr << 8, data, NULL, len);
+}
+
+int sfe_cmd_i2c_read(sfe_cmd *c, unsigned char addr, unsigned char *data, unsigned len)
+{
+    if (len > 8){
+        fprintf(stderr, "i2c transfers are at most 8 bytes\n");
+        c->broken = 1;
+        return -1;
+    }
+    return add_ep0(c, LIBUSB_ENDPOINT_IN, VR_I2C, addr << 8, NULL, data, len);
+}
+
+int sfe_cmd_submit(sfe_cmd *c, sfe_cmd_callback *done, void *userdata)
+{
+    sfe_cmdq *q = c->q;
+    struct cmd_list list = {NULL, NULL};
+    
+    if (c->broken){
+        free_cmd(c);
+        return -1;
+    }
+    c->done = done;
+    c->userdata = userdata;
+    
+    pthread_mutex_lock(&q->lock);
+    if (q->tail){
+        q->tail->next_cmd = c;
+    }else{
+        q->head = c;
+    }
+    q->tail = c;
+    q->queued++;
+    if (!q->pending){
+        run_queue(q, &list);
+    }
+    pthread_mutex_unlock(&q->lock);
+    retire(q, &list);
+    return 0;
+}
+
+struct cmd_sync{
+    sfe_cmdq *q;
+    int done;
+    int status;
+};
+
+static void sync_done(int status, void *userdata)
+{
+    struct cmd_sync *s = userdata;
+    
+    pthread_mutex_lock(&s->q->lock);
+    s->status = status;
+    s->done = 1;
+    pthread_mutex_unlock(&s->q->lock);
+}
+
+int sfe_cmd_run(sfe_cmd *c)
+{
+    sfe_cmdq *q = c->q;
+    struct cmd_sync s = {q, 0, 0};
+
+    c->waited = 1;
+    if (sfe_cmd_submit(c, sync_done, &s)){
+        return -1;
+    }
+    pthread_mutex_lock(&q->lock);
+    while (!s.done){
+        wait_retired(q);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return s.status;
+}
+
+void sfe_cmd_free(sfe_cmd *c)
+{
+    if (c){
+        free_cmd(c);
+    }
+}
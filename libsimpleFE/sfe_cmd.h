@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SFE_CMD_H_
+#define SFE_CMD_H_
+
+#include <pthread.h>
+#include "simpleFE.h"
+#include "usb_access.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/* the register access queue behind sfe_cmd_xxx(). a command is a list of
+ * steps, each one or two usb transfers. vendor requests (gpio, i2c) go 
+ * over ep0 and spi over the bulk pipe, the host keeps the order within a
+ * pipe but not across them, so the queue runs in phases: consecutive ep0
+ * steps are submitted together, even across commands, an spi step submits
+ * its OUT and IN at once, and the next phase starts when everything in 
+ * flight has completed.
+ *
+ * completions run on the usb event thread of the owner, which keeps it
+ * running while the queue is in use. a queue without an owner (the flash
+ * tools, which have no sfe handle) has no event thread, its waits handle
+ * the usb events and the done callbacks run inside them */
+
+#define SFE_CMD_SPI_CHUNK     64     /* what the FX2 spi pipe takes at once */
+#define SFE_CMD_MAX_PHASE     16
+
+typedef struct sfe_cmdq_s{
+    sfe *owner;
+    sfe_usb *usb;
+    pthread_mutex_t lock;
+    pthread_cond_t retired;
+    sfe_cmd *head;
+    sfe_cmd *tail;
+    unsigned queued;          /* submitted and not retired yet */
+    unsigned pending;         /* transfers of the current phase in flight */
+    int status;               /* first error since the last sfe_cmdq_wait */
+}sfe_cmdq;
+
+/* owner may be NULL, see above */
+void sfe_cmdq_init(sfe_cmdq *q, sfe *owner, sfe_usb *usb);
+/* waits for the queue to drain */
+void sfe_cmdq_destroy(sfe_cmdq *q);
+sfe_cmd* sfe_cmdq_new_cmd(sfe_cmdq *q);
+int sfe_cmdq_wait(sfe_cmdq *q);
+/* waits until a done callback has set *flag */
+void sfe_cmdq_wait_flag(sfe_cmdq *q, const int *flag);
+sfe* sfe_cmd_owner(const sfe_cmd *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
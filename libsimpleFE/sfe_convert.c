@@ -0,0 +1,692 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include "sfe_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SFE_X86  1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SFE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* msvc takes any intrinsic, gcc and clang need the isa per function */
+#if defined(SFE_X86) && !defined(_MSC_VER)
+#define TARGET_SSE2  __attribute__((target("sse2")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+typedef unsigned (pack_f32_fn)(unsigned char *dst, const float *src, unsigned n);
+typedef unsigned (pack_s16_fn)(unsigned char *dst, const short *src, unsigned n);
+typedef unsigned (unpack_f32_fn)(float *dst, const unsigned char *src, unsigned n);
+typedef unsigned (unpack_s8_fn)(signed char *dst, const unsigned char *src, unsigned n);
+typedef unsigned (unpack_s16_fn)(short *dst, const unsigned char *src, unsigned n);
+
+typedef struct kernel_s{
+    const char *name;
+    pack_f32_fn *pack_f32;
+    pack_s16_fn *pack_s16;
+    unpack_f32_fn *unpack_f32;
+    unpack_s8_fn *unpack_s8;
+    unpack_s16_fn *unpack_s16;
+}kernel;
+
+#define ADC_SCALE   (1.0f/127.0f)
+
+
+/****************************************************************
+ * scalar reference 
+ ****************************************************************/
+
+static inline unsigned short dac_code_f32(float x)
+{
+    float y;
+    /* written so that NaN ends up at -1, the same as maxps/minps */
+    x = x > -1.0f ? x : -1.0f;
+    x = x < 1.0f ? x : 1.0f;
+    y = x * 511.0f;
+    return (unsigned short)((int)y + 512);
+}
+
+static inline unsigned short dac_code_s16(short x)
+{
+    return (unsigned short)((x >> 6) + 512);
+}
+
+static inline void pack_frame(unsigned char *out, 
+                              unsigned short u0, unsigned short u1,
+                              unsigned short u2, unsigned short u3)
+{
+    out[0] = (u0 >> 8) | ((u1 >> 8) << 2) | ((u2 >> 8) << 4) | ((u3 >> 8) << 6);
+    out[1] = u0 & 0xFF;
+    out[2] = u1 & 0xFF;
+    out[3] = u2 & 0xFF;
+    out[4] = u3 & 0xFF;
+}
+
+unsigned sfe_pack_f32_ref(unsigned char *dst, const float *src, unsigned n)
+{
+    unsigned i;
+    unsigned char *out = dst;
+    
+    for (i=0; i+4<=n; i+=4, out+=5){
+        pack_frame(out,
+                   dac_code_f32(src[i]), dac_code_f32(src[i+1]),
+                   dac_code_f32(src[i+2]), dac_code_f32(src[i+3]));
+    }
+    return out - dst;
+}
+
+unsigned sfe_pack_s16_ref(unsigned char *dst, const short *src, unsigned n)
+{
+    unsigned i;
+    unsigned char *out = dst;
+    
+    for (i=0; i+4<=n; i+=4, out+=5){
+        pack_frame(out,
+                   dac_code_s16(src[i]), dac_code_s16(src[i+1]),
+                   dac_code_s16(src[i+2]), dac_code_s16(src[i+3]));
+    }
+    return out - dst;
+}
+
+unsigned sfe_pack_idle(unsigned char *dst, unsigned len)
+{
+    unsigned i;
+    
+    for (i=0; i+5<=len; i+=5){
+        /* 0x200 in all four samples */
+        dst[i] = 0xAA;
+        dst[i+1] = 0;
+        dst[i+2] = 0;
+        dst[i+3] = 0;
+        dst[i+4] = 0;
+    }
+    return i;
+}
+
+unsigned sfe_unpack_f32_ref(float *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i;
+    for (i=0; i<n; i++){
+        dst[i] = (src[i] - 128) * ADC_SCALE;
+    }
+    return n;
+}
+
+unsigned sfe_unpack_s8_ref(signed char *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i;
+    for (i=0; i<n; i++){
+        dst[i] = (signed char)(src[i] - 128);
+    }
+    return n;
+}
+
+unsigned sfe_unpack_s16_ref(short *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i;
+    for (i=0; i<n; i++){
+        dst[i] = (short)((src[i] - 128) * 256);
+    }
+    return n;
+}
+
+
+/****************************************************************
+ * SIMD kernels
+ *
+ * the codes are narrowed to 16 bits so each 64 bit lane holds one 
+ * frame u3:u2:u1:u0, the lane is then folded into the 40 bit frame 
+ * with shifts and masks:
+ *     msb   = the bits 9:8 of the four codes gathered into bits 7:0
+ *     low   = the four low bytes gathered into bits 31:0
+ *     frame = msb | low << 8
+ * and stored with 8 byte stores 5 bytes apart. every store spills 3 
+ * bytes into the next frame, so the vector loops stop while at least 
+ * one frame is left for the scalar tail to write over them.
+ ****************************************************************/
+
+#ifdef SFE_X86
+
+TARGET_SSE2 static inline __m128i fold_frames_sse2(__m128i w)
+{
+    const __m128i m_msb = _mm_set1_epi32(0x00030003);
+    const __m128i m_byte = _mm_set1_epi16(0x00FF);
+    const __m128i m_word = _mm_set1_epi32(0x0000FFFF);
+    const __m128i m_dword = _mm_set_epi32(0, -1, 0, -1);
+    const __m128i m_lsb = _mm_set_epi32(0, 0xFF, 0, 0xFF);
+    __m128i t, msb, low;
+
+    t = _mm_and_si128(_mm_srli_epi64(w, 8), m_msb);
+    msb = _mm_or_si128(_mm_or_si128(t, _mm_srli_epi64(t, 14)),
+                       _mm_or_si128(_mm_srli_epi64(t, 28), _mm_srli_epi64(t, 42)));
+    msb = _mm_and_si128(msb, m_lsb);
+
+    low = _mm_and_si128(w, m_byte);
+    low = _mm_and_si128(_mm_or_si128(low, _mm_srli_epi64(low, 8)), m_word);
+    low = _mm_and_si128(_mm_or_si128(low, _mm_srli_epi64(low, 16)), m_dword);
+
+    return _mm_or_si128(msb, _mm_slli_epi64(low, 8));
+}
+
+TARGET_SSE2 static inline __m128i dac_codes_sse2(__m128 x)
+{
+    /* maxps returns the second operand for NaN */
+    x = _mm_max_ps(x, _mm_set1_ps(-1.0f));
+    x = _mm_min_ps(x, _mm_set1_ps(1.0f));
+    return _mm_add_epi32(_mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(511.0f))),
+                         _mm_set1_epi32(512));
+}
+
+TARGET_SSE2 static inline void store_frames_sse2(unsigned char *out, __m128i f)
+{
+    _mm_storel_epi64((__m128i*)out, f);
+    _mm_storel_epi64((__m128i*)(out + 5), _mm_srli_si128(f, 8));
+}
+
+TARGET_SSE2 static unsigned pack_f32_sse2(unsigned char *dst, const float *src, unsigned n)
+{
+    unsigned i = 0;
+    unsigned char *out = dst;
+    
+    /* 8 samples, 2 frames per round */
+    for (; i+8+4<=n; i+=8, out+=10){
+        __m128i a = dac_codes_sse2(_mm_loadu_ps(src + i));
+        __m128i b = dac_codes_sse2(_mm_loadu_ps(src + i + 4));
+        store_frames_sse2(out, fold_frames_sse2(_mm_packs_epi32(a, b)));
+    }
+    return (out - dst) + sfe_pack_f32_ref(out, src + i, n - i);
+}
+
+TARGET_SSE2 static unsigned pack_s16_sse2(unsigned char *dst, const short *src, unsigned n)
+{
+    unsigned i = 0;
+    unsigned char *out = dst;
+    
+    for (; i+8+4<=n; i+=8, out+=10){
+        __m128i w = _mm_loadu_si128((const __m128i*)(src + i));
+        w = _mm_add_epi16(_mm_srai_epi16(w, 6), _mm_set1_epi16(512));
+        store_frames_sse2(out, fold_frames_sse2(w));
+    }
+    return (out - dst) + sfe_pack_s16_ref(out, src + i, n - i);
+}
+
+/* flipping the top bit turns offset binary into two's complement */
+TARGET_SSE2 static inline __m128i load_adc_sse2(const unsigned char *src)
+{
+    return _mm_xor_si128(_mm_loadu_si128((const __m128i*)src), _mm_set1_epi8((char)0x80));
+}
+
+TARGET_SSE2 static inline void store_f32_sse2(float *dst, __m128i w)
+{
+    const __m128 scale = _mm_set1_ps(ADC_SCALE);
+    /* sign extend by duplicating into the upper half and shifting down */
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16);
+    _mm_storeu_ps(dst, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+}
+
+TARGET_SSE2 static unsigned unpack_f32_sse2(float *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        __m128i x = load_adc_sse2(src + i);
+        store_f32_sse2(dst + i, _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8));
+        store_f32_sse2(dst + i + 8, _mm_srai_epi16(_mm_unpackhi_epi8(x, x), 8));
+    }
+    return i + sfe_unpack_f32_ref(dst + i, src + i, n - i);
+}
+
+TARGET_SSE2 static unsigned unpack_s8_sse2(signed char *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        _mm_storeu_si128((__m128i*)(dst + i), load_adc_sse2(src + i));
+    }
+    return i + sfe_unpack_s8_ref(dst + i, src + i, n - i);
+}
+
+TARGET_SSE2 static unsigned unpack_s16_sse2(short *dst, const unsigned char *src, unsigned n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        __m128i x = load_adc_sse2(src + i);
+        /* the sample lands in the high byte, which is the << 8 */
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(zero, x));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(zero, x));
+    }
+    return i + sfe_unpack_s16_ref(dst + i, src + i, n - i);
+}
+
+TARGET_AVX2 static inline __m256i fold_frames_avx2(__m256i w)
+{
+    const __m256i m_msb = _mm256_set1_epi32(0x00030003);
+    const __m256i m_byte = _mm256_set1_epi16(0x00FF);
+    const __m256i m_word = _mm256_set1_epi32(0x0000FFFF);
+    const __m256i m_dword = _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+    const __m256i m_lsb = _mm256_set_epi32(0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF);
+    __m256i t, msb, low;
+
+    t = _mm256_and_si256(_mm256_srli_epi64(w, 8), m_msb);
+    msb = _mm256_or_si256(_mm256_or_si256(t, _mm256_srli_epi64(t, 14)),
+                          _mm256_or_si256(_mm256_srli_epi64(t, 28), _mm256_srli_epi64(t, 42)));
+    msb = _mm256_and_si256(msb, m_lsb);
+
+    low = _mm256_and_si256(w, m_byte);
+    low = _mm256_and_si256(_mm256_or_si256(low, _mm256_srli_epi64(low, 8)), m_word);
+    low = _mm256_and_si256(_mm256_or_si256(low, _mm256_srli_epi64(low, 16)), m_dword);
+
+    return _mm256_or_si256(msb, _mm256_slli_epi64(low, 8));
+}
+
+TARGET_AVX2 static inline __m256i dac_codes_avx2(__m256 x)
+{
+    x = _mm256_max_ps(x, _mm256_set1_ps(-1.0f));
+    x = _mm256_min_ps(x, _mm256_set1_ps(1.0f));
+    return _mm256_add_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(511.0f))),
+                            _mm256_set1_epi32(512));
+}
+
+TARGET_AVX2 static inline void store_frames_avx2(unsigned char *out, __m256i f)
+{
+    __m128i lo = _mm256_castsi256_si128(f);
+    __m128i hi = _mm256_extracti128_si256(f, 1);
+    
+    _mm_storel_epi64((__m128i*)out, lo);
+    _mm_storel_epi64((__m128i*)(out + 5), _mm_srli_si128(lo, 8));
+    _mm_storel_epi64((__m128i*)(out + 10), hi);
+    _mm_storel_epi64((__m128i*)(out + 15), _mm_srli_si128(hi, 8));
+}
+
+TARGET_AVX2 static unsigned pack_f32_avx2(unsigned char *dst, const float *src, unsigned n)
+{
+    unsigned i = 0;
+    unsigned char *out = dst;
+    
+    /* 16 samples, 4 frames per round */
+    for (; i+16+4<=n; i+=16, out+=20){
+        __m256i a = dac_codes_avx2(_mm256_loadu_ps(src + i));
+        __m256i b = dac_codes_avx2(_mm256_loadu_ps(src + i + 8));
+        /* packs works per 128 bit half, put the quads back in order */
+        __m256i w = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        store_frames_avx2(out, fold_frames_avx2(w));
+    }
+    return (out - dst) + sfe_pack_f32_ref(out, src + i, n - i);
+}
+
+TARGET_AVX2 static unsigned pack_s16_avx2(unsigned char *dst, const short *src, unsigned n)
+{
+    unsigned i = 0;
+    unsigned char *out = dst;
+    
+    for (; i+16+4<=n; i+=16, out+=20){
+        __m256i w = _mm256_loadu_si256((const __m256i*)(src + i));
+        w = _mm256_add_epi16(_mm256_srai_epi16(w, 6), _mm256_set1_epi16(512));
+        store_frames_avx2(out, fold_frames_avx2(w));
+    }
+    return (out - dst) + sfe_pack_s16_ref(out, src + i, n - i);
+}
+
+TARGET_AVX2 static unsigned unpack_f32_avx2(float *dst, const unsigned char *src, unsigned n)
+{
+    const __m256 scale = _mm256_set1_ps(ADC_SCALE);
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        __m128i x = load_adc_sse2(src + i);
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(x));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(x, 8)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(lo, scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(hi, scale));
+    }
+    return i + sfe_unpack_f32_ref(dst + i, src + i, n - i);
+}
+
+TARGET_AVX2 static unsigned unpack_s8_avx2(signed char *dst, const unsigned char *src, unsigned n)
+{
+    const __m256i flip = _mm256_set1_epi8((char)0x80);
+    unsigned i = 0;
+    
+    for (; i+32<=n; i+=32){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(x, flip));
+    }
+    return i + sfe_unpack_s8_ref(dst + i, src + i, n - i);
+}
+
+TARGET_AVX2 static unsigned unpack_s16_avx2(short *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        __m256i w = _mm256_cvtepi8_epi16(load_adc_sse2(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_slli_epi16(w, 8));
+    }
+    return i + sfe_unpack_s16_ref(dst + i, src + i, n - i);
+}
+
+#endif /* SFE_X86 */
+
+
+#ifdef SFE_NEON
+
+static inline uint64x2_t fold_frames_neon(uint64x2_t w)
+{
+    const uint64x2_t m_msb = vdupq_n_u64(0x0003000300030003ULL);
+    const uint64x2_t m_byte = vdupq_n_u64(0x00FF00FF00FF00FFULL);
+    const uint64x2_t m_word = vdupq_n_u64(0x0000FFFF0000FFFFULL);
+    const uint64x2_t m_dword = vdupq_n_u64(0xFFFFFFFFULL);
+    const uint64x2_t m_lsb = vdupq_n_u64(0xFFULL);
+    uint64x2_t t, msb, low;
+
+    t = vandq_u64(vshrq_n_u64(w, 8), m_msb);
+    msb = vorrq_u64(vorrq_u64(t, vshrq_n_u64(t, 14)),
+                    vorrq_u64(vshrq_n_u64(t, 28), vshrq_n_u64(t, 42)));
+    msb = vandq_u64(msb, m_lsb);
+
+    low = vandq_u64(w, m_byte);
+    low = vandq_u64(vorrq_u64(low, vshrq_n_u64(low, 8)), m_word);
+    low = vandq_u64(vorrq_u64(low, vshrq_n_u64(low, 16)), m_dword);
+
+    return vorrq_u64(msb, vshlq_n_u64(low, 8));
+}
+
+static inline int32x4_t dac_codes_neon(float32x4_t x)
+{
+    const float32x4_t lo = vdupq_n_f32(-1.0f);
+    /* vmaxq propagates NaN, select instead so NaN goes to -1 */
+    x = vbslq_f32(vcgtq_f32(x, lo), x, lo);
+    x = vminq_f32(x, vdupq_n_f32(1.0f));
+    return vaddq_s32(vcvtq_s32_f32(vmulq_n_f32(x, 511.0f)), vdupq_n_s32(512));
+}
+
+static inline void store_frames_neon(unsigned char *out, uint64x2_t f)
+{
+    vst1_u8(out, vreinterpret_u8_u64(vget_low_u64(f)));
+    vst1_u8(out + 5, vreinterpret_u8_u64(vget_high_u64(f)));
+}
+
+static unsigned pack_f32_neon(unsigned char *dst, const float *src, unsigned n)
+{
+    unsigned i = 0;
+    unsigned char *out = dst;
+    
+    for (; i+8+4<=n; i+=8, out+=10){
+        int16x4_t a = vmovn_s32(dac_codes_neon(vld1q_f32(src + i)));
+        int16x4_t b = vmovn_s32(dac_codes_neon(vld1q_f32(src + i + 4)));
+        uint64x2_t w = vreinterpretq_u64_s16(vcombine_s16(a, b));
+        store_frames_neon(out, fold_frames_neon(w));
+    }
+    return (out - dst) + sfe_pack_f32_ref(out, src + i, n - i);
+}
+
+static unsigned pack_s16_neon(unsigned char *dst, const short *src, unsigned n)
+{
+    unsigned i = 0;
+    unsigned char *out = dst;
+    
+    for (; i+8+4<=n; i+=8, out+=10){
+        int16x8_t w = vld1q_s16(src + i);
+        w = vaddq_s16(vshrq_n_s16(w, 6), vdupq_n_s16(512));
+        store_frames_neon(out, fold_frames_neon(vreinterpretq_u64_s16(w)));
+    }
+    return (out - dst) + sfe_pack_s16_ref(out, src + i, n - i);
+}
+
+static inline int8x16_t load_adc_neon(const unsigned char *src)
+{
+    return vreinterpretq_s8_u8(veorq_u8(vld1q_u8(src), vdupq_n_u8(0x80)));
+}
+
+static inline void store_f32_neon(float *dst, int16x8_t w)
+{
+    int32x4_t lo = vmovl_s16(vget_low_s16(w));
+    int32x4_t hi = vmovl_s16(vget_high_s16(w));
+    vst1q_f32(dst, vmulq_n_f32(vcvtq_f32_s32(lo), ADC_SCALE));
+    vst1q_f32(dst + 4, vmulq_n_f32(vcvtq_f32_s32(hi), ADC_SCALE));
+}
+
+static unsigned unpack_f32_neon(float *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        int8x16_t x = load_adc_neon(src + i);
+        store_f32_neon(dst + i, vmovl_s8(vget_low_s8(x)));
+        store_f32_neon(dst + i + 8, vmovl_s8(vget_high_s8(x)));
+    }
+    return i + sfe_unpack_f32_ref(dst + i, src + i, n - i);
+}
+
+static unsigned unpack_s8_neon(signed char *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        vst1q_s8(dst + i, load_adc_neon(src + i));
+    }
+    return i + sfe_unpack_s8_ref(dst + i, src + i, n - i);
+}
+
+static unsigned unpack_s16_neon(short *dst, const unsigned char *src, unsigned n)
+{
+    unsigned i = 0;
+    
+    for (; i+16<=n; i+=16){
+        int8x16_t x = load_adc_neon(src + i);
+        vst1q_s16(dst + i, vshll_n_s8(vget_low_s8(x), 8));
+        vst1q_s16(dst + i + 8, vshll_n_s8(vget_high_s8(x), 8));
+    }
+    return i + sfe_unpack_s16_ref(dst + i, src + i, n - i);
+}
+
+#endif /* SFE_NEON */
+
+
+/****************************************************************
+ * runtime dispatch
+ ****************************************************************/
+
+static const kernel kernels[SFE_SIMD_NUM] = {
+    {"scalar", sfe_pack_f32_ref, sfe_pack_s16_ref,
+     sfe_unpack_f32_ref, sfe_unpack_s8_ref, sfe_unpack_s16_ref},
+#ifdef SFE_X86
+    {"sse2", pack_f32_sse2, pack_s16_sse2,
+     unpack_f32_sse2, unpack_s8_sse2, unpack_s16_sse2},
+    {"avx2", pack_f32_avx2, pack_s16_avx2,
+     unpack_f32_avx2, unpack_s8_avx2, unpack_s16_avx2},
+#else
+    {"sse2", NULL, NULL, NULL, NULL, NULL},
+    {"avx2", NULL, NULL, NULL, NULL, NULL},
+#endif
+#ifdef SFE_NEON
+    {"neon", pack_f32_neon, pack_s16_neon,
+     unpack_f32_neon, unpack_s8_neon, unpack_s16_neon},
+#else
+    {"neon", NULL, NULL, NULL, NULL, NULL},
+#endif
+};
+
+static const kernel *active_kernel = NULL;
+static sfe_simd active_simd = SFE_SIMD_SCALAR;
+
+#ifdef SFE_X86
+static int cpu_has_x86(sfe_simd k)
+{
+#ifdef _MSC_VER
+    int info[4];
+    
+    __cpuid(info, 1);
+    if (k == SFE_SIMD_SSE2){
+        return (info[3] >> 26) & 1;
+    }
+    /* avx2 needs the os to save the ymm state too */
+    if (!((info[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6){
+        return 0;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+#else
+    __builtin_cpu_init();
+    if (k == SFE_SIMD_SSE2){
+        return __builtin_cpu_supports("sse2");
+    }
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+int sfe_simd_supported(sfe_simd k)
+{
+    switch (k){
+    case SFE_SIMD_SCALAR:
+        return 1;
+#ifdef SFE_X86
+    case SFE_SIMD_SSE2:
+    case SFE_SIMD_AVX2:
+        return cpu_has_x86(k);
+#endif
+#ifdef SFE_NEON
+    case SFE_SIMD_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+const char* sfe_simd_name(sfe_simd k)
+{
+    if (k < 0 || k >= SFE_SIMD_NUM){
+        return "auto";
+    }
+    return kernels[k].name;
+}
+
+int sfe_convert_set_kernel(sfe_simd k)
+{
+    if (k == SFE_SIMD_AUTO){
+        k = SFE_SIMD_SCALAR;
+        if (sfe_simd_supported(SFE_SIMD_NEON)){
+            k = SFE_SIMD_NEON;
+        }
+        else if (sfe_simd_supported(SFE_SIMD_AVX2)){
+            k = SFE_SIMD_AVX2;
+        }
+        else if (sfe_simd_supported(SFE_SIMD_SSE2)){
+            k = SFE_SIMD_SSE2;
+        }
+    }
+    
+    if (!sfe_simd_supported(k)){
+        fprintf(stderr, "%s kernel not supported\n", sfe_simd_name(k));
+        return -1;
+    }
+    active_simd = k;
+    active_kernel = &kernels[k];
+    return 0;
+}
+
+sfe_simd sfe_convert_get_kernel(void)
+{
+    if (!active_kernel){
+        sfe_convert_set_kernel(SFE_SIMD_AUTO);
+    }
+    return active_simd;
+}
+
+static inline const kernel* get_kernel(void)
+{
+    /* racing first calls all pick the same kernel */
+    if (!active_kernel){
+        sfe_convert_set_kernel(SFE_SIMD_AUTO);
+    }
+    return active_kernel;
+}
+
+unsigned sfe_pack_f32(unsigned char *dst, const float *src, unsigned n)
+{
+    return get_kernel()->pack_f32(dst, src, n);
+}
+
+unsigned sfe_pack_cf32(unsigned char *dst, const float *src, unsigned n)
+{
+    /* a frame is 2 I/Q pairs, the same layout as 4 real samples */
+    return get_kernel()->pack_f32(dst, src, n*2);
+}
+
+unsigned sfe_pack_s16(unsigned char *dst, const short *src, unsigned n)
+{
+    return get_kernel()->pack_s16(dst, src, n);
+}
+
+unsigned sfe_unpack_f32(float *dst, const unsigned char *src, unsigned n)
+{
+    return get_kernel()->unpack_f32(dst, src, n);
+}
+
+unsigned sfe_unpack_cf32(float *dst, const unsigned char *src, unsigned n)
+{
+    /* I and Q already come interleaved */
+    return get_kernel()->unpack_f32(dst, src, n) / 2;
+}
+
+unsigned sfe_unpack_s8(signed char *dst, const unsigned char *src, unsigned n)
+{
+    return get_kernel()->unpack_s8(dst, src, n);
+}
+
+unsigned sfe_unpack_s16(short *dst, const unsigned char *src, unsigned n)
+{
+    return get_kernel()->unpack_s16(dst, src, n);
+}
+
+unsigned sfe_unpack_cs16(short *dst, const unsigned char *src, unsigned n)
+{
+    return get_kernel()->unpack_s16(dst, src, n) / 2;
+}
@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SFE_CONVERT_H_
+#define SFE_CONVERT_H_
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/* sample format conversion between host samples and the simpleFE wire 
+ * format, with SIMD kernels picked at runtime.
+ *
+ * DAC: 10 bit offset binary, 4 samples per 5 byte frame. byte 0 carries
+ * the two MSBs of each sample (sample 0 in bits 1:0 ... sample 3 in bits
+ * 7:6), bytes 1-4 the low bytes of samples 0-3. floats are clamped to 
+ * [-1, 1] (NaN goes to -1) and truncated to [1, 1023], int16 uses its 
+ * 10 most significant bits [0, 1023]. every kernel is bit exact with the
+ * scalar reference.
+ *
+ * ADC: 8 bit offset binary, one byte per sample. float output is 
+ * (x - 128) / 127, int8 is x - 128 and int16 is (x - 128) << 8 so it
+ * spans the int16 range like other sc16 sources. */
+
+typedef enum sfe_simd_e{
+    SFE_SIMD_AUTO = -1,
+    SFE_SIMD_SCALAR = 0,
+    SFE_SIMD_SSE2,
+    SFE_SIMD_AVX2,
+    SFE_SIMD_NEON,
+    SFE_SIMD_NUM
+}sfe_simd;
+
+/* non zero if the kernel is built in and the cpu runs it */
+int sfe_simd_supported(sfe_simd k);
+const char* sfe_simd_name(sfe_simd k);
+/* the best supported kernel is used unless one is forced here, 
+ * returns -1 if k is not supported. not thread safe against running
+ * conversions */
+int sfe_convert_set_kernel(sfe_simd k);
+sfe_simd sfe_convert_get_kernel(void);
+
+/* n samples (a multiple of 4, the rest is ignored) into n/4*5 bytes, 
+ * returns the number of bytes written */
+unsigned sfe_pack_f32(unsigned char *dst, const float *src, unsigned n);
+/* n interleaved I/Q pairs (a multiple of 2) */
+unsigned sfe_pack_cf32(unsigned char *dst, const float *src, unsigned n);
+unsigned sfe_pack_s16(unsigned char *dst, const short *src, unsigned n);
+/* whole frames of mid scale (code 512) into len bytes, what the DAC sends
+ * when there is nothing to send, returns the number of bytes written */
+unsigned sfe_pack_idle(unsigned char *dst, unsigned len);
+
+/* n raw bytes into n samples, or n/2 I/Q pairs for the complex 
+ * versions (n even), returns the number of samples or pairs written */
+unsigned sfe_unpack_f32(float *dst, const unsigned char *src, unsigned n);
+unsigned sfe_unpack_cf32(float *dst, const unsigned char *src, unsigned n);
+unsigned sfe_unpack_s8(signed char *dst, const unsigned char *src, unsigned n);
+unsigned sfe_unpack_s16(short *dst, const unsigned char *src, unsigned n);
+unsigned sfe_unpack_cs16(short *dst, const unsigned char *src, unsigned n);
+
+/* scalar reference versions */
+unsigned sfe_pack_f32_ref(unsigned char *dst, const float *src, unsigned n);
+unsigned sfe_pack_s16_ref(unsigned char *dst, const short *src, unsigned n);
+unsigned sfe_unpack_f32_ref(float *dst, const unsigned char *src, unsigned n);
+unsigned sfe_unpack_s8_ref(signed char *dst, const unsigned char *src, unsigned n);
+unsigned sfe_unpack_s16_ref(short *dst, const unsigned char *src, unsigned n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
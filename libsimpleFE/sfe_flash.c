@@ -0,0 +1,476 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sfe_flash.h"
+#include "sfe_cmd.h"
+#include "chip_select.h"
+
+#define FC_WE         0x06
+#define FC_RSR1       0x05
+#define FC_RD         0x03
+#define FC_PP         0x02
+#define FC_SE         0x20
+#define FC_BE64       0xD8
+#define FC_CE         0xC7
+
+#define READ_FRAME    4096       /* bytes per chip select frame */
+#define READ_WINDOW   8          /* frames queued at once */
+#define POLL_MIN      16         /* status bytes read behind a page program */
+#define POLL_MAX      512
+#define SHRINK_AFTER  64         /* early pages before the status read shrinks */
+#define READY_POLL    16         /* status bytes per sfe_flash_wait_ready round */
+#define BUSY_TIMEOUT_S  300      /* a chip erase takes tens of seconds */
+
+struct sfe_flash_s{
+    sfe_cmdq q;
+    unsigned poll_len;
+    unsigned early;            /* pages in a row that were done early */
+    sfe_flash_stats st;
+};
+
+struct flash_page{
+    unsigned addr;
+    const unsigned char *data;
+    unsigned len;
+};
+
+/* a page program in flight */
+struct page_slot{
+    int done;
+    int status;
+    unsigned poll_len;
+    unsigned char poll[1 + POLL_MAX];
+};
+
+/* a read frame in flight */
+struct read_slot{
+    int done;
+    int status;
+};
+
+static const unsigned char zeros[READ_FRAME];
+static const unsigned char rsr_cmd[1 + POLL_MAX] = {FC_RSR1};
+
+static const unsigned crc_nibble[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+unsigned sfe_crc32(unsigned crc, const unsigned char *data, unsigned len)
+{
+    unsigned i;
+    
+    crc = ~crc;
+    for (i=0; i<len; i++){
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc_nibble[crc & 15];
+        crc = (crc >> 4) ^ crc_nibble[crc & 15];
+    }
+    return ~crc;
+}
+
+/* the last two samples of a continuous status read, the flash is idle
+ * from then on as nothing else was sent */
+static int poll_ready(const unsigned char *st, unsigned len)
+{
+    return !(st[len] & 1) && !(st[len-1] & 1);
+}
+
+static void slot_done(int status, void *userdata)
+{
+    struct read_slot *s = (struct read_slot*)userdata;
+    s->status = status;
+    s->done = 1;
+}
+
+static void page_done(int status, void *userdata)
+{
+    struct page_slot *s = (struct page_slot*)userdata;
+    s->status = status;
+    s->done = 1;
+}
+
+sfe_flash* sfe_flash_open(sfe_usb *usb)
+{
+    sfe_flash *f = (sfe_flash*)calloc(1, sizeof(sfe_flash));
+
+    if (!f){
+        return NULL;
+    }
+    sfe_cmdq_init(&f->q, NULL, usb);
+    f->poll_len = 2*POLL_MIN;
+    return f;
+}
+
+void sfe_flash_close(sfe_flash *f)
+{
+    if (f){
+        sfe_cmdq_destroy(&f->q);
+        free(f);
+    }
+}
+
+void sfe_flash_get_stats(sfe_flash *f, sfe_flash_stats *st)
+{
+    *st = f->st;
+}
+
+int sfe_flash_wait_ready(sfe_flash *f)
+{
+    unsigned char st[1 + READY_POLL];
+    time_t start = time(NULL);
+
+    while (1){
+        sfe_cmd *c = sfe_cmdq_new_cmd(&f->q);
+        
+        if (!c){
+            return -1;
+        }
+        sfe_cmd_spi(c, FLASH_CS, rsr_cmd, st, sizeof(st));
+        if (sfe_cmd_run(c)){
+            return -1;
+        }
+        if (poll_ready(st, READY_POLL)){
+            return 0;
+        }
+        if (time(NULL) - start > BUSY_TIMEOUT_S){
+            fprintf(stderr, "flash stays busy\n");
+            return -1;
+        }
+    }
+}
+
+/* chip select frames of READ_FRAME bytes, READ_WINDOW of them queued */
+int sfe_flash_read(sfe_flash *f, unsigned addr, unsigned char *data, unsigned len)
+{
+    struct read_slot slots[READ_WINDOW];
+    unsigned nframes = (len + READ_FRAME - 1) / READ_FRAME;
+    unsigned i;
+    int ret = 0;
+
+    for (i=0; i<nframes && !ret; i++){
+        struct read_slot *s = &slots[i % READ_WINDOW];
+        unsigned off = i * READ_FRAME;
+        unsigned n = len - off < READ_FRAME ? len - off : READ_FRAME;
+        unsigned a = addr + off;
+        unsigned char cmd[4] = {FC_RD, (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff};
+        sfe_cmd *c;
+        
+        if (i >= READ_WINDOW){
+            sfe_cmdq_wait_flag(&f->q, &s->done);
+            if (s->status){
+                ret = -1;
+                break;
+            }
+        }
+        c = sfe_cmdq_new_cmd(&f->q);
+        if (!c){
+            ret = -1;
+            break;
+        }
+        /* one frame, the address and the data as separate steps */
+        sfe_cmd_gpio(c, FLASH_CS, 0);
+        sfe_cmd_spi(c, -1, cmd, NULL, 4);
+        sfe_cmd_spi(c, -1, zeros, data + off, n);
+        sfe_cmd_gpio(c, FLASH_CS, 1);
+        s->done = 0;
+        s->status = 0;
+        if (sfe_cmd_submit(c, slot_done, s)){
+            ret = -1;
+        }
+    }
+    if (sfe_cmdq_wait(&f->q)){
+        ret = -1;
+    }
+    if (!ret){
+        f->st.bytes_read += len;
+    }
+    return ret;
+}
+
+int sfe_flash_verify(sfe_flash *f, unsigned addr, const unsigned char *data, unsigned len)
+{
+    unsigned char *buf = (unsigned char*)malloc(len ? len : 1);
+    int ret;
+
+    if (!buf){
+        return -1;
+    }
+    ret = sfe_flash_read(f, addr, buf, len);
+    if (!ret){
+        ret = memcmp(buf, data, len) ? 1 : 0;
+    }
+    free(buf);
+    return ret;
+}
+
+static int erase_one(sfe_flash *f, unsigned char op, unsigned addr)
+{
+    unsigned char we = FC_WE;
+    unsigned char cmd[4] = {op, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff};
+    sfe_cmd *c = sfe_cmdq_new_cmd(&f->q);
+
+    if (!c){
+        return -1;
+    }
+    sfe_cmd_spi(c, FLASH_CS, &we, NULL, 1);
+    sfe_cmd_spi(c, FLASH_CS, cmd, NULL, op == FC_CE ? 1 : 4);
+    if (sfe_cmd_run(c)){
+        return -1;
+    }
+    return sfe_flash_wait_ready(f);
+}
+
+int sfe_flash_erase(sfe_flash *f, unsigned addr, unsigned len, unsigned unit)
+{
+    unsigned char op = unit == SFE_FLASH_BLOCK ? FC_BE64 : FC_SE;
+    unsigned a, end = addr + len;
+
+    if (unit != SFE_FLASH_BLOCK && unit != SFE_FLASH_SECTOR){
+        fprintf(stderr, "flash erase unit %u not supported\n", unit);
+        return -1;
+    }
+    if (sfe_flash_wait_ready(f)){
+        return -1;
+    }
+    for (a = addr & ~(unit - 1); a < end; a += unit){
+        if (erase_one(f, op, a)){
+            return -1;
+        }
+        f->st.sectors_erased += unit / SFE_FLASH_SECTOR;
+    }
+    return 0;
+}
+
+int sfe_flash_erase_chip(sfe_flash *f)
+{
+    if (sfe_flash_wait_ready(f)){
+        return -1;
+    }
+    return erase_one(f, FC_CE, 0);
+}
+
+/* write enable, page program and a continuous status read in one command */
+static int submit_page(sfe_flash *f, const struct flash_page *p, struct page_slot *s)
+{
+    unsigned char we = FC_WE;
+    unsigned char cmd[4 + SFE_FLASH_PAGE];
+    sfe_cmd *c = sfe_cmdq_new_cmd(&f->q);
+
+    if (!c){
+        return -1;
+    }
+    cmd[0] = FC_PP;
+    cmd[1] = (p->addr >> 16) & 0xff;
+    cmd[2] = (p->addr >> 8) & 0xff;
+    cmd[3] = p->addr & 0xff;
+    memcpy(cmd + 4, p->data, p->len);
+    
+    s->done = 0;
+    s->status = 0;
+    s->poll_len = f->poll_len;
+    memset(s->poll, 0, 1 + s->poll_len);
+    
+    sfe_cmd_spi(c, FLASH_CS, &we, NULL, 1);
+    sfe_cmd_spi(c, FLASH_CS, cmd, NULL, 4 + p->len);
+    sfe_cmd_spi(c, FLASH_CS, rsr_cmd, s->poll, 1 + s->poll_len);
+    f->st.pages++;
+    return sfe_cmd_submit(c, page_done, s);
+}
+
+/* a page is confirmed once its status read ended ready, the ones behind
+ * it were then sent to an idle flash. if it ended busy, the pages queued
+ * behind it may have been ignored and are sent again. the status read 
+ * doubles when that happens and shrinks slowly while it sees ready early */
+static int program_pages(sfe_flash *f, const struct flash_page *pages, unsigned n)
+{
+    struct page_slot *slots;
+    unsigned next = 0, confirmed = 0;
+    int ret = 0;
+
+    if (!n){
+        return 0;
+    }
+    if (sfe_flash_wait_ready(f)){
+        return -1;
+    }
+    slots = (struct page_slot*)malloc(SFE_FLASH_WINDOW * sizeof(struct page_slot));
+    if (!slots){
+        return -1;
+    }
+    while (confirmed < n){
+        struct page_slot *s;
+        
+        while (next < n && next - confirmed < SFE_FLASH_WINDOW){
+            if (submit_page(f, &pages[next], &slots[next % SFE_FLASH_WINDOW])){
+                ret = -1;
+                goto out;
+            }
+            next++;
+        }
+        
+        s = &slots[confirmed % SFE_FLASH_WINDOW];
+        sfe_cmdq_wait_flag(&f->q, &s->done);
+        if (s->status){
+            ret = -1;
+            goto out;
+        }
+        if (poll_ready(s->poll, s->poll_len)){
+            unsigned first = s->poll_len;
+
+            while (first > 1 && !(s->poll[first-1] & 1)){
+                first--;
+            }
+            f->early = first <= s->poll_len / 4 ? f->early + 1 : 0;
+            if (f->early >= SHRINK_AFTER && f->poll_len > POLL_MIN){
+                f->poll_len -= f->poll_len / 4;
+                f->early = 0;
+            }
+            confirmed++;
+            continue;
+        }
+        
+        /* still busy, start over behind this page on an idle flash */
+        if (sfe_cmdq_wait(&f->q) || sfe_flash_wait_ready(f)){
+            ret = -1;
+            goto out;
+        }
+        confirmed++;
+        if (next > confirmed){
+            f->st.resent += next - confirmed;
+            f->poll_len = f->poll_len * 2 > POLL_MAX ? POLL_MAX : f->poll_len * 2;
+            f->early = 0;
+        }
+        next = confirmed;
+    }
+    
+ out:
+    if (sfe_cmdq_wait(&f->q)){
+        ret = -1;
+    }
+    free(slots);
+    return ret;
+}
+
+int sfe_flash_program(sfe_flash *f, unsigned addr, const unsigned char *data, unsigned len)
+{
+    unsigned n = 0, off = 0;
+    struct flash_page *pages;
+    int ret;
+
+    /* pages must not cross a page boundary */
+    pages = (struct flash_page*)malloc((len / SFE_FLASH_PAGE + 2) * sizeof(struct flash_page));
+    if (!pages){
+        return -1;
+    }
+    while (off < len){
+        unsigned a = addr + off;
+        unsigned room = SFE_FLASH_PAGE - (a & (SFE_FLASH_PAGE - 1));
+        
+        pages[n].addr = a;
+        pages[n].data = data + off;
+        pages[n].len = len - off < room ? len - off : room;
+        off += pages[n].len;
+        n++;
+    }
+    ret = program_pages(f, pages, n);
+    free(pages);
+    return ret;
+}
+
+int sfe_flash_update(sfe_flash *f, unsigned addr, const unsigned char *data, unsigned len)
+{
+    unsigned first = addr & ~(SFE_FLASH_SECTOR - 1);
+    unsigned end = (addr + len + SFE_FLASH_SECTOR - 1) & ~(SFE_FLASH_SECTOR - 1);
+    unsigned size = end - first;
+    unsigned char *cur = (unsigned char*)malloc(size ? size : 1);
+    unsigned char *want = (unsigned char*)malloc(size ? size : 1);
+    struct flash_page *pages = (struct flash_page*)malloc((size / SFE_FLASH_PAGE + 1) * sizeof(struct flash_page));
+    unsigned np = 0, s, p;
+    int ret = -1;
+
+    if (!cur || !want || !pages){
+        goto out;
+    }
+    if (sfe_flash_read(f, first, cur, size)){
+        goto out;
+    }
+    memcpy(want, cur, size);
+    memcpy(want + (addr - first), data, len);
+
+    for (s=0; s<size; s+=SFE_FLASH_SECTOR){
+        unsigned char *c = cur + s;
+        unsigned char *w = want + s;
+        int need_erase = 0;
+
+        if (sfe_crc32(0, c, SFE_FLASH_SECTOR) == sfe_crc32(0, w, SFE_FLASH_SECTOR)){
+            f->st.sectors_skipped++;
+            continue;
+        }
+        /* programming only clears bits */
+        for (p=0; p<SFE_FLASH_SECTOR; p++){
+            if ((c[p] & w[p]) != w[p]){
+                need_erase = 1;
+                break;
+            }
+        }
+        if (need_erase){
+            if (sfe_flash_wait_ready(f) || erase_one(f, FC_SE, first + s)){
+                goto out;
+            }
+            memset(c, 0xff, SFE_FLASH_SECTOR);
+            f->st.sectors_erased++;
+        }else{
+            f->st.sectors_patched++;
+        }
+        for (p=0; p<SFE_FLASH_SECTOR; p+=SFE_FLASH_PAGE){
+            if (memcmp(c + p, w + p, SFE_FLASH_PAGE)){
+                pages[np].addr = first + s + p;
+                pages[np].data = w + p;
+                pages[np].len = SFE_FLASH_PAGE;
+                np++;
+            }
+        }
+    }
+    ret = program_pages(f, pages, np);
+    
+ out:
+    free(cur);
+    free(want);
+    free(pages);
+    return ret;
+}
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SFE_FLASH_H_
+#define SFE_FLASH_H_
+
+#include "usb_access.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/* the iCE40 configuration flash (W25Q and alike) on the FX2 spi pipe, for
+ * use while the FPGA is held in reset, see ice40prog. 
+ *
+ * page programs are pipelined: each one carries a continuous status read
+ * in the same submission and up to SFE_FLASH_WINDOW of them are queued.
+ * if a status read still saw the flash busy, the pages queued behind it 
+ * may have been ignored, they are sent again once it is idle (programming
+ * the same data twice changes nothing). reads are long chip select frames
+ * queued back to back. sfe_flash_update() compares 4k sectors by CRC32 
+ * and only erases and programs the ones that differ.
+ *
+ * returns are 0 or -1, all waits handle the usb events of the board */
+
+#define SFE_FLASH_PAGE        256
+#define SFE_FLASH_SECTOR      4096
+#define SFE_FLASH_BLOCK       65536
+#define SFE_FLASH_WINDOW      8
+
+typedef struct sfe_flash_stats_s{
+    unsigned pages;            /* page programs sent */
+    unsigned resent;           /* sent again after a busy status read */
+    unsigned sectors_skipped;  /* sfe_flash_update(), CRC matched */
+    unsigned sectors_erased;
+    unsigned sectors_patched;  /* only bits to clear, programmed without erase */
+    unsigned long long bytes_read;
+}sfe_flash_stats;
+
+typedef struct sfe_flash_s sfe_flash;
+
+sfe_flash* sfe_flash_open(sfe_usb *usb);
+void sfe_flash_close(sfe_flash *f);
+int sfe_flash_wait_ready(sfe_flash *f);
+int sfe_flash_read(sfe_flash *f, unsigned addr, unsigned char *data, unsigned len);
+/* 0 if the flash holds data, 1 if not, -1 on errors */
+int sfe_flash_verify(sfe_flash *f, unsigned addr, const unsigned char *data, unsigned len);
+/* erases the SFE_FLASH_SECTOR or SFE_FLASH_BLOCK units covering the range */
+int sfe_flash_erase(sfe_flash *f, unsigned addr, unsigned len, unsigned unit);
+int sfe_flash_erase_chip(sfe_flash *f);
+/* the range has to be erased */
+int sfe_flash_program(sfe_flash *f, unsigned addr, const unsigned char *data, unsigned len);
+/* erase and program only what differs, the rest of the sectors is kept */
+int sfe_flash_update(sfe_flash *f, unsigned addr, const unsigned char *data, unsigned len);
+void sfe_flash_get_stats(sfe_flash *f, sfe_flash_stats *st);
+
+/* IEEE 802.3, start with 0 */
+unsigned sfe_crc32(unsigned crc, const unsigned char *data, unsigned len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
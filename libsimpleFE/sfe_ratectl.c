@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <string.h>
+#include "sfe_ratectl.h"
+
+#define USB_UFRAMES_PER_SEC   8000
+
+/* time constants of the loop in seconds. the proportional part keeps the
+ * FIFO centred, at 500 ppm off it settles 0.125 s * 500e-6 of the byte rate
+ * away from the target (600 bytes at 7.5MS/s), the integral part then 
+ * takes over within a few seconds. the level reading is noisy, a packet 
+ * is a quarter of the FIFO and the reading lands anywhere in the 
+ * microframe, the estimate is averaged over a much longer time */
+#define RC_P_TIME             0.125
+#define RC_I_TIME             1.0
+#define RC_EST_TIME           10.0
+/* crystals are good to a few 10 ppm, a clock reading that far off is 
+ * caught by ensure_stable_clock_reading() already */
+#define RC_MAX_INTEG          1e-3
+#define RC_MAX_CORR           2e-3
+
+static double packet_bytes(const sfe_ratectl *rc)
+{
+    return rc->rate / USB_UFRAMES_PER_SEC;
+}
+
+static double clamp(double x, double lim)
+{
+    return x > lim ? lim : (x < -lim ? -lim : x);
+}
+
+void sfe_rc_init(sfe_ratectl *rc, double nominal, double rate, unsigned depth,
+                 unsigned fifo_bytes, double interval)
+{
+    memset(rc, 0, sizeof(*rc));
+    rc->nominal = nominal;
+    rc->interval = interval;
+    rc->fifo_bytes = fifo_bytes;
+    rc->center = fifo_bytes / 2.0;
+    rc->depth = depth < 1 ? 1 : (depth > SFE_RC_MAX_DEPTH ? SFE_RC_MAX_DEPTH : depth);
+    sfe_rc_clock(rc, rate);
+}
+
+void sfe_rc_clock(sfe_ratectl *rc, double rate)
+{
+    /* the loop has followed the clock since the last reading already, hand
+       over without a jump in what is sent. the integrator is left with the
+       error of the reading itself */
+    if (rc->rate > 0){
+        rc->integ = clamp((1 + rc->integ) * rc->rate / rate - 1, RC_MAX_INTEG);
+        rc->est_integ = (1 + rc->est_integ) * rc->rate / rate - 1;
+        rc->corr = clamp((1 + rc->corr) * rc->rate / rate - 1, RC_MAX_CORR);
+    }
+    /* the gains are per byte, the loop dynamics stay the same at any rate */
+    rc->rate = rate;
+    rc->kp = 1 / (rate * RC_P_TIME);
+    rc->ki = rc->interval / (rate * RC_P_TIME * RC_I_TIME);
+}
+
+void sfe_rc_level(sfe_ratectl *rc, unsigned level)
+{
+    /* the FPGA reports the top 6 bits of the fill, take the middle of the step */
+    double fill = (level + 0.5) * rc->fifo_bytes / SFE_RC_LEVEL_STEPS;
+    double w;
+
+    rc->level = level;
+    rc->history[rc->history_pos] = level;
+    rc->history_pos = (rc->history_pos + 1) % SFE_RATE_HISTORY;
+    if (rc->history_len < SFE_RATE_HISTORY){
+        rc->history_len++;
+    }
+    rc->num_updates++;
+
+    /* the host controller runs the periodic iso packet ahead of control
+       transfers in a microframe, the level is read at the top of the 
+       sawtooth, a packet above the bottom. half full in the middle */
+    rc->err = fill + rc->inflight_sum - rc->center - packet_bytes(rc) / 2;
+    rc->integ = clamp(rc->integ - rc->ki * rc->err, RC_MAX_INTEG);
+    rc->corr = clamp(rc->integ - rc->kp * rc->err, RC_MAX_CORR);
+
+    /* a running mean at first, so the estimate is usable right away */
+    w = 1.0 / rc->num_updates;
+    if (w < rc->interval / RC_EST_TIME){
+        w = rc->interval / RC_EST_TIME;
+    }
+    rc->est_integ += (rc->integ - rc->est_integ) * w;
+}
+
+unsigned sfe_rc_next(sfe_ratectl *rc, unsigned num_pkts)
+{
+    double base = rc->rate * num_pkts / USB_UFRAMES_PER_SEC;
+    double want = base * (1 + rc->corr) + rc->carry;
+    double delta;
+    unsigned total;
+
+    /* the first transfer primes the FIFO to half full, halfway between
+       a packet coming in and the DAC draining it */
+    if (!rc->primed){
+        want += rc->center - packet_bytes(rc) / 2;
+        rc->primed = 1;
+    }
+
+    if (want < 0){
+        want = 0;
+    }
+    total = (unsigned)(want / SFE_RC_FRAME_BYTES) * SFE_RC_FRAME_BYTES;
+    rc->carry = want - total;
+
+    /* the integral part only follows the drift, what it sends is drained 
+       as it comes in. the proportional part moves the level, by the time
+       the transfer is at the FIFO */
+    delta = base * (rc->corr - rc->integ);
+    rc->inflight_sum += delta - rc->inflight[rc->head];
+    rc->inflight[rc->head] = delta;
+    rc->head = (rc->head + 1) % rc->depth;
+    
+    return total;
+}
+
+void sfe_rc_get_state(const sfe_ratectl *rc, sfe_tx_rate_state *st)
+{
+    unsigned i, first;
+    
+    memset(st, 0, sizeof(*st));
+    if (rc->nominal > 0){
+        st->clock_ppm = (rc->rate / rc->nominal - 1) * 1e6;
+        st->est_ppm = (rc->rate * (1 + rc->est_integ) / rc->nominal - 1) * 1e6;
+    }
+    st->integrator_ppm = rc->integ * 1e6;
+    st->correction_ppm = rc->corr * 1e6;
+    st->fifo_error = rc->err;
+    st->level = rc->level;
+    st->num_updates = rc->num_updates;
+
+    first = (rc->history_pos + SFE_RATE_HISTORY - rc->history_len) % SFE_RATE_HISTORY;
+    for (i=0; i<rc->history_len; i++){
+        st->level_history[i] = rc->history[(first + i) % SFE_RATE_HISTORY];
+    }
+    st->history_len = rc->history_len;
+}
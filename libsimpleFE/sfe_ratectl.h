@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SFE_RATECTL_H_
+#define SFE_RATECTL_H_
+
+#include "simpleFE.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/* tx rate control. the host sends one iso packet per microframe of its own
+ * usb clock, the DAC drains the FIFO at the board clock, so the number of 
+ * bytes per transfer has to follow the ratio of the two.
+ *
+ * the board clock reading (every 10 s) gives the rate up front, a PI loop
+ * on the DAC FIFO level (every transfer) trims what the reading cannot see.
+ * corrections made while earlier transfers are still queued on the bus 
+ * only reach the FIFO a queue depth later, they are added to the level 
+ * reading so the loop does not wait for them (a Smith predictor). byte
+ * counts are kept fractional, whole DAC frames are sent and the rest is
+ * carried to the next transfer.
+ *
+ * no usb in here, the caller serializes the calls */
+
+#define SFE_RC_MAX_DEPTH      256
+#define SFE_RC_FRAME_BYTES    5
+#define SFE_RC_LEVEL_STEPS    64
+
+typedef struct sfe_ratectl_s{
+    double nominal;          /* bytes per second at the nominal board clock */
+    double rate;             /* bytes per second from the clock reading */
+    double interval;         /* seconds between two level readings */
+    double kp;               /* per byte of FIFO error */
+    double ki;
+    double integ;            /* fraction of rate, what the loop adds in the long run */
+    double est_integ;        /* integ averaged for the estimate */
+    double corr;             /* fraction of rate, applied now */
+    double err;              /* bytes above half full, predicted */
+    double carry;            /* bytes owed to the next transfer */
+    int primed;
+    unsigned fifo_bytes;
+    double center;
+
+    /* corrections still on the bus, one per queued transfer */
+    double inflight[SFE_RC_MAX_DEPTH];
+    double inflight_sum;
+    unsigned depth;
+    unsigned head;
+    
+    unsigned level;
+    unsigned num_updates;
+    unsigned char history[SFE_RATE_HISTORY];
+    unsigned history_pos;
+    unsigned history_len;
+}sfe_ratectl;
+
+/* depth is the number of transfers kept in flight, interval the level
+ * reading period in seconds */
+void sfe_rc_init(sfe_ratectl *rc, double nominal, double rate, unsigned depth,
+                 unsigned fifo_bytes, double interval);
+/* a new board clock reading, in DAC bytes per second */
+void sfe_rc_clock(sfe_ratectl *rc, double rate);
+/* a new 6 bit DAC FIFO level */
+void sfe_rc_level(sfe_ratectl *rc, unsigned level);
+/* bytes for the next transfer of num_pkts microframes, a multiple of 
+ * SFE_RC_FRAME_BYTES. the first one after sfe_rc_init() primes the FIFO */
+unsigned sfe_rc_next(sfe_ratectl *rc, unsigned num_pkts);
+void sfe_rc_get_state(const sfe_ratectl *rc, sfe_tx_rate_state *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,224 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "sfe_stats.h"
+#include "sfe_ratectl.h"
+
+void sfe_stat_time(sfe_counter *hist, unsigned long long ns)
+{
+    unsigned long long us = ns / 1000;
+    unsigned bin = 0;
+
+    while (us && bin < SFE_STATS_TIME_BINS-1){
+        us >>= 1;
+        bin++;
+    }
+    sfe_ctr_add(&hist[bin], 1);
+}
+
+void sfe_stat_level(sfe_counter *hist, unsigned level)
+{
+    unsigned bin = level * SFE_STATS_LEVEL_BINS / SFE_RC_LEVEL_STEPS;
+
+    sfe_ctr_add(&hist[bin < SFE_STATS_LEVEL_BINS ? bin : SFE_STATS_LEVEL_BINS-1], 1);
+}
+
+void sfe_stat_double(sfe_counter *c, double v)
+{
+    sfe_counter bits;
+
+    memcpy(&bits, &v, sizeof(bits));
+    sfe_ctr_set(c, bits);
+}
+
+static double get_double(const sfe_counter *c)
+{
+    sfe_counter bits = sfe_ctr_get(c);
+    double v;
+
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+void sfe_stat_error(sfe_statctr *s, int err)
+{
+    sfe_ctr_set(&s->last_error, (sfe_counter)(long long)err);
+}
+
+static void copy_hist(unsigned long long *dst, const sfe_counter *src, unsigned n)
+{
+    unsigned i;
+    for (i=0; i<n; i++){
+        dst[i] = sfe_ctr_get(&src[i]);
+    }
+}
+
+void sfe_stats_snapshot(const sfe_statctr *s, const sfe_logring *r, sfe_stats *st)
+{
+    st->rx_transfers = sfe_ctr_get(&s->rx_transfers);
+    st->rx_packets = sfe_ctr_get(&s->rx_packets);
+    st->rx_bytes = sfe_ctr_get(&s->rx_bytes);
+    st->rx_short_packets = sfe_ctr_get(&s->rx_short_packets);
+    st->rx_failed_packets = sfe_ctr_get(&s->rx_failed_packets);
+    st->rx_resubmit_errors = sfe_ctr_get(&s->rx_resubmit_errors);
+    st->rx_overflows = sfe_ctr_get(&s->rx_overflows);
+    st->tx_transfers = sfe_ctr_get(&s->tx_transfers);
+    st->tx_packets = sfe_ctr_get(&s->tx_packets);
+    st->tx_bytes = sfe_ctr_get(&s->tx_bytes);
+    st->tx_short_packets = sfe_ctr_get(&s->tx_short_packets);
+    st->tx_failed_packets = sfe_ctr_get(&s->tx_failed_packets);
+    st->tx_resubmit_errors = sfe_ctr_get(&s->tx_resubmit_errors);
+    st->ctrl_errors = sfe_ctr_get(&s->ctrl_errors);
+    copy_hist(st->rx_callback_time, s->rx_callback_time, SFE_STATS_TIME_BINS);
+    copy_hist(st->tx_callback_time, s->tx_callback_time, SFE_STATS_TIME_BINS);
+    copy_hist(st->adc_level, s->adc_level, SFE_STATS_LEVEL_BINS);
+    copy_hist(st->dac_level, s->dac_level, SFE_STATS_LEVEL_BINS);
+    st->rc_updates = sfe_ctr_get(&s->rc_updates);
+    st->rc_correction_ppm = get_double(&s->rc_correction);
+    st->rc_est_ppm = get_double(&s->rc_est);
+    st->clock_hz = sfe_ctr_get(&s->clock_hz);
+    st->log_dropped = sfe_ctr_get(&r->dropped);
+    st->last_error = (int)(long long)sfe_ctr_get(&s->last_error);
+}
+
+void sfe_log(sfe_logring *r, const char *fmt, ...)
+{
+    sfe_counter pos = sfe_ctr_get(&r->head);
+    sfe_logslot *sl;
+    va_list ap;
+
+    for (;;){
+        sfe_counter seq;
+
+        sl = &r->slot[pos % SFE_LOG_ENTRIES];
+        seq = sfe_ctr_get_acq(&sl->seq);
+        if (seq == pos){
+            /* a failed swap leaves the current head in pos */
+            if (sfe_ctr_cas(&r->head, pos, pos + 1)){
+                break;
+            }
+        }
+        else if (seq < pos){
+            /* not drained since the last round */
+            sfe_ctr_add(&r->dropped, 1);
+            return;
+        }
+        else{
+            pos = sfe_ctr_get(&r->head);
+        }
+    }
+    va_start(ap, fmt);
+    vsnprintf(sl->msg, sizeof(sl->msg), fmt, ap);
+    va_end(ap);
+    sfe_ctr_set_rel(&sl->seq, pos + 1);
+}
+
+static void drain(sfe_logring *r)
+{
+    for (;;){
+        sfe_counter pos = r->tail;
+        sfe_logslot *sl = &r->slot[pos % SFE_LOG_ENTRIES];
+
+        if (sfe_ctr_get_acq(&sl->seq) != pos + 1){
+            break;
+        }
+        fputs(sl->msg, stderr);
+        r->tail = pos + 1;
+        sfe_ctr_set_rel(&sl->seq, pos + SFE_LOG_ENTRIES);
+    }
+}
+
+static void* drain_thread_func(void *ctx)
+{
+    sfe_logring *r = ctx;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->exit){
+        struct timespec deadline;
+
+        pthread_mutex_unlock(&r->lock);
+        drain(r);
+        pthread_mutex_lock(&r->lock);
+
+#ifdef _WIN32
+        timespec_get(&deadline, TIME_UTC);
+#else
+        clock_gettime(CLOCK_REALTIME, &deadline);
+#endif
+        deadline.tv_nsec += SFE_LOG_DRAIN_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (!r->exit){
+            pthread_cond_timedwait(&r->wake, &r->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+int sfe_log_init(sfe_logring *r)
+{
+    unsigned i;
+
+    memset(r, 0, sizeof(*r));
+    for (i=0; i<SFE_LOG_ENTRIES; i++){
+        r->slot[i].seq = i;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    if (pthread_create(&r->thread, NULL, drain_thread_func, r)){
+        fprintf(stderr, "log thread creation failed\n");
+        return -1;
+    }
+    r->running = 1;
+    return 0;
+}
+
+void sfe_log_destroy(sfe_logring *r)
+{
+    if (r->running){
+        pthread_mutex_lock(&r->lock);
+        r->exit = 1;
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+        r->running = 0;
+    }
+    drain(r);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->wake);
+}
@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2019, Ning Wang <nwang.cooper@gmail.com> All rights reserved.
+
+
+Redistribution and use in source and binary forms, with or without modification, 
+are permitted provided that the following conditions are met:
+    
+     Redistributions of source code must retain the above copyright notice, 
+     this list of conditions and the following disclaimer.
+
+     Redistributions in binary form must reproduce the above copyright notice, 
+     this list of conditions and the following disclaimer in the 
+     documentation and/or other materials provided with the distribution.
+ 
+     Neither the name of its contributors can be used to endorse or promote 
+     products derived from this software witthout specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, 
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR 
+PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS 
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, 
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SFE_STATS_H_
+#define SFE_STATS_H_
+
+#include <pthread.h>
+#include "simpleFE.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/* counters the usb event thread updates and any thread reads, relaxed
+ * atomics, nothing else is ordered by them. _acq and _rel order the log
+ * ring below */
+typedef unsigned long long sfe_counter;
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define sfe_ctr_add(c, v)     _InterlockedExchangeAdd64((volatile __int64*)(c), (__int64)(v))
+#define sfe_ctr_set(c, v)     _InterlockedExchange64((volatile __int64*)(c), (__int64)(v))
+#define sfe_ctr_get(c)        ((sfe_counter)_InterlockedCompareExchange64((volatile __int64*)(c), 0, 0))
+#define sfe_ctr_cas(c, o, n)  (_InterlockedCompareExchange64((volatile __int64*)(c), (__int64)(n), (__int64)(o)) == (__int64)(o))
+#define sfe_ctr_get_acq(c)    sfe_ctr_get(c)
+#define sfe_ctr_set_rel(c, v) sfe_ctr_set(c, v)
+#else
+#define sfe_ctr_add(c, v)     __atomic_fetch_add((c), (v), __ATOMIC_RELAXED)
+#define sfe_ctr_set(c, v)     __atomic_store_n((c), (v), __ATOMIC_RELAXED)
+#define sfe_ctr_get(c)        __atomic_load_n((c), __ATOMIC_RELAXED)
+#define sfe_ctr_cas(c, o, n)  __atomic_compare_exchange_n((c), &(o), (n), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+#define sfe_ctr_get_acq(c)    __atomic_load_n((c), __ATOMIC_ACQUIRE)
+#define sfe_ctr_set_rel(c, v) __atomic_store_n((c), (v), __ATOMIC_RELEASE)
+#endif
+
+typedef struct sfe_statctr_s{
+    sfe_counter rx_transfers;
+    sfe_counter rx_packets;
+    sfe_counter rx_bytes;
+    sfe_counter rx_short_packets;
+    sfe_counter rx_failed_packets;
+    sfe_counter rx_resubmit_errors;
+    sfe_counter rx_overflows;
+    sfe_counter tx_transfers;
+    sfe_counter tx_packets;
+    sfe_counter tx_bytes;
+    sfe_counter tx_short_packets;
+    sfe_counter tx_failed_packets;
+    sfe_counter tx_resubmit_errors;
+    sfe_counter ctrl_errors;
+    sfe_counter rx_callback_time[SFE_STATS_TIME_BINS];
+    sfe_counter tx_callback_time[SFE_STATS_TIME_BINS];
+    sfe_counter adc_level[SFE_STATS_LEVEL_BINS];
+    sfe_counter dac_level[SFE_STATS_LEVEL_BINS];
+    sfe_counter rc_updates;
+    sfe_counter rc_correction;    /* the bits of the doubles */
+    sfe_counter rc_est;
+    sfe_counter clock_hz;
+    sfe_counter last_error;
+}sfe_statctr;
+
+void sfe_stat_time(sfe_counter *hist, unsigned long long ns);
+void sfe_stat_level(sfe_counter *hist, unsigned level);
+void sfe_stat_double(sfe_counter *c, double v);
+void sfe_stat_error(sfe_statctr *s, int err);
+
+/* messages of the event thread, printing there would hold up the stream.
+ * producers claim a slot with a compare and swap on head, a message is 
+ * readable once its slot sequence is one past its position, the drain 
+ * thread prints them to stderr every SFE_LOG_DRAIN_MS. a full ring drops
+ * the message and counts it */
+#define SFE_LOG_ENTRIES       64
+#define SFE_LOG_MSG_BYTES     120
+#define SFE_LOG_DRAIN_MS      50
+
+typedef struct sfe_logslot_s{
+    sfe_counter seq;
+    char msg[SFE_LOG_MSG_BYTES];
+}sfe_logslot;
+
+typedef struct sfe_logring_s{
+    sfe_logslot slot[SFE_LOG_ENTRIES];
+    sfe_counter head;
+    sfe_counter tail;         /* the drain thread only */
+    sfe_counter dropped;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int exit;
+    int running;
+}sfe_logring;
+
+int sfe_log_init(sfe_logring *r);
+/* prints what is left */
+void sfe_log_destroy(sfe_logring *r);
+void sfe_log(sfe_logring *r, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+void sfe_stats_snapshot(const sfe_statctr *s, const sfe_logring *r, sfe_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -28,6 +28,10 @@ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
 OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#ifdef __linux__
+/* pthread_setaffinity_np */
+#define _GNU_SOURCE
+#endif
 #include "simpleFE.h"
 #include <stdio.h>
 #include <string.h>
@@ -37,11 +41,20 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "simpleFE.h"
 #include "chip_select.h"
 #include "ezusb.h"
+#include "sfe_ratectl.h"
+#include "sfe_cmd.h"
+#include "sfe_convert.h"
+#include "sfe_stats.h"
 #include <pthread.h>
+#include <sched.h>
+#include <errno.h>
 #include "libusb.h"
 
 #define FPGA_CLK   30000000
 #define FPGA_I2C_ADDR  (0x02)
+/* FIFO_AW in hardware/HDL/top.v */
+#define DAC_FIFO_BYTES  4096
+#define ADC_FIFO_BYTES  4096
 #ifdef __linux__
 #define NUM_PKTS_PER_XFER        120
 #define NUM_TRANSFERS            32
@@ -49,15 +62,52 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #define NUM_PKTS_PER_XFER        240
 #define NUM_TRANSFERS            16
 #endif
+/* limits for sfe_init_ex, a transfer is at least one 1ms frame */
+#define MIN_PKTS_PER_XFER        8
+#define MAX_PKTS_PER_XFER        1024
+#define MIN_TRANSFERS            2
+#define MAX_TRANSFERS            256
+#define USB_MICROFRAME_US        125
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+#define HAVE_INTERRUPT_EVENT_HANDLER 1
+#endif
+/* how often the event thread looks at its exit flag when libusb cannot 
+ * be interrupted */
+#define EVENT_POLL_US            100000
+/* extra zero-copy rx transfers, they keep the usb queue full while
+ * the application is holding lent blocks */
+#define NUM_SPARE_LEND_XFERS     8
+/* tx completions averaged to line the DAC up with the rx sample count */
+#define TX_ALIGN_COUNT           32
+/* one iso transaction, a high bandwidth endpoint moves up to three of
+ * them per microframe */
+#define USB_ISO_TRANSACTION      1024
 
 
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#else
+#include <windows.h>
+#endif
+#include <time.h>
 
 
 static const unsigned num_pkts_per_sec = 8000; /* 8 packets per 1ms */
-static const unsigned num_pkts_per_125ms = 1000;
+/* the DAC FIFO level is read about every 15ms, on a transfer boundary */
+static const unsigned num_pkts_per_level = 120;
+
+struct rx_lend_s{
+    sfe *h;
+    struct libusb_transfer *xfer;
+    unsigned char *buf;
+    int devmem;
+    unsigned *lengths;
+    sfe_rx_block blk;
+    struct rx_lend_s *next;
+};
 
 struct sfe_s{
 
@@ -76,91 +126,204 @@ struct sfe_s{
     int num_rx_channels;
     int num_tx_channels;
     
-    /* this is DAC rate control  */
-    int tx_bytes_adj;
-    int tx_bytes_frame_remain;
+    /* this is DAC rate control, guarded by tx_lock */
+    sfe_ratectl tx_rc;
     unsigned tx_bytes_per_sec;
     unsigned dac_check_pkts;
-    unsigned prev_dac_level;
-    unsigned rc_hold_count;
+    unsigned level_check_pkts;
+    unsigned clk_check_pkts;
     
     /* transfer stats */
     unsigned tx_pkts;
     unsigned rx_pkts;
     
     int rx_data_valid;
-
-    /* callback functions */
-    pthread_t tx_thread;
-    pthread_t rx_thread;
+    unsigned rx_skipped;   /* bytes dropped before rx_data_valid */
+
+    /* rx stream position, only touched on the event thread */
+    sfe_rx_meta rx_meta;
+    unsigned long long rx_samples;
+    unsigned long long rx_frames;
+    unsigned long long rx_last_ns;
+    unsigned rx_level_pkts;
+    int rx_overflow;
+    /* the last rx completion for other threads, guarded by clock_lock */
+    pthread_mutex_t clock_lock;
+    int rx_clk_valid;
+    unsigned long long rx_clk_sample;
+    unsigned long long rx_clk_ns;
+    unsigned rx_clk_rate;
+
+    /* one thread handles the events of both directions, started by the
+       first user and stopped with the last */
+    pthread_t event_thread;
+    pthread_mutex_t event_lock;
+    unsigned event_users;
+    int event_exit;
+    int tx_active;
+    int rx_active;
+    sfe_rt_params rt;
+    sfe_rt_status rt_status;
     
+    /* callback functions */
     sfe_callback *tx_callback;
     void *tx_ctx;
     int tx_exit_request;
+    pthread_mutex_t tx_lock;
+    /* one transfer is filled and submitted at a time, taken before tx_lock
+       and held across the user callback, which runs without tx_lock so it
+       may call the tx functions */
+    pthread_mutex_t tx_fill_lock;
+    pthread_cond_t tx_drained;
+    unsigned tx_inflight;
+
+    /* burst tx, guarded by tx_lock. tx byte b plays at rx sample 
+       tx_offset + b*4/5/num_tx_channels. tx_in_burst is only touched by
+       the filler, tx_bytes is written with both locks held */
+    sfe_tx_burst_callback *tx_burst_callback;
+    unsigned long long tx_bursts[SFE_TX_MAX_BURSTS];
+    unsigned tx_burst_head;
+    unsigned tx_burst_count;
+    int tx_in_burst;
+    unsigned long long tx_bytes;     /* filled since the start */
+    unsigned long long tx_queued;    /* bytes on the bus */
+    double tx_offset;
+    unsigned tx_offset_n;
     
     sfe_callback *rx_callback;
     void *rx_ctx;
     int rx_exit_request;
-    
+    unsigned rx_inflight;
+    /* signalled with rx_pool_lock when rx_inflight drops to 0 */
+    pthread_cond_t rx_drained;
+
+    /* batched rx, one scatter list per transfer */
+    sfe_rx_batch_callback *rx_batch_callback;
+    sfe_rx_batch rx_batch;
+    sfe_iovec *rx_iov;
+    unsigned *rx_status_bits;
+
+    /* zero-copy rx pool, guarded by rx_pool_lock */
+    sfe_rx_block_callback *rx_block_callback;
+    pthread_mutex_t rx_pool_lock;
+    /* iso packet length, whole transactions for the rx data rate */
+    unsigned rx_packet_size;
+    struct rx_lend_s *rx_pool;
+    struct rx_lend_s *rx_free;
+    unsigned rx_pool_size;
+    size_t rx_buf_size;
+    unsigned rx_lent;
+    int rx_pool_closing;
 
     unsigned char ext_gpio[2];
+
+    /* register access, the event thread runs while the board is open */
+    sfe_cmdq cmdq;
+    int cmd_event_ref;
+    /* shadow of FPGA reg 0 and 1, guarded by reg_lock */
+    pthread_mutex_t reg_lock;
+    int fpga_valid;
+    unsigned char fpga_ctrl;
+    unsigned char fpga_cdiv;
     
     int status;    
+
+    /* sfe_get_stats(), and the messages of the event thread */
+    sfe_statctr stats;
+    sfe_logring log;
 };
 
 
-static void set_fpga_cdiv(sfe* h, int div)
+/* the shadow of FPGA registers 0 and 1 saves reading the status back 
+ * before every change. it starts out invalid when the board is opened and
+ * is dropped on sfe_reset_board(), a failed write and any raw SPI from 
+ * the application, anything else writing regs 0/1 has to go through 
+ * here. reg_lock held */
+static int fpga_read_regs(sfe *h)
 {
-    unsigned char cfg[2];
-    assert(div < 128 && div >= 0);
-    cfg[0] = (1<<7) | (0x01 << 5); //reg 1
-    cfg[1] = div & 0x7F;
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
+    unsigned char st[3];
+    sfe_cmd *c;
+
+    if (h->fpga_valid){
+        return 0;
+    }
+    st[0] = 0x02 << 5; //status
+    st[1] = st[2] = 0;
+    c = sfe_cmd_new(h);
+    if (!c || sfe_cmd_spi(c, FPGA_CS, st, st, 3)){
+        sfe_cmd_free(c);
+        fprintf(stderr, "cannot read fpga status\n");
+        return -1;
+    }
+    if (sfe_cmd_run(c)){
+        fprintf(stderr, "cannot read fpga status\n");
+        return -1;
+    }
+    h->fpga_cdiv = st[1] & 0x7F;
+    h->fpga_ctrl = st[2] & 0x1F;
+    h->fpga_valid = 1;
+    return 0;
 }
 
-static void start_fpga(sfe *h)
+static void cmd_fpga_write(sfe_cmd *c, sfe *h, int reg, unsigned char val)
 {
     unsigned char cfg[2];
-    int tx_i, tx_q, rx_i, rx_q;
-    get_fpga_status(h->usb, NULL, &tx_i, &tx_q, &rx_i, &rx_q, NULL);
     
-    cfg[0] = (1<<7); //reg 0
-    cfg[1] = (tx_q << 4) | (tx_i << 3) | (rx_q << 2) | (rx_i << 1) | 0x01;
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
+    cfg[0] = (1<<7) | (reg << 5);
+    cfg[1] = val;
+    sfe_cmd_spi(c, FPGA_CS, &cfg[0], NULL, 2);
+    if (reg == 0){
+        h->fpga_ctrl = val & 0x1F;
+    }else if (reg == 1){
+        h->fpga_cdiv = val & 0x7F;
+    }
+}
+
+/* reg_lock held, the shadow is read again if the write did not make it */
+static int fpga_write(sfe *h, int reg, unsigned char val)
+{
+    sfe_cmd *c = sfe_cmd_new(h);
+    
+    if (!c){
+        return -1;
+    }
+    cmd_fpga_write(c, h, reg, val);
+    if (sfe_cmd_run(c)){
+        h->fpga_valid = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static int set_fpga_cdiv(sfe* h, int div)
+{
+    assert(div < 128 && div >= 0);
+    return fpga_write(h, 1, div & 0x7F); //reg 1
 }
 
 static void stop_fpga(sfe *h)
 {
-    unsigned char cfg[2];    
-    cfg[0] = (1<<7); //reg 0
-    cfg[1] = 0;
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
+    fpga_write(h, 0, 0); //reg 0
 }
 
 void sfe_tx_enable(sfe *h, int tx_i, int tx_q)
 {
     int rx_i, rx_q;
     int sys_en;
-    unsigned char cfg[2];
-
-    get_fpga_status(h->usb, NULL, NULL, NULL, &rx_i, &rx_q, &sys_en);
 
+    pthread_mutex_lock(&h->reg_lock);
+    if (fpga_read_regs(h)){
+        pthread_mutex_unlock(&h->reg_lock);
+        return;
+    }
+    rx_i = (h->fpga_ctrl & 0x02) >> 1;
+    rx_q = (h->fpga_ctrl & 0x04) >> 2;
+    sys_en = h->fpga_ctrl & 0x01;
 
     h->xfer_ctrl |= (tx_q << 4) | (tx_i << 3);
     h->num_tx_channels = tx_i + tx_q;
 
-    
-    cfg[0] = (1<<7); //reg 0
-    cfg[1] = (tx_q << 4) | (tx_i << 3);
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
+    fpga_write(h, 0, (tx_q << 4) | (tx_i << 3));
 
 #ifdef _MSC_VER
     _sleep(1);
@@ -170,22 +333,24 @@ void sfe_tx_enable(sfe *h, int tx_i, int tx_q)
 
     /* enable fpga */
     sys_en |= (tx_i | tx_q);
-    cfg[0] = (1<<7); //reg 0
-    cfg[1] = (tx_q << 4) | (tx_i << 3) | (rx_q << 2) | (rx_i << 1) | sys_en;
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
-    
+    fpga_write(h, 0, (tx_q << 4) | (tx_i << 3) | (rx_q << 2) | (rx_i << 1) | sys_en);
+    pthread_mutex_unlock(&h->reg_lock);
 }
 
 
 void sfe_rx_enable(sfe *h, int rx_i, int rx_q)
 {
     int tx_i, tx_q;
-    unsigned char cfg[2];
     int sys_en;
     
-    get_fpga_status(h->usb, NULL, &tx_i, &tx_q,NULL, NULL, &sys_en);
+    pthread_mutex_lock(&h->reg_lock);
+    if (fpga_read_regs(h)){
+        pthread_mutex_unlock(&h->reg_lock);
+        return;
+    }
+    tx_i = (h->fpga_ctrl & 0x08) >> 3;
+    tx_q = (h->fpga_ctrl & 0x10) >> 4;
+    sys_en = h->fpga_ctrl & 0x01;
 
     h->xfer_ctrl |= (rx_q << 2) | (rx_i << 1);
     h->num_rx_channels = rx_i + rx_q;
@@ -193,23 +358,15 @@ void sfe_rx_enable(sfe *h, int rx_i, int rx_q)
     sys_en |= (rx_i | rx_q);
 
     //reset rx path, 
-    cfg[0] = (1<<7); //reg 0
-    cfg[1] = (tx_q << 4) | (tx_i << 3) | sys_en;
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
+    fpga_write(h, 0, (tx_q << 4) | (tx_i << 3) | sys_en);
 #ifdef _MSC_VER
     _sleep(1);
 #else            
     usleep(1000);
 #endif            
     //enable rx path
-    cfg[0] = (1<<7); //reg 0
-    cfg[1] = (tx_q << 4) | (tx_i << 3) | (rx_q << 2) | (rx_i << 1) | sys_en;
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
-    
+    fpga_write(h, 0, (tx_q << 4) | (tx_i << 3) | (rx_q << 2) | (rx_i << 1) | sys_en);
+    pthread_mutex_unlock(&h->reg_lock);
 }
 
 static 
@@ -241,34 +398,16 @@ int ensure_stable_clock_reading(sfe *h, unsigned *pclk)
     if (pclk) {
         *pclk = m_clock;
     }
+    sfe_ctr_set(&h->stats.clock_hz, m_clock);
 
     return 0;
 }
 
 
-static void tx_rate_control(sfe* h, unsigned char dac_level)
-{
-    /* 1k per/sec prime, 125ms cycle of reading fifo */
-    if (h->rc_hold_count++ < 2*num_pkts_per_sec/num_pkts_per_125ms){
-        h->tx_bytes_adj = 0;
-    }
-    else{
-
-        if (dac_level > 0x30){
-            h->rc_hold_count = 0;
-            h->tx_bytes_adj = -1024;
-        }else if (dac_level < 0x10){
-            h->rc_hold_count = 0;
-            h->tx_bytes_adj = 1024;
-        }else{
-            h->tx_bytes_adj = 0;
-        }
-    }
-}
-
-
-static void LIBUSB_CALL
-usb_get_level_callback(struct libusb_transfer *transfer)
+/* a FIFO status reading, tx reads it for the rate control, rx only for 
+ * the ADC side while tx is off. a full ADC FIFO has dropped samples */
+static void
+fifo_level_done(struct libusb_transfer *transfer, int for_tx)
 {
     sfe *h = transfer->user_data;
     if (transfer->status == LIBUSB_TRANSFER_COMPLETED){
@@ -276,11 +415,29 @@ usb_get_level_callback(struct libusb_transfer *transfer)
         unsigned char *data = &transfer->buffer[LIBUSB_CONTROL_SETUP_SIZE];
         unsigned adc_level = data[0]& 0x3F;
         unsigned dac_level = data[1]& 0x3F;
-        tx_rate_control(h, dac_level);
+
+        sfe_stat_level(h->stats.adc_level, adc_level);
+        if (for_tx){
+            sfe_tx_rate_state rs;
+
+            pthread_mutex_lock(&h->tx_lock);
+            sfe_rc_level(&h->tx_rc, dac_level);
+            sfe_rc_get_state(&h->tx_rc, &rs);
+            pthread_mutex_unlock(&h->tx_lock);
+            sfe_stat_level(h->stats.dac_level, dac_level);
+            sfe_ctr_add(&h->stats.rc_updates, 1);
+            sfe_stat_double(&h->stats.rc_correction, rs.correction_ppm);
+            sfe_stat_double(&h->stats.rc_est, rs.est_ppm);
+        }
+        if (h->rx_active && adc_level == 0x3F){
+            h->rx_overflow = 1;
+        }
         //printf("dac: 0x%02x, adc: 0x%02x\n",dac_level, adc_level);
     }
     else{
-        fprintf(stderr, "control transfer status: %d\n", transfer->status);        
+        sfe_log(&h->log, "control transfer status: %d\n", transfer->status);
+        sfe_ctr_add(&h->stats.ctrl_errors, 1);
+        sfe_stat_error(&h->stats, transfer->status);
         h->status = transfer->status;
     }
 
@@ -288,6 +445,18 @@ usb_get_level_callback(struct libusb_transfer *transfer)
     libusb_free_transfer(transfer);
 }
 
+static void LIBUSB_CALL
+usb_get_level_callback(struct libusb_transfer *transfer)
+{
+    fifo_level_done(transfer, 1);
+}
+
+static void LIBUSB_CALL
+usb_get_adc_level_callback(struct libusb_transfer *transfer)
+{
+    fifo_level_done(transfer, 0);
+}
+
 
 static void LIBUSB_CALL
 usb_get_clock_callback(struct libusb_transfer *transfer)
@@ -298,13 +467,20 @@ usb_get_clock_callback(struct libusb_transfer *transfer)
             unsigned char *data = &transfer->buffer[LIBUSB_CONTROL_SETUP_SIZE];
             unsigned rate = (data[0] << 24) | (data[1]<<16) | (data[2]<<8) | data[3];
 
+            sfe_ctr_set(&h->stats.clock_hz, rate);
+
+            pthread_mutex_lock(&h->tx_lock);
+            sfe_rc_clock(&h->tx_rc, rate / (h->clk_div*2 + 4.0) * h->num_tx_channels * 10 / 8);
+            pthread_mutex_unlock(&h->tx_lock);
             rate = rate /(h->clk_div*2 + 4);
             h->sample_rate = rate;
             h->tx_bytes_per_sec = rate * h->num_tx_channels * 10 / 8;
             //printf("onboard rate: %d\n",rate);
     }
     else{
-        fprintf(stderr, "control transfer status: %d\n", transfer->status);        
+        sfe_log(&h->log, "control transfer status: %d\n", transfer->status);
+        sfe_ctr_add(&h->stats.ctrl_errors, 1);
+        sfe_stat_error(&h->stats, transfer->status);
         h->status = transfer->status;
     }
 
@@ -312,222 +488,816 @@ usb_get_clock_callback(struct libusb_transfer *transfer)
     libusb_free_transfer(transfer);
 }
 
+/* one VR_RATE read, cb frees the buffer and the transfer */
 static void
-get_usb_fifolevel(sfe* h)
+submit_rate_request(sfe* h, unsigned short index, unsigned short len, libusb_transfer_cb_fn cb)
 {
-    
-    void* setup = malloc(LIBUSB_CONTROL_SETUP_SIZE + MAX_VR_BYTES);
+    unsigned char* setup;
     struct libusb_transfer* transfer = libusb_alloc_transfer(0);
-    if (!transfer){
-        fprintf(stderr, "cannot allocate transfer structure\n");
+    
+    setup = malloc(LIBUSB_CONTROL_SETUP_SIZE + MAX_VR_BYTES);
+    if (!transfer || !setup){
+        sfe_log(&h->log, "cannot allocate control transfer\n");
+        sfe_ctr_add(&h->stats.ctrl_errors, 1);
+        free(setup);
+        libusb_free_transfer(transfer);
         return;
     }
     
     libusb_fill_control_setup(setup,
                               LIBUSB_RECIPIENT_DEVICE  | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
                               VR_RATE,
-                              0x0000, 0, VR_RATE_STATUS_BYTES);
+                              index, 0, len);
 
-    transfer->buffer = setup;
     libusb_fill_control_transfer(transfer,
                                  h->usb->dev,
                                  setup,
-                                 usb_get_level_callback,
+                                 cb,
                                  h,
                                  5000
                                  );
-
                                 
     h->status = libusb_submit_transfer(transfer);                              
+    if (h->status){
+        sfe_ctr_add(&h->stats.ctrl_errors, 1);
+        sfe_stat_error(&h->stats, h->status);
+        /* the callback never runs for it */
+        free(setup);
+        libusb_free_transfer(transfer);
+    }
 }
 
 static void
-get_board_clockrate(sfe* h)
+get_usb_fifolevel(sfe* h, libusb_transfer_cb_fn cb)
 {
-    
-    void* setup = malloc(LIBUSB_CONTROL_SETUP_SIZE + MAX_VR_BYTES);
-    struct libusb_transfer* transfer = libusb_alloc_transfer(0);
-    if (!transfer){
-        fprintf(stderr, "cannot allocate transfer structure\n");
-        return;
-    }
-    
-    libusb_fill_control_setup(setup,
-                              LIBUSB_RECIPIENT_DEVICE  | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_ENDPOINT_IN,
-                              VR_RATE,
-                              0x0001, 0, VR_RATE_CLOCK_BYTES);
+    submit_rate_request(h, 0x0000, VR_RATE_STATUS_BYTES, cb);
+}
 
-    transfer->buffer = setup;    
-    libusb_fill_control_transfer(transfer,
-                                 h->usb->dev,
-                                 setup,
-                                 usb_get_clock_callback,
-                                 h,
-                                 5000
-                                 );
-                                
-    h->status = libusb_submit_transfer(transfer);                              
+static void
+get_board_clockrate(sfe* h)
+{
+    submit_rate_request(h, 0x0001, VR_RATE_CLOCK_BYTES, usb_get_clock_callback);
 }
 
 
 /* this will return number of bytes need to be transfered 
- * and will a number of multiple of 5 */
+ * and will a number of multiple of 5, called with tx_lock held */
 static unsigned
-set_tx_packet_info(sfe* h, struct libusb_transfer *xfer, int pkt_adj)
+set_tx_packet_info(sfe* h, struct libusb_transfer *xfer)
 {
 
-    unsigned total  = (long long )h->tx_bytes_per_sec * (long long)xfer->num_iso_packets/ num_pkts_per_sec;
+    unsigned total = sfe_rc_next(&h->tx_rc, xfer->num_iso_packets);
+    unsigned max = h->usb->max_out_packet_size * xfer->num_iso_packets;
     unsigned i, len0, rem;
-    const unsigned frame_size = 5;
 
-    total += pkt_adj + h->tx_bytes_frame_remain;
-    /* make sure total bytes is multiple of 5 */
-    h->tx_bytes_frame_remain = total - (total/frame_size)*frame_size;
-    total = total - h->tx_bytes_frame_remain;
-    
+    /* the priming bytes can be more than the packets carry, the FIFO
+       level loop makes up for what is cut */
+    if (total > max){
+        total = max - max % SFE_RC_FRAME_BYTES;
+    }
+    /* every microframe carries its share, none more than the rate needs */
     len0 = total / xfer->num_iso_packets;
-    rem = total - len0 * (xfer->num_iso_packets-1);
-
-    for (i=xfer->num_iso_packets-1; i>0; i--){
-        xfer->iso_packet_desc[i].length = len0;
+    rem = total % xfer->num_iso_packets;
+    for (i=0; i<xfer->num_iso_packets; i++){
+        xfer->iso_packet_desc[i].length = len0 + (i < rem);
     }
-    xfer->iso_packet_desc[0].length = rem;
     xfer->length = total;
     
     return total;
 }
     
+/* called with rx_pool_lock held */
+static void
+rx_inflight_dec(sfe* h)
+{
+    if (--h->rx_inflight == 0){
+        pthread_cond_broadcast(&h->rx_drained);
+    }
+}
+
+static unsigned long long
+monotonic_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (unsigned long long)(cnt.QuadPart / freq.QuadPart) * 1000000000ULL +
+        (unsigned long long)(cnt.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* iso bytes per microframe for a stream of bytes_per_sec, with room for
+ * the FIFOs to catch up after the host was late */
+static unsigned
+iso_bytes_needed(unsigned long long bytes_per_sec)
+{
+    unsigned long long b = (bytes_per_sec + num_pkts_per_sec - 1) / num_pkts_per_sec;
+    return (unsigned)(b + b / 16);
+}
+
+/* rx iso packets of as many transactions as the rate needs, the firmware
+ * is told to send that many per microframe */
+static int
+rx_set_packet_size(sfe* h)
+{
+    unsigned max = h->usb->max_in_packet_size;
+    unsigned need = iso_bytes_needed((unsigned long long)h->sample_rate * h->num_rx_channels);
+    unsigned n;
+
+    if (need > max){
+        fprintf(stderr, "Sample rate too high for %d rx channels, rate=%d, max=%d\n",
+                h->num_rx_channels, h->sample_rate,
+                sfe_get_max_sample_rate(h, h->num_rx_channels, 0));
+        return -1;
+    }
+    n = (need + USB_ISO_TRANSACTION - 1) / USB_ISO_TRANSACTION;
+    if (max <= USB_ISO_TRANSACTION || n > 2){
+        /* not high bandwidth, or all of it, the endpoint default */
+        h->rx_packet_size = max;
+        return 0;
+    }
+    n = n ? n : 1;
+    set_isopkts(h->usb, n);
+    h->rx_packet_size = n * USB_ISO_TRANSACTION;
+    return 0;
+}
+
+static void
+rx_stream_reset(sfe* h)
+{
+    h->rx_pkts = 0;
+    h->rx_data_valid = 0;
+    h->rx_skipped = 0;
+    memset(&h->rx_meta, 0, sizeof(h->rx_meta));
+    h->rx_samples = 0;
+    h->rx_frames = 0;
+    h->rx_last_ns = 0;
+    h->rx_level_pkts = 0;
+    h->rx_overflow = 0;
+    pthread_mutex_lock(&h->clock_lock);
+    h->rx_clk_valid = 0;
+    pthread_mutex_unlock(&h->clock_lock);
+}
+
+/* starts the metadata of a completed transfer. the transfers in flight 
+ * last num_xfers transfers, if the event thread was away for longer than
+ * that the bus ran dry and the ADC FIFO overflowed once it was full */
+static void
+rx_meta_begin(sfe* h, struct libusb_transfer *transfer)
+{
+    sfe_rx_meta *m = &h->rx_meta;
+    unsigned nch = h->num_rx_channels > 0 ? h->num_rx_channels : 1;
+    unsigned long long now = monotonic_ns();
+    unsigned long long queued_ns = (unsigned long long)h->num_xfers *
+        transfer->num_iso_packets * USB_MICROFRAME_US * 1000;
+
+    m->flags = 0;
+    m->lost_packets = 0;
+    m->lost_samples = 0;
+    if (h->rx_data_valid && h->rx_last_ns && now - h->rx_last_ns > queued_ns){
+        unsigned long long dry = (now - h->rx_last_ns - queued_ns) * h->sample_rate / 1000000000ULL;
+        if (dry > ADC_FIFO_BYTES / nch){
+            dry -= ADC_FIFO_BYTES / nch;
+            m->flags |= SFE_RX_OVERFLOW;
+            m->lost_samples += dry;
+            h->rx_samples += dry;
+        }
+    }
+    if (h->rx_overflow){
+        m->flags |= SFE_RX_OVERFLOW;
+        h->rx_overflow = 0;
+    }
+    h->rx_last_ns = now;
+    sfe_ctr_add(&h->stats.rx_transfers, 1);
+
+    m->sample = h->rx_samples;
+    m->time_ns = now;
+    m->frame = h->rx_frames;
+    m->rate = h->sample_rate;
+    m->channels = nch;
+    h->rx_frames += transfer->num_iso_packets;
+}
+
+/* counts one iso packet into the stream position, returns the bytes to 
+ * deliver. the first packets may be rubbish and are dropped, with what
+ * the ADC FIFO filled up with before the start, packets sized to the 
+ * rate take a while to drain it. a lost packet is taken to have carried
+ * one microframe of samples */
+static unsigned
+rx_meta_packet(sfe* h, const struct libusb_iso_packet_descriptor *desc)
+{
+    sfe_rx_meta *m = &h->rx_meta;
+    unsigned nch = m->channels;
+    unsigned len = 0;
+
+    if (desc->status == LIBUSB_TRANSFER_COMPLETED){
+        h->rx_pkts++;
+        sfe_ctr_add(&h->stats.rx_packets, 1);
+        sfe_ctr_add(&h->stats.rx_bytes, desc->actual_length);
+        if (desc->actual_length % nch){
+            sfe_ctr_add(&h->stats.rx_short_packets, 1);
+        }
+        if (h->rx_data_valid){
+            len = desc->actual_length;
+            if (len % nch){
+                m->flags |= SFE_RX_GAP;
+            }
+            h->rx_samples += len / nch;
+        }
+        else{
+            h->rx_skipped += desc->actual_length;
+            h->rx_data_valid = h->rx_pkts > 2 && h->rx_skipped >= ADC_FIFO_BYTES;
+        }
+    }
+    else{
+        sfe_ctr_add(&h->stats.rx_failed_packets, 1);
+        sfe_stat_error(&h->stats, desc->status);
+        m->flags |= SFE_RX_GAP;
+        m->lost_packets++;
+        if (h->rx_data_valid){
+            unsigned est = (h->sample_rate + num_pkts_per_sec/2) / num_pkts_per_sec;
+            m->lost_samples += est;
+            h->rx_samples += est;
+        }
+    }
+    return len;
+}
+
+/* the end of the transfer is where the rx sample clock is now */
+static void
+rx_meta_end(sfe* h)
+{
+    if (h->rx_meta.flags & SFE_RX_OVERFLOW){
+        sfe_ctr_add(&h->stats.rx_overflows, 1);
+    }
+    pthread_mutex_lock(&h->clock_lock);
+    h->rx_clk_valid = h->rx_data_valid;
+    h->rx_clk_sample = h->rx_samples;
+    h->rx_clk_ns = h->rx_meta.time_ns;
+    h->rx_clk_rate = h->rx_meta.rate;
+    pthread_mutex_unlock(&h->clock_lock);
+}
+
+/* with tx off nobody reads the FIFO status, rx reads it every ~15ms too */
+static void
+rx_check_level(sfe* h, unsigned num_packets)
+{
+    h->rx_level_pkts += num_packets;
+    if (h->rx_level_pkts >= num_pkts_per_level){
+        h->rx_level_pkts = 0;
+        if (!h->tx_active){
+            get_usb_fifolevel(h, usb_get_adc_level_callback);
+        }
+    }
+}
+
+static int
+deliver_rx_batch(sfe* h, struct libusb_transfer *transfer)
+{
+    unsigned i, total = 0;
+    unsigned long long t0;
+    int ret;
+
+    memset(h->rx_status_bits, 0, (transfer->num_iso_packets + 31)/32 * sizeof(unsigned));
+    rx_meta_begin(h, transfer);
+    for (i=0; i<transfer->num_iso_packets; i++){
+        struct libusb_iso_packet_descriptor *desc = &transfer->iso_packet_desc[i];
+        unsigned len = rx_meta_packet(h, desc);
+
+        if (desc->status == LIBUSB_TRANSFER_COMPLETED){
+            h->rx_status_bits[i >> 5] |= 1u << (i & 31);
+        }else{
+            h->status = desc->status;
+        }
+        h->rx_iov[i].base = libusb_get_iso_packet_buffer_simple(transfer, i);
+        h->rx_iov[i].len = len;
+        total += len;
+    }
+    rx_meta_end(h);
+
+    h->rx_batch.n_iov = transfer->num_iso_packets;
+    h->rx_batch.total_bytes = total;
+    if (!total){
+        return 0;
+    }
+    t0 = monotonic_ns();
+    ret = h->rx_batch_callback(&h->rx_batch, h->rx_ctx);
+    sfe_stat_time(h->stats.rx_callback_time, monotonic_ns() - t0);
+    return ret;
+}
+
 static void LIBUSB_CALL
 usb_in_callback(struct libusb_transfer *transfer)
 {
     sfe* h = transfer->user_data;
     int ret = 0;
     
-    if (transfer->status == LIBUSB_TRANSFER_COMPLETED){
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED && h->rx_batch_callback){
+        ret = deliver_rx_batch(h, transfer);
+    }
+    else if (transfer->status == LIBUSB_TRANSFER_COMPLETED){
+        unsigned long long t0 = monotonic_ns();
         unsigned i;
+        rx_meta_begin(h, transfer);
         for (i=0; i<transfer->num_iso_packets; i++){
             struct libusb_iso_packet_descriptor *desc = &transfer->iso_packet_desc[i];
+            unsigned long long sample = h->rx_samples;
+            int valid = h->rx_data_valid;
+            unsigned len = rx_meta_packet(h, desc);
 
             if (desc->status == LIBUSB_TRANSFER_COMPLETED){
-                unsigned int len = desc->actual_length;
                 unsigned char *pkt = libusb_get_iso_packet_buffer_simple(transfer, i);
-                h->rx_pkts++;
                 /* ignore the first packet as it may be rabbish*/
-                if (h->rx_data_valid && h->rx_callback){
+                if (valid && h->rx_callback){
+                    h->rx_meta.sample = sample;
                     ret = h->rx_callback(pkt, len, h->rx_ctx);
                 }
-                if (h->rx_pkts > 2 && !h->rx_data_valid) {
-                    h->rx_data_valid = 1;
-                }
-		
             }else{
-                fprintf(stderr, "rx desc status: %s\n", libusb_error_name(desc->status));
+                sfe_log(&h->log, "rx desc status: %s\n", libusb_error_name(desc->status));
                 h->status = desc->status;
                 h->rx_exit_request = 1;
                 break;
             }
         }
+        rx_meta_end(h);
+        /* the packets go to the callback one by one, timed together */
+        sfe_stat_time(h->stats.rx_callback_time, monotonic_ns() - t0);
     }
     else{
         //fprintf(stderr, "rx transfer status: %d\n", transfer->status);
+        sfe_stat_error(&h->stats, transfer->status);
         h->status = transfer->status;
     }
     
-    if (ret || h->rx_exit_request){
-        /* user indicate exit */
-        free(transfer->buffer);
-        libusb_free_transfer(transfer);
-    }
-    else{
+    if (!ret && !h->rx_exit_request){
+        int err;
+        rx_check_level(h, transfer->num_iso_packets);
         transfer->status = -1;
-        h->status = libusb_submit_transfer(transfer);
+        /* h->status is shared with the other callbacks, decide on our own copy */
+        h->status = err = libusb_submit_transfer(transfer);
+        if (err == 0){
+            return;
+        }
+        sfe_log(&h->log, "rx resubmit error: %s\n", libusb_error_name(err));
+        sfe_ctr_add(&h->stats.rx_resubmit_errors, 1);
+        sfe_stat_error(&h->stats, err);
+    }
+
+    /* user indicate exit */
+    free(transfer->buffer);
+    libusb_free_transfer(transfer);
+    pthread_mutex_lock(&h->rx_pool_lock);
+    rx_inflight_dec(h);
+    pthread_mutex_unlock(&h->rx_pool_lock);
+}
+
+
+static unsigned char*
+alloc_xfer_buffer(sfe* h, size_t size, int *devmem)
+{
+    unsigned char *buf = NULL;
+    
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    /* usbfs memory can be dma'ed into directly, no copy in the kernel */
+    buf = libusb_dev_mem_alloc(h->usb->dev, size);
+    if (buf){
+        *devmem = 1;
+        return buf;
+    }
+#endif
+    *devmem = 0;
+#ifdef _MSC_VER
+    buf = _aligned_malloc(size, 4096);
+#else
+    if (posix_memalign((void**)&buf, sysconf(_SC_PAGESIZE), size)){
+        buf = NULL;
+    }
+#endif
+    return buf;
+}
+
+static void
+free_xfer_buffer(sfe* h, unsigned char *buf, size_t size, int devmem)
+{
+    if (!buf){
+        return;
+    }
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+    if (devmem){
+        libusb_dev_mem_free(h->usb->dev, buf, size);
+        return;
+    }
+#endif
+#ifdef _MSC_VER
+    _aligned_free(buf);
+#else
+    free(buf);
+#endif
+}
+
+static void
+free_rx_pool(sfe* h)
+{
+    unsigned i;
+    for (i=0; i<h->rx_pool_size; i++){
+        struct rx_lend_s *e = &h->rx_pool[i];
+        libusb_free_transfer(e->xfer);
+        free_xfer_buffer(h, e->buf, h->rx_buf_size, e->devmem);
+        free(e->lengths);
+    }
+    free(h->rx_pool);
+    h->rx_pool = NULL;
+    h->rx_free = NULL;
+    h->rx_pool_size = 0;
+}
+
+/* the caller has already counted the transfer as in flight */
+static void
+submit_lend_transfer(sfe* h, struct rx_lend_s *e)
+{
+    e->xfer->status = -1;
+    h->status = libusb_submit_transfer(e->xfer);
+    if (h->status){
+        sfe_log(&h->log, "rx submit transfer error: %s\n", libusb_error_name(h->status));
+        sfe_ctr_add(&h->stats.rx_resubmit_errors, 1);
+        sfe_stat_error(&h->stats, h->status);
+        pthread_mutex_lock(&h->rx_pool_lock);
+        rx_inflight_dec(h);
+        e->next = h->rx_free;
+        h->rx_free = e;
+        pthread_mutex_unlock(&h->rx_pool_lock);
     }
 }
 
+/* hand a block back to usb when the queue is short, otherwise park it */
+static void
+rx_pool_put(sfe* h, struct rx_lend_s *e)
+{
+    int resubmit = 0;
+    
+    pthread_mutex_lock(&h->rx_pool_lock);
+    if (!h->rx_exit_request && h->rx_inflight < h->num_xfers){
+        h->rx_inflight++;
+        resubmit = 1;
+    }
+    else{
+        e->next = h->rx_free;
+        h->rx_free = e;
+    }
+    pthread_mutex_unlock(&h->rx_pool_lock);
+
+    if (resubmit){
+        submit_lend_transfer(h, e);
+    }
+}
 
 static void LIBUSB_CALL
-usb_out_callback(struct libusb_transfer *transfer)
+usb_in_lend_callback(struct libusb_transfer *transfer)
 {
-    sfe* h = transfer->user_data;
+    struct rx_lend_s *e = transfer->user_data;
+    sfe* h = e->h;
+    struct rx_lend_s *spare = NULL;
+    unsigned total = 0;
     int ret = 0;
-    unsigned tx_size;
-            
+
+    memset(e->lengths, 0, transfer->num_iso_packets * sizeof(unsigned));
     if (transfer->status == LIBUSB_TRANSFER_COMPLETED){
         unsigned i;
+        rx_meta_begin(h, transfer);
         for (i=0; i<transfer->num_iso_packets; i++){
             struct libusb_iso_packet_descriptor *desc = &transfer->iso_packet_desc[i];
+            unsigned len = rx_meta_packet(h, desc);
 
             if (desc->status == LIBUSB_TRANSFER_COMPLETED){
-                h->tx_pkts++;
-                h->dac_check_pkts++;
+                e->lengths[i] = len;
+                total += len;
             }else{
-                fprintf(stderr, "tx desc status: %d\n", desc->status);
+                sfe_log(&h->log, "rx desc status: %s\n", libusb_error_name(desc->status));
                 h->status = desc->status;
-                h->tx_exit_request = 1;
+                h->rx_exit_request = 1;
+                break;
             }
         }
-        
-        tx_size = set_tx_packet_info(h, transfer, h->tx_bytes_adj);
-        h->tx_bytes_adj = 0;
-        if (h->tx_callback){
-            ret = h->tx_callback(transfer->buffer, tx_size, h->tx_ctx);
-        }
+        rx_meta_end(h);
     }
     else{
-        //fprintf(stderr, "wr transfer status: %d\n", transfer->status);
+        sfe_stat_error(&h->stats, transfer->status);
         h->status = transfer->status;
     }
-    
-    if (ret || h->tx_exit_request){
-        /* user indicate exit */
-        free(transfer->buffer);
-        libusb_free_transfer(transfer);
+    e->blk.total_bytes = total;
+    e->blk.meta = h->rx_meta;
+    if (!h->rx_exit_request){
+        rx_check_level(h, transfer->num_iso_packets);
+    }
+
+    /* keep the queue depth with a spare before the user sees this one */
+    pthread_mutex_lock(&h->rx_pool_lock);
+    if (!h->rx_exit_request && h->rx_free){
+        spare = h->rx_free;
+        h->rx_free = spare->next;
     }
     else{
-        //submit the data transfer
-        transfer->status = -1;        
-        h->status = libusb_submit_transfer(transfer);            
+        rx_inflight_dec(h);
+    }
+    pthread_mutex_unlock(&h->rx_pool_lock);
 
-        //every 125ms get fifo status
-        if (h->dac_check_pkts >= num_pkts_per_125ms){
-            h->dac_check_pkts = 0;
-            get_usb_fifolevel(h);
-        }
-        //every 10 second get the rate
-        if (h->tx_pkts % 10*num_pkts_per_sec == 0){ 
-            get_board_clockrate(h);
-        }
+    if (spare){
+        submit_lend_transfer(h, spare);
     }
 
+    if (total && !h->rx_exit_request && h->rx_block_callback){
+        unsigned long long t0;
+
+        pthread_mutex_lock(&h->rx_pool_lock);
+        h->rx_lent++;
+        pthread_mutex_unlock(&h->rx_pool_lock);
+        
+        t0 = monotonic_ns();
+        ret = h->rx_block_callback(&e->blk, h->rx_ctx);
+        sfe_stat_time(h->stats.rx_callback_time, monotonic_ns() - t0);
+        if (ret){
+            /* user indicate exit */
+            h->rx_exit_request = 1;
+        }
+    }
+    else{
+        rx_pool_put(h, e);
+    }
 }
 
 
-static void submit_tx_transfers(sfe* h)
+/* where the next tx byte lands on the rx sample clock: what is on the 
+ * bus and in the DAC FIFO plays before it. measured on tx completions 
+ * while rx is running and averaged over the first TX_ALIGN_COUNT, then 
+ * the tx byte count alone keeps it. tx_lock held */
+static void
+tx_align(sfe* h)
 {
-    const unsigned int num_transfers = h->num_xfers;
+    unsigned long long rx_now;
+    double per_byte, fifo, at;
+
+    if (h->tx_offset_n >= TX_ALIGN_COUNT || !h->tx_rc.num_updates ||
+        sfe_rx_time_to_sample(h, monotonic_ns(), &rx_now)){
+        return;
+    }
+    per_byte = 4.0 / (5.0 * h->num_tx_channels);
+    fifo = (double)h->tx_rc.level * DAC_FIFO_BYTES / SFE_RC_LEVEL_STEPS;
+    at = rx_now + (h->tx_queued + fifo) * per_byte - h->tx_bytes * per_byte;
+    h->tx_offset_n++;
+    h->tx_offset += (at - h->tx_offset) / h->tx_offset_n;
+}
+
+/* takes the next burst off the queue if it starts before byte len of
+ * this transfer, returns where it starts (pos if it is late) or -1. 
+ * tx_lock held */
+static long long
+tx_next_burst(sfe* h, unsigned pos, unsigned len, unsigned *flags)
+{
+    double per_byte = 4.0 / (5.0 * h->num_tx_channels);
+    unsigned long long start;
+    long long ret = pos;
+
+    if (!h->tx_burst_count){
+        return -1;
+    }
+    start = h->tx_bursts[h->tx_burst_head];
+    if (start != SFE_TX_NOW){
+        double at;
+        long long frame;
+                
+        if (h->tx_offset_n < TX_ALIGN_COUNT){
+            /* not lined up with rx yet */
+            return -1;
+        }
+        /* the first whole frame at or after start */
+        at = (start - h->tx_offset) / per_byte - (double)h->tx_bytes;
+        frame = (long long)(at / SFE_RC_FRAME_BYTES);
+        frame += frame < at / SFE_RC_FRAME_BYTES;
+        at = (double)frame * SFE_RC_FRAME_BYTES;
+        if (at >= len){
+            return -1;
+        }
+        if (at < pos){
+            *flags |= SFE_TX_LATE;
+        }
+        else{
+            ret = (long long)at;
+        }
+    }
+    h->tx_burst_head = (h->tx_burst_head + 1) % SFE_TX_MAX_BURSTS;
+    h->tx_burst_count--;
+    return ret;
+}
+
+/* one transfer of burst tx, idle frames around the bursts. tx_fill_lock
+ * held, the callback may queue bursts */
+static int
+fill_tx_burst(sfe* h, unsigned char *buf, unsigned len)
+{
+    unsigned pos = 0;
+
+    while (pos < len){
+        unsigned flags = SFE_TX_SOB;
+        int n;
+        
+        if (!h->tx_in_burst){
+            long long at;
+
+            pthread_mutex_lock(&h->tx_lock);
+            at = tx_next_burst(h, pos, len, &flags);
+            pthread_mutex_unlock(&h->tx_lock);
+            if (at < 0){
+                break;
+            }
+            sfe_pack_idle(buf + pos, (unsigned)at - pos);
+            pos = (unsigned)at;
+            h->tx_in_burst = 1;
+        }
+        else{
+            flags = 0;
+        }
+
+        n = h->tx_burst_callback(buf + pos, len - pos, flags, h->tx_ctx);
+        if (n < 0){
+            h->tx_in_burst = 0;
+            sfe_pack_idle(buf + pos, len - pos);
+            return n;
+        }
+        n -= n % SFE_RC_FRAME_BYTES;
+        if ((unsigned)n < len - pos){
+            /* the end of the burst, only the tail is padded */
+            h->tx_in_burst = 0;
+        }
+        else{
+            n = len - pos;
+        }
+        pos += n;
+    }
+    sfe_pack_idle(buf + pos, len - pos);
+    return 0;
+}
+
+/* tx_fill_lock held, not tx_lock */
+static int
+fill_tx_transfer(sfe* h, unsigned char *buf, unsigned len)
+{
+    int ret = 0;
+
+    if (h->tx_callback){
+        ret = h->tx_callback(buf, len, h->tx_ctx);
+    }
+    else if (h->tx_burst_callback){
+        ret = fill_tx_burst(h, buf, len);
+    }
+    pthread_mutex_lock(&h->tx_lock);
+    h->tx_bytes += len;
+    pthread_mutex_unlock(&h->tx_lock);
+    return ret;
+}
+
+static void LIBUSB_CALL
+usb_out_callback(struct libusb_transfer *transfer)
+{
+    sfe* h = transfer->user_data;
+    int ret = 0;
+    int resubmitted = 0;
+    unsigned tx_size;
+            
+    /* keeps the stream in order while sfe_tx_start is still priming */
+    pthread_mutex_lock(&h->tx_fill_lock);
+    pthread_mutex_lock(&h->tx_lock);
+    h->tx_queued -= transfer->length;
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED){
+        unsigned long long t0;
+        unsigned i;
+
+        sfe_ctr_add(&h->stats.tx_transfers, 1);
+        for (i=0; i<transfer->num_iso_packets; i++){
+            struct libusb_iso_packet_descriptor *desc = &transfer->iso_packet_desc[i];
+
+            if (desc->status == LIBUSB_TRANSFER_COMPLETED){
+                h->tx_pkts++;
+                h->dac_check_pkts++;
+                sfe_ctr_add(&h->stats.tx_packets, 1);
+                sfe_ctr_add(&h->stats.tx_bytes, desc->actual_length);
+                if (desc->actual_length < desc->length){
+                    sfe_ctr_add(&h->stats.tx_short_packets, 1);
+                }
+            }else{
+                sfe_log(&h->log, "tx desc status: %d\n", desc->status);
+                sfe_ctr_add(&h->stats.tx_failed_packets, 1);
+                sfe_stat_error(&h->stats, desc->status);
+                h->status = desc->status;
+                h->tx_exit_request = 1;
+            }
+        }
+        
+        tx_align(h);
+        tx_size = set_tx_packet_info(h, transfer);
+        pthread_mutex_unlock(&h->tx_lock);
+        t0 = monotonic_ns();
+        ret = fill_tx_transfer(h, transfer->buffer, tx_size);
+        sfe_stat_time(h->stats.tx_callback_time, monotonic_ns() - t0);
+        pthread_mutex_lock(&h->tx_lock);
+    }
+    else{
+        //fprintf(stderr, "wr transfer status: %d\n", transfer->status);
+        sfe_stat_error(&h->stats, transfer->status);
+        h->status = transfer->status;
+    }
+    
+    if (!ret && !h->tx_exit_request){
+        //submit the data transfer
+        int err;
+        transfer->status = -1;        
+        h->status = err = libusb_submit_transfer(transfer);            
+        if (err){
+            sfe_log(&h->log, "tx resubmit error: %s\n", libusb_error_name(err));
+            sfe_ctr_add(&h->stats.tx_resubmit_errors, 1);
+            sfe_stat_error(&h->stats, err);
+        }
+        else{
+            h->tx_queued += transfer->length;
+        }
+        resubmitted = !err;
+    }
+    pthread_mutex_unlock(&h->tx_lock);
+    pthread_mutex_unlock(&h->tx_fill_lock);
+    
+    /* sfe_stop_tx may set tx_exit_request at any time, a resubmitted
+       transfer belongs to usb again and must not be freed here */
+    if (!resubmitted){
+        /* user indicate exit */
+        free(transfer->buffer);
+        libusb_free_transfer(transfer);
+        pthread_mutex_lock(&h->tx_lock);
+        if (--h->tx_inflight == 0){
+            pthread_cond_broadcast(&h->tx_drained);
+        }
+        pthread_mutex_unlock(&h->tx_lock);
+    }
+    else{
+
+        //every 15ms get fifo status
+        if (h->dac_check_pkts >= h->level_check_pkts){
+            h->dac_check_pkts = 0;
+            get_usb_fifolevel(h, usb_get_level_callback);
+        }
+        //every 10 second get the rate
+        if (h->tx_pkts - h->clk_check_pkts >= 10*num_pkts_per_sec){ 
+            h->clk_check_pkts = h->tx_pkts;
+            get_board_clockrate(h);
+        }
+    }
+
+}
+
+
+/* a transfer at the tx rate, the rate control trim and the priming */
+static unsigned tx_buffer_size(sfe* h)
+{
+    unsigned pkt = iso_bytes_needed(h->tx_bytes_per_sec);
+    unsigned max = h->usb->max_out_packet_size;
+    
+    pkt = pkt < max ? pkt : max;
+    return pkt * h->packets_per_xfer + DAC_FIFO_BYTES;
+}
+
+static void submit_tx_transfers(sfe* h)
+{
+    const unsigned int num_transfers = h->num_xfers;
     const unsigned int num_iso_pkts = h->packets_per_xfer;
 
-    if (h->tx_callback && h->num_tx_channels > 0 ){
+    if ((h->tx_callback || h->tx_burst_callback) && h->num_tx_channels > 0 ){
         
+        /* the event thread may already be running, the first transfers
+           must not come back and be refilled before the last is queued */
+        pthread_mutex_lock(&h->tx_fill_lock);
         for (int i = 0; i < num_transfers; i++){
            
             struct libusb_transfer *transfer;
             unsigned char* buf;
-            unsigned buf_size = h->usb->max_out_packet_size * num_iso_pkts;
+            unsigned buf_size = tx_buffer_size(h);
             unsigned tx_size;
-            unsigned prime_bytes = 0;
+            int err;
            
             transfer = libusb_alloc_transfer(num_iso_pkts);
             if (!transfer){
                 fprintf(stderr, "cannot allocate transfer structure\n");
-                return ;
+                break;
             }
 
             /* pre-fill the data */
             buf = malloc(buf_size);
             if (!buf){
                 fprintf(stderr, "cannot allocate tx buffer\n");
-                return ;
+                libusb_free_transfer(transfer);
+                break;
             }
             
             libusb_fill_iso_transfer(transfer, h->usb->dev, h->usb->ep_data_out,
@@ -535,21 +1305,34 @@ static void submit_tx_transfers(sfe* h)
                                      usb_out_callback,
                                      h, 5000);
 
-            //prime the fifo with addition 2k data
-            if (i == 0) prime_bytes = 2000;
-            tx_size = set_tx_packet_info(h, transfer, prime_bytes);
+            //the first one primes the fifo to half full
+            pthread_mutex_lock(&h->tx_lock);
+            tx_size = set_tx_packet_info(h, transfer);
+            pthread_mutex_unlock(&h->tx_lock);
             //printf("%d: %d\n", tx_size, transfer->iso_packet_desc[0].length);            
 
-            h->tx_callback(buf, tx_size, h->tx_ctx);
+            fill_tx_transfer(h, buf, tx_size);
 
+            pthread_mutex_lock(&h->tx_lock);
             h->pp_xfers[i] = transfer;
             transfer->status = -1;
-            h->status = libusb_submit_transfer(transfer);
-            if (h->status){
+            h->tx_inflight++;
+            h->status = err = libusb_submit_transfer(transfer);
+            if (err){
+                h->tx_inflight--;
+            }
+            else{
+                h->tx_queued += transfer->length;
+            }
+            pthread_mutex_unlock(&h->tx_lock);
+            if (err){
                 fprintf(stderr, "tx submit %dth transfer error\n", i);
-                return ;
+                free(buf);
+                libusb_free_transfer(transfer);
+                break;
             }
         }
+        pthread_mutex_unlock(&h->tx_fill_lock);
     }
 
 }
@@ -560,12 +1343,12 @@ static void submit_rx_transfers(sfe* h)
     const unsigned int num_transfers = h->num_xfers;
     const unsigned int num_iso_pkts = h->packets_per_xfer;
     
-    if (h->rx_callback && h->num_rx_channels > 0){
+    if ((h->rx_callback || h->rx_batch_callback) && h->num_rx_channels > 0){
 
        for (int i = 0; i < num_transfers; i++){
             struct libusb_transfer *transfer;
             unsigned char* buf;
-            unsigned buf_size = h->usb->max_in_packet_size * num_iso_pkts;
+            unsigned buf_size = h->rx_packet_size * num_iso_pkts;
 
             transfer = libusb_alloc_transfer(num_iso_pkts);
             if (!transfer){
@@ -584,13 +1367,21 @@ static void submit_rx_transfers(sfe* h)
                                      usb_in_callback,
                                      h, 5000);
         
-            libusb_set_iso_packet_lengths(transfer, h->usb->max_in_packet_size);
+            libusb_set_iso_packet_lengths(transfer, h->rx_packet_size);
 
             h->pp_xfers[i] = transfer;
             transfer->status = -1;
+            pthread_mutex_lock(&h->rx_pool_lock);
+            h->rx_inflight++;
+            pthread_mutex_unlock(&h->rx_pool_lock);
             h->status = libusb_submit_transfer(transfer);
             if (h->status){
                 fprintf(stderr, "rx submit %dth transfer error\n", i);
+                free(buf);
+                libusb_free_transfer(transfer);
+                pthread_mutex_lock(&h->rx_pool_lock);
+                rx_inflight_dec(h);
+                pthread_mutex_unlock(&h->rx_pool_lock);
                 return ;
             }
         }
@@ -598,23 +1389,102 @@ static void submit_rx_transfers(sfe* h)
     return ;
 }
 
+static int alloc_rx_pool(sfe* h)
+{
+    const unsigned num_iso_pkts = h->packets_per_xfer;
+    const unsigned stride = h->rx_packet_size;
+    size_t page = 4096;
+    unsigned i;
+
+#ifndef _MSC_VER
+    page = sysconf(_SC_PAGESIZE);
+#endif
+    h->rx_buf_size = (stride * num_iso_pkts + page - 1) / page * page;
+    h->rx_pool_size = h->num_xfers + NUM_SPARE_LEND_XFERS;
+    h->rx_pool = calloc(h->rx_pool_size, sizeof(struct rx_lend_s));
+    h->rx_free = NULL;
+    if (!h->rx_pool){
+        fprintf(stderr, "cannot allocate rx buffer pool\n");
+        return -1;
+    }
+    
+    for (i=0; i<h->rx_pool_size; i++){
+        struct rx_lend_s *e = &h->rx_pool[i];
+
+        e->h = h;
+        e->xfer = libusb_alloc_transfer(num_iso_pkts);
+        e->lengths = calloc(num_iso_pkts, sizeof(unsigned));
+        e->buf = alloc_xfer_buffer(h, h->rx_buf_size, &e->devmem);
+        if (!e->xfer || !e->lengths || !e->buf){
+            fprintf(stderr, "cannot allocate rx buffer pool\n");
+            free_rx_pool(h);
+            return -1;
+        }
+        
+        libusb_fill_iso_transfer(e->xfer, h->usb->dev, h->usb->ep_data_in,
+                                 e->buf, stride * num_iso_pkts, num_iso_pkts,
+                                 usb_in_lend_callback,
+                                 e, 5000);
+        libusb_set_iso_packet_lengths(e->xfer, stride);
+
+        e->blk.data = e->buf;
+        e->blk.stride = stride;
+        e->blk.num_packets = num_iso_pkts;
+        e->blk.lengths = e->lengths;
+        e->blk.priv = e;
+        
+        e->next = h->rx_free;
+        h->rx_free = e;
+    }
+    return 0;
+}
+
+static void submit_lend_transfers(sfe* h)
+{
+    unsigned i;
+    
+    for (i = 0; i < h->num_xfers; i++){
+        struct rx_lend_s *e;
+        
+        pthread_mutex_lock(&h->rx_pool_lock);
+        e = h->rx_free;
+        h->rx_free = e->next;
+        h->rx_inflight++;
+        pthread_mutex_unlock(&h->rx_pool_lock);
+
+        submit_lend_transfer(h, e);
+        if (h->status){
+            fprintf(stderr, "rx submit %dth transfer error\n", i);
+            return ;
+        }
+    }
+}
+
 int sfe_set_sample_rate(sfe *h, unsigned samplerate)
 {
     const unsigned clk = FPGA_CLK;
     int  div, cdiv, sys_en;
     div = (clk / samplerate - 4)/2;
 
-    get_fpga_status(h->usb, &cdiv, NULL, NULL
-                    ,NULL, NULL, &sys_en);
+    pthread_mutex_lock(&h->reg_lock);
+    if (fpga_read_regs(h)){
+        pthread_mutex_unlock(&h->reg_lock);
+        return -1;
+    }
+    cdiv = h->fpga_cdiv;
+    sys_en = h->fpga_ctrl & 0x01;
 
     if (sys_en && cdiv != div){
+        pthread_mutex_unlock(&h->reg_lock);
         fprintf(stderr, "simpleFE is running, cannot change sample rate(%d), set to: %d \n", cdiv, div);
         return -1;
     }
 
-    if (cdiv != div){
-        set_fpga_cdiv(h, div);
+    if (cdiv != div && set_fpga_cdiv(h, div)){
+        pthread_mutex_unlock(&h->reg_lock);
+        return -1;
     }
+    pthread_mutex_unlock(&h->reg_lock);
     
     h->clk_div = div;
     h->sample_rate = clk/(div *2 + 4);
@@ -622,40 +1492,161 @@ int sfe_set_sample_rate(sfe *h, unsigned samplerate)
     return 0;
 }
 
-static void* rx_thread_func(void* ctx)
+static int to_os_policy(int policy)
 {
-    sfe *h = (sfe*) ctx;
+    switch (policy){
+    case SFE_SCHED_FIFO: return SCHED_FIFO;
+    case SFE_SCHED_RR: return SCHED_RR;
+    default: return SCHED_OTHER;
+    }
+}
 
-    do {
-       struct timeval timeout = {0 ,5000};
-       int err = libusb_handle_events_timeout(NULL, &timeout);
-       if (err ==  LIBUSB_ERROR_INTERRUPTED)
-            err = libusb_handle_events_timeout(NULL, &timeout);
+static int from_os_policy(int policy)
+{
+    if (policy == SCHED_FIFO){
+        return SFE_SCHED_FIFO;
+    }
+    if (policy == SCHED_RR){
+        return SFE_SCHED_RR;
+    }
+    return SFE_SCHED_OTHER;
+}
 
-    }while(!h->rx_exit_request);
+/* read what the event thread really runs with, event_lock held */
+static void read_rt_status(sfe* h)
+{
+    struct sched_param param;
+    int policy = SCHED_OTHER;
+    sfe_rt_status *st = &h->rt_status;
+
+    memset(&param, 0, sizeof(param));
+    pthread_getschedparam(h->event_thread, &policy, &param);
+    st->policy = from_os_policy(policy);
+    st->priority = st->policy == SFE_SCHED_OTHER ? 0 : param.sched_priority;
+    st->cpu_mask = 0;
+#ifdef __linux__
+    {
+        cpu_set_t set;
+        int cpu;
+        
+        CPU_ZERO(&set);
+        if (!pthread_getaffinity_np(h->event_thread, sizeof(set), &set)){
+            for (cpu=0; cpu<(int)(sizeof(st->cpu_mask)*8); cpu++){
+                if (CPU_ISSET(cpu, &set)){
+                    st->cpu_mask |= 1UL << cpu;
+                }
+            }
+        }
+    }
+#endif
+
+    st->granted = st->policy == h->rt.policy &&
+        (h->rt.policy == SFE_SCHED_OTHER || st->priority == h->rt.priority) &&
+        (!h->rt.cpu_mask || (st->cpu_mask && !(st->cpu_mask & ~h->rt.cpu_mask))) &&
+        (!h->rt.lock_memory || st->memory_locked);
+}
+
+/* event_lock held and the event thread running */
+static void apply_rt_params(sfe* h)
+{
+    struct sched_param param;
+    int err;
     
-    return NULL;
+#ifdef __linux__
+    if (h->rt.cpu_mask){
+        cpu_set_t set;
+        int cpu;
+        
+        CPU_ZERO(&set);
+        for (cpu=0; cpu<(int)(sizeof(h->rt.cpu_mask)*8); cpu++){
+            if (h->rt.cpu_mask & (1UL << cpu)){
+                CPU_SET(cpu, &set);
+            }
+        }
+        err = pthread_setaffinity_np(h->event_thread, sizeof(set), &set);
+        if (err){
+            fprintf(stderr, "cannot pin usb event thread: %s\n", strerror(err));
+        }
+    }
+#else
+    if (h->rt.cpu_mask){
+        fprintf(stderr, "cpu pinning is not supported on this platform\n");
+    }
+#endif
+
+    memset(&param, 0, sizeof(param));
+    if (h->rt.policy != SFE_SCHED_OTHER){
+        param.sched_priority = h->rt.priority;
+    }
+    err = pthread_setschedparam(h->event_thread, to_os_policy(h->rt.policy), &param);
+    if (err && h->rt.policy != SFE_SCHED_OTHER){
+        fprintf(stderr, "cannot set realtime priority %d on usb event thread: %s\n",
+                h->rt.priority, strerror(err));
+    }
+
+    read_rt_status(h);
 }
 
-static void* tx_thread_func(void* ctx)
+/* every usb callback of this device runs here */
+static void* event_thread_func(void* ctx)
 {
     sfe *h = (sfe*) ctx;
 
-    do {
-       struct timeval timeout = {0 ,5000};
-       int err = libusb_handle_events_timeout(NULL, &timeout);
-       if (err ==  LIBUSB_ERROR_INTERRUPTED)
-            err = libusb_handle_events_timeout(NULL, &timeout);
-
-    }while(!h->tx_exit_request);
+    while (!h->event_exit){
+#ifdef HAVE_INTERRUPT_EVENT_HANDLER
+        /* sleeps until there is work, woken by event_thread_put */
+        libusb_handle_events_completed(h->usb->ctx, &h->event_exit);
+#else
+        struct timeval timeout = {0, EVENT_POLL_US};
+        libusb_handle_events_timeout_completed(h->usb->ctx, &timeout, &h->event_exit);
+#endif
+    }
     
     return NULL;
 }
 
-int sfe_tx_start(sfe *h,
-                sfe_callback* tx_cb,
-                void* cbdata
-                )
+static int event_thread_get(sfe* h)
+{
+    int ret = 0;
+    
+    pthread_mutex_lock(&h->event_lock);
+    if (h->event_users == 0){
+        h->event_exit = 0;
+        if (pthread_create(&h->event_thread, NULL, event_thread_func, h)){
+            fprintf(stderr, "thread creation failed\n");
+            ret = -1;
+        }
+        else{
+            apply_rt_params(h);
+        }
+    }
+    if (!ret){
+        h->event_users++;
+    }
+    pthread_mutex_unlock(&h->event_lock);
+    return ret;
+}
+
+static void event_thread_put(sfe* h)
+{
+    void *ret;
+    
+    pthread_mutex_lock(&h->event_lock);
+    if (h->event_users > 0 && --h->event_users == 0){
+        h->event_exit = 1;
+#ifdef HAVE_INTERRUPT_EVENT_HANDLER
+        libusb_interrupt_event_handler(h->usb->ctx);
+#endif
+        pthread_join(h->event_thread, &ret);
+    }
+    pthread_mutex_unlock(&h->event_lock);
+}
+
+static int tx_start(sfe *h,
+                    sfe_callback* tx_cb,
+                    sfe_tx_burst_callback* burst_cb,
+                    void* cbdata
+                    )
 {
 
     int tx_i=0,  tx_q=0;
@@ -664,7 +1655,9 @@ int sfe_tx_start(sfe *h,
 
     h->tx_pkts = 0;
     h->dac_check_pkts = 0;
-    h->tx_bytes_frame_remain = 0;
+    h->clk_check_pkts = 0;
+    h->level_check_pkts = (num_pkts_per_level + h->packets_per_xfer - 1) / 
+        h->packets_per_xfer * h->packets_per_xfer;
     
     if (ensure_stable_clock_reading(h, &clk)){
         fprintf(stderr, "board is not boot yet\n");
@@ -673,55 +1666,127 @@ int sfe_tx_start(sfe *h,
     rate =  clk/(h->clk_div*2 + 4);
     h->actual_rate = rate;
     h->tx_bytes_per_sec = rate * h->num_tx_channels * 10/8;
-    if (h->tx_bytes_per_sec > (h->usb->max_out_packet_size * 8 *1000)){
-        fprintf(stderr, "Sample rate too high, rate=%d, bytes=%d\n",rate, h->tx_bytes_per_sec);
+    if (iso_bytes_needed(h->tx_bytes_per_sec) > h->usb->max_out_packet_size){
+        fprintf(stderr, "Sample rate too high for %d tx channels, rate=%d, max=%d\n",
+                h->num_tx_channels, rate, sfe_get_max_sample_rate(h, 0, h->num_tx_channels));
         return -1;
     }
 
-    //start thread
-    h->rc_hold_count = 0;
+    pthread_mutex_lock(&h->tx_lock);
+    h->tx_burst_head = 0;
+    h->tx_burst_count = 0;
+    h->tx_in_burst = 0;
+    h->tx_bytes = 0;
+    h->tx_queued = 0;
+    h->tx_offset = 0;
+    h->tx_offset_n = 0;
+    sfe_rc_init(&h->tx_rc, 
+                FPGA_CLK / (h->clk_div*2 + 4.0) * h->num_tx_channels * 10 / 8,
+                clk / (h->clk_div*2 + 4.0) * h->num_tx_channels * 10 / 8,
+                h->num_xfers, DAC_FIFO_BYTES,
+                (double)h->level_check_pkts / num_pkts_per_sec);
     h->tx_callback = tx_cb;
+    h->tx_burst_callback = burst_cb;
     h->tx_ctx = cbdata;
     h->tx_exit_request = 0;
+    pthread_mutex_unlock(&h->tx_lock);
 
-    submit_tx_transfers(h);
-    
-    if(pthread_create(&h->tx_thread, NULL, tx_thread_func, h)){
-        fprintf(stderr, "thread creation failed\n");
+    //start thread
+
+    if (event_thread_get(h)){
         return -1;
     }
+    h->tx_active = 1;
+    submit_tx_transfers(h);
 
     return 0;
 }
 
-void sfe_stop_tx(sfe *h)
+int sfe_tx_start(sfe *h,
+                sfe_callback* tx_cb,
+                void* cbdata
+                )
 {
-    void *ret;
-    int rx_i, rx_q, tx_i, tx_q, sys_en;
-    unsigned char cfg[2];
+    return tx_start(h, tx_cb, NULL, cbdata);
+}
 
+int sfe_tx_start_burst(sfe *h,
+                       sfe_tx_burst_callback* tx_cb,
+                       void* cbdata
+                       )
+{
+    return tx_start(h, NULL, tx_cb, cbdata);
+}
+
+int sfe_tx_burst(sfe *h, unsigned long long start)
+{
+    int ret = -1;
+    int rx_valid;
+    
+    pthread_mutex_lock(&h->clock_lock);
+    rx_valid = h->rx_clk_valid;
+    pthread_mutex_unlock(&h->clock_lock);
+
+    pthread_mutex_lock(&h->tx_lock);
+    if (!h->tx_burst_callback){
+        fprintf(stderr, "tx is not started for bursts\n");
+    }
+    else if (h->tx_burst_count == SFE_TX_MAX_BURSTS){
+        /* the caller retries */
+    }
+    else if (start != SFE_TX_NOW && !rx_valid){
+        fprintf(stderr, "a burst at a sample needs rx running\n");
+    }
+    else{
+        h->tx_bursts[(h->tx_burst_head + h->tx_burst_count) % SFE_TX_MAX_BURSTS] = start;
+        h->tx_burst_count++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&h->tx_lock);
+    return ret;
+}
+
+int sfe_tx_get_time(sfe *h, unsigned long long *sample)
+{
+    int ret = -1;
+    
+    pthread_mutex_lock(&h->tx_lock);
+    if (h->tx_offset_n >= TX_ALIGN_COUNT){
+        *sample = (unsigned long long)(h->tx_offset + 
+                                       h->tx_bytes * 4.0 / (5.0 * h->num_tx_channels) + 0.5);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&h->tx_lock);
+    return ret;
+}
+
+void sfe_stop_tx(sfe *h)
+{
+    /* the callbacks free the transfers as they come back */
+    pthread_mutex_lock(&h->tx_lock);
     h->tx_exit_request = 1;
-    pthread_join(h->tx_thread, &ret);
+    while (h->tx_inflight){
+        pthread_cond_wait(&h->tx_drained, &h->tx_lock);
+    }
+    pthread_mutex_unlock(&h->tx_lock);
+    if (h->tx_active){
+        h->tx_active = 0;
+        event_thread_put(h);
+    }
 
     //if nothing is there, stop fpga
-    get_fpga_status(h->usb, NULL, &tx_i, &tx_q, &rx_i, &rx_q, &sys_en);
-    if (!sys_en){
+    pthread_mutex_lock(&h->reg_lock);
+    if (fpga_read_regs(h) || !(h->fpga_ctrl & 0x01)){
+        pthread_mutex_unlock(&h->reg_lock);
         return;
     }
 
-
-    h->xfer_ctrl = (rx_q << 2) | (rx_i << 1);
+    h->xfer_ctrl = h->fpga_ctrl & 0x06;
 
     if (!h->xfer_ctrl){
         stop_fpga(h);
     }else{
-        
-        cfg[0] = (1<<7); //reg 0
-        cfg[1] =  h->xfer_ctrl;
-        
-        set_gpio(h->usb, FPGA_CS, 0);
-        usb_xfer_spi(h->usb, &cfg[0], 2);
-        set_gpio(h->usb, FPGA_CS, 1);
+        fpga_write(h, 0, h->xfer_ctrl);
 
 #ifdef _MSC_VER
 		_sleep(1);
@@ -729,13 +1794,9 @@ void sfe_stop_tx(sfe *h)
 		usleep(1000);
 #endif
         
-        cfg[0] = (1<<7); //reg 0
-        cfg[1] =  h->xfer_ctrl | 0x01;
-    
-        set_gpio(h->usb, FPGA_CS, 0);
-        usb_xfer_spi(h->usb, &cfg[0], 2);
-        set_gpio(h->usb, FPGA_CS, 1);
+        fpga_write(h, 0, h->xfer_ctrl | 0x01);
     }
+    pthread_mutex_unlock(&h->reg_lock);
 }
 
 int  sfe_rx_start(sfe *h,
@@ -744,72 +1805,263 @@ int  sfe_rx_start(sfe *h,
                   )
 {
 
-    int rx_i=0,  rx_q=0;
-    const unsigned th = 1024 *num_pkts_per_sec;
-    
-    h->rx_pkts = 0;
-    h->rx_data_valid = 0;
-
-    /*
-    if (h->sample_rate * h->num_rx_channels <= th){
-        set_isopkts(h->usb, 1);
-    }else{
-        set_isopkts(h->usb, 2);
+    if (rx_set_packet_size(h)){
+        return -1;
     }
-    */
-    
+    rx_stream_reset(h);
+
     //start thread
     h->rx_callback = rx_cb;
+    h->rx_batch_callback = NULL;
+    h->rx_block_callback = NULL;
     h->rx_ctx = cbdata;
     h->rx_exit_request = 0;
+    h->rx_inflight = 0;
 
+    if (event_thread_get(h)){
+        return -1;
+    }
+    h->rx_active = 1;
     submit_rx_transfers(h);
 
-    if(pthread_create(&h->rx_thread, NULL, rx_thread_func, h)){
-        fprintf(stderr, "thread creation failed\n");
+    return 0;
+}
+
+int sfe_rx_start_batched(sfe *h,
+                         sfe_rx_batch_callback* rx_cb,
+                         void* cbdata
+                         )
+{
+    if (rx_set_packet_size(h)){
+        return -1;
+    }
+    rx_stream_reset(h);
+
+    h->rx_callback = NULL;
+    h->rx_batch_callback = rx_cb;
+    h->rx_block_callback = NULL;
+    h->rx_ctx = cbdata;
+    h->rx_exit_request = 0;
+    h->rx_inflight = 0;
+
+    if (event_thread_get(h)){
         return -1;
     }
+    h->rx_active = 1;
+    submit_rx_transfers(h);
 
     return 0;
 }
 
-void sfe_stop_rx(sfe *h)
+int sfe_rx_start_zerocopy(sfe *h,
+                          sfe_rx_block_callback* rx_cb,
+                          void* cbdata
+                          )
 {
-    void *ret;
-    int rx_i, rx_q, tx_i, tx_q, sys_en;
-    unsigned char cfg[2];
+    if (h->rx_pool){
+        fprintf(stderr, "rx blocks of the last run are still lent out\n");
+        return -1;
+    }
+    if (!rx_cb || h->num_rx_channels <= 0){
+        fprintf(stderr, "rx is not enabled\n");
+        return -1;
+    }
+    if (rx_set_packet_size(h)){
+        return -1;
+    }
+    
+    rx_stream_reset(h);
+    h->rx_callback = NULL;
+    h->rx_batch_callback = NULL;
+    h->rx_block_callback = rx_cb;
+    h->rx_ctx = cbdata;
+    h->rx_exit_request = 0;
+    h->rx_inflight = 0;
+    h->rx_lent = 0;
+    h->rx_pool_closing = 0;
+
+    if (alloc_rx_pool(h)){
+        return -1;
+    }
+    if (event_thread_get(h)){
+        free_rx_pool(h);
+        return -1;
+    }
+    h->rx_active = 1;
+    submit_lend_transfers(h);
+
+    return 0;
+}
+
+void sfe_rx_release(sfe *h, sfe_rx_block *blk)
+{
+    struct rx_lend_s *e = blk->priv;
+    int closing, last;
+    
+    pthread_mutex_lock(&h->rx_pool_lock);
+    h->rx_lent--;
+    closing = h->rx_pool_closing;
+    last = closing && h->rx_lent == 0;
+    pthread_mutex_unlock(&h->rx_pool_lock);
+
+    if (!closing){
+        rx_pool_put(h, e);
+    }
+    else if (last){
+        free_rx_pool(h);
+    }
+}
 
+void sfe_get_rx_meta(sfe *h, sfe_rx_meta *meta)
+{
+    *meta = h->rx_meta;
+}
+
+int sfe_rx_time_to_sample(sfe *h, unsigned long long time_ns, unsigned long long *sample)
+{
+    int ret = -1;
+    
+    pthread_mutex_lock(&h->clock_lock);
+    if (h->rx_clk_valid){
+        double dt = ((double)time_ns - (double)h->rx_clk_ns) * 1e-9;
+        double s = h->rx_clk_sample + dt * h->rx_clk_rate;
+        *sample = s > 0 ? (unsigned long long)(s + 0.5) : 0;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&h->clock_lock);
+    return ret;
+}
+
+void sfe_stop_rx(sfe *h)
+{
+    pthread_mutex_lock(&h->rx_pool_lock);
     h->rx_exit_request = 1;
-    pthread_join(h->rx_thread, &ret);
+    while (h->rx_inflight){
+        pthread_cond_wait(&h->rx_drained, &h->rx_pool_lock);
+    }
+    pthread_mutex_unlock(&h->rx_pool_lock);
+    pthread_mutex_lock(&h->clock_lock);
+    h->rx_clk_valid = 0;
+    pthread_mutex_unlock(&h->clock_lock);
+    if (h->rx_active){
+        h->rx_active = 0;
+        event_thread_put(h);
+    }
+
+    if (h->rx_pool){
+        int lent;
+        pthread_mutex_lock(&h->rx_pool_lock);
+        h->rx_pool_closing = 1;
+        lent = h->rx_lent;
+        pthread_mutex_unlock(&h->rx_pool_lock);
+        /* otherwise the last sfe_rx_release frees the pool */
+        if (!lent){
+            free_rx_pool(h);
+        }
+    }
 
     //if nothing is there, stop fpga
-    get_fpga_status(h->usb, NULL, &tx_i, &tx_q, &rx_i, &rx_q, &sys_en);
-    if (!sys_en){
+    pthread_mutex_lock(&h->reg_lock);
+    if (fpga_read_regs(h) || !(h->fpga_ctrl & 0x01)){
+        pthread_mutex_unlock(&h->reg_lock);
         return;
     }
 
-    h->xfer_ctrl = (tx_q << 4) | (tx_i << 3);
+    h->xfer_ctrl = h->fpga_ctrl & 0x18;
 
     if (!h->xfer_ctrl){
         stop_fpga(h);
     }else{
         //dont have to stop fpga
-        cfg[0] = (1<<7); //reg 0
-        cfg[1] =  h->xfer_ctrl | 0x01;
-    
-        set_gpio(h->usb, FPGA_CS, 0);
-        usb_xfer_spi(h->usb, &cfg[0], 2);
-        set_gpio(h->usb, FPGA_CS, 1);
+        fpga_write(h, 0, h->xfer_ctrl | 0x01);
+    }
+    pthread_mutex_unlock(&h->reg_lock);
+}
+
+
+static unsigned clamp_geometry(unsigned v, unsigned lo, unsigned hi, const char *what)
+{
+    if (v < lo || v > hi){
+        fprintf(stderr, "%s %u out of range, using %u\n", what, v, v < lo ? lo : hi);
+        return v < lo ? lo : hi;
     }
+    return v;
 }
 
+static void set_transfer_geometry(sfe* h, const sfe_init_options *opt)
+{
+    unsigned pkts = NUM_PKTS_PER_XFER;
+    unsigned xfers = NUM_TRANSFERS;
+    unsigned budget = 0;
+
+    if (opt && opt->latency_us){
+        /* total microframes in flight, split over at least 4 transfers
+           in whole 1ms frames but never bigger than the default */
+        budget = opt->latency_us / USB_MICROFRAME_US;
+        pkts = budget / 4 / MIN_PKTS_PER_XFER * MIN_PKTS_PER_XFER;
+        if (pkts > NUM_PKTS_PER_XFER){
+            pkts = NUM_PKTS_PER_XFER;
+        }
+        if (pkts < MIN_PKTS_PER_XFER){
+            pkts = MIN_PKTS_PER_XFER;
+        }
+    }
+    if (opt && opt->packets_per_xfer){
+        pkts = opt->packets_per_xfer;
+    }
+    pkts = clamp_geometry(pkts, MIN_PKTS_PER_XFER, MAX_PKTS_PER_XFER, "packets per transfer");
+
+    if (opt && opt->num_xfers){
+        xfers = opt->num_xfers;
+    }
+    else if (budget){
+        xfers = budget / pkts;
+        if (xfers < MIN_TRANSFERS){
+            fprintf(stderr, "latency %uus is below %u transfers of %u packets\n",
+                    opt->latency_us, MIN_TRANSFERS, pkts);
+        }
+    }
+    xfers = clamp_geometry(xfers, MIN_TRANSFERS, MAX_TRANSFERS, "number of transfers");
     
+    h->packets_per_xfer = pkts;
+    h->num_xfers = xfers;
+}
+
+int sfe_enumerate(sfe_device_info *list, int max_devices)
+{
+    sfe_usb_info info[16];
+    int i, n;
+
+    n = usb_enumerate(info, sizeof(info)/sizeof(info[0]));
+    for (i=0; i<n && i<max_devices && i<sizeof(info)/sizeof(info[0]); i++){
+        list[i].bus = info[i].bus;
+        list[i].address = info[i].address;
+        memcpy(list[i].port_path, info[i].port_path, sizeof(list[i].port_path));
+        memcpy(list[i].serial, info[i].serial, sizeof(list[i].serial));
+    }
+    return n;
+}
+
+void sfe_get_device_info(sfe *h, sfe_device_info *info)
+{
+    info->bus = h->usb->info.bus;
+    info->address = h->usb->info.address;
+    memcpy(info->port_path, h->usb->info.port_path, sizeof(info->port_path));
+    memcpy(info->serial, h->usb->info.serial, sizeof(info->serial));
+}
+
 sfe* sfe_init()
 {
-    unsigned char cfg[2];
+    return sfe_init_ex(NULL);
+}
+
+sfe* sfe_init_ex(const sfe_init_options *opt)
+{
+    unsigned char cfg[1];
+    sfe_cmd *c;
 
     sfe *h = calloc(sizeof(sfe), 1);
-    h->usb = usb_init();
+    h->usb = opt ? usb_open(opt->device_index, opt->serial) : usb_init();
     if (h->usb == NULL){
         free(h);
         fprintf(stderr, "cannot find known device to load firmware or run program\n");
@@ -817,21 +2069,48 @@ sfe* sfe_init()
     }
 
     if (get_cdone(h->usb) == -1){
+        usb_close(h->usb);
         free(h);
         fprintf(stderr, "firmware has not been loaded, load firmware first\n");
         return NULL;
     }        
 
-    h->packets_per_xfer = NUM_PKTS_PER_XFER;
-    h->num_xfers = NUM_TRANSFERS;
+    set_transfer_geometry(h, opt);
+    if (opt){
+        h->rt.cpu_mask = opt->event_cpu_mask;
+        h->rt.priority = opt->event_priority;
+        h->rt.policy = opt->event_priority > 0 ? SFE_SCHED_FIFO : SFE_SCHED_OTHER;
+    }
 
     h->pp_xfers = calloc(sizeof(struct libusb_transfer*), h->num_xfers);
+    pthread_mutex_init(&h->rx_pool_lock, NULL);
+    pthread_cond_init(&h->rx_drained, NULL);
+    pthread_mutex_init(&h->tx_lock, NULL);
+    pthread_mutex_init(&h->tx_fill_lock, NULL);
+    pthread_cond_init(&h->tx_drained, NULL);
+    pthread_mutex_init(&h->event_lock, NULL);
+    pthread_mutex_init(&h->reg_lock, NULL);
+    pthread_mutex_init(&h->clock_lock, NULL);
+    sfe_cmdq_init(&h->cmdq, h, h->usb);
+    if (sfe_log_init(&h->log) || event_thread_get(h)){
+        sfe_close(h);
+        return NULL;
+    }
+    h->cmd_event_ref = 1;
+
+    h->rx_iov = calloc(sizeof(sfe_iovec), h->packets_per_xfer);
+    h->rx_status_bits = calloc(sizeof(unsigned), (h->packets_per_xfer + 31)/32);
+    h->rx_batch.iov = h->rx_iov;
+    h->rx_batch.status = h->rx_status_bits;
+    h->rx_batch.meta = &h->rx_meta;
 
     // 1. enable MAX6863 ADC/DAC
     cfg[0] = 0x04;
-    set_gpio(h->usb, MAX5863_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 1);
-    set_gpio(h->usb, MAX5863_CS, 1);
+    c = sfe_cmd_new(h);
+    if (c){
+        sfe_cmd_spi(c, MAX5863_CS, &cfg[0], NULL, 1);
+        sfe_cmd_run(c);
+    }
 
     sfe_reset_board(h);
     
@@ -843,11 +2122,91 @@ unsigned sfe_get_num_data_per_transfer(sfe *h)
     return (unsigned)((h->sample_rate * 1.0 ) / num_pkts_per_sec * h->packets_per_xfer);
 }
 
+int sfe_set_rt_params(sfe *h, const sfe_rt_params *p)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&h->event_lock);
+    h->rt = *p;
+    if (h->rt.policy != SFE_SCHED_OTHER){
+        int lo = sched_get_priority_min(to_os_policy(h->rt.policy));
+        int hi = sched_get_priority_max(to_os_policy(h->rt.policy));
+        if (h->rt.priority < lo || h->rt.priority > hi){
+            fprintf(stderr, "priority %d out of range [%d, %d]\n", h->rt.priority, lo, hi);
+            h->rt.priority = h->rt.priority < lo ? lo : hi;
+        }
+    }
+    
+    if (p->lock_memory && !h->rt_status.memory_locked){
+#ifndef _WIN32
+        if (mlockall(MCL_CURRENT | MCL_FUTURE)){
+            fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+        }
+        else{
+            h->rt_status.memory_locked = 1;
+        }
+#else
+        fprintf(stderr, "memory locking is not supported on this platform\n");
+#endif
+    }
+    
+    if (h->event_users){
+        apply_rt_params(h);
+        ret = h->rt_status.granted ? 0 : -1;
+    }
+    else if (p->lock_memory && !h->rt_status.memory_locked){
+        ret = -1;
+    }
+    pthread_mutex_unlock(&h->event_lock);
+    return ret;
+}
+
+int sfe_get_rt_status(sfe *h, sfe_rt_status *st)
+{
+    int ret = -1;
+    
+    pthread_mutex_lock(&h->event_lock);
+    if (h->event_users){
+        read_rt_status(h);
+        ret = 0;
+    }
+    *st = h->rt_status;
+    pthread_mutex_unlock(&h->event_lock);
+    return ret;
+}
+
+void sfe_get_transfer_geometry(sfe *h, unsigned *packets_per_xfer, unsigned *num_xfers)
+{
+    if (packets_per_xfer){
+        *packets_per_xfer = h->packets_per_xfer;
+    }
+    if (num_xfers){
+        *num_xfers = h->num_xfers;
+    }
+}
+
 
 void sfe_close(sfe* h)
 {
+    sfe_cmdq_destroy(&h->cmdq);
+    if (h->cmd_event_ref){
+        h->cmd_event_ref = 0;
+        event_thread_put(h);
+    }
     usb_close(h->usb);
+    /* the event thread is gone, whatever it logged is printed */
+    sfe_log_destroy(&h->log);
     free(h->pp_xfers);
+    pthread_mutex_destroy(&h->rx_pool_lock);
+    pthread_cond_destroy(&h->rx_drained);
+    pthread_mutex_destroy(&h->tx_lock);
+    pthread_mutex_destroy(&h->tx_fill_lock);
+    pthread_cond_destroy(&h->tx_drained);
+    pthread_mutex_destroy(&h->event_lock);
+    pthread_mutex_destroy(&h->reg_lock);
+    pthread_mutex_destroy(&h->clock_lock);
+    free(h->rx_iov);
+    free(h->rx_status_bits);
     free(h);
 }
 
@@ -861,31 +2220,61 @@ void sfe_query_sample_rates(unsigned *pr)
     }
 }
 
+unsigned sfe_get_max_sample_rate(sfe *h, int rx_channels, int tx_channels)
+{
+    const unsigned clk = FPGA_CLK;
+    unsigned div;
+
+    /* the rates go down with the divider */
+    for (div = 0; div<SIMPLE_FE_NUM_SAMPLE_RATES; div++){
+        unsigned long long rate = clk / (div*2 + 4);
+        
+        if (rx_channels > 0 && 
+            iso_bytes_needed(rate * rx_channels) > h->usb->max_in_packet_size){
+            continue;
+        }
+        if (tx_channels > 0 &&
+            iso_bytes_needed(rate * tx_channels * 10 / 8) > h->usb->max_out_packet_size){
+            continue;
+        }
+        return (unsigned)rate;
+    }
+    return 0;
+}
+
 
 void sfe_reset_board(sfe* h)
 {
-	uint8_t cfg[2];
+    uint8_t cfg[2];
+    sfe_cmd *c = sfe_cmd_new(h);
+
+    if (!c){
+        return;
+    }
     // Reset FPGA
-    set_gpio(h->usb, FPGA_RST, 0);
-    set_gpio(h->usb, FPGA_RST, 1);
+    sfe_cmd_gpio(c, FPGA_RST, 0);
+    sfe_cmd_gpio(c, FPGA_RST, 1);
 
     //enable I2C
     cfg[0] = (1 << 7) | (0x02<<5); //reg 2
     cfg[1] =  0x80;
-    set_gpio(h->usb, FPGA_CS, 0);
-    usb_xfer_spi(h->usb, &cfg[0], 2);
-    set_gpio(h->usb, FPGA_CS, 1);
+    sfe_cmd_spi(c, FPGA_CS, &cfg[0], NULL, 2);
 
     //enable all GPIO to be high
     cfg[0] = 0x00;
     cfg[1] = 0xff;
-    usb_write_i2c(h->usb, cfg, FPGA_I2C_ADDR, 2);
+    sfe_cmd_i2c_write(c, FPGA_I2C_ADDR, cfg, 2);
 
     cfg[0] = 0x01;
     cfg[1] = 0xff;
-    usb_write_i2c(h->usb, cfg, FPGA_I2C_ADDR, 2);
+    sfe_cmd_i2c_write(c, FPGA_I2C_ADDR, cfg, 2);
 
     h->ext_gpio[0] = h->ext_gpio[1] = 0xff;
+    
+    pthread_mutex_lock(&h->reg_lock);
+    sfe_cmd_run(c);
+    h->fpga_valid = 0;
+    pthread_mutex_unlock(&h->reg_lock);
 }
 
 
@@ -894,9 +2283,30 @@ unsigned get_real_sample_rate(sfe* h)
     return h->actual_rate;
 }
 
+void sfe_get_tx_rate_state(sfe *h, sfe_tx_rate_state *st)
+{
+    pthread_mutex_lock(&h->tx_lock);
+    sfe_rc_get_state(&h->tx_rc, st);
+    pthread_mutex_unlock(&h->tx_lock);
+}
 
-void sfe_external_gpio_set(sfe* h, int gpio, int val)
+void sfe_get_stats(sfe *h, sfe_stats *st)
+{
+    sfe_stats_snapshot(&h->stats, &h->log, st);
+}
+
+
+/* a blocking call is one command waited for */
+static void run_one(sfe_cmd *c)
+{
+    if (c){
+        sfe_cmd_run(c);
+    }
+}
+
+int sfe_cmd_external_gpio(sfe_cmd *c, int gpio, int val)
 {
+    sfe *h = sfe_cmd_owner(c);
     uint8_t reg[2];
     int i = gpio > 7;
     
@@ -909,16 +2319,37 @@ void sfe_external_gpio_set(sfe* h, int gpio, int val)
     reg[0] = i;
     reg[1] = h->ext_gpio[i];
     
-    usb_write_i2c(h->usb, reg, FPGA_I2C_ADDR, 2);
- }
+    return sfe_cmd_i2c_write(c, FPGA_I2C_ADDR, reg, 2);
+}
 
-int sfe_spi_transfer(sfe *h, unsigned char *data, unsigned len)
+void sfe_external_gpio_set(sfe* h, int gpio, int val)
 {
-    usb_xfer_spi(h->usb, data, len);
+    sfe_cmd *c = sfe_cmd_new(h);
+    if (c){
+        sfe_cmd_external_gpio(c, gpio, val);
+    }
+    run_one(c);
 }
 
+int sfe_spi_transfer(sfe *h, unsigned char *data, unsigned len)
+{
+    sfe_cmd *c = sfe_cmd_new(h);
+    
+    int ret;
+    
+    if (!c || sfe_cmd_spi(c, -1, data, data, len)){
+        sfe_cmd_free(c);
+        return -1;
+    }
+    ret = sfe_cmd_run(c) ? -1 : (int)len;
+    /* it may have gone to the FPGA */
+    pthread_mutex_lock(&h->reg_lock);
+    h->fpga_valid = 0;
+    pthread_mutex_unlock(&h->reg_lock);
+    return ret;
+}
 
-void sfe_auxdac_set(sfe* h, int ch, unsigned val)
+int sfe_cmd_auxdac(sfe_cmd *c, int ch, unsigned val)
 {
     unsigned char oct0 = (val & 0xF0)>>4;
     unsigned char oct1 = val & 0x0F;
@@ -928,18 +2359,42 @@ void sfe_auxdac_set(sfe* h, int ch, unsigned val)
     
     dac[0] = (ch<<6) | (0x01<<4) | oct0;
     dac[1] = oct1 << 4;
-    set_gpio(h->usb, AUXDAC_CS, 0);
-    usb_xfer_spi(h->usb, &dac[0], 2);
-    set_gpio(h->usb, AUXDAC_CS, 1);
+    return sfe_cmd_spi(c, AUXDAC_CS, &dac[0], NULL, 2);
+}
 
+void sfe_auxdac_set(sfe* h, int ch, unsigned val)
+{
+    sfe_cmd *c = sfe_cmd_new(h);
+    if (c){
+        sfe_cmd_auxdac(c, ch, val);
+    }
+    run_one(c);
 }
 
 void sfe_i2c_write(sfe* h, unsigned char addr,  char *data, unsigned len)
 {
-    usb_write_i2c(h->usb, data, addr, len);
+    sfe_cmd *c = sfe_cmd_new(h);
+    if (c){
+        sfe_cmd_i2c_write(c, addr, (unsigned char*)data, len);
+    }
+    run_one(c);
 }
 
 void sfe_i2c_read(sfe* h, unsigned char addr, char *data, unsigned len)
 {
-    usb_read_i2c(h->usb, data, addr, len);
+    sfe_cmd *c = sfe_cmd_new(h);
+    if (c){
+        sfe_cmd_i2c_read(c, addr, (unsigned char*)data, len);
+    }
+    run_one(c);
+}
+
+sfe_cmd* sfe_cmd_new(sfe *h)
+{
+    return sfe_cmdq_new_cmd(&h->cmdq);
+}
+
+int sfe_cmd_wait(sfe *h)
+{
+    return sfe_cmdq_wait(&h->cmdq);
 }
@@ -40,30 +40,277 @@ extern "C"{
 
 typedef struct sfe_s sfe;
 typedef int (sfe_callback)(unsigned char* buffer, int length, void* userdata);
+
+#define SFE_RX_GAP        0x01   /* iso packets were lost or cut short */
+#define SFE_RX_OVERFLOW   0x02   /* the ADC FIFO ran full, samples were dropped */
+
+/* where a delivered block sits in the stream. sample is the per channel
+ * index of its first sample since the stream started, lost samples are 
+ * estimated and counted in, so it keeps pace with the ADC across gaps. 
+ * time_ns is the host monotonic clock (CLOCK_MONOTONIC, QueryPerformance-
+ * Counter on windows) when the transfer completed, which is close to the 
+ * last sample of the block. libusb does not tell the bus frame number, 
+ * frame counts the iso packets of the stream instead, one per microframe.
+ * flags are SFE_RX_xxx for anything lost since the previous block */
+typedef struct sfe_rx_meta_s{
+    unsigned long long sample;
+    unsigned long long time_ns;
+    unsigned long long frame;
+    unsigned rate;            /* per channel */
+    unsigned channels;
+    unsigned flags;
+    unsigned lost_packets;
+    unsigned lost_samples;    /* per channel, an estimate */
+}sfe_rx_meta;
+
+/* a completed rx transfer lent to the application by the zero-copy rx mode,
+ * packet i starts at data + i*stride and holds lengths[i] valid bytes
+ * (0 for packets that carry no data). the block stays valid until it is
+ * handed back with sfe_rx_release() */
+typedef struct sfe_rx_block_s{
+    unsigned char *data;
+    unsigned stride;
+    unsigned num_packets;
+    unsigned *lengths;
+    unsigned total_bytes;
+    void *priv;
+    sfe_rx_meta meta;
+}sfe_rx_block;
+typedef int (sfe_rx_block_callback)(sfe_rx_block* blk, void* userdata);
+
+typedef struct sfe_iovec_s{
+    unsigned char *base;
+    unsigned len;
+}sfe_iovec;
+
+/* one completed rx transfer as a scatter list, bit i of status is set when
+ * packet i was received. packets that failed or carry no data have len 0 */
+typedef struct sfe_rx_batch_s{
+    const sfe_iovec *iov;
+    unsigned n_iov;
+    const unsigned *status;
+    unsigned total_bytes;
+    const sfe_rx_meta *meta;
+}sfe_rx_batch;
+typedef int (sfe_rx_batch_callback)(const sfe_rx_batch* batch, void* userdata);
+
+/* transfer geometry, zero fields take the defaults. in-flight buffering
+ * is num_xfers * packets_per_xfer * 125us, latency_us asks the library to
+ * size both to fit that budget, explicit values take precedence.
+ * 
+ * all usb callbacks of a device run on one event thread, event_cpu_mask 
+ * pins it (bit n = cpu n, linux only) and event_priority runs it 
+ * SCHED_FIFO at that priority, the same as sfe_set_rt_params() below */
+typedef struct sfe_init_options_s{
+    unsigned packets_per_xfer;
+    unsigned num_xfers;
+    unsigned latency_us;
+    unsigned long event_cpu_mask;
+    int event_priority;
+    /* which board to open, by serial number if set, otherwise the 
+     * device_index-th one as listed by sfe_enumerate() */
+    const char *serial;
+    int device_index;
+}sfe_init_options;
+
+/* a board attached to the host */
+typedef struct sfe_device_info_s{
+    unsigned bus;
+    unsigned address;
+    char port_path[32];
+    char serial[64];
+}sfe_device_info;
+
+#define SFE_SCHED_OTHER   0
+#define SFE_SCHED_FIFO    1
+#define SFE_SCHED_RR      2
+
+/* scheduling of the usb event thread, every stream callback runs on it */
+typedef struct sfe_rt_params_s{
+    int policy;               /* SFE_SCHED_xxx */
+    int priority;             /* 1-99 for FIFO/RR */
+    unsigned long cpu_mask;   /* bit n = cpu n, 0 leaves it alone */
+    int lock_memory;          /* mlockall current and future pages */
+}sfe_rt_params;
+
+/* what the os actually gave the event thread */
+typedef struct sfe_rt_status_s{
+    int policy;
+    int priority;
+    unsigned long cpu_mask;
+    int memory_locked;
+    int granted;              /* non zero if all of the request was granted */
+}sfe_rt_status;
+
+#define SFE_RATE_HISTORY  64
+
+/* the tx rate control loop. the host paces tx with its own usb clock, the
+ * loop follows the DAC clock from the board clock readings (every 10 s) 
+ * and the DAC FIFO level (every ~15 ms), ppm are against the nominal rate */
+typedef struct sfe_tx_rate_state_s{
+    double est_ppm;           /* DAC rate as the host sees it */
+    double clock_ppm;         /* last board clock reading */
+    double integrator_ppm;    /* what the FIFO loop adds to the reading */
+    double correction_ppm;    /* what is applied to the reading right now */
+    double fifo_error;        /* bytes above half full, queued corrections included */
+    unsigned level;           /* last 6 bit FIFO level */
+    unsigned num_updates;
+    unsigned char level_history[SFE_RATE_HISTORY];  /* oldest first */
+    unsigned history_len;
+}sfe_tx_rate_state;
+
+#define SFE_STATS_TIME_BINS   16
+#define SFE_STATS_LEVEL_BINS  16
+
+/* counters since sfe_init, kept with atomics by the usb event thread.
+ * callback times are per transfer, bin 0 below 1us, bin n from 2^(n-1)
+ * to 2^n us, the last bin open ended. FIFO levels are the 6 bit readings
+ * in bins of 4 steps. short rx packets do not end on a whole sample of
+ * all channels, short tx packets were not taken in full */
+typedef struct sfe_stats_s{
+    unsigned long long rx_transfers;
+    unsigned long long rx_packets;
+    unsigned long long rx_bytes;
+    unsigned long long rx_short_packets;
+    unsigned long long rx_failed_packets;
+    unsigned long long rx_resubmit_errors;
+    unsigned long long rx_overflows;    /* blocks flagged SFE_RX_OVERFLOW */
+    unsigned long long tx_transfers;
+    unsigned long long tx_packets;
+    unsigned long long tx_bytes;
+    unsigned long long tx_short_packets;
+    unsigned long long tx_failed_packets;
+    unsigned long long tx_resubmit_errors;
+    unsigned long long ctrl_errors;     /* FIFO level and clock readings */
+    unsigned long long rx_callback_time[SFE_STATS_TIME_BINS];
+    unsigned long long tx_callback_time[SFE_STATS_TIME_BINS];
+    unsigned long long adc_level[SFE_STATS_LEVEL_BINS];
+    unsigned long long dac_level[SFE_STATS_LEVEL_BINS];
+    unsigned long long rc_updates;      /* DAC FIFO level readings used */
+    double rc_correction_ppm;           /* last one applied */
+    double rc_est_ppm;
+    unsigned long long clock_hz;        /* last FPGA clock reading */
+    unsigned long long log_dropped;     /* messages the log ring had no room for */
+    int last_error;                     /* libusb error code, 0 if none yet */
+}sfe_stats;
+
+/* every board has its own libusb context and event thread, so several
+ * of them can stream at once, each pinned with sfe_set_rt_params() */
+int sfe_enumerate(sfe_device_info *list, int max_devices);
 sfe* sfe_init();
+sfe* sfe_init_ex(const sfe_init_options *opt);
 void sfe_close(sfe* h);
+/* the board behind an open handle */
+void sfe_get_device_info(sfe *h, sfe_device_info *info);
 /* pr should at least hold SIMPLE_FE_NUM_SAMPLE_RATES integers */
 void sfe_query_sample_rates(unsigned *pr);
+/* the highest of them the usb link of the board carries with that many
+ * rx and tx channels streaming, 0 if none. rx iso packets are sized to
+ * the rate when rx starts, starting above it fails */
+unsigned sfe_get_max_sample_rate(sfe *h, int rx_channels, int tx_channels);
 
 unsigned sfe_get_num_data_per_transfer(sfe *h);
+void sfe_get_transfer_geometry(sfe *h, unsigned *packets_per_xfer, unsigned *num_xfers);
+
+/* applied right away, the event thread runs while the board is open. 
+ * refused settings (usually missing CAP_SYS_NICE / RLIMIT_MEMLOCK) are 
+ * reported and not fatal, returns 0 if everything was granted */
+int sfe_set_rt_params(sfe *h, const sfe_rt_params *p);
+/* reads the settings back from the event thread, returns -1 if it is
+ * not running (only memory_locked is valid then) */
+int sfe_get_rt_status(sfe *h, sfe_rt_status *st);
+
 /* these are threaded functions */
 int sfe_set_sample_rate(sfe *h, unsigned samplerate);
 void sfe_tx_enable(sfe *h, int tx_i, int tx_q);
 void sfe_rx_enable(sfe *h, int rx_i, int rx_q);
     
+/* tx_cb runs on the usb event thread with no library lock held, it may
+ * call sfe_tx_burst(), sfe_tx_get_time() and sfe_get_tx_rate_state(). 
+ * it must not call sfe_stop_tx(), which waits for the callbacks to 
+ * finish, a negative return stops tx from inside */
 int  sfe_tx_start(sfe *h,
                   sfe_callback* tx_cb,
                   void* cbdata
                   );
 
+/* burst tx. the iso stream runs from sfe_tx_start_burst() to sfe_stop_tx()
+ * and the DAC idles at mid scale between bursts. every sfe_tx_burst() 
+ * queues one burst, from its start on tx_cb is asked for data (with 
+ * SFE_TX_SOB the first time) and returns the bytes it filled, in whole 5 
+ * byte frames. less than length ends the burst and the rest of the 
+ * transfer is idle, a negative value stops tx.
+ *
+ * start is an rx sample index (see sfe_rx_meta, rx has to run on the same
+ * board) or SFE_TX_NOW, the burst starts on the first whole frame at or 
+ * after it. the DAC and the ADC share the clock, how their sample counts
+ * line up is measured on the host to about a millisecond during the first
+ * transfers, after that bursts land exactly where they are put relative 
+ * to each other. a burst whose start has passed starts at once with 
+ * SFE_TX_LATE. tx_cb may queue the next burst itself (see sfe_tx_start)
+ */
+#define SFE_TX_NOW          (~0ULL)
+#define SFE_TX_SOB          0x01
+#define SFE_TX_LATE         0x02
+#define SFE_TX_MAX_BURSTS   64
+
+typedef int (sfe_tx_burst_callback)(unsigned char* buffer, int length, unsigned flags, void* userdata);
+
+int sfe_tx_start_burst(sfe *h,
+                       sfe_tx_burst_callback* tx_cb,
+                       void* cbdata
+                       );
+/* returns -1 if SFE_TX_MAX_BURSTS are queued, or start is a sample and
+ * rx is not running */
+int sfe_tx_burst(sfe *h, unsigned long long start);
+/* the rx sample index the next transfer to be filled starts at, the 
+ * earliest start that is not late. called from tx_cb, where the transfer
+ * being filled starts. -1 until tx and rx are lined up */
+int sfe_tx_get_time(sfe *h, unsigned long long *sample);
+
 int sfe_rx_start(sfe *h,
                  sfe_callback* rx_cb,
                  void* cbdata
                  );
-    
+
+/* batched rx, rx_cb is called once per completed transfer instead of once
+ * per iso packet, the buffers are only valid during the call. a failed 
+ * packet does not stop the stream, it is reported in the status bitmap */
+int sfe_rx_start_batched(sfe *h,
+                         sfe_rx_batch_callback* rx_cb,
+                         void* cbdata
+                         );
+
+/* zero-copy rx, libsimpleFE owns a pool of page aligned transfer buffers
+ * and lends every completed transfer to rx_cb (called on the usb thread),
+ * the application hands it back with sfe_rx_release() from any thread 
+ * once done. that includes the block of the call that returns nonzero to
+ * stop the stream, it is lent like any other. blocks still lent out at 
+ * sfe_stop_rx() stay valid, the pool is freed when the last of them is 
+ * released */
+int sfe_rx_start_zerocopy(sfe *h,
+                          sfe_rx_block_callback* rx_cb,
+                          void* cbdata
+                          );
+void sfe_rx_release(sfe *h, sfe_rx_block *blk);
+/* inside a sfe_rx_start() callback, where the packet being delivered sits
+ * in the stream, the other modes get it with the batch or the block */
+void sfe_get_rx_meta(sfe *h, sfe_rx_meta *meta);
+/* the rx sample index at host monotonic time time_ns, from the last
+ * completed rx transfer. -1 if rx is not running */
+int sfe_rx_time_to_sample(sfe *h, unsigned long long time_ns, unsigned long long *sample);
+
 void sfe_stop_tx(sfe *h);
 void sfe_stop_rx(sfe *h);
 
+/* a snapshot of the tx rate control, safe to call while streaming */
+void sfe_get_tx_rate_state(sfe *h, sfe_tx_rate_state *st);
+
+/* never blocks the event thread, counters read while streaming may be a
+ * transfer apart from each other. messages of the event thread go to 
+ * stderr from a thread of their own */
+void sfe_get_stats(sfe *h, sfe_stats *st);
+
 unsigned get_real_sample_rate(sfe* h);
 void sfe_reset_board(sfe* h);
 
@@ -73,6 +320,42 @@ void sfe_auxdac_set(sfe* h, int ch, unsigned val);
 void sfe_i2c_read(sfe* h, unsigned char addr, char *data, unsigned len);
 void sfe_i2c_write(sfe* h, unsigned char addr,  char *data, unsigned len);
 
+/* asynchronous register access. a command is a sequence of gpio, spi and 
+ * i2c steps, submitted as a whole and run back to back on the usb event
+ * thread, commands run in the order they are submitted. the blocking 
+ * calls above go through the same queue, each one is a command waited 
+ * for, so a retune that queues its writes and waits once saves most of
+ * the round trips.
+ * 
+ * the steps copy what they send, buffers for what is read back have to
+ * stay valid until the command completes. done (may be NULL) is called on
+ * the event thread with 0 or a libusb error once the last step is done,
+ * after an error the remaining steps are skipped except those releasing
+ * a line. a command that failed to build is freed by sfe_cmd_submit(), 
+ * which returns -1 then and does not call done. sfe_cmd_run() and 
+ * sfe_cmd_wait() must not be called from a stream or done callback */
+typedef struct sfe_cmd_s sfe_cmd;
+typedef void (sfe_cmd_callback)(int status, void* userdata);
+
+sfe_cmd* sfe_cmd_new(sfe *h);
+int sfe_cmd_gpio(sfe_cmd *c, int gpio, int val);
+/* selects cs (see chip_select.h, -1 leaves the selects alone), clocks len
+ * bytes out and the reply into miso if it is not NULL, then deselects */
+int sfe_cmd_spi(sfe_cmd *c, int cs, const unsigned char *mosi, unsigned char *miso, unsigned len);
+int sfe_cmd_i2c_write(sfe_cmd *c, unsigned char addr, const unsigned char *data, unsigned len);
+int sfe_cmd_i2c_read(sfe_cmd *c, unsigned char addr, unsigned char *data, unsigned len);
+int sfe_cmd_auxdac(sfe_cmd *c, int ch, unsigned val);
+int sfe_cmd_external_gpio(sfe_cmd *c, int gpio, int val);
+/* hands the command over, it is freed once done has returned */
+int sfe_cmd_submit(sfe_cmd *c, sfe_cmd_callback *done, void *userdata);
+/* submits and waits for this command, returns its status */
+int sfe_cmd_run(sfe_cmd *c);
+/* only for a command that was never submitted */
+void sfe_cmd_free(sfe_cmd *c);
+/* waits for everything submitted so far, returns the first error of a
+ * sfe_cmd_submit() command since the last call, 0 if there was none */
+int sfe_cmd_wait(sfe *h);
+
 
 
 #ifdef __cplusplus
@@ -32,6 +32,7 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include "usb_access.h"
 #include "chip_select.h"
@@ -49,62 +50,168 @@ static struct simplefe_usb_device known_devices[] =
     };
         
 
+static int is_known_device(const struct libusb_device_descriptor *desc)
+{
+    int j;
+    
+    for (j=0; j<sizeof(known_devices)/sizeof(struct simplefe_usb_device); j++){
+        if (desc->idVendor == known_devices[j].vid && desc->idProduct == known_devices[j].pid){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* bus, address, port path and serial number, the serial needs the 
+ * device to be opened, it is left empty if that is not permitted */
+static void read_usb_info(libusb_device *dev,
+                          libusb_device_handle *handle,
+                          const struct libusb_device_descriptor *desc,
+                          sfe_usb_info *info)
+{
+    uint8_t ports[8];
+    int i, n, len = 0;
+    libusb_device_handle *hd = handle;
+
+    memset(info, 0, sizeof(*info));
+    info->bus = libusb_get_bus_number(dev);
+    info->address = libusb_get_device_address(dev);
+
+    n = libusb_get_port_numbers(dev, ports, sizeof(ports));
+    len = snprintf(info->port_path, sizeof(info->port_path), "%u", info->bus);
+    for (i=0; i<n && len < sizeof(info->port_path); i++){
+        len += snprintf(info->port_path + len, sizeof(info->port_path) - len,
+                        i == 0 ? "-%u" : ".%u", ports[i]);
+    }
+
+    if (desc->iSerialNumber == 0){
+        return;
+    }
+    if (!hd && libusb_open(dev, &hd) != 0){
+        return;
+    }
+    if (libusb_get_string_descriptor_ascii(hd, desc->iSerialNumber,
+                                           (unsigned char*)info->serial,
+                                           sizeof(info->serial)) < 0){
+        info->serial[0] = 0;
+    }
+    if (!handle){
+        libusb_close(hd);
+    }
+}
+
+int usb_enumerate(sfe_usb_info *list, int max_devices)
+{
+    libusb_context *ctx;
+    libusb_device *dev, **devs;
+    struct libusb_device_descriptor desc;
+    int status, i, n = 0;
+
+    status = libusb_init(&ctx);
+    if (status < 0) {
+        fprintf(stderr, "libusb_init() failed: %s\n", libusb_error_name(status));
+        return -1;
+    }
+
+    status = libusb_get_device_list(ctx, &devs);
+    if (status < 0) {
+        fprintf(stderr, "libusb_get_device_list() failed: %s\n", libusb_error_name(status));
+        libusb_exit(ctx);
+        return -1;
+    }
+
+    for (i=0; (dev=devs[i]) != NULL; i++) {
+        if (libusb_get_device_descriptor(dev, &desc) < 0 || !is_known_device(&desc)){
+            continue;
+        }
+        if (n < max_devices){
+            read_usb_info(dev, NULL, &desc, &list[n]);
+        }
+        n++;
+    }
+
+    libusb_free_device_list(devs, 1);
+    libusb_exit(ctx);
+    return n;
+}
+
 sfe_usb *usb_init()
+{
+    return usb_open(0, NULL);
+}
+
+sfe_usb *usb_open(int index, const char *serial)
 {
     sfe_usb *h = calloc(sizeof(sfe_usb), 1);
     int status;
     libusb_device *dev, **devs;
     struct libusb_device_descriptor desc;
-    int bfound = 0, i, j;
+    sfe_usb_info info;
+    int n = 0, i;
     
-    status = libusb_init(NULL);
+    status = libusb_init(&h->ctx);
     if (status < 0) {
         fprintf(stderr, "libusb_init() failed: %s\n", libusb_error_name(status));
         free(h);
         return NULL;
     }
 
-    if (libusb_get_device_list(NULL, &devs) < 0) {
+    status = libusb_get_device_list(h->ctx, &devs);
+    if (status < 0) {
         fprintf(stderr, "libusb_get_device_list() failed: %s\n", libusb_error_name(status));
+        libusb_exit(h->ctx);
         free(h);
         return NULL;
     }
-    
-    for (i=0; !bfound && (dev=devs[i]) != NULL; i++) {
-        status = libusb_get_device_descriptor(dev, &desc);
-        if (status >= 0) {
-            for (j=0; j<sizeof(known_devices)/sizeof(struct simplefe_usb_device); j++){
-                if (desc.idVendor == known_devices[j].vid && desc.idProduct == known_devices[j].pid){
-                    //printf("found device = 0x%x, vid=%x, pid=%x\n", dev, desc.idVendor, desc.idProduct);
-                    bfound = 1;
-                    break;
-                }
+
+    /* the index counts known devices in the order usb_enumerate() lists them */
+    for (i=0; (dev=devs[i]) != NULL; i++) {
+        if (libusb_get_device_descriptor(dev, &desc) < 0 || !is_known_device(&desc)){
+            continue;
+        }
+        if (serial && serial[0]){
+            read_usb_info(dev, NULL, &desc, &info);
+            if (strcmp(info.serial, serial) == 0){
+                break;
             }
         }
+        else if (n++ == index){
+            break;
+        }
     }
 
     if (dev == NULL) {
         libusb_free_device_list(devs, 1);
-        libusb_exit(NULL);
-        fprintf(stderr, "could not find a known device \n");
+        libusb_exit(h->ctx);
+        free(h);
+        if (serial && serial[0]){
+            fprintf(stderr, "could not find a known device with serial %s\n", serial);
+        }
+        else{
+            fprintf(stderr, "could not find a known device #%d\n", index);
+        }
         return NULL;
     }
     
     h->dev = NULL;
     status = libusb_open(dev, &h->dev);
-    libusb_free_device_list(devs, 1);
     if (status < 0) {
+        libusb_free_device_list(devs, 1);
         fprintf(stderr, "libusb_open() failed: %s\n", libusb_error_name(status));
+        libusb_exit(h->ctx);
         free(h);
         return NULL;
     }
+    read_usb_info(dev, h->dev, &desc, &h->info);
     
     libusb_set_auto_detach_kernel_driver(h->dev, 1);
     status = libusb_claim_interface(h->dev, 0);
 
     if (status != LIBUSB_SUCCESS) {
+        libusb_free_device_list(devs, 1);
         libusb_close(h->dev);
         fprintf(stderr, "libusb_claim_interface failed: %s\n", libusb_error_name(status));
+        libusb_exit(h->ctx);
         free(h);
         return NULL;
     }
@@ -118,6 +225,7 @@ sfe_usb *usb_init()
 
     h->max_out_packet_size = libusb_get_max_iso_packet_size(dev, h->ep_data_out);
     h->max_in_packet_size = libusb_get_max_iso_packet_size(dev, h->ep_data_in);
+    libusb_free_device_list(devs, 1);
 
     //printf("iso max packet size: %d : %d \n", h->max_out_packet_size, h->max_in_packet_size);
     return h;
@@ -128,7 +236,7 @@ void usb_close(sfe_usb *h)
 {
     libusb_release_interface(h->dev, 0);
     libusb_close(h->dev);
-    libusb_exit(NULL);
+    libusb_exit(h->ctx);
     free(h);
 }
 
@@ -34,8 +34,20 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #define USB_ACCESS_H_
 
 #include "libusb.h"
+
+/* where a board sits on the bus, serial is empty if it cannot be read */
+typedef struct
+{
+    unsigned bus;
+    unsigned address;
+    char port_path[32];      /* bus-port.port..., stable across replugs */
+    char serial[64];
+}sfe_usb_info;
+
 typedef struct
 {
+    /* private context, its events are only handled by this device */
+    libusb_context *ctx;
     libusb_device_handle *dev;
     unsigned char ep_spi_out;
     unsigned char ep_spi_in;
@@ -45,10 +57,16 @@ typedef struct
     /* ISO handling */
     unsigned  max_out_packet_size;
     unsigned  max_in_packet_size;
-    
+
+    sfe_usb_info info;
 }sfe_usb;
 
 
+/* fills up to max_devices entries, returns the number of boards found */
+int usb_enumerate(sfe_usb_info *list, int max_devices);
+/* opens the board with the given serial, or the index-th one if serial 
+ * is NULL or empty. usb_init() opens the first */
+sfe_usb *usb_open(int index, const char *serial);
 sfe_usb *usb_init();
 void usb_close(sfe_usb *h);
 int  usb_xfer_spi(sfe_usb *h, uint8_t *data, int n);